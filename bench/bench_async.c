@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+// runs a growing number of sleeping commands from a lua script, one after
+// the other with lush.exec and all at once with lush.spawn and lush.wait,
+// and reports the speedup of the second
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_LUSH "bin/Debug/lush/lush"
+#define DEFAULT_MILLISECONDS 200
+#define MAX_COMMANDS 32
+
+extern char **environ;
+
+static const char *sequential = "for i = 1, %d do\n"
+								"  lush.exec('sleep %g')\n"
+								"end\n";
+
+static const char *concurrent = "local handles = {}\n"
+								"for i = 1, %d do\n"
+								"  handles[i] = lush.spawn({'sleep', '%g'})\n"
+								"end\n"
+								"for _, handle in ipairs(handles) do\n"
+								"  handle:wait()\n"
+								"end\n";
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// writes the script for count commands and returns the seconds lush took
+static double run_script(const char *lush, const char *format, int count,
+						 double seconds) {
+	char path[] = "/tmp/lush_async_benchXXXXXX.lua";
+	int fd = mkstemps(path, 4);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+	if (file == NULL) {
+		perror("lush_async_bench");
+		exit(1);
+	}
+	fprintf(file, format, count, seconds);
+	fclose(file);
+
+	char *argv[] = {(char *)lush, path, NULL};
+	double start = now();
+	pid_t pid;
+	int err = posix_spawn(&pid, lush, NULL, NULL, argv, environ);
+	if (err != 0) {
+		fprintf(stderr, "%s: could not be started\n", lush);
+		exit(1);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	double elapsed = now() - start;
+	unlink(path);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s: script failed\n", lush);
+		exit(1);
+	}
+	return elapsed;
+}
+
+int main(int argc, char **argv) {
+	const char *lush = argc > 1 ? argv[1] : DEFAULT_LUSH;
+	int milliseconds = argc > 2 ? atoi(argv[2]) : DEFAULT_MILLISECONDS;
+	if (milliseconds <= 0 || access(lush, X_OK) != 0) {
+		fprintf(stderr, "usage: %s [lush binary] [ms per command]\n",
+				argv[0]);
+		return 1;
+	}
+
+	double seconds = milliseconds / 1000.0;
+	printf("%8s %12s %12s %8s\n", "commands", "exec s", "spawn s", "speedup");
+	for (int count = 1; count <= MAX_COMMANDS; count *= 2) {
+		double exec_time = run_script(lush, sequential, count, seconds);
+		double spawn_time = run_script(lush, concurrent, count, seconds);
+		printf("%8d %12.3f %12.3f %7.1fx\n", count, exec_time, spawn_time,
+			   exec_time / spawn_time);
+	}
+	return 0;
+}
@@ -0,0 +1,154 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+// runs shell-only commands from a lua script with lush.exec, with
+// lush.exec and history off and with lush.execMany, and reports the time
+// per command of each. the history file is put back afterwards
+
+#include <pwd.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_LUSH "bin/Debug/lush/lush"
+#define DEFAULT_COMMANDS 2000
+
+extern char **environ;
+
+static const char *per_call = "for i = 1, %d do\n"
+							  "  lush.exec('x=' .. i)\n"
+							  "end\n";
+
+static const char *no_history = "for i = 1, %d do\n"
+								"  lush.exec('x=' .. i, {history = false})\n"
+								"end\n";
+
+static const char *batched = "local lines = {}\n"
+							 "for i = 1, %d do\n"
+							 "  lines[i] = 'x=' .. i\n"
+							 "end\n"
+							 "lush.execMany(lines)\n";
+
+static const char *batched_history = "local lines = {}\n"
+									 "for i = 1, %d do\n"
+									 "  lines[i] = 'x=' .. i\n"
+									 "end\n"
+									 "lush.execMany(lines, {history = true})\n";
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// reads the whole history file so the runs do not leave their lines in it
+static char *read_history(const char *path, size_t *len) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return NULL;
+	char *content = NULL;
+	size_t size = 0;
+	FILE *out = open_memstream(&content, &size);
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+		fwrite(buf, 1, n, out);
+	fclose(out);
+	fclose(file);
+	*len = size;
+	return content;
+}
+
+static void restore_history(const char *path, const char *content,
+							size_t len) {
+	if (content == NULL) {
+		unlink(path);
+		return;
+	}
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror("lush_exec_bench");
+		return;
+	}
+	fwrite(content, 1, len, file);
+	fclose(file);
+}
+
+// writes the script for count commands and returns the seconds lush took
+static double run_script(const char *lush, const char *format, int count) {
+	char path[] = "/tmp/lush_exec_benchXXXXXX.lua";
+	int fd = mkstemps(path, 4);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+	if (file == NULL) {
+		perror("lush_exec_bench");
+		exit(1);
+	}
+	fprintf(file, format, count);
+	fclose(file);
+
+	char *argv[] = {(char *)lush, path, NULL};
+	double start = now();
+	pid_t pid;
+	int err = posix_spawn(&pid, lush, NULL, NULL, argv, environ);
+	if (err != 0) {
+		fprintf(stderr, "%s: could not be started\n", lush);
+		exit(1);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	double elapsed = now() - start;
+	unlink(path);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s: script failed\n", lush);
+		exit(1);
+	}
+	return elapsed;
+}
+
+int main(int argc, char **argv) {
+	const char *lush = argc > 1 ? argv[1] : DEFAULT_LUSH;
+	int count = argc > 2 ? atoi(argv[2]) : DEFAULT_COMMANDS;
+	struct passwd *pw = getpwuid(getuid());
+	if (count <= 0 || pw == NULL || access(lush, X_OK) != 0) {
+		fprintf(stderr, "usage: %s [lush binary] [commands]\n", argv[0]);
+		return 1;
+	}
+
+	// lush keeps its history next to the passwd home, not $HOME
+	char history[4096];
+	snprintf(history, sizeof(history), "%s/.lush_history", pw->pw_dir);
+	size_t len = 0;
+	char *saved = read_history(history, &len);
+
+	const char *names[] = {"exec", "exec no history", "execMany",
+						   "execMany history"};
+	const char *scripts[] = {per_call, no_history, batched, batched_history};
+	printf("%-18s %10s %12s\n", "mode", "total s", "us/command");
+	for (int i = 0; i < 4; i++) {
+		double elapsed = run_script(lush, scripts[i], count);
+		printf("%-18s %10.3f %12.1f\n", names[i], elapsed,
+			   elapsed * 1e6 / count);
+	}
+
+	restore_history(history, saved, len);
+	free(saved);
+	return 0;
+}
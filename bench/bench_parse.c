@@ -0,0 +1,175 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+// replays a corpus of command lines through the parser and reports
+// throughput, allocations per line and peak memory
+
+#include "ast.h"
+#include "parse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS 2000
+
+// count allocations by wrapping the glibc allocator
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static size_t num_allocs = 0;
+
+void *malloc(size_t size) {
+	num_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	num_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	num_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+typedef struct {
+	char **lines;
+	size_t count;
+} corpus_t;
+
+static void load_corpus(const char *path, corpus_t *corpus) {
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+
+	size_t capacity = 256;
+	corpus->lines = malloc(capacity * sizeof(char *));
+	if (!corpus->lines) {
+		perror("malloc failed");
+		exit(1);
+	}
+	corpus->count = 0;
+
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+	while ((n = getline(&line, &len, fp)) != -1) {
+		if (n > 0 && line[n - 1] == '\n')
+			line[--n] = '\0';
+		// skip blank lines and comments in the corpus file
+		if (n == 0 || line[0] == '#')
+			continue;
+
+		if (corpus->count == capacity) {
+			capacity *= 2;
+			corpus->lines =
+				realloc(corpus->lines, capacity * sizeof(char *));
+			if (!corpus->lines) {
+				perror("realloc failed");
+				exit(1);
+			}
+		}
+		corpus->lines[corpus->count++] = strdup(line);
+	}
+	free(line);
+	fclose(fp);
+}
+
+static void parse_ast(char *line) {
+	int status = 0;
+	lush_ast_free(lush_ast_parse(line, &status));
+}
+
+static void parse_split(char *line) {
+	int status = 0;
+	char *expanded = lush_resolve_aliases(line);
+	char **commands = lush_split_commands(expanded);
+	char ***args = lush_split_args(commands, &status);
+	if (status >= 0)
+		lush_expand_globs(args);
+	lush_free_args(args);
+	lush_free_commands(commands);
+	free(expanded);
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *name, void (*parse)(char *), corpus_t *corpus,
+				  int iterations) {
+	size_t allocs = num_allocs;
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		for (size_t j = 0; j < corpus->count; j++)
+			parse(corpus->lines[j]);
+	}
+	double elapsed = now() - start;
+	allocs = num_allocs - allocs;
+
+	double lines = (double)corpus->count * iterations;
+	printf("%-6s %12.0f lines/sec %8.2f allocs/line\n", name,
+		   lines / elapsed, allocs / lines);
+}
+
+int main(int argc, char **argv) {
+	const char *path = "bench/corpus.txt";
+	int iterations = DEFAULT_ITERATIONS;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = atoi(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr, "usage: %s [-n iterations] [corpus]\n", argv[0]);
+			return 1;
+		} else {
+			path = argv[i];
+		}
+	}
+
+	corpus_t corpus;
+	load_corpus(path, &corpus);
+	if (corpus.count == 0) {
+		fprintf(stderr, "%s: empty corpus\n", path);
+		return 1;
+	}
+	printf("%zu lines x %d iterations\n", corpus.count, iterations);
+
+	// errors from malformed lines would swamp the report
+	if (!freopen("/dev/null", "w", stderr))
+		perror("freopen failed");
+
+	bench("ast", parse_ast, &corpus, iterations);
+	bench("split", parse_split, &corpus, iterations);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("peak rss %ld KiB\n", usage.ru_maxrss);
+
+	for (size_t i = 0; i < corpus.count; i++)
+		free(corpus.lines[i]);
+	free(corpus.lines);
+	return 0;
+}
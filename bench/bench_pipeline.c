@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+// pushes a large stream through pipelines of growing length, run by lush
+// and by /bin/sh for reference, and reports the throughput of each
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_LUSH "bin/Debug/lush/lush"
+#define DEFAULT_MEGABYTES 256
+#define MAX_STAGES 4
+
+extern char **environ;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// runs shell -c command and returns the seconds it took
+static double run_shell(const char *shell, const char *command) {
+	char *argv[] = {(char *)shell, "-c", (char *)command, NULL};
+	double start = now();
+	pid_t pid;
+	int err = posix_spawn(&pid, shell, NULL, NULL, argv, environ);
+	if (err != 0) {
+		fprintf(stderr, "%s: could not be started\n", shell);
+		exit(1);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s: '%s' failed\n", shell, command);
+		exit(1);
+	}
+	return now() - start;
+}
+
+int main(int argc, char **argv) {
+	const char *lush = argc > 1 ? argv[1] : DEFAULT_LUSH;
+	int megabytes = argc > 2 ? atoi(argv[2]) : DEFAULT_MEGABYTES;
+	if (megabytes <= 0 || access(lush, X_OK) != 0) {
+		fprintf(stderr, "usage: %s [lush binary] [MiB]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%8s %12s %12s\n", "stages", "lush MiB/s", "sh MiB/s");
+	for (int stages = 1; stages <= MAX_STAGES; stages++) {
+		// the output is discarded by the last cat so nothing hits the disk
+		char command[256];
+		int len = snprintf(command, sizeof(command),
+						   "head -c %dM /dev/zero", megabytes);
+		for (int i = 1; i < stages; i++)
+			len += snprintf(command + len, sizeof(command) - len, " | cat");
+		snprintf(command + len, sizeof(command) - len, " | cat > /dev/null");
+
+		double lushed = run_shell(lush, command);
+		double shelled = run_shell("/bin/sh", command);
+		printf("%8d %12.0f %12.0f\n", stages + 1, megabytes / lushed,
+			   megabytes / shelled);
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+// runs a cpu bound lua job, parsing synthetic log lines, through
+// lush.parallel with a growing number of workers and reports the speedup
+// over a single worker
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_LUSH "bin/Debug/lush/lush"
+#define DEFAULT_INPUTS 64
+#define LINES_PER_INPUT 20000
+
+extern char **environ;
+
+static const char *script =
+	"local inputs = {}\n"
+	"for i = 1, %d do\n"
+	"  inputs[i] = i\n"
+	"end\n"
+	"lush.parallel([[\n"
+	"return function(seed)\n"
+	"  local counts = {}\n"
+	"  for i = 1, %d do\n"
+	"    local line = string.format('host%%d GET /%%d %%d', (seed * i) %% 17,\n"
+	"                               i %% 100, 200 + (i %% 3) * 100)\n"
+	"    local host, status = line:match('(host%%d+) %%S+ %%S+ (%%d+)')\n"
+	"    counts[host .. status] = (counts[host .. status] or 0) + 1\n"
+	"  end\n"
+	"  return counts\n"
+	"end]], inputs, {workers = %d})\n";
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// writes the script for the worker count and returns the seconds lush took
+static double run_script(const char *lush, int inputs, int workers) {
+	char path[] = "/tmp/lush_pool_benchXXXXXX.lua";
+	int fd = mkstemps(path, 4);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+	if (file == NULL) {
+		perror("lush_pool_bench");
+		exit(1);
+	}
+	fprintf(file, script, inputs, LINES_PER_INPUT, workers);
+	fclose(file);
+
+	char *argv[] = {(char *)lush, path, NULL};
+	double start = now();
+	pid_t pid;
+	int err = posix_spawn(&pid, lush, NULL, NULL, argv, environ);
+	if (err != 0) {
+		fprintf(stderr, "%s: could not be started\n", lush);
+		exit(1);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	double elapsed = now() - start;
+	unlink(path);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s: script failed\n", lush);
+		exit(1);
+	}
+	return elapsed;
+}
+
+int main(int argc, char **argv) {
+	const char *lush = argc > 1 ? argv[1] : DEFAULT_LUSH;
+	int inputs = argc > 2 ? atoi(argv[2]) : DEFAULT_INPUTS;
+	if (inputs <= 0 || access(lush, X_OK) != 0) {
+		fprintf(stderr, "usage: %s [lush binary] [inputs]\n", argv[0]);
+		return 1;
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+	printf("%8s %12s %8s\n", "workers", "seconds", "speedup");
+	double single = run_script(lush, inputs, 1);
+	printf("%8d %12.3f %7.1fx\n", 1, single, 1.0);
+	for (int workers = 2; workers <= cpus; workers *= 2) {
+		double elapsed = run_script(lush, inputs, workers);
+		printf("%8d %12.3f %7.1fx\n", workers, elapsed, single / elapsed);
+	}
+	return 0;
+}
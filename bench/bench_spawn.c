@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+// measures how long launching a trivial command takes as the Lua heap
+// grows, comparing fork and exec against lush_spawn
+
+#include "launch.h"
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_ITERATIONS 200
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// grows the heap with tables of small strings like a large init.lua would
+static void grow_heap(lua_State *L, int megabytes) {
+	char chunk[256];
+	snprintf(chunk, sizeof(chunk),
+			 "heap = heap or {}\n"
+			 "while collectgarbage('count') < %d * 1024 do\n"
+			 "  heap[#heap + 1] = { tostring(#heap), #heap }\n"
+			 "end\n",
+			 megabytes);
+	if (luaL_dostring(L, chunk) != LUA_OK) {
+		fprintf(stderr, "%s\n", lua_tostring(L, -1));
+		exit(1);
+	}
+}
+
+static double bench_fork(char **argv, int iterations) {
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		} else if (pid == 0) {
+			execv(argv[0], argv);
+			_exit(127);
+		}
+		int status;
+		waitpid(pid, &status, 0);
+	}
+	return (now() - start) / iterations;
+}
+
+static double bench_spawn(char **argv, int iterations) {
+	double start = now();
+	for (int i = 0; i < iterations; i++) {
+		pid_t pid = lush_spawn(argv, STDIN_FILENO, STDOUT_FILENO, -1, false);
+		if (pid < 0) {
+			perror("lush_spawn");
+			exit(1);
+		}
+		lush_spawn_wait(pid);
+	}
+	return (now() - start) / iterations;
+}
+
+int main(int argc, char **argv) {
+	int iterations = DEFAULT_ITERATIONS;
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	char *command[] = {"/bin/true", NULL};
+	int sizes[] = {0, 16, 64, 256, 1024};
+	printf("%10s %12s %12s\n", "heap MiB", "fork us", "spawn us");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		if (sizes[i] > 0)
+			grow_heap(L, sizes[i]);
+		double forked = bench_fork(command, iterations);
+		double spawned = bench_spawn(command, iterations);
+		printf("%10.0f %12.1f %12.1f\n", lua_gc(L, LUA_GCCOUNT, 0) / 1024.0,
+			   forked * 1e6, spawned * 1e6);
+	}
+
+	lua_close(L);
+	return 0;
+}
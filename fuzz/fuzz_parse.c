@@ -0,0 +1,124 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+// fuzz entry point for the line parser, builds with libFuzzer when
+// LUSH_LIBFUZZER is defined and as an AFL/plain file driver otherwise
+
+#include "ast.h"
+#include "parse.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// runs a line through both the ast parser and the legacy split path
+static void parse_line(char *line) {
+	int status = 0;
+	ast_node_t *root = lush_ast_parse(line, &status);
+	lush_ast_free(root);
+
+	char *expanded = lush_resolve_aliases(line);
+	char **commands = lush_split_commands(expanded);
+	char ***args = lush_split_args(commands, &status);
+	if (status >= 0)
+		lush_expand_globs(args);
+	lush_free_args(args);
+	lush_free_commands(commands);
+	free(expanded);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	// the parser works on C strings so stop at the first NUL
+	char *line = malloc(size + 1);
+	if (!line) {
+		perror("malloc failed");
+		exit(1);
+	}
+	memcpy(line, data, size);
+	line[size] = '\0';
+
+	parse_line(line);
+	free(line);
+	return 0;
+}
+
+#ifndef LUSH_LIBFUZZER
+
+// reads all of a stream into a growable buffer
+static uint8_t *read_stream(FILE *fp, size_t *size) {
+	size_t capacity = 4096;
+	uint8_t *buf = malloc(capacity);
+	if (!buf) {
+		perror("malloc failed");
+		exit(1);
+	}
+
+	*size = 0;
+	size_t n;
+	while ((n = fread(buf + *size, 1, capacity - *size, fp)) > 0) {
+		*size += n;
+		if (*size == capacity) {
+			capacity *= 2;
+			buf = realloc(buf, capacity);
+			if (!buf) {
+				perror("realloc failed");
+				exit(1);
+			}
+		}
+	}
+	return buf;
+}
+
+static int run_file(const char *path) {
+	FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+	if (!fp) {
+		perror(path);
+		return 1;
+	}
+
+	size_t size;
+	uint8_t *buf = read_stream(fp, &size);
+	if (fp != stdin)
+		fclose(fp);
+
+	LLVMFuzzerTestOneInput(buf, size);
+	free(buf);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+#ifdef __AFL_LOOP
+		// afl persistent mode feeds a new case on stdin each iteration
+		while (__AFL_LOOP(10000)) {
+			clearerr(stdin);
+			run_file("-");
+		}
+		return 0;
+#else
+		return run_file("-");
+#endif
+	}
+
+	int rc = 0;
+	for (int i = 1; i < argc; i++)
+		rc |= run_file(argv[i]);
+	return rc;
+}
+
+#endif // LUSH_LIBFUZZER
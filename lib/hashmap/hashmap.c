@@ -29,6 +29,23 @@ hashmap_t *hm_new_hashmap() {
 	return this;
 }
 
+void hm_free_hashmap(hashmap_t *this) {
+	if (this == NULL)
+		return;
+
+	// keys and values are owned by the caller, only free the pairs
+	for (unsigned int i = 0; i < this->cap; i++) {
+		map_pair_t *current = this->list[i];
+		while (current) {
+			map_pair_t *next = current->next;
+			free(current);
+			current = next;
+		}
+	}
+	free(this->list);
+	free(this);
+}
+
 unsigned int hm_hashcode(hashmap_t *this, char *key) {
 	unsigned int code;
 	for (code = 0; *key != '\0'; key++) {
@@ -38,6 +55,33 @@ unsigned int hm_hashcode(hashmap_t *this, char *key) {
 	return code % (this->cap);
 }
 
+static void hm_grow(hashmap_t *this) {
+	unsigned int old_cap = this->cap;
+	map_pair_t **old_list = this->list;
+
+	map_pair_t **new_list = calloc(old_cap * 2, sizeof(map_pair_t *));
+	if (new_list == NULL) {
+		// keep the old buckets, lookups just get slower
+		return;
+	}
+
+	this->cap = old_cap * 2;
+	this->list = new_list;
+
+	// rehash every pair into the new bucket list
+	for (unsigned int i = 0; i < old_cap; i++) {
+		map_pair_t *current = old_list[i];
+		while (current) {
+			map_pair_t *next = current->next;
+			unsigned int idx = hm_hashcode(this, current->key);
+			current->next = this->list[idx];
+			this->list[idx] = current;
+			current = next;
+		}
+	}
+	free(old_list);
+}
+
 char *hm_get(hashmap_t *this, char *key) {
 	map_pair_t *current;
 	for (current = this->list[hm_hashcode(this, key)]; current;
@@ -60,6 +104,12 @@ void hm_set(hashmap_t *this, char *key, char *val) {
 		}
 	}
 
+	// keep chains short by growing once the load factor passes 1
+	if (this->len >= this->cap) {
+		hm_grow(this);
+		idx = hm_hashcode(this, key);
+	}
+
 	map_pair_t *p = malloc(sizeof(map_pair_t));
 	p->key = key;
 	p->val = val;
@@ -31,6 +31,7 @@ typedef struct {
 } hashmap_t;
 
 hashmap_t *hm_new_hashmap();
+void hm_free_hashmap(hashmap_t *this);
 unsigned int hm_hashcode(hashmap_t *this, char *key);
 char *hm_get(hashmap_t *this, char *key);
 void hm_set(hashmap_t *this, char *key, char *val);
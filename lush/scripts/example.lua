@@ -40,6 +40,14 @@ if lush.exec('echo "hello world"\n') then
 	print("echo worked properly")
 end
 
+-- exec records the line in history unless history is turned off
+lush.exec("x=1", { history = false })
+
+-- execMany runs a list of lines and returns a table of their exit statuses
+-- it leaves history alone unless asked, which rewrites the file only once
+local statuses = lush.execMany({ "true", "false" }, { history = false })
+print(statuses[1], statuses[2])
+
 -- debug mode can be used to log execution of commands
 lush.debug(true) -- enters debug
 lush.exec('echo "echo in debug mode"')
@@ -55,6 +63,73 @@ lush.cd("~/.lush/scripts")
 lush.exec('cat "example.lua" | grep "hello" | sort | uniq')
 lush.cd(cwd)
 
+-- every command of a pipeline leaves its exit status in $PIPESTATUS
+-- and with pipefail on the pipeline fails when any of them does
+lush.pipefail(true)
+if not lush.exec("false | true") then
+	lush.exec("echo $PIPESTATUS")
+end
+lush.pipefail(false)
+
+-- timers run while the shell waits, here on the sleep
+local timer = lush.setTimer(100, function()
+	print("tick")
+end, true)
+lush.exec("sleep 0.35")
+lush.clearTimer(timer)
+
+-- spawn starts commands without waiting, stdout and stderr can be piped
+-- into the process and wait returns the first one that finishes
+local procs = {}
+for i = 1, 3 do
+	procs[i] = lush.spawn("sleep 0." .. i .. " && echo " .. i, { stdout = "pipe" })
+end
+while #procs > 0 do
+	local proc, index = lush.wait(procs)
+	print("finished " .. proc.stdout:gsub("\n", "") .. " with " .. proc.status)
+	table.remove(procs, index)
+end
+
+-- capture runs a command and returns what it printed, max_bytes caps how
+-- much of each stream is kept
+local branch, _, status = lush.capture("git branch --show-current", { max_bytes = 256 })
+if status == 0 then
+	print("on branch " .. branch)
+end
+
+-- lines streams a command's output without holding all of it, breaking
+-- out of the loop stops the command
+for line in lush.lines("ls -1") do
+	if line:match("%.lua$") then
+		print("first script: " .. line)
+		break
+	end
+end
+
+-- run takes argument vectors as they are so nothing needs quoting, stdin,
+-- stdout and stderr name files and glob = true expands patterns
+local pattern = "*.lua"
+lush.run({ { "find", ".", "-name", pattern }, { "wc", "-l" }, stdout = "/dev/null" })
+
+-- lua:name runs a Lua function as a pipeline stage, it gets each line and
+-- then nil at the end, whatever string it returns is written out
+local seen = 0
+function numbered(line)
+	if line then
+		seen = seen + 1
+		return seen .. ": " .. line
+	end
+end
+lush.exec("ls -1 | lua:numbered | head -n 3")
+
+-- parallel spreads cpu heavy Lua over worker states on every core, fn is
+-- source returning the function or a function that uses no outer locals
+-- inputs and results may be nil, booleans, numbers, strings and tables
+local lengths = lush.parallel(function(word)
+	return #word
+end, { "moon", "lunar", "shell" }, { workers = 2 })
+print(lengths[1], lengths[2], lengths[3])
+
 -- exists allows you to check if a file or directory exists
 if lush.exists("~/.lush/scripts/example.lua") then
 	print("example.lua exists")
@@ -77,6 +152,20 @@ if lush.isWriteable("~/.lush/scripts/example.lua") then
 	print("example.lua is writeable")
 end
 
+-- stat reads everything at once: type, size, mode, uid, gid, times and
+-- whether the path is readable, writeable and executable
+-- it returns nil and an error message when the path does not exist
+local info = lush.stat("~/.lush/scripts/example.lua")
+if info then
+	print(info.type, info.size, info.mtime)
+end
+
+-- statMany does the same for a list of paths and readdir walks a directory
+-- without a command, stat = true gives each entry's stat table too
+for name, type in lush.readdir("~/.lush/scripts") do
+	print(name, type)
+end
+
 -- you can fetch the most recently executed command in history
 print("Most recent history: " .. lush.lastHistory())
 
@@ -97,9 +186,9 @@ lush.unsetenv("EXAMPLE")
 print("Terminal Columns: " .. lush.termCols())
 print("Terminal Rows: " .. lush.termRows())
 
--- the glob function scans the current working directory for files with the given extension and returns
--- them as an array of strings
-local textFiles = lush.glob("txt")
+-- the glob function expands a pattern the same way the shell does and returns the sorted matches as an
+-- array of strings, a bare word like "txt" is treated as an extension
+local textFiles = lush.glob("*.txt")
 if textFiles ~= nil then
 	print("Printing txt files:")
 	for i = 1, #textFiles do
@@ -107,6 +196,18 @@ if textFiles ~= nil then
 	end
 end
 
+-- glob also takes an options table. dir sets the directory to search, recursive and maxDepth walk into
+-- subdirectories, type keeps only "file", "directory" or "link" entries and hidden includes dot files.
+-- when walking the pattern is matched against each entry name
+local luaScripts = lush.glob("*.lua", { dir = lush.getenv("HOME") .. "/.lush", recursive = true, type = "file" })
+print("Found " .. #luaScripts .. " lua files")
+
+-- with iter set glob returns an iterator instead, entries are streamed so large trees never have to fit
+-- in a table. the second value is the type of the entry
+for path, kind in lush.glob("*", { iter = true, maxDepth = 2 }) do
+	print(kind .. ": " .. path)
+end
+
 -- the exit function is used to make the program quit in the case of an error
 print("making an error with lush.exit()")
 lush.exit()
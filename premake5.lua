@@ -1,24 +1,25 @@
 workspace("lush")
 configurations({ "Debug", "Release" })
 
--- lush project
-project("lush")
-kind("ConsoleApp")
-language("C")
-targetdir("bin/%{cfg.buildcfg}/lush")
-
 local lua_inc_path = "/usr/include"
 local lua_lib_path = "/usr/lib"
+local lua_links = { "lua", "pthread" }
 
 if os.findlib("lua5.4") then
 	lua_inc_path = "/usr/include/lua5.4"
 	lua_lib_path = "/usr/lib/5.4"
 	-- Readline for better interactive support, dl for dynamic loading, and m for the math library dependency
-	links({ "lua5.4", "readline", "dl", "m" })
-else
-	links({ "lua" })
+	lua_links = { "lua5.4", "readline", "dl", "m", "pthread" }
 end
 
+-- lush project
+project("lush")
+kind("ConsoleApp")
+language("C")
+targetdir("bin/%{cfg.buildcfg}/lush")
+
+links(lua_links)
+
 includedirs({
 	lua_inc_path,
 	"lib/hashmap",
@@ -48,3 +49,100 @@ symbols("On")
 filter("configurations:Release")
 defines({ "NDEBUG" })
 optimize("On")
+
+filter({})
+
+-- the parser builds on its own so it can be fuzzed and benchmarked
+-- without lua or the repl
+local parser_files = {
+	"src/parse.h",
+	"src/parse.c",
+	"src/expand.h",
+	"src/expand.c",
+	"src/arith.h",
+	"src/arith.c",
+	"src/ast.h",
+	"src/ast.c",
+	"src/wildcard.h",
+	"src/wildcard.c",
+	"lib/hashmap/**.h",
+	"lib/hashmap/**.c",
+}
+
+newoption({
+	trigger = "fuzzer",
+	description = "Build lush_fuzz against libFuzzer with clang",
+})
+
+-- fuzz target, reads cases from files or stdin unless built with --fuzzer
+project("lush_fuzz")
+kind("ConsoleApp")
+language("C")
+targetdir("bin/%{cfg.buildcfg}/lush_fuzz")
+includedirs({ "src", "lib/hashmap" })
+files(parser_files)
+files({ "fuzz/fuzz_parse.c" })
+links({ "pthread" })
+symbols("On")
+
+if _OPTIONS["fuzzer"] then
+	toolset("clang")
+	defines({ "LUSH_LIBFUZZER" })
+	buildoptions({ "-fsanitize=fuzzer,address,undefined" })
+	linkoptions({ "-fsanitize=fuzzer,address,undefined" })
+end
+
+-- replays bench/corpus.txt and reports lines/sec, allocs/line and peak rss
+project("lush_bench")
+kind("ConsoleApp")
+language("C")
+targetdir("bin/%{cfg.buildcfg}/lush_bench")
+includedirs({ "src", "lib/hashmap" })
+files(parser_files)
+files({ "bench/bench_parse.c" })
+links({ "pthread" })
+optimize("On")
+
+-- launches /bin/true with fork and with lush_spawn as the Lua heap grows
+project("lush_spawn_bench")
+kind("ConsoleApp")
+language("C")
+targetdir("bin/%{cfg.buildcfg}/lush_spawn_bench")
+includedirs({ lua_inc_path, "src", "lib/hashmap" })
+libdirs({ lua_lib_path })
+links(lua_links)
+files({ "src/launch.h", "src/launch.c", "bench/bench_spawn.c" })
+files({ "lib/hashmap/**.h", "lib/hashmap/**.c" })
+optimize("On")
+
+-- pushes a large stream through pipelines run by lush and by /bin/sh
+project("lush_pipe_bench")
+kind("ConsoleApp")
+language("C")
+targetdir("bin/%{cfg.buildcfg}/lush_pipe_bench")
+files({ "bench/bench_pipeline.c" })
+optimize("On")
+
+-- runs sleeping commands from lua one by one and with lush.spawn
+project("lush_async_bench")
+kind("ConsoleApp")
+language("C")
+targetdir("bin/%{cfg.buildcfg}/lush_async_bench")
+files({ "bench/bench_async.c" })
+optimize("On")
+
+-- runs shell-only commands through lush.exec and lush.execMany
+project("lush_exec_bench")
+kind("ConsoleApp")
+language("C")
+targetdir("bin/%{cfg.buildcfg}/lush_exec_bench")
+files({ "bench/bench_exec.c" })
+optimize("On")
+
+-- maps a cpu bound lua function over inputs with lush.parallel workers
+project("lush_pool_bench")
+kind("ConsoleApp")
+language("C")
+targetdir("bin/%{cfg.buildcfg}/lush_pool_bench")
+files({ "bench/bench_pool.c" })
+optimize("On")
@@ -0,0 +1,574 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "arith.h"
+#include "expand.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// variables holding expressions are evaluated recursively up to this depth
+#define ARITH_MAX_DEPTH 32
+
+// binding powers, left associative operators bind their right side at +1
+#define BP_COMMA 2
+#define BP_ASSIGN 4
+#define BP_TERNARY 6
+#define BP_LOGICAL_OR 8
+#define BP_LOGICAL_AND 10
+#define BP_BIT_OR 12
+#define BP_BIT_XOR 14
+#define BP_BIT_AND 16
+#define BP_EQUALITY 18
+#define BP_RELATIONAL 20
+#define BP_SHIFT 22
+#define BP_ADDITIVE 24
+#define BP_MULTIPLICATIVE 26
+#define BP_POWER 28
+#define BP_PREFIX 30
+#define BP_POSTFIX 32
+
+typedef enum {
+	TOK_END,
+	TOK_NUMBER,
+	TOK_NAME,
+	TOK_OPERATOR,
+} arith_token_type_t;
+
+typedef struct {
+	arith_token_type_t type;
+	const char *start;
+	size_t len;
+	long long number;
+} arith_token_t;
+
+typedef struct {
+	const char *expr;
+	const char *pos;
+	arith_token_t token;
+	const char *error;
+	int skip;  // nonzero while inside a short circuited operand
+	int depth; // nesting of variables evaluated as expressions
+} arith_parser_t;
+
+typedef struct {
+	long long value;
+	const char *name; // set when the operand is a variable
+	size_t name_len;
+} arith_value_t;
+
+// longest operators first so that matching is greedy
+static const char *arith_operators[] = {
+	"<<=", ">>=", "**", "<<", ">>", "<=", ">=", "==", "!=", "&&",
+	"||",  "++",  "--", "+=", "-=", "*=", "/=", "%=", "&=", "^=",
+	"|=",  "+",	  "-",	"*",  "/",	"%",  "<",	">",  "&",	"|",
+	"^",   "!",	  "~",	"?",  ":",	"=",  ",",	"(",  ")"};
+
+static int arith_eval_r(const char *expr, long long *result, int depth,
+						int skip);
+
+static int arith_fail(arith_parser_t *p, const char *error) {
+	if (p->error == NULL)
+		p->error = error;
+	return -1;
+}
+
+static int arith_next(arith_parser_t *p) {
+	while (isspace((unsigned char)*p->pos))
+		p->pos++;
+
+	arith_token_t *tok = &p->token;
+	tok->start = p->pos;
+	tok->len = 0;
+
+	if (*p->pos == '\0') {
+		tok->type = TOK_END;
+		return 0;
+	}
+
+	if (isdigit((unsigned char)*p->pos)) {
+		char *end;
+		tok->type = TOK_NUMBER;
+		tok->number = strtoll(p->pos, &end, 0);
+		if (isalnum((unsigned char)*end) || *end == '_')
+			return arith_fail(p, "value too great for base");
+		tok->len = end - p->pos;
+		p->pos = end;
+		return 0;
+	}
+
+	if (isalpha((unsigned char)*p->pos) || *p->pos == '_') {
+		const char *end = p->pos;
+		while (isalnum((unsigned char)*end) || *end == '_')
+			end++;
+		tok->type = TOK_NAME;
+		tok->len = end - p->pos;
+		p->pos = end;
+		return 0;
+	}
+
+	int num_operators = sizeof(arith_operators) / sizeof(arith_operators[0]);
+	for (int i = 0; i < num_operators; i++) {
+		size_t len = strlen(arith_operators[i]);
+		if (strncmp(p->pos, arith_operators[i], len) == 0) {
+			tok->type = TOK_OPERATOR;
+			tok->len = len;
+			p->pos += len;
+			return 0;
+		}
+	}
+
+	return arith_fail(p, "syntax error: invalid arithmetic operator");
+}
+
+static bool arith_is(arith_parser_t *p, const char *op) {
+	return p->token.type == TOK_OPERATOR && p->token.len == strlen(op) &&
+		   strncmp(p->token.start, op, p->token.len) == 0;
+}
+
+// -- variables --
+
+static char *copy_name(const arith_value_t *val, char *buffer, size_t size) {
+	if (val->name_len < size) {
+		memcpy(buffer, val->name, val->name_len);
+		buffer[val->name_len] = '\0';
+		return buffer;
+	}
+	return strndup(val->name, val->name_len);
+}
+
+static int arith_lookup(arith_parser_t *p, arith_value_t *val) {
+	char buffer[256];
+	char *name = copy_name(val, buffer, sizeof(buffer));
+	if (name == NULL)
+		return arith_fail(p, "out of memory");
+
+	const char *str = lush_env_get(name);
+	if (name != buffer)
+		free(name);
+
+	val->value = 0;
+	if (str == NULL)
+		return 0;
+
+	while (isspace((unsigned char)*str))
+		str++;
+	if (*str == '\0')
+		return 0;
+
+	// plain numbers are the common case, anything else is an expression
+	char *end;
+	val->value = strtoll(str, &end, 0);
+	while (isspace((unsigned char)*end))
+		end++;
+	if (*end == '\0')
+		return 0;
+
+	if (p->depth >= ARITH_MAX_DEPTH)
+		return arith_fail(p, "expression recursion level exceeded");
+	// the value lives in the environment snapshot, which an assignment in
+	// the nested expression would free while it is being parsed
+	char *expr = strdup(str);
+	if (expr == NULL)
+		return arith_fail(p, "out of memory");
+	int rc = arith_eval_r(expr, &val->value, p->depth + 1, p->skip);
+	free(expr);
+	if (rc != 0)
+		return arith_fail(p, "invalid variable value");
+	return 0;
+}
+
+static int arith_assign(arith_parser_t *p, arith_value_t *val,
+						long long value) {
+	val->value = value;
+	if (p->skip)
+		return 0;
+
+	char buffer[256];
+	char *name = copy_name(val, buffer, sizeof(buffer));
+	if (name == NULL)
+		return arith_fail(p, "out of memory");
+
+	char value_str[32];
+	snprintf(value_str, sizeof(value_str), "%lld", value);
+	lush_env_set(name, value_str);
+
+	if (name != buffer)
+		free(name);
+	return 0;
+}
+
+// -- operators --
+
+// unsigned math keeps overflow defined, it wraps like bash does
+static int arith_binary(arith_parser_t *p, const char *op, size_t len,
+						long long lhs, long long rhs, long long *result) {
+	unsigned long long ulhs = lhs, urhs = rhs;
+
+	if (len == 2 && strncmp(op, "**", 2) == 0) {
+		if (rhs < 0)
+			return arith_fail(p, "exponent less than 0");
+		unsigned long long base = ulhs, acc = 1;
+		while (urhs) {
+			if (urhs & 1)
+				acc *= base;
+			base *= base;
+			urhs >>= 1;
+		}
+		*result = (long long)acc;
+		return 0;
+	}
+
+	switch (op[0]) {
+	case '+':
+		*result = (long long)(ulhs + urhs);
+		return 0;
+	case '-':
+		*result = (long long)(ulhs - urhs);
+		return 0;
+	case '*':
+		*result = (long long)(ulhs * urhs);
+		return 0;
+	case '/':
+	case '%':
+		if (rhs == 0) {
+			if (p->skip) {
+				*result = 0;
+				return 0;
+			}
+			return arith_fail(p, "division by 0");
+		}
+		if (rhs == -1) {
+			// avoid trapping on LLONG_MIN / -1
+			*result = op[0] == '/' ? (long long)(0 - ulhs) : 0;
+			return 0;
+		}
+		*result = op[0] == '/' ? lhs / rhs : lhs % rhs;
+		return 0;
+	case '<':
+		if (len == 2 && op[1] == '<')
+			*result = (long long)(ulhs << (urhs & 63));
+		else if (len == 2)
+			*result = lhs <= rhs;
+		else
+			*result = lhs < rhs;
+		return 0;
+	case '>':
+		if (len == 2 && op[1] == '>')
+			*result = lhs >> (urhs & 63);
+		else if (len == 2)
+			*result = lhs >= rhs;
+		else
+			*result = lhs > rhs;
+		return 0;
+	case '=':
+		*result = lhs == rhs;
+		return 0;
+	case '!':
+		*result = lhs != rhs;
+		return 0;
+	case '&':
+		*result = lhs & rhs;
+		return 0;
+	case '|':
+		*result = lhs | rhs;
+		return 0;
+	case '^':
+		*result = lhs ^ rhs;
+		return 0;
+	default:
+		return arith_fail(p, "syntax error: operand expected");
+	}
+}
+
+// returns the left binding power of an infix operator or 0 if the token
+// does not continue an expression
+static int arith_infix_bp(arith_parser_t *p) {
+	if (p->token.type != TOK_OPERATOR)
+		return 0;
+
+	const char *op = p->token.start;
+	size_t len = p->token.len;
+
+	if (len == 3 || (len == 2 && op[1] == '=' && strchr("+-*/%&^|", op[0])))
+		return BP_ASSIGN;
+	if (len == 2) {
+		if (strncmp(op, "**", 2) == 0)
+			return BP_POWER;
+		if (strncmp(op, "<<", 2) == 0 || strncmp(op, ">>", 2) == 0)
+			return BP_SHIFT;
+		if (strncmp(op, "<=", 2) == 0 || strncmp(op, ">=", 2) == 0)
+			return BP_RELATIONAL;
+		if (strncmp(op, "==", 2) == 0 || strncmp(op, "!=", 2) == 0)
+			return BP_EQUALITY;
+		if (strncmp(op, "&&", 2) == 0)
+			return BP_LOGICAL_AND;
+		if (strncmp(op, "||", 2) == 0)
+			return BP_LOGICAL_OR;
+		if (strncmp(op, "++", 2) == 0 || strncmp(op, "--", 2) == 0)
+			return BP_POSTFIX;
+		return 0;
+	}
+
+	switch (op[0]) {
+	case ',':
+		return BP_COMMA;
+	case '=':
+		return BP_ASSIGN;
+	case '?':
+		return BP_TERNARY;
+	case '|':
+		return BP_BIT_OR;
+	case '^':
+		return BP_BIT_XOR;
+	case '&':
+		return BP_BIT_AND;
+	case '<':
+	case '>':
+		return BP_RELATIONAL;
+	case '+':
+	case '-':
+		return BP_ADDITIVE;
+	case '*':
+	case '/':
+	case '%':
+		return BP_MULTIPLICATIVE;
+	default:
+		return 0;
+	}
+}
+
+static int arith_parse_r(arith_parser_t *p, int min_bp, arith_value_t *out);
+
+static int arith_prefix(arith_parser_t *p, arith_value_t *out) {
+	arith_token_t tok = p->token;
+	out->name = NULL;
+	out->name_len = 0;
+
+	if (tok.type == TOK_NUMBER) {
+		out->value = tok.number;
+		return arith_next(p);
+	}
+
+	if (tok.type == TOK_NAME) {
+		out->name = tok.start;
+		out->name_len = tok.len;
+		if (arith_lookup(p, out) != 0)
+			return -1;
+		return arith_next(p);
+	}
+
+	if (tok.type != TOK_OPERATOR)
+		return arith_fail(p, "syntax error: operand expected");
+
+	if (arith_is(p, "(")) {
+		if (arith_next(p) != 0 || arith_parse_r(p, 0, out) != 0)
+			return -1;
+		if (!arith_is(p, ")"))
+			return arith_fail(p, "missing `)'");
+		out->name = NULL;
+		return arith_next(p);
+	}
+
+	bool increment = arith_is(p, "++");
+	bool decrement = arith_is(p, "--");
+	if (!increment && !decrement &&
+		(tok.len != 1 || !strchr("+-!~", tok.start[0])))
+		return arith_fail(p, "syntax error: operand expected");
+
+	arith_value_t operand;
+	if (arith_next(p) != 0 || arith_parse_r(p, BP_PREFIX, &operand) != 0)
+		return -1;
+
+	if (increment || decrement) {
+		if (operand.name == NULL)
+			return arith_fail(p, "attempted assignment to non-variable");
+		long long delta = increment ? 1 : -1;
+		if (arith_assign(p, &operand,
+						 (long long)((unsigned long long)operand.value +
+									 delta)) != 0)
+			return -1;
+		out->value = operand.value;
+		return 0;
+	}
+
+	switch (tok.start[0]) {
+	case '+':
+		out->value = operand.value;
+		break;
+	case '-':
+		out->value = (long long)(0 - (unsigned long long)operand.value);
+		break;
+	case '!':
+		out->value = !operand.value;
+		break;
+	case '~':
+		out->value = ~operand.value;
+		break;
+	}
+	return 0;
+}
+
+static int arith_parse_r(arith_parser_t *p, int min_bp, arith_value_t *out) {
+	if (arith_prefix(p, out) != 0)
+		return -1;
+
+	while (true) {
+		int bp = arith_infix_bp(p);
+		if (bp == 0 || bp < min_bp)
+			break;
+
+		arith_token_t op = p->token;
+		if (arith_next(p) != 0)
+			return -1;
+
+		if (bp == BP_POSTFIX) {
+			if (out->name == NULL)
+				return arith_fail(p, "attempted assignment to non-variable");
+			long long old = out->value;
+			long long delta = op.start[0] == '+' ? 1 : -1;
+			if (arith_assign(p, out,
+							 (long long)((unsigned long long)old + delta)) != 0)
+				return -1;
+			out->value = old;
+			out->name = NULL;
+			continue;
+		}
+
+		arith_value_t rhs;
+		if (bp == BP_TERNARY) {
+			bool cond = out->value != 0;
+			arith_value_t other;
+
+			p->skip += !cond;
+			int rc = arith_parse_r(p, 0, &rhs);
+			p->skip -= !cond;
+			if (rc != 0)
+				return -1;
+			if (!arith_is(p, ":"))
+				return arith_fail(p, "`:' expected for conditional expression");
+			if (arith_next(p) != 0)
+				return -1;
+
+			p->skip += cond;
+			rc = arith_parse_r(p, BP_TERNARY, &other);
+			p->skip -= cond;
+			if (rc != 0)
+				return -1;
+
+			out->value = cond ? rhs.value : other.value;
+			out->name = NULL;
+			continue;
+		}
+
+		if (bp == BP_LOGICAL_AND || bp == BP_LOGICAL_OR) {
+			// the right side is parsed but its side effects are skipped
+			bool decided = bp == BP_LOGICAL_AND ? out->value == 0
+												: out->value != 0;
+			p->skip += decided;
+			int rc = arith_parse_r(p, bp + 1, &rhs);
+			p->skip -= decided;
+			if (rc != 0)
+				return -1;
+
+			if (bp == BP_LOGICAL_AND)
+				out->value = out->value != 0 && rhs.value != 0;
+			else
+				out->value = out->value != 0 || rhs.value != 0;
+			out->name = NULL;
+			continue;
+		}
+
+		if (bp == BP_ASSIGN) {
+			if (out->name == NULL)
+				return arith_fail(p, "attempted assignment to non-variable");
+			if (arith_parse_r(p, BP_ASSIGN, &rhs) != 0)
+				return -1;
+
+			long long value = rhs.value;
+			if (op.len > 1) {
+				// compound assignment applies the operator before the '='
+				if (arith_binary(p, op.start, op.len - 1, out->value,
+								 rhs.value, &value) != 0)
+					return -1;
+			}
+			if (arith_assign(p, out, value) != 0)
+				return -1;
+			out->name = NULL;
+			continue;
+		}
+
+		if (bp == BP_COMMA) {
+			if (arith_parse_r(p, BP_COMMA + 1, &rhs) != 0)
+				return -1;
+			*out = rhs;
+			out->name = NULL;
+			continue;
+		}
+
+		// exponentiation is the only right associative binary operator
+		int rbp = bp == BP_POWER ? bp : bp + 1;
+		if (arith_parse_r(p, rbp, &rhs) != 0)
+			return -1;
+		if (arith_binary(p, op.start, op.len, out->value, rhs.value,
+						 &out->value) != 0)
+			return -1;
+		out->name = NULL;
+	}
+
+	return 0;
+}
+
+// skip carries a short circuit into the expression a variable holds
+static int arith_eval_r(const char *expr, long long *result, int depth,
+						int skip) {
+	arith_parser_t parser = {0};
+	parser.expr = expr;
+	parser.pos = expr;
+	parser.depth = depth;
+	parser.skip = skip;
+
+	arith_value_t value = {0};
+	int rc = arith_next(&parser);
+	if (rc == 0 && parser.token.type != TOK_END) {
+		rc = arith_parse_r(&parser, 0, &value);
+		if (rc == 0 && parser.token.type != TOK_END)
+			rc = arith_fail(&parser, "syntax error in expression");
+	}
+
+	if (rc != 0) {
+		// nested failures were already reported by the inner parser
+		if (strcmp(parser.error, "invalid variable value") == 0)
+			return -1;
+
+		if (*parser.token.start != '\0')
+			fprintf(stderr, "lush: %s: %s (error token is \"%s\")\n", expr,
+					parser.error, parser.token.start);
+		else
+			fprintf(stderr, "lush: %s: %s\n", expr, parser.error);
+		return -1;
+	}
+
+	*result = value.value;
+	return 0;
+}
+
+int lush_arith_eval(const char *expr, long long *result) {
+	return arith_eval_r(expr, result, 0, 0);
+}
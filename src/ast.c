@@ -0,0 +1,1034 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "ast.h"
+#include "expand.h"
+#include "parse.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	// raw words from lush_split_words, operators get their own segment
+	char ***segments;
+	int seg;
+	int word;
+	bool error;
+	// heredoc bodies in the order their operators appear
+	char **heredocs;
+	int num_heredocs;
+	int next_heredoc;
+} parser_t;
+
+typedef struct {
+	char *delimiter;
+	bool strip_tabs;
+} heredoc_t;
+
+static const char *terminators[] = {"then", "elif", "else", "fi", "do",
+									"done", "esac", "}"};
+
+static const char *openers[] = {"if",	 "for", "while",   "until",
+								"case", "{",	  "function"};
+
+static ast_node_t *parse_list(parser_t *p);
+static ast_node_t *parse_command(parser_t *p);
+
+// -- node helpers --
+
+static ast_node_t *new_node(ast_type_t type) {
+	ast_node_t *node = calloc(1, sizeof(ast_node_t));
+	if (node == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+	node->type = type;
+	return node;
+}
+
+static void append_child(ast_node_t *node, ast_node_t *child, int connector) {
+	int n = node->num_children;
+	node->children = realloc(node->children, (n + 1) * sizeof(ast_node_t *));
+	node->connectors = realloc(node->connectors, (n + 1) * sizeof(int));
+	if (node->children == NULL || node->connectors == NULL) {
+		perror("realloc failed");
+		exit(1);
+	}
+	node->children[n] = child;
+	node->connectors[n] = connector;
+	node->num_children++;
+}
+
+// appends to a NULL terminated array of word arrays
+static char ***append_words(char ***list, int *count, char **words) {
+	list = realloc(list, (*count + 2) * sizeof(char **));
+	if (list == NULL) {
+		perror("realloc failed");
+		exit(1);
+	}
+	list[(*count)++] = words;
+	list[*count] = NULL;
+	return list;
+}
+
+// appends a word that was just duplicated
+static char **append_word(char **words, int *count, char *word) {
+	if (word == NULL) {
+		perror("strdup failed");
+		exit(1);
+	}
+	words = realloc(words, (*count + 2) * sizeof(char *));
+	if (words == NULL) {
+		perror("realloc failed");
+		exit(1);
+	}
+	words[(*count)++] = word;
+	words[*count] = NULL;
+	return words;
+}
+
+void lush_ast_free(ast_node_t *node) {
+	if (node == NULL)
+		return;
+
+	lush_free_args(node->words);
+	lush_free_args(node->patterns);
+	free(node->name);
+	free(node->input);
+	for (int i = 0; i < node->num_children; i++) {
+		lush_ast_free(node->children[i]);
+	}
+	free(node->children);
+	free(node->connectors);
+	lush_ast_free(node->cond);
+	lush_ast_free(node->body);
+	lush_ast_free(node->else_body);
+	free(node);
+}
+
+// -- token cursor --
+
+static bool is_op_segment(char **segment) {
+	return segment[0] != NULL && segment[1] == NULL &&
+		   lush_is_operator(segment[0]) &&
+		   (size_t)lush_operator_length(segment[0]) == strlen(segment[0]);
+}
+
+// skips over word segments that have been used up
+static void settle(parser_t *p) {
+	while (p->segments[p->seg] && !is_op_segment(p->segments[p->seg]) &&
+		   p->segments[p->seg][p->word] == NULL) {
+		p->seg++;
+		p->word = 0;
+	}
+}
+
+static bool at_end(parser_t *p) { return p->segments[p->seg] == NULL; }
+
+// operator under the cursor, 0 for a word or the end of input
+static int peek_op(parser_t *p) {
+	char **segment = p->segments[p->seg];
+	if (segment == NULL || !is_op_segment(segment))
+		return 0;
+	return lush_is_operator(segment[0]);
+}
+
+// word under the cursor, NULL for an operator or the end of input
+static char *peek_word(parser_t *p) {
+	char **segment = p->segments[p->seg];
+	if (segment == NULL || is_op_segment(segment))
+		return NULL;
+	return segment[p->word];
+}
+
+static void next_word(parser_t *p) {
+	p->word++;
+	settle(p);
+}
+
+static void next_segment(parser_t *p) {
+	p->seg++;
+	p->word = 0;
+	settle(p);
+}
+
+// takes ownership of the words left in the current segment
+static char **take_segment(parser_t *p) {
+	char **segment = p->segments[p->seg];
+	int count = 0;
+	while (segment[p->word + count])
+		count++;
+
+	char **words = calloc(count + 1, sizeof(char *));
+	if (words == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+	memcpy(words, segment + p->word, count * sizeof(char *));
+	segment[p->word] = NULL;
+	next_segment(p);
+	return words;
+}
+
+// first word of the segment after the operator under the cursor
+static char *word_after_op(parser_t *p) {
+	if (at_end(p))
+		return NULL;
+	char **next = p->segments[p->seg + 1];
+	return next != NULL && !is_op_segment(next) ? next[0] : NULL;
+}
+
+static char **copy_segment(parser_t *p) {
+	int count = 0;
+	char **words = NULL;
+	for (int i = p->word; p->segments[p->seg][i]; i++) {
+		words = append_word(words, &count, strdup(p->segments[p->seg][i]));
+	}
+	next_segment(p);
+	return words;
+}
+
+static bool in_list(const char *word, const char **list, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		if (strcmp(word, list[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+static bool is_terminator(const char *word) {
+	return in_list(word, terminators,
+				   sizeof(terminators) / sizeof(terminators[0]));
+}
+
+static bool is_opener(const char *word) {
+	return in_list(word, openers, sizeof(openers) / sizeof(openers[0]));
+}
+
+static bool at_keyword(parser_t *p, const char *keyword) {
+	char *word = peek_word(p);
+	return word != NULL && strcmp(word, keyword) == 0;
+}
+
+static void *syntax_error(parser_t *p) {
+	if (!p->error) {
+		if (at_end(p)) {
+			fprintf(stderr, "lush: syntax error: unexpected end of input\n");
+		} else {
+			char *token = peek_word(p);
+			fprintf(stderr, "lush: syntax error near unexpected token `%s'\n",
+					token ? token : p->segments[p->seg][0]);
+		}
+	}
+	p->error = true;
+	return NULL;
+}
+
+static bool expect(parser_t *p, const char *keyword) {
+	if (!at_keyword(p, keyword)) {
+		syntax_error(p);
+		return false;
+	}
+	next_word(p);
+	return true;
+}
+
+static void skip_newlines(parser_t *p) {
+	while (peek_op(p) == OP_SEMICOLON)
+		next_segment(p);
+}
+
+static bool is_name(const char *word, size_t len) {
+	if (len == 0 || !(isalpha((unsigned char)word[0]) || word[0] == '_'))
+		return false;
+	for (size_t i = 1; i < len; i++) {
+		if (!(isalnum((unsigned char)word[i]) || word[i] == '_'))
+			return false;
+	}
+	return true;
+}
+
+// -- heredocs --
+
+// removes the quoting from a delimiter word
+static char *unquote_delimiter(const char *word, size_t len) {
+	char *delimiter = malloc(len + 1);
+	if (delimiter == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+
+	size_t j = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (word[i] == '\'' || word[i] == '"')
+			continue;
+		if (word[i] == '\\' && i + 1 < len)
+			i++;
+		delimiter[j++] = word[i];
+	}
+	delimiter[j] = '\0';
+	return delimiter;
+}
+
+// reads the lines of a heredoc body up to its delimiter line, returns false
+// if the input ran out first
+static bool read_body(const char **cursor, heredoc_t *heredoc, char **body) {
+	const char *line = *cursor;
+	size_t delimiter_len = strlen(heredoc->delimiter);
+	size_t len = 0;
+	char *out = malloc(strlen(line) + 2);
+	if (out == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+
+	bool found = false;
+	while (*line) {
+		if (heredoc->strip_tabs) {
+			while (*line == '\t')
+				line++;
+		}
+
+		const char *end = strchr(line, '\n');
+		size_t line_len = end ? (size_t)(end - line) : strlen(line);
+		const char *next = end ? end + 1 : line + line_len;
+		if (line_len == delimiter_len &&
+			strncmp(line, heredoc->delimiter, delimiter_len) == 0) {
+			line = next;
+			found = true;
+			break;
+		}
+
+		memcpy(out + len, line, line_len);
+		len += line_len;
+		out[len++] = '\n';
+		line = next;
+	}
+
+	out[len] = '\0';
+	*body = out;
+	*cursor = line;
+	return found;
+}
+
+// moves heredoc bodies out of the line so the rest can be split into
+// commands. returns the number of heredocs that ran out of input
+static int collect_heredocs(const char *line, char **stripped, char ***bodies,
+							int *num_bodies) {
+	char *out = malloc(strlen(line) + 1);
+	if (out == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+
+	heredoc_t *pending = NULL;
+	int num_pending = 0;
+	int missing = 0;
+	size_t len = 0;
+	char quote = '\0';
+	int depth = 0;
+
+	*bodies = NULL;
+	*num_bodies = 0;
+
+	const char *c = line;
+	while (*c) {
+		if (quote) {
+			if (*c == '\\' && quote == '"' && c[1])
+				out[len++] = *c++;
+			else if (*c == quote)
+				quote = '\0';
+		} else if (*c == '"' || *c == '\'') {
+			quote = *c;
+		} else if (*c == '\\' && c[1]) {
+			out[len++] = *c++;
+		} else if (*c == '$' && (c[1] == '{' || c[1] == '(')) {
+			depth++;
+			out[len++] = *c++;
+		} else if (depth > 0 && (*c == '{' || *c == '(')) {
+			depth++;
+		} else if (depth > 0 && (*c == '}' || *c == ')')) {
+			depth--;
+		} else if (depth == 0 && strncmp(c, "<<<", 3) == 0) {
+			// here-strings are left for the parser
+			memcpy(out + len, c, 3);
+			len += 3;
+			c += 3;
+			continue;
+		} else if (depth == 0 && strncmp(c, "<<", 2) == 0) {
+			size_t op_len = c[2] == '-' ? 3 : 2;
+			memcpy(out + len, c, op_len);
+			len += op_len;
+			c += op_len;
+			while (*c == ' ' || *c == '\t')
+				out[len++] = *c++;
+
+			int word_len = lush_word_length(c);
+			if (word_len > 0) {
+				pending =
+					realloc(pending, (num_pending + 1) * sizeof(heredoc_t));
+				if (pending == NULL) {
+					perror("realloc failed");
+					exit(1);
+				}
+				pending[num_pending].delimiter = unquote_delimiter(c, word_len);
+				pending[num_pending++].strip_tabs = op_len == 3;
+				memcpy(out + len, c, word_len);
+				len += word_len;
+				c += word_len;
+			}
+			continue;
+		} else if (*c == '\n' && num_pending > 0) {
+			// bodies start on the line after their operators
+			out[len++] = *c++;
+			for (int i = 0; i < num_pending; i++) {
+				char *body = NULL;
+				if (!read_body(&c, &pending[i], &body))
+					missing++;
+				*bodies = append_word(*bodies, num_bodies, body);
+				free(pending[i].delimiter);
+			}
+			num_pending = 0;
+			continue;
+		}
+		out[len++] = *c++;
+	}
+
+	// operators on the last line never got a body
+	for (int i = 0; i < num_pending; i++) {
+		*bodies = append_word(*bodies, num_bodies, strdup(""));
+		free(pending[i].delimiter);
+		missing++;
+	}
+	free(pending);
+
+	out[len] = '\0';
+	*stripped = out;
+	return missing;
+}
+
+bool lush_heredoc_pending(const char *line) {
+	char *stripped = NULL;
+	char **bodies = NULL;
+	int num_bodies = 0;
+	int missing = collect_heredocs(line, &stripped, &bodies, &num_bodies);
+	free(stripped);
+	lush_free_commands(bodies);
+	return missing > 0;
+}
+
+// -- grammar --
+
+// stdin of a command from a file, heredoc or here-string
+static bool parse_input(parser_t *p, ast_node_t *node, int op) {
+	// only the first command of a pipeline reads from the shell's stdin
+	for (int i = 0; node->type == AST_CHAIN && i < node->num_words; i++) {
+		if (lush_is_operator(node->words[i][0]) == OP_PIPE &&
+			node->words[i][1] == NULL) {
+			syntax_error(p);
+			return false;
+		}
+	}
+
+	next_segment(p);
+	char *word = peek_word(p);
+	if (word == NULL) {
+		syntax_error(p);
+		return false;
+	}
+
+	free(node->input);
+	if (op == OP_HEREDOC || op == OP_HEREDOC_STRIP) {
+		if (p->next_heredoc >= p->num_heredocs) {
+			node->input = NULL;
+			syntax_error(p);
+			return false;
+		}
+		node->input = p->heredocs[p->next_heredoc];
+		p->heredocs[p->next_heredoc++] = NULL;
+		node->input_quoted = strpbrk(word, "'\"\\") != NULL;
+	} else {
+		node->input = strdup(word);
+		node->input_quoted = false;
+	}
+	node->input_op = op;
+	next_word(p);
+
+	// words after the target still belong to the command
+	if (peek_word(p) != NULL && node->type != AST_CHAIN) {
+		syntax_error(p);
+		return false;
+	} else if (peek_word(p) != NULL) {
+		char **extra = take_segment(p);
+		int count = 0;
+		while (node->words[0][count])
+			count++;
+		for (int i = 0; extra[i]; i++) {
+			node->words[0] = append_word(node->words[0], &count, extra[i]);
+		}
+		free(extra);
+	}
+	return true;
+}
+
+// a pipeline with its redirections, runs through lush_run
+static ast_node_t *parse_chain(parser_t *p) {
+	ast_node_t *node = new_node(AST_CHAIN);
+	node->words = append_words(NULL, &node->num_words, take_segment(p));
+
+	while (true) {
+		int op = peek_op(p);
+		// a compound command after a pipe is left for parse_pipeline
+		char *next = word_after_op(p);
+		if (op == OP_PIPE && next != NULL && is_opener(next))
+			break;
+
+		if (op == OP_PIPE ||
+			(op >= OP_REDIRECT_STDOUT && op <= OP_APPEND_BOTH)) {
+			node->words =
+				append_words(node->words, &node->num_words, copy_segment(p));
+			char *word = peek_word(p);
+			if (word == NULL || is_terminator(word)) {
+				lush_ast_free(node);
+				return syntax_error(p);
+			}
+			node->words =
+				append_words(node->words, &node->num_words, take_segment(p));
+		} else if (op >= OP_REDIRECT_STDIN && op <= OP_HERESTRING) {
+			if (!parse_input(p, node, op)) {
+				lush_ast_free(node);
+				return NULL;
+			}
+		} else if (op == OP_BACKGROUND) {
+			node->words =
+				append_words(node->words, &node->num_words, copy_segment(p));
+			break;
+		} else {
+			break;
+		}
+	}
+
+	return node;
+}
+
+// a list that has to contain at least one command
+static ast_node_t *parse_body(parser_t *p) {
+	ast_node_t *list = parse_list(p);
+	if (list != NULL && list->num_children == 0) {
+		lush_ast_free(list);
+		return syntax_error(p);
+	}
+	return list;
+}
+
+// the if or elif keyword has already been consumed
+static ast_node_t *parse_if_r(parser_t *p) {
+	ast_node_t *node = new_node(AST_IF);
+	if ((node->cond = parse_body(p)) == NULL || !expect(p, "then") ||
+		(node->body = parse_body(p)) == NULL) {
+		lush_ast_free(node);
+		return NULL;
+	}
+
+	if (at_keyword(p, "elif")) {
+		next_word(p);
+		// the nested if consumes the closing fi
+		if ((node->else_body = parse_if_r(p)) == NULL) {
+			lush_ast_free(node);
+			return NULL;
+		}
+		return node;
+	}
+
+	if (at_keyword(p, "else")) {
+		next_word(p);
+		if ((node->else_body = parse_body(p)) == NULL) {
+			lush_ast_free(node);
+			return NULL;
+		}
+	}
+
+	if (!expect(p, "fi")) {
+		lush_ast_free(node);
+		return NULL;
+	}
+	return node;
+}
+
+static ast_node_t *parse_loop(parser_t *p, ast_type_t type) {
+	ast_node_t *node = new_node(type);
+	if ((node->cond = parse_body(p)) == NULL || !expect(p, "do") ||
+		(node->body = parse_body(p)) == NULL || !expect(p, "done")) {
+		lush_ast_free(node);
+		return NULL;
+	}
+	return node;
+}
+
+static ast_node_t *parse_for(parser_t *p) {
+	char *name = peek_word(p);
+	if (name == NULL || !is_name(name, strlen(name)))
+		return syntax_error(p);
+
+	ast_node_t *node = new_node(AST_FOR);
+	node->name = strdup(name);
+	next_word(p);
+
+	// the item list is the rest of the segment after in
+	char **items = NULL;
+	if (at_keyword(p, "in")) {
+		next_word(p);
+		if (peek_word(p) != NULL)
+			items = take_segment(p);
+	}
+	if (items == NULL && (items = calloc(1, sizeof(char *))) == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+	node->words = append_words(NULL, &node->num_words, items);
+
+	skip_newlines(p);
+	if (!expect(p, "do") || (node->body = parse_body(p)) == NULL ||
+		!expect(p, "done")) {
+		lush_ast_free(node);
+		return NULL;
+	}
+	return node;
+}
+
+// reads the patterns of a clause up to and including the closing paren
+static char **parse_patterns(parser_t *p) {
+	char **patterns = NULL;
+	int count = 0;
+
+	if (at_keyword(p, "("))
+		next_word(p);
+
+	while (true) {
+		char *word = peek_word(p);
+		if (word == NULL)
+			break;
+
+		// the optional open paren can be attached to the first pattern
+		if (count == 0 && word[0] == '(' && word[1] != '\0')
+			word++;
+
+		size_t len = strlen(word);
+		if (len > 1 && word[len - 1] == ')') {
+			patterns = append_word(patterns, &count, strndup(word, len - 1));
+			next_word(p);
+			return patterns;
+		}
+
+		patterns = append_word(patterns, &count, strdup(word));
+		next_word(p);
+		if (at_keyword(p, ")")) {
+			next_word(p);
+			return patterns;
+		} else if (peek_op(p) == OP_PIPE) {
+			next_segment(p);
+		} else {
+			break;
+		}
+	}
+
+	lush_free_commands(patterns);
+	return syntax_error(p);
+}
+
+static ast_node_t *parse_case(parser_t *p) {
+	char *subject = peek_word(p);
+	if (subject == NULL)
+		return syntax_error(p);
+
+	ast_node_t *node = new_node(AST_CASE);
+	node->name = strdup(subject);
+	next_word(p);
+	skip_newlines(p);
+	if (!expect(p, "in")) {
+		lush_ast_free(node);
+		return NULL;
+	}
+
+	int num_patterns = 0;
+	while (true) {
+		skip_newlines(p);
+		if (at_keyword(p, "esac")) {
+			next_word(p);
+			return node;
+		}
+
+		char **patterns = parse_patterns(p);
+		if (patterns == NULL) {
+			lush_ast_free(node);
+			return NULL;
+		}
+		node->patterns = append_words(node->patterns, &num_patterns, patterns);
+
+		ast_node_t *body = parse_list(p);
+		if (body == NULL) {
+			lush_ast_free(node);
+			return NULL;
+		}
+		append_child(node, body, OP_SEMICOLON);
+
+		if (peek_op(p) == OP_CASE_END) {
+			next_segment(p);
+		} else if (!at_keyword(p, "esac")) {
+			lush_ast_free(node);
+			return syntax_error(p);
+		}
+	}
+}
+
+static ast_node_t *parse_group(parser_t *p) {
+	ast_node_t *node = new_node(AST_GROUP);
+	if ((node->body = parse_body(p)) == NULL || !expect(p, "}")) {
+		lush_ast_free(node);
+		return NULL;
+	}
+	return node;
+}
+
+// name() compound, name () compound or function name compound
+static ast_node_t *parse_function(parser_t *p) {
+	char *word = peek_word(p);
+	bool keyword = strcmp(word, "function") == 0;
+	if (keyword) {
+		next_word(p);
+		if ((word = peek_word(p)) == NULL)
+			return syntax_error(p);
+	}
+
+	size_t len = strlen(word);
+	bool parens = len > 2 && strcmp(word + len - 2, "()") == 0;
+	if (parens)
+		len -= 2;
+	if (!is_name(word, len))
+		return syntax_error(p);
+
+	ast_node_t *node = new_node(AST_FUNCTION);
+	node->name = strndup(word, len);
+	next_word(p);
+	if (!parens && at_keyword(p, "()")) {
+		next_word(p);
+	} else if (!parens && !keyword) {
+		lush_ast_free(node);
+		return syntax_error(p);
+	}
+
+	// the body has to be a compound command
+	skip_newlines(p);
+	word = peek_word(p);
+	if (word == NULL || !is_opener(word) || strcmp(word, "function") == 0 ||
+		(node->body = parse_command(p)) == NULL) {
+		lush_ast_free(node);
+		return p->error ? NULL : syntax_error(p);
+	}
+	return node;
+}
+
+static bool is_function_start(parser_t *p) {
+	char *word = peek_word(p);
+	size_t len = strlen(word);
+	if (strcmp(word, "function") == 0)
+		return true;
+	if (len > 2 && strcmp(word + len - 2, "()") == 0)
+		return true;
+
+	char *next = p->segments[p->seg][p->word + 1];
+	return next != NULL && strcmp(next, "()") == 0;
+}
+
+static ast_node_t *parse_command(parser_t *p) {
+	char *word = peek_word(p);
+
+	if (is_function_start(p))
+		return parse_function(p);
+
+	if (strcmp(word, "if") == 0) {
+		next_word(p);
+		return parse_if_r(p);
+	} else if (strcmp(word, "for") == 0) {
+		next_word(p);
+		return parse_for(p);
+	} else if (strcmp(word, "while") == 0) {
+		next_word(p);
+		return parse_loop(p, AST_WHILE);
+	} else if (strcmp(word, "until") == 0) {
+		next_word(p);
+		return parse_loop(p, AST_UNTIL);
+	} else if (strcmp(word, "case") == 0) {
+		next_word(p);
+		return parse_case(p);
+	} else if (strcmp(word, "{") == 0) {
+		next_word(p);
+		return parse_group(p);
+	}
+
+	return parse_chain(p);
+}
+
+static bool is_output_op(int op) {
+	return op >= OP_REDIRECT_STDOUT && op <= OP_APPEND_BOTH;
+}
+
+// true if a chain is a pipeline where a stage starts with NAME=value
+static bool has_stage_assignments(ast_node_t *chain) {
+	bool piped = false;
+	bool assigns = chain->words[0][0] != NULL &&
+				   lush_assignment_length(chain->words[0][0]) > 0;
+	for (int i = 1; i + 1 < chain->num_words; i++) {
+		if (lush_is_operator(chain->words[i][0]) != OP_PIPE)
+			continue;
+		piped = true;
+		char *first = chain->words[i + 1][0];
+		assigns = assigns || (first && lush_assignment_length(first) > 0);
+	}
+	return piped && assigns;
+}
+
+// moves each stage of a chain into a chain of its own so every stage can
+// get its own assignments, redirections stay with the stage before them
+static void split_chain(ast_node_t *pipeline, ast_node_t *chain) {
+	ast_node_t *stage = new_node(AST_CHAIN);
+	stage->input_op = chain->input_op;
+	stage->input = chain->input;
+	stage->input_quoted = chain->input_quoted;
+	stage->words = append_words(NULL, &stage->num_words, chain->words[0]);
+
+	for (int i = 1; i < chain->num_words; i++) {
+		char **words = chain->words[i];
+		int op = lush_is_operator(words[0]);
+		if (op == OP_PIPE) {
+			append_child(pipeline, stage, OP_PIPE);
+			stage = new_node(AST_CHAIN);
+			lush_free_commands(words);
+			words = chain->words[++i];
+		} else if (op == OP_BACKGROUND) {
+			pipeline->background = true;
+			lush_free_commands(words);
+			continue;
+		} else {
+			// the operator and its target
+			stage->words = append_words(stage->words, &stage->num_words, words);
+			words = chain->words[++i];
+		}
+		stage->words = append_words(stage->words, &stage->num_words, words);
+	}
+	append_child(pipeline, stage, OP_PIPE);
+
+	free(chain->words);
+	free(chain);
+}
+
+// compound commands piped or redirected, and pipelines whose stages have
+// their own assignments, are run by the shell one stage at a time
+static ast_node_t *parse_pipeline(parser_t *p, ast_node_t *node) {
+	int op = peek_op(p);
+	if (node->type == AST_CHAIN ? op != OP_PIPE && !has_stage_assignments(node)
+								: op != OP_PIPE && !is_output_op(op) &&
+									  op != OP_BACKGROUND)
+		return node;
+
+	ast_node_t *pipeline = new_node(AST_PIPELINE);
+	while (true) {
+		if (node->type == AST_CHAIN && has_stage_assignments(node)) {
+			split_chain(pipeline, node);
+		} else {
+			append_child(pipeline, node, OP_PIPE);
+			// the & a chain took belongs to the whole pipeline
+			char **last = node->type == AST_CHAIN && node->num_words > 1
+							  ? node->words[node->num_words - 1]
+							  : NULL;
+			if (last && lush_is_operator(last[0]) == OP_BACKGROUND) {
+				lush_free_commands(last);
+				node->words[--node->num_words] = NULL;
+				pipeline->background = true;
+			}
+		}
+
+		if (peek_op(p) != OP_PIPE)
+			break;
+		next_segment(p);
+		char *word = peek_word(p);
+		if (word == NULL || is_terminator(word)) {
+			lush_ast_free(pipeline);
+			return syntax_error(p);
+		}
+		if ((node = parse_command(p)) == NULL) {
+			lush_ast_free(pipeline);
+			return NULL;
+		}
+	}
+
+	// a chain keeps its own redirections, the ones after a compound
+	// command take the output of the whole pipeline
+	ast_node_t *last = pipeline->children[pipeline->num_children - 1];
+	op = peek_op(p);
+	while (last->type != AST_CHAIN && is_output_op(op)) {
+		pipeline->words =
+			append_words(pipeline->words, &pipeline->num_words,
+						 copy_segment(p));
+		char *word = peek_word(p);
+		if (word == NULL || is_terminator(word)) {
+			lush_ast_free(pipeline);
+			return syntax_error(p);
+		}
+		int count = 0;
+		char **target = append_word(NULL, &count, strdup(word));
+		pipeline->words =
+			append_words(pipeline->words, &pipeline->num_words, target);
+		next_word(p);
+		if (peek_word(p) != NULL) {
+			lush_ast_free(pipeline);
+			return syntax_error(p);
+		}
+		op = peek_op(p);
+	}
+
+	if (op == OP_BACKGROUND) {
+		pipeline->background = true;
+		next_segment(p);
+	}
+	return pipeline;
+}
+
+// parses commands until a terminator keyword, ;; or the end of input
+static ast_node_t *parse_list(parser_t *p) {
+	ast_node_t *list = new_node(AST_LIST);
+	int connector = OP_SEMICOLON;
+
+	while (true) {
+		skip_newlines(p);
+		if (at_end(p) || peek_op(p) == OP_CASE_END)
+			break;
+
+		char *word = peek_word(p);
+		if (word == NULL) {
+			lush_ast_free(list);
+			return syntax_error(p);
+		}
+		if (is_terminator(word))
+			break;
+
+		ast_node_t *node = parse_command(p);
+		if (node == NULL) {
+			lush_ast_free(list);
+			return NULL;
+		}
+		// compound commands can take their stdin from a redirection
+		int op = peek_op(p);
+		while (node->type != AST_CHAIN && op >= OP_REDIRECT_STDIN &&
+			   op <= OP_HERESTRING) {
+			if (!parse_input(p, node, op)) {
+				lush_ast_free(node);
+				lush_ast_free(list);
+				return NULL;
+			}
+			op = peek_op(p);
+		}
+
+		node = parse_pipeline(p, node);
+		if (node == NULL) {
+			lush_ast_free(list);
+			return NULL;
+		}
+		append_child(list, node, connector);
+
+		op = peek_op(p);
+		if (op == OP_AND || op == OP_OR) {
+			next_segment(p);
+			skip_newlines(p);
+			word = peek_word(p);
+			if (word == NULL || is_terminator(word)) {
+				lush_ast_free(list);
+				return syntax_error(p);
+			}
+			connector = op;
+		} else if (op == 0 || op == OP_SEMICOLON || op == OP_CASE_END) {
+			connector = OP_SEMICOLON;
+		} else {
+			lush_ast_free(list);
+			return syntax_error(p);
+		}
+	}
+
+	return list;
+}
+
+static void free_heredocs(char **heredocs, int num_heredocs) {
+	for (int i = 0; i < num_heredocs; i++) {
+		free(heredocs[i]);
+	}
+	free(heredocs);
+}
+
+ast_node_t *lush_ast_parse(const char *line, int *status) {
+	// heredoc bodies have to be taken out before aliases touch the spacing
+	char *stripped = NULL;
+	char **heredocs = NULL;
+	int num_heredocs = 0;
+	if (collect_heredocs(line, &stripped, &heredocs, &num_heredocs) > 0)
+		fprintf(stderr, "lush: warning: here-document delimited by end of "
+						"input\n");
+
+	char *expanded_line = lush_resolve_aliases(stripped);
+	free(stripped);
+	if (expanded_line == NULL) {
+		free_heredocs(heredocs, num_heredocs);
+		*status = -2;
+		return NULL;
+	}
+
+	char **commands = lush_split_commands(expanded_line);
+	char ***segments = lush_split_words(commands, status);
+	lush_free_commands(commands);
+	free(expanded_line);
+
+	if (*status < 0) {
+		fprintf(stderr, "lush: Expected end of quoted string\n");
+		lush_free_args(segments);
+		free_heredocs(heredocs, num_heredocs);
+		*status = -1;
+		return NULL;
+	}
+
+	parser_t p = {segments, 0, 0, false, heredocs, num_heredocs, 0};
+	settle(&p);
+	ast_node_t *tree = parse_list(&p);
+	if (tree != NULL && !at_end(&p)) {
+		// a terminator or ;; without its opening keyword
+		syntax_error(&p);
+	}
+	lush_free_args(segments);
+	free_heredocs(heredocs, num_heredocs);
+
+	*status = 0;
+	if (p.error) {
+		lush_ast_free(tree);
+		*status = -2;
+		return NULL;
+	}
+	if (tree->num_children == 0) {
+		lush_ast_free(tree);
+		return NULL;
+	}
+	return tree;
+}
@@ -0,0 +1,72 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef AST_H
+#define AST_H
+
+#include <stdbool.h>
+
+typedef enum {
+	AST_CHAIN,	  // simple commands joined by pipes and redirections
+	AST_LIST,	  // commands joined by ;, && and ||
+	AST_IF,		  // if/elif/else
+	AST_FOR,	  // for name in words
+	AST_WHILE,	  // while cond
+	AST_UNTIL,	  // until cond
+	AST_CASE,	  // case word in patterns
+	AST_GROUP,	  // { list; }
+	AST_FUNCTION, // name() compound
+	AST_PIPELINE, // stages the shell has to run itself, joined by pipes
+} ast_type_t;
+
+typedef struct ast_node {
+	ast_type_t type;
+	// raw words of a chain, one array per command or operator. a for loop
+	// keeps its items in words[0] and a pipeline its output redirections
+	char ***words;
+	int num_words;
+	// a pipeline that ended with &
+	bool background;
+	// stdin of a chain, a file name, here-string word or heredoc body
+	// depending on the operator. quoted heredocs are not expanded
+	int input_op;
+	char *input;
+	bool input_quoted;
+	// loop variable, function name or case subject
+	char *name;
+	// list items, case clause bodies or pipeline stages
+	struct ast_node **children;
+	// operator joining each list item to the one before it
+	int *connectors;
+	// raw patterns for each case clause
+	char ***patterns;
+	int num_children;
+	struct ast_node *cond;
+	struct ast_node *body;
+	struct ast_node *else_body;
+} ast_node_t;
+
+// parses a line into a syntax tree once so it can be executed many times,
+// aliases are resolved first. returns NULL with status 0 for an empty line,
+// -1 for an unterminated quote and -2 for a syntax error, errors are printed
+ast_node_t *lush_ast_parse(const char *line, int *status);
+void lush_ast_free(ast_node_t *node);
+
+// true if a heredoc in the line is still waiting for its delimiter line
+bool lush_heredoc_pending(const char *line);
+
+#endif // AST_H
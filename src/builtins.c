@@ -15,17 +15,25 @@ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
 IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
 */
 
+#include "eval.h"
+#include "expand.h"
 #include "help.h"
+#include "jobs.h"
+#include "launch.h"
+#include "loop.h"
 #include "lua.h"
 #include "lua_api.h"
 #include "lush.h"
+#include "parallel.h"
 #include <asm-generic/ioctls.h>
 #include <bits/time.h>
 #include <dirent.h>
 #include <linux/limits.h>
 #include <locale.h>
 #include <pwd.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,6 +50,10 @@ lua_State *trap_L;
 
 char *traps[MAX_SIGNALS];
 
+// one bit per signal that arrived since the traps last ran, however many
+// times it was sent
+static _Atomic uint64_t pending_traps = 0;
+
 const char *sig_strs[] = {
 	"SIGHUP",	   "SIGINT",	  "SIGQUIT",	 "SIGILL",		"SIGTRAP",
 	"SIGABRT",	   "SIGBUS",	  "SIGFPE",		 "SIGKILL",		"SIGUSR1",
@@ -58,38 +70,71 @@ const char *sig_strs[] = {
 	"SIGRTMAX-3",  "SIGRTMAX-2",  "SIGRTMAX-1",	 "SIGRTMAX"};
 
 static int trap_exec(const char *line) {
-	int status = 0;
 	lush_push_history(line);
-	char *expanded_line = lush_resolve_aliases((char *)line);
-	char **commands = lush_split_commands(expanded_line);
-	char ***args = lush_split_args(commands, &status);
-
-	if (status == -1) {
-		fprintf(stderr, "lush: Expected end of quoted string\n");
-	} else if (lush_run(trap_L, args, status) != 0) {
-		return -1;
-	}
+	return lush_eval_line(trap_L, line) == 0 ? 0 : -1;
+}
+
+// delivered by the event loop, the trap itself waits for lush_run_traps
+static void trap_signal(int signum, void *data) {
+	atomic_fetch_or(&pending_traps, (uint64_t)1 << (signum - 1));
+}
 
-	for (int i = 0; args[i]; i++) {
-		free(args[i]);
+void lush_run_traps() {
+	// signals that come in while a trap runs wait for the next safe point
+	static bool running = false;
+	if (running || atomic_load(&pending_traps) == 0)
+		return;
+
+	running = true;
+	uint64_t pending = atomic_exchange(&pending_traps, 0);
+	// a trap does not change the $? the interrupted commands see
+	int status = lush_get_last_status();
+	for (int i = 0; i < MAX_SIGNALS; i++) {
+		if ((pending & ((uint64_t)1 << i)) && traps[i])
+			trap_exec(traps[i]);
 	}
-	free(args);
-	free(commands);
-	return 0;
+	lush_set_last_status(status);
+	running = false;
 }
 
-void trap_handler(int signum) {
-	if (traps[signum - 1]) {
-		trap_exec(traps[signum - 1]);
+// prints the traps for the named signals, or all of them
+static void print_traps(char **names) {
+	for (int i = 0; i < MAX_SIGNALS; i++) {
+		if (traps[i] == NULL)
+			continue;
+		bool listed = names[0] == NULL;
+		for (int j = 0; names[j] && !listed; j++)
+			listed = strcmp(names[j], sig_strs[i]) == 0;
+		if (listed)
+			printf("trap -- '%s' %s\n", traps[i], sig_strs[i]);
 	}
 }
 
-char *builtin_strs[] = {"cd", "help", "exit", "time", "trap"};
-char *builtin_usage[] = {"[dirname]", "", "", "[pipeline]",
-						 "[-lp] [[command] signal]"};
+char *builtin_strs[] = {"cd",	 "help",	 "exit",   "time",	  "trap",
+						"break", "continue", "return", "hash",	  "jobs",
+						"fg",	 "bg",		 "wait",   "disown",  "parallel"};
+char *builtin_usage[] = {"[dirname]",
+						 "",
+						 "",
+						 "[pipeline]",
+						 "[-lp] [[command] signal]",
+						 "[n]",
+						 "[n]",
+						 "[n]",
+						 "[-r] [-d name] [-t name] [name ...]",
+						 "[-lp]",
+						 "[job]",
+						 "[job ...]",
+						 "[job | pid ...]",
+						 "[job ...]",
+						 "[-j jobs] [-k] [-u] [--halt never|soon|now] "
+						 "[command] [::: input ...]"};
 
 int (*builtin_func[])(lua_State *, char ***) = {
-	&lush_cd, &lush_help, &lush_exit, &lush_time, &lush_trap, &lush_lua};
+	&lush_cd,	 &lush_help,	 &lush_exit,   &lush_time,	 &lush_trap,
+	&lush_break, &lush_continue, &lush_return, &lush_hash,	 &lush_jobs,
+	&lush_fg,	 &lush_bg,		 &lush_wait,   &lush_disown, &lush_parallel,
+	&lush_lua};
 
 int lush_num_builtins() { return sizeof(builtin_strs) / sizeof(char *); }
 
@@ -110,7 +155,7 @@ int lush_cd(lua_State *L, char ***args) {
 		char *tilda = strchr(args[0][1], '~');
 		// first check if they want to go to old dir
 		if (strcmp("-", args[0][1]) == 0) {
-			strcpy(path, getenv("OLDPWD"));
+			strcpy(path, lush_env_get("OLDPWD"));
 		} else if (tilda) {
 			strcpy(path, pw->pw_dir);
 			strcat(path, tilda + 1);
@@ -125,7 +170,7 @@ int lush_cd(lua_State *L, char ***args) {
 		}
 
 		char *cwd = getcwd(NULL, 0);
-		setenv("OLDPWD", cwd, 1);
+		lush_env_set("OLDPWD", cwd);
 		free(cwd);
 
 		if (chdir(exp_path) != 0) {
@@ -148,15 +193,20 @@ int lush_help(lua_State *L, char ***args) {
 		printf("- %s %s\n", builtin_strs[i], builtin_usage[i]);
 	}
 
-	char *api_strs[] = {"exec(string command)",
+	char *api_strs[] = {"exec(string command, table opts)",
+						"execMany(table lines, table opts)",
 						"getcwd()",
 						"debug(boolean isOn)",
+						"pipefail(boolean isOn)",
 						"cd(string path)",
 						"exists(string path)",
 						"isFile(string path)",
 						"isDir(string path)",
 						"isReadable(string path)",
 						"isWriteable(string path)",
+						"stat(string path, table opts)",
+						"statMany(table paths, table opts)",
+						"readdir(string dir, table opts)",
 						"lastHistory()",
 						"getHistory(int index)",
 						"getenv(string envar)",
@@ -167,17 +217,32 @@ int lush_help(lua_State *L, char ***args) {
 						"termCols()",
 						"termRows()",
 						"glob(string extension)",
+						"setTimer(int ms, function fn, boolean repeat)",
+						"clearTimer(int id)",
+						"spawn(string|table command, table opts)",
+						"wait(process|table procs, number seconds)",
+						"poll(process proc)",
+						"kill(process proc, string|int signal)",
+						"capture(string|table command, table opts)",
+						"lines(string|table command)",
+						"run(table stages)",
+						"parallel(function fn, table inputs, table opts)",
 						"exit()"};
 	char *api_usage[] = {
 		"executes the command line chain given",
+		"runs each line, returns their statuses, history only if asked",
 		"gets current working directory",
 		"sets debug mode",
+		"makes a pipeline fail when any of its commands fails",
 		"changed current working directory to path given",
 		"checks if a file/directory exists at path",
 		"checks if given path is a file",
 		"checks if given path is a directory",
 		"checks if given path is readable",
 		"checks if given path is writeable",
+		"returns a table of metadata for a path from one statx",
+		"stats a list of paths, false where one could not be read",
+		"iterates over the names and types of a directory's entries",
 		"returns last history element",
 		"returns history at an index, 1 is most recent",
 		"returns value of an environment variable",
@@ -188,6 +253,16 @@ int lush_help(lua_State *L, char ***args) {
 		"returns present number of columns in terminal",
 		"returns present number of rows in terminal",
 		"returns an array of filenames that have a given extension",
+		"calls fn after ms, or every ms, while the shell waits",
+		"stops a timer by the id setTimer returned",
+		"starts a command without waiting and returns its process",
+		"waits for the first of procs to finish, returns it and its index",
+		"returns the status of a finished process, nil while it runs",
+		"sends a process SIGTERM or the signal given",
+		"runs a command, returns stdout, stderr, status and truncated",
+		"iterates over the lines a command prints as they arrive",
+		"runs argv tables as a pipeline without parsing or quoting",
+		"maps fn over inputs on worker lua states, one per cpu",
 		"ends the current process erroneously"};
 	printf("\nLunar Shell Lua API:\n\n");
 	for (int i = 0; i < sizeof(api_strs) / sizeof(char *); i++) {
@@ -196,7 +271,10 @@ int lush_help(lua_State *L, char ***args) {
 	return 0;
 }
 
-int lush_exit(lua_State *L, char ***args) { exit(0); }
+int lush_exit(lua_State *L, char ***args) {
+	lush_free_aliases();
+	exit(0);
+}
 
 int lush_time(lua_State *L, char ***args) {
 	// advance past time command
@@ -227,6 +305,13 @@ int lush_time(lua_State *L, char ***args) {
 
 int lush_trap(lua_State *L, char ***args) {
 	args[0]++;
+	// a bare trap lists what is set like -p
+	if (args[0][0] == NULL) {
+		print_traps(args[0]);
+		args[0]--;
+		return 0;
+	}
+
 	// check for -lp
 	if (args[0][0][0] == '-') {
 		if (strchr(args[0][0], 'l')) {
@@ -270,18 +355,17 @@ int lush_trap(lua_State *L, char ***args) {
 			return 0;
 		}
 		if (strchr(args[0][0], 'p')) {
-			for (int i = 0; i < MAX_SIGNALS; i++) {
-				if (traps[i] != NULL) {
-					printf("trap -- '%s' %s\n", traps[i], sig_strs[i]);
-				}
-			}
+			print_traps(args[0] + 1);
 			args[0]--;
 			return 0;
 		}
 		if (strlen(args[0][0]) == 1) {
 			// check for unbinding
-			for (int i = 0; i < MAX_SIGNALS; i++) {
+			for (int i = 0; args[0][1] && i < MAX_SIGNALS; i++) {
 				if (sig_strs[i] && strcmp(args[0][1], sig_strs[i]) == 0) {
+					lush_loop_release_signal(i + 1);
+					free(traps[i]);
+					traps[i] = NULL;
 					if (i == 1) {
 						// SIGINT is a special case for parent process
 						signal(i + 1, SIG_IGN);
@@ -299,9 +383,10 @@ int lush_trap(lua_State *L, char ***args) {
 	if (args[0][0] && args[0][1]) {
 		for (int i = 0; i < MAX_SIGNALS; i++) {
 			if (sig_strs[i] && strcmp(args[0][1], sig_strs[i]) == 0) {
+				free(traps[i]);
 				traps[i] = strdup(args[0][0]);
 				trap_L = L; // idk if I like this but doing it for now
-				signal(i + 1, trap_handler);
+				lush_loop_on_signal(i + 1, trap_signal, NULL);
 				break;
 			}
 		}
@@ -311,6 +396,294 @@ int lush_trap(lua_State *L, char ***args) {
 	return 0;
 }
 
+int lush_break(lua_State *L, char ***args) {
+	return lush_eval_break(args[0][1] ? atoi(args[0][1]) : 1);
+}
+
+int lush_continue(lua_State *L, char ***args) {
+	return lush_eval_continue(args[0][1] ? atoi(args[0][1]) : 1);
+}
+
+int lush_return(lua_State *L, char ***args) {
+	int status = args[0][1] ? atoi(args[0][1]) : lush_get_last_status();
+	return lush_eval_return(status & 0xff);
+}
+
+int lush_hash(lua_State *L, char ***args) {
+	char **argv = args[0];
+	if (argv[1] == NULL) {
+		if (lush_hash_print() == 0)
+			printf("hash: hash table empty\n");
+		return 0;
+	}
+
+	int status = 0;
+	for (int i = 1; argv[i] != NULL; i++) {
+		if (strcmp(argv[i], "-r") == 0) {
+			lush_hash_clear();
+			lua_clear_script_cache();
+			continue;
+		}
+
+		bool forget = strcmp(argv[i], "-d") == 0;
+		bool show = strcmp(argv[i], "-t") == 0;
+		if ((forget || show) && argv[++i] == NULL) {
+			fprintf(stderr, "lush: hash: %s: option requires an argument\n",
+					argv[i - 1]);
+			return 2;
+		}
+
+		if (forget) {
+			lush_hash_forget(argv[i]);
+			continue;
+		}
+
+		// resolving a name also seeds the table with it
+		const char *path = lush_hash_lookup(argv[i]);
+		if (path == NULL) {
+			fprintf(stderr, "lush: hash: %s: not found\n", argv[i]);
+			status = 1;
+		} else if (show) {
+			printf("%s\n", path);
+		}
+	}
+	return status;
+}
+
+int lush_jobs(lua_State *L, char ***args) {
+	char **argv = args[0];
+	bool with_pids = false, only_pids = false;
+	for (int i = 1; argv[i] != NULL; i++) {
+		if (strcmp(argv[i], "-l") == 0) {
+			with_pids = true;
+		} else if (strcmp(argv[i], "-p") == 0) {
+			only_pids = true;
+		} else {
+			fprintf(stderr, "lush: jobs: %s: invalid option\n", argv[i]);
+			return 2;
+		}
+	}
+
+	lush_jobs_update();
+	for (int i = 0; i < lush_job_count(); i++) {
+		job_t *job = lush_job_at(i);
+		if (only_pids)
+			printf("%d\n", job->pgid);
+		else
+			lush_job_print(job, with_pids);
+		job->changed = false;
+	}
+
+	// finished jobs are only reported once
+	for (int i = lush_job_count() - 1; i >= 0; i--) {
+		if (lush_job_at(i)->state == JOB_DONE)
+			lush_job_remove(lush_job_at(i));
+	}
+	return 0;
+}
+
+int lush_fg(lua_State *L, char ***args) {
+	char *spec = args[0][1];
+	job_t *job = lush_job_find(spec);
+	if (job == NULL) {
+		fprintf(stderr, "lush: fg: %s: no such job\n",
+				spec ? spec : "current");
+		return 1;
+	}
+
+	printf("%s\n", job->command);
+	fflush(stdout);
+	return lush_job_foreground(job, true);
+}
+
+int lush_bg(lua_State *L, char ***args) {
+	char **argv = args[0];
+	int status = 0;
+	for (int i = 1; i == 1 || argv[i] != NULL; i++) {
+		job_t *job = lush_job_find(argv[i]);
+		if (job == NULL) {
+			fprintf(stderr, "lush: bg: %s: no such job\n",
+					argv[i] ? argv[i] : "current");
+			status = 1;
+		} else if (job->state == JOB_STOPPED) {
+			lush_job_background(job, true);
+			printf("[%d] %s &\n", job->id, job->command);
+		}
+		if (argv[i] == NULL)
+			break;
+	}
+	return status;
+}
+
+// the job a wait argument names, either a job spec or a pid in one
+static job_t *find_wait_job(const char *arg) {
+	if (arg[0] == '%')
+		return lush_job_find(arg);
+
+	pid_t pid = atoi(arg);
+	for (int i = 0; i < lush_job_count(); i++) {
+		job_t *job = lush_job_at(i);
+		for (int j = 0; j < job->num_procs; j++) {
+			if (job->procs[j].pid == pid)
+				return job;
+		}
+	}
+	return NULL;
+}
+
+int lush_wait(lua_State *L, char ***args) {
+	char **argv = args[0];
+	if (argv[1] == NULL) {
+		// every running job, stopped ones would never finish
+		for (int i = 0; i < lush_job_count();) {
+			job_t *job = lush_job_at(i);
+			if (job->state == JOB_STOPPED) {
+				i++;
+				continue;
+			}
+			lush_job_wait(job);
+			if (i < lush_job_count() && lush_job_at(i) == job)
+				i++;
+		}
+		return 0;
+	}
+
+	int status = 0;
+	for (int i = 1; argv[i] != NULL; i++) {
+		job_t *job = find_wait_job(argv[i]);
+		if (job == NULL) {
+			fprintf(stderr, "lush: wait: %s: no such job\n", argv[i]);
+			status = 127;
+		} else {
+			status = lush_job_wait(job);
+		}
+	}
+	return status;
+}
+
+int lush_disown(lua_State *L, char ***args) {
+	char **argv = args[0];
+	int status = 0;
+	for (int i = 1; i == 1 || argv[i] != NULL; i++) {
+		job_t *job = lush_job_find(argv[i]);
+		if (job == NULL) {
+			fprintf(stderr, "lush: disown: %s: no such job\n",
+					argv[i] ? argv[i] : "current");
+			status = 1;
+		} else {
+			lush_job_remove(job);
+		}
+		if (argv[i] == NULL)
+			break;
+	}
+	return status;
+}
+
+// inputs are the lines of stdin when none follow :::
+static char **read_inputs(int *count) {
+	char **inputs = NULL;
+	int capacity = 0;
+	*count = 0;
+
+	char *line = NULL;
+	size_t line_capacity = 0;
+	ssize_t len;
+	while ((len = getline(&line, &line_capacity, stdin)) >= 0) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if (*count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			inputs = realloc(inputs, capacity * sizeof(char *));
+			if (inputs == NULL) {
+				perror("realloc failed");
+				exit(1);
+			}
+		}
+		inputs[(*count)++] = strdup(line);
+	}
+	free(line);
+	clearerr(stdin);
+	return inputs;
+}
+
+int lush_parallel(lua_State *L, char ***args) {
+	char **argv = args[0];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	parallel_opts_t opts = {.max_jobs = cpus > 0 ? cpus : 1};
+
+	int i = 1;
+	for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+		char *value = NULL;
+		if (strcmp(argv[i], "--") == 0) {
+			i++;
+			break;
+		} else if (strcmp(argv[i], "-k") == 0) {
+			opts.keep_order = true;
+		} else if (strcmp(argv[i], "-u") == 0) {
+			opts.ungroup = true;
+		} else if (strncmp(argv[i], "-j", 2) == 0) {
+			value = argv[i][2] ? &argv[i][2] : argv[++i];
+			opts.max_jobs = value ? atoi(value) : 0;
+			if (opts.max_jobs <= 0) {
+				fprintf(stderr, "lush: parallel: -j: needs a positive count\n");
+				return 2;
+			}
+		} else if (strcmp(argv[i], "--halt") == 0) {
+			value = argv[++i];
+			if (value && strcmp(value, "never") == 0) {
+				opts.halt = PARALLEL_HALT_NEVER;
+			} else if (value && strcmp(value, "soon") == 0) {
+				opts.halt = PARALLEL_HALT_SOON;
+			} else if (value && strcmp(value, "now") == 0) {
+				opts.halt = PARALLEL_HALT_NOW;
+			} else {
+				fprintf(stderr, "lush: parallel: --halt: expects never, soon "
+								"or now\n");
+				return 2;
+			}
+		} else {
+			fprintf(stderr, "lush: parallel: %s: invalid option\n", argv[i]);
+			return 2;
+		}
+	}
+
+	// the words up to ::: make the template, joined like GNU parallel does
+	size_t len = 1;
+	int first = i;
+	for (; argv[i] != NULL && strcmp(argv[i], ":::") != 0; i++)
+		len += strlen(argv[i]) + 1;
+	char *template = calloc(len, sizeof(char));
+	if (template == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+	for (int j = first; j < i; j++) {
+		if (j > first)
+			strcat(template, " ");
+		strcat(template, argv[j]);
+	}
+
+	int num_inputs = 0;
+	char **inputs = NULL;
+	if (argv[i] != NULL) {
+		inputs = &argv[i + 1];
+		while (inputs[num_inputs] != NULL)
+			num_inputs++;
+	} else {
+		inputs = read_inputs(&num_inputs);
+	}
+
+	int rc = lush_parallel_run(L, template, inputs, num_inputs, &opts);
+
+	if (argv[i] == NULL) {
+		for (int j = 0; j < num_inputs; j++)
+			free(inputs[j]);
+		free(inputs);
+	}
+	free(template);
+	return rc;
+}
+
 int lush_lua(lua_State *L, char ***args) {
 	// run the lua file given
 	const char *script = args[0][0];
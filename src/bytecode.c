@@ -0,0 +1,276 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#define _GNU_SOURCE
+#include "bytecode.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <lauxlib.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "LUSHLUAC"
+#define CACHE_FORMAT 1
+// bytecode can change between releases of the same version
+#ifdef LUA_VERSION_RELEASE_NUM
+#define CACHE_LUA_VERSION LUA_VERSION_RELEASE_NUM
+#else
+#define CACHE_LUA_VERSION LUA_VERSION_NUM
+#endif
+
+// written in front of every cached chunk, the source path follows it and
+// then the bytecode
+typedef struct {
+	char magic[8];
+	uint32_t format;
+	uint32_t lua_version;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t size;
+	uint64_t path_len;
+	uint64_t code_len;
+	// catches a chunk cut short or damaged on disk
+	uint64_t checksum;
+} cache_header_t;
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t capacity;
+} dump_buf_t;
+
+typedef struct {
+	const char *data;
+	size_t len;
+} chunk_reader_t;
+
+static uint64_t fnv1a(const void *data, size_t len, uint64_t hash) {
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+
+// the cache directory, created on first use. NULL if there is none
+static const char *cache_dir() {
+	static char dir[PATH_MAX];
+	static bool tried = false;
+	if (tried)
+		return dir[0] ? dir : NULL;
+	tried = true;
+
+	// the parent may not exist yet either
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int len = -1;
+	if (xdg != NULL && xdg[0] == '/')
+		len = snprintf(dir, sizeof(dir), "%s/lush", xdg);
+	else if (home != NULL)
+		len = snprintf(dir, sizeof(dir), "%s/.cache/lush", home);
+	if (len > 0 && (size_t)len < sizeof(dir)) {
+		char *slash = strrchr(dir, '/');
+		*slash = '\0';
+		mkdir(dir, 0700);
+		*slash = '/';
+	}
+
+	// the chunks are run as they are, so only a directory of our own that
+	// nobody else can write to is trusted
+	struct stat st;
+	if (len < 0 || (size_t)len >= sizeof(dir) ||
+		(mkdir(dir, 0700) != 0 && errno != EEXIST) || stat(dir, &st) != 0 ||
+		!S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+		(st.st_mode & (S_IWGRP | S_IWOTH))) {
+		dir[0] = '\0';
+		return NULL;
+	}
+	return dir;
+}
+
+// the cache file for the source at the absolute path
+static bool cache_path(const char *source, char *out, size_t size) {
+	const char *dir = cache_dir();
+	if (dir == NULL)
+		return false;
+	uint64_t hash = fnv1a(source, strlen(source), FNV_OFFSET);
+	int len = snprintf(out, size, "%s/%016llx.luac", dir,
+					   (unsigned long long)hash);
+	return len > 0 && (size_t)len < size;
+}
+
+// hands lua_load the whole mapped chunk at once
+static const char *read_chunk(lua_State *L, void *data, size_t *size) {
+	chunk_reader_t *reader = data;
+	if (reader->len == 0)
+		return NULL;
+	*size = reader->len;
+	reader->len = 0;
+	return reader->data;
+}
+
+// loads the cached chunk if it was compiled from this version of the
+// source, returns false without touching the stack otherwise
+static bool load_cached(lua_State *L, const char *cached, const char *source,
+						const struct stat *source_st, const char *chunkname) {
+	int fd = open(cached, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+		st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) ||
+		(size_t)st.st_size < sizeof(cache_header_t)) {
+		close(fd);
+		return false;
+	}
+	size_t file_len = st.st_size;
+	char *map = mmap(NULL, file_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	cache_header_t header;
+	memcpy(&header, map, sizeof(header));
+	size_t path_len = strlen(source);
+	const char *path = map + sizeof(header);
+	const char *code = path + path_len;
+	bool valid =
+		memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+		header.format == CACHE_FORMAT &&
+		header.lua_version == CACHE_LUA_VERSION &&
+		header.mtime_sec == source_st->st_mtim.tv_sec &&
+		header.mtime_nsec == source_st->st_mtim.tv_nsec &&
+		header.size == source_st->st_size && header.path_len == path_len &&
+		file_len - sizeof(header) >= path_len &&
+		header.code_len == file_len - sizeof(header) - path_len &&
+		memcmp(path, source, path_len) == 0 &&
+		fnv1a(code, header.code_len, FNV_OFFSET) == header.checksum;
+
+	bool loaded = false;
+	if (valid) {
+		chunk_reader_t reader = {code, header.code_len};
+		if (lua_load(L, read_chunk, &reader, chunkname, "b") == LUA_OK)
+			loaded = true;
+		else
+			lua_pop(L, 1);
+	}
+	munmap(map, file_len);
+	return loaded;
+}
+
+static int write_dump(lua_State *L, const void *data, size_t len, void *ud) {
+	dump_buf_t *buf = ud;
+	if (buf->len + len > buf->capacity) {
+		size_t capacity = buf->capacity ? buf->capacity : 4096;
+		while (capacity < buf->len + len)
+			capacity *= 2;
+		char *grown = realloc(buf->data, capacity);
+		if (grown == NULL)
+			return 1;
+		buf->data = grown;
+		buf->capacity = capacity;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+static bool write_all(int fd, const void *data, size_t len) {
+	const char *bytes = data;
+	while (len > 0) {
+		ssize_t written = write(fd, bytes, len);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		bytes += written;
+		len -= written;
+	}
+	return true;
+}
+
+// stores the function on top of the stack, a failure only costs the next
+// load a compile
+static void store_cached(lua_State *L, const char *cached, const char *source,
+						 const struct stat *source_st) {
+	dump_buf_t buf = {0};
+	if (lua_dump(L, write_dump, &buf, 0) != 0 || buf.len == 0) {
+		free(buf.data);
+		return;
+	}
+
+	cache_header_t header = {0};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.format = CACHE_FORMAT;
+	header.lua_version = CACHE_LUA_VERSION;
+	header.mtime_sec = source_st->st_mtim.tv_sec;
+	header.mtime_nsec = source_st->st_mtim.tv_nsec;
+	header.size = source_st->st_size;
+	header.path_len = strlen(source);
+	header.code_len = buf.len;
+	header.checksum = fnv1a(buf.data, buf.len, FNV_OFFSET);
+
+	// written aside and renamed over the old one, so a reader never sees
+	// half a chunk
+	char tmp[PATH_MAX];
+	int fd = -1;
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cached) < (int)sizeof(tmp))
+		fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd >= 0) {
+		bool ok = write_all(fd, &header, sizeof(header)) &&
+				  write_all(fd, source, header.path_len) &&
+				  write_all(fd, buf.data, buf.len);
+		close(fd);
+		if (!ok || rename(tmp, cached) != 0)
+			unlink(tmp);
+	}
+	free(buf.data);
+}
+
+int lush_load_file(lua_State *L, const char *path) {
+	char source[PATH_MAX];
+	char cached[PATH_MAX];
+	struct stat st;
+	if (realpath(path, source) == NULL || stat(source, &st) != 0 ||
+		!S_ISREG(st.st_mode) || !cache_path(source, cached, sizeof(cached)))
+		return luaL_loadfile(L, path);
+
+	// the same name luaL_loadfile gives, for error messages
+	lua_pushfstring(L, "@%s", path);
+	const char *chunkname = lua_tostring(L, -1);
+	if (load_cached(L, cached, source, &st, chunkname)) {
+		lua_remove(L, -2);
+		return LUA_OK;
+	}
+	lua_pop(L, 1);
+
+	int rc = luaL_loadfile(L, path);
+	if (rc == LUA_OK)
+		store_cached(L, cached, source, &st);
+	return rc;
+}
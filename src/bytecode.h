@@ -0,0 +1,30 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <lua.h>
+
+// loads a Lua source file like luaL_loadfile, reusing the chunk compiled
+// the last time when the file has not changed since. compiled chunks are
+// kept in $XDG_CACHE_HOME/lush, or ~/.cache/lush, keyed by the path, its
+// mtime and size and the Lua version. anything wrong with a cached chunk
+// falls back to compiling the source
+int lush_load_file(lua_State *L, const char *path);
+
+#endif // BYTECODE_H
@@ -0,0 +1,210 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#define _GNU_SOURCE
+#include "capture.h"
+#include "ast.h"
+#include "eval.h"
+#include "expand.h"
+#include "launch.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct {
+	int fd;
+	char *data;
+	size_t len;
+	size_t capacity;
+} capture_buf_t;
+
+static lua_State *capture_state = NULL;
+
+static void buf_reserve(capture_buf_t *buf, size_t extra) {
+	if (buf->len + extra + 1 <= buf->capacity)
+		return;
+	size_t capacity = buf->capacity ? buf->capacity : 4096;
+	while (capacity < buf->len + extra + 1)
+		capacity *= 2;
+	buf->data = realloc(buf->data, capacity);
+	if (buf->data == NULL) {
+		perror("realloc failed");
+		exit(1);
+	}
+	buf->capacity = capacity;
+}
+
+// reads what is available on the stream, closing it at end of file or
+// once it wrote more than max_bytes. returns true if it was cut short
+static bool read_stream(capture_buf_t *buf, size_t max_bytes) {
+	buf_reserve(buf, 4096);
+	// one byte past the limit tells a full stream from a longer one
+	size_t room = buf->capacity - buf->len - 1;
+	if (room > max_bytes + 1 - buf->len)
+		room = max_bytes + 1 - buf->len;
+
+	ssize_t len = read(buf->fd, buf->data + buf->len, room);
+	if (len < 0 && (errno == EINTR || errno == EAGAIN))
+		return false;
+	if (len > 0)
+		buf->len += len;
+	bool over = buf->len > max_bytes;
+	if (over)
+		buf->len = max_bytes;
+	if (len <= 0 || over) {
+		close(buf->fd);
+		buf->fd = -1;
+	}
+	return over;
+}
+
+static pid_t start(lua_State *L, const char *line, char **argv,
+				   const int fds[3], int *status) {
+	if (line == NULL) {
+		pid_t pid = lush_spawn_stdio(argv, fds, -1, false);
+		if (pid < 0) {
+			fprintf(stderr, "lush: %s: %s\n", argv[0], strerror(errno));
+			*status = errno == ENOENT ? 127 : 126;
+		}
+		return pid;
+	}
+
+	int parse_status = 0;
+	ast_node_t *tree = lush_ast_parse(line, &parse_status);
+	*status = parse_status < 0 ? 2 : 0;
+	pid_t pid = -1;
+	if (tree != NULL)
+		pid = lush_eval_start(L, tree, fds, status);
+	lush_ast_free(tree);
+	return pid;
+}
+
+void lush_capture(lua_State *L, const char *line, char **argv,
+				  size_t max_bytes, bool capture_err, capture_t *result) {
+	memset(result, 0, sizeof(capture_t));
+	result->status = 1;
+	capture_buf_t bufs[2] = {{.fd = -1}, {.fd = -1}};
+	int fds[3] = {STDIN_FILENO, -1, STDERR_FILENO};
+
+	bool opened = true;
+	for (int i = 0; i < (capture_err ? 2 : 1) && opened; i++) {
+		int pipes[2];
+		opened = pipe2(pipes, O_CLOEXEC) == 0;
+		if (opened) {
+			bufs[i].fd = pipes[0];
+			fds[i + 1] = pipes[1];
+		} else {
+			perror("lush: pipe");
+		}
+	}
+
+	pid_t pid = -1;
+	if (opened)
+		pid = start(L, line, argv, fds, &result->status);
+	// the command has its own copies of the write ends now
+	for (int i = 1; i < 3; i++) {
+		if (fds[i] > STDERR_FILENO)
+			close(fds[i]);
+	}
+
+	// both streams are read as they fill so a command writing a lot to
+	// one of them never blocks while the other is being read
+	struct pollfd polls[2];
+	while (pid > 0) {
+		int count = 0;
+		for (int i = 0; i < 2; i++) {
+			if (bufs[i].fd < 0)
+				continue;
+			polls[count].fd = bufs[i].fd;
+			polls[count].events = POLLIN;
+			count++;
+		}
+		if (count == 0)
+			break;
+		if (poll(polls, count, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("lush: poll");
+			break;
+		}
+		for (int i = 0, j = 0; i < 2; i++) {
+			if (bufs[i].fd < 0 || polls[j++].revents == 0)
+				continue;
+			// a forked shell holds read ends too, so closing ours does
+			// not stop it writing
+			if (read_stream(&bufs[i], max_bytes) && !result->truncated) {
+				result->truncated = true;
+				kill(pid, SIGPIPE);
+			}
+		}
+	}
+
+	if (pid > 0) {
+		int wstatus;
+		while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+			;
+		result->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus)
+											: 128 + WTERMSIG(wstatus);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (bufs[i].fd >= 0)
+			close(bufs[i].fd);
+		buf_reserve(&bufs[i], 0);
+		bufs[i].data[bufs[i].len] = '\0';
+	}
+	result->out = bufs[0].data;
+	result->out_len = bufs[0].len;
+	if (capture_err) {
+		result->err = bufs[1].data;
+		result->err_len = bufs[1].len;
+	} else {
+		free(bufs[1].data);
+	}
+}
+
+void lush_capture_free(capture_t *result) {
+	free(result->out);
+	free(result->err);
+	result->out = result->err = NULL;
+}
+
+static int substitute(const char *command, char **output) {
+	capture_t result;
+	lush_capture(capture_state, command, NULL, LUSH_CAPTURE_MAX, false,
+				 &result);
+	lush_set_last_status(result.status);
+	if (result.truncated) {
+		fprintf(stderr, "lush: $(%s): output is over %d bytes\n", command,
+				LUSH_CAPTURE_MAX);
+		lush_capture_free(&result);
+		return -1;
+	}
+	*output = result.out;
+	return 0;
+}
+
+void lush_capture_init(lua_State *L) {
+	capture_state = L;
+	lush_set_substitute(substitute);
+}
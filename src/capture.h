@@ -0,0 +1,52 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <lua.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// default limit on how much of each stream is kept
+#define LUSH_CAPTURE_MAX (64 * 1024 * 1024)
+
+typedef struct {
+	// NUL terminated, but the output may hold NULs of its own
+	char *out;
+	size_t out_len;
+	// NULL unless stderr was captured
+	char *err;
+	size_t err_len;
+	// exit status, or 128 plus the signal that killed the command
+	int status;
+	// a stream went past max_bytes and was closed early
+	bool truncated;
+} capture_t;
+
+// runs the command line, or argv when line is NULL, and reads its stdout
+// into result, and stderr too when capture_err is set. at most max_bytes
+// of each stream are kept, the command gets SIGPIPE if it writes more
+void lush_capture(lua_State *L, const char *line, char **argv,
+				  size_t max_bytes, bool capture_err, capture_t *result);
+
+void lush_capture_free(capture_t *result);
+
+// makes $(...) run commands through lush_capture with L
+void lush_capture_init(lua_State *L);
+
+#endif // CAPTURE_H
@@ -0,0 +1,946 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#define _GNU_SOURCE
+
+#include "eval.h"
+#include "ast.h"
+#include "expand.h"
+#include "hashmap.h"
+#include "jobs.h"
+#include "launch.h"
+#include "loop.h"
+#include "lush.h"
+#include "wildcard.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FUNCTION_MAX_DEPTH 1000
+#define LUA_STAGE_BUFFER (64 * 1024)
+// largest pipe buffer asked for so a body can be written in one go, bigger
+// ones go through a writer thread instead of pinning kernel memory
+#define PIPE_MAX_RESIZE (1024 * 1024)
+
+typedef enum {
+	FLOW_NONE,
+	FLOW_BREAK,
+	FLOW_CONTINUE,
+	FLOW_RETURN,
+	FLOW_INTERRUPT, // a command was killed by ^C
+} flow_t;
+
+// function bodies are detached from the tree that defined them
+static hashmap_t *functions = NULL;
+
+static flow_t flow = FLOW_NONE;
+static int flow_value = 0;
+static int loop_depth = 0;
+static int function_depth = 0;
+
+static int eval_r(lua_State *L, ast_node_t *node);
+
+// -- control flow --
+
+int lush_eval_break(int count) {
+	if (loop_depth == 0) {
+		fprintf(stderr, "lush: break: only meaningful in a loop\n");
+		return 1;
+	}
+	flow = FLOW_BREAK;
+	flow_value = count < 1 ? 1 : (count > loop_depth ? loop_depth : count);
+	return 0;
+}
+
+int lush_eval_continue(int count) {
+	if (loop_depth == 0) {
+		fprintf(stderr, "lush: continue: only meaningful in a loop\n");
+		return 1;
+	}
+	flow = FLOW_CONTINUE;
+	flow_value = count < 1 ? 1 : (count > loop_depth ? loop_depth : count);
+	return 0;
+}
+
+int lush_eval_return(int status) {
+	if (function_depth == 0) {
+		fprintf(stderr, "lush: return: can only return from a function\n");
+		return 1;
+	}
+	flow = FLOW_RETURN;
+	flow_value = status;
+	return status;
+}
+
+// consumes a break or continue aimed at the current loop, returns true when
+// the loop has to stop
+static bool loop_should_stop() {
+	if (flow == FLOW_BREAK || flow == FLOW_CONTINUE) {
+		// aimed at an outer loop
+		if (--flow_value > 0)
+			return true;
+		bool stop = flow == FLOW_BREAK;
+		flow = FLOW_NONE;
+		return stop;
+	}
+	return flow != FLOW_NONE;
+}
+
+// -- functions --
+
+bool lush_is_function(const char *name) {
+	return functions != NULL && hm_get(functions, (char *)name) != NULL;
+}
+
+int lush_call_function(lua_State *L, char **args) {
+	ast_node_t *body = (ast_node_t *)hm_get(functions, args[0]);
+	if (function_depth >= FUNCTION_MAX_DEPTH) {
+		fprintf(stderr, "lush: %s: maximum function nesting level exceeded\n",
+				args[0]);
+		return 1;
+	}
+
+	char **saved = lush_set_positional(args + 1);
+	// loops of the caller cannot be broken out of from inside the function
+	int saved_loop_depth = loop_depth;
+	loop_depth = 0;
+	function_depth++;
+
+	int status = eval_r(L, body);
+	if (flow == FLOW_RETURN) {
+		status = flow_value;
+		flow = FLOW_NONE;
+	}
+
+	function_depth--;
+	loop_depth = saved_loop_depth;
+	lush_set_positional(saved);
+	return status;
+}
+
+static int define_function(ast_node_t *node) {
+	if (functions == NULL)
+		functions = hm_new_hashmap();
+
+	ast_node_t *old = (ast_node_t *)hm_get(functions, node->name);
+	if (old != NULL) {
+		// the existing key is kept by the map
+		lush_ast_free(old);
+		hm_set(functions, node->name, (char *)node->body);
+	} else {
+		char *name = strdup(node->name);
+		if (name == NULL) {
+			perror("strdup failed");
+			return 1;
+		}
+		hm_set(functions, name, (char *)node->body);
+	}
+
+	node->body = NULL;
+	return 0;
+}
+
+// -- evaluation --
+
+// expands a single raw word, words that expand to nothing become empty
+static char *expand_single(const char *raw) {
+	char *word = NULL;
+	int rc = lush_expand_word(raw, &word);
+	if (rc == 0)
+		return strdup("");
+	return rc < 0 ? NULL : word;
+}
+
+typedef struct {
+	int fd;
+	char *data;
+	size_t len;
+} pipe_writer_t;
+
+static int write_all(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += written;
+		len -= written;
+	}
+	return 0;
+}
+
+static void *pipe_writer(void *arg) {
+	pipe_writer_t *writer = arg;
+
+	// a reader that exits early must not take the shell down with SIGPIPE
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	write_all(writer->fd, writer->data, writer->len);
+	close(writer->fd);
+	free(writer->data);
+	free(writer);
+	return NULL;
+}
+
+int lush_feed_pipe(char *data) {
+	size_t len = strlen(data);
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		perror("pipe");
+		free(data);
+		return -1;
+	}
+
+	// bodies that fit in the pipe buffer are written right away
+	int capacity = fcntl(fds[1], F_GETPIPE_SZ);
+	if (capacity >= 0 && len > (size_t)capacity && len <= PIPE_MAX_RESIZE)
+		capacity = fcntl(fds[1], F_SETPIPE_SZ, (int)len);
+	if (capacity >= 0 && len <= (size_t)capacity) {
+		write_all(fds[1], data, len);
+		close(fds[1]);
+		free(data);
+		return fds[0];
+	}
+
+	// anything larger is streamed so the shell never waits on the reader
+	pipe_writer_t *writer = malloc(sizeof(pipe_writer_t));
+	if (writer == NULL) {
+		perror("malloc failed");
+		free(data);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	writer->fd = fds[1];
+	writer->data = data;
+	writer->len = len;
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, pipe_writer, writer) != 0) {
+		perror("pthread_create");
+		free(writer);
+		free(data);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	pthread_detach(thread);
+	return fds[0];
+}
+
+// opens the stdin source of a chain, nothing is staged on disk
+static int open_input(ast_node_t *node) {
+	char *data = NULL;
+	if (node->input_op == OP_REDIRECT_STDIN) {
+		char *path = expand_single(node->input);
+		if (path == NULL)
+			return -1;
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			fprintf(stderr, "lush: %s: %s\n", path, strerror(errno));
+		free(path);
+		return fd;
+	} else if (node->input_op == OP_HERESTRING) {
+		char *word = expand_single(node->input);
+		if (word == NULL)
+			return -1;
+		size_t len = strlen(word);
+		data = realloc(word, len + 2);
+		if (data == NULL) {
+			perror("realloc failed");
+			free(word);
+			return -1;
+		}
+		// here-strings end with a newline like echo
+		data[len] = '\n';
+		data[len + 1] = '\0';
+	} else if (node->input_quoted) {
+		if ((data = strdup(node->input)) == NULL) {
+			perror("strdup failed");
+			return -1;
+		}
+	} else if (lush_expand_heredoc(node->input, &data) != 0) {
+		return -1;
+	}
+
+	return lush_feed_pipe(data);
+}
+
+// the expanded word is still a glob pattern, the value is taken literally
+static void assign(char *word) {
+	lush_wildcard_unescape(word);
+	char *eq = strchr(word, '=');
+	*eq = '\0';
+	lush_env_set(word, eq + 1);
+	*eq = '=';
+}
+
+static int run_chain(lua_State *L, char ***args, int num_commands) {
+	lush_expand_globs(args);
+	int rc = lush_run(L, args, num_commands);
+	if (rc < 0)
+		rc = 1;
+	if (rc == 128 + SIGINT)
+		flow = FLOW_INTERRUPT;
+	return rc;
+}
+
+static bool is_piped(ast_node_t *node) {
+	for (int i = 1; i < node->num_words; i++) {
+		if (lush_is_operator(node->words[i][0]) == OP_PIPE)
+			return true;
+	}
+	return false;
+}
+
+static int eval_chain(lua_State *L, ast_node_t *node) {
+	int status = 0;
+	char ***args = lush_expand_args(node->words, &status);
+	if (status < 0) {
+		lush_free_args(args);
+		return 1;
+	}
+
+	// leading NAME=value words of a command that is not piped, pipelines
+	// with assignments are split into stages by the parser. the expanded
+	// form of an assignment is never dropped so the indexes line up with
+	// the raw words
+	int num_assigns = 0;
+	if (!is_piped(node)) {
+		while (node->words[0][num_assigns] &&
+			   lush_assignment_length(node->words[0][num_assigns]) > 0)
+			num_assigns++;
+	}
+
+	if (num_assigns == 0) {
+		int rc = run_chain(L, args, status);
+		lush_free_args(args);
+		return rc;
+	}
+
+	char **command = args[0];
+	if (command[num_assigns] == NULL) {
+		// plain assignments persist in the shell
+		for (int i = 0; i < num_assigns; i++) {
+			assign(command[i]);
+		}
+		lush_free_args(args);
+		return 0;
+	}
+
+	// otherwise they only last for the one command
+	char **saved = calloc(num_assigns, sizeof(char *));
+	char **assigns = calloc(num_assigns, sizeof(char *));
+	if (saved == NULL || assigns == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+	for (int i = 0; i < num_assigns; i++) {
+		assigns[i] = command[i];
+		char *eq = strchr(assigns[i], '=');
+		*eq = '\0';
+		char *old = lush_env_get(assigns[i]);
+		saved[i] = old ? strdup(old) : NULL;
+		*eq = '=';
+		assign(assigns[i]);
+	}
+	int remaining = 0;
+	while (command[num_assigns + remaining])
+		remaining++;
+	memmove(command, command + num_assigns, (remaining + 1) * sizeof(char *));
+
+	int rc = run_chain(L, args, status);
+
+	for (int i = num_assigns - 1; i >= 0; i--) {
+		*strchr(assigns[i], '=') = '\0';
+		if (saved[i]) {
+			lush_env_set(assigns[i], saved[i]);
+			free(saved[i]);
+		} else {
+			lush_env_unset(assigns[i]);
+		}
+		free(assigns[i]);
+	}
+	free(saved);
+	free(assigns);
+	lush_free_args(args);
+	return rc;
+}
+
+static int eval_node(lua_State *L, ast_node_t *node);
+
+static int eval_with_input(lua_State *L, ast_node_t *node) {
+	int fd = open_input(node);
+	if (fd < 0)
+		return 1;
+
+	// swap the shell's stdin so builtins and lua scripts read it too
+	int saved_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+	if (saved_stdin < 0 || dup2(fd, STDIN_FILENO) < 0) {
+		perror("dup2 stdin");
+		if (saved_stdin >= 0)
+			close(saved_stdin);
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	int rc = eval_node(L, node);
+
+	if (dup2(saved_stdin, STDIN_FILENO) < 0)
+		perror("dup2 restore stdin");
+	close(saved_stdin);
+	clearerr(stdin);
+	return rc;
+}
+
+static int eval_list(lua_State *L, ast_node_t *node) {
+	int status = 0;
+	for (int i = 0; i < node->num_children; i++) {
+		int connector = node->connectors[i];
+		if ((connector == OP_AND && status != 0) ||
+			(connector == OP_OR && status == 0))
+			continue;
+
+		status = eval_r(L, node->children[i]);
+		lush_set_last_status(status);
+		if (flow != FLOW_NONE)
+			break;
+	}
+	return status;
+}
+
+static int eval_if(lua_State *L, ast_node_t *node) {
+	int cond = eval_r(L, node->cond);
+	if (flow != FLOW_NONE)
+		return cond;
+
+	if (cond == 0)
+		return eval_r(L, node->body);
+	if (node->else_body != NULL)
+		return eval_r(L, node->else_body);
+	return 0;
+}
+
+static int eval_loop(lua_State *L, ast_node_t *node) {
+	int status = 0;
+	loop_depth++;
+	while (true) {
+		int cond = eval_r(L, node->cond);
+		if (flow != FLOW_NONE || (cond == 0) != (node->type == AST_WHILE))
+			break;
+
+		status = eval_r(L, node->body);
+		if (loop_should_stop())
+			break;
+	}
+	loop_depth--;
+	return status;
+}
+
+static int eval_for(lua_State *L, ast_node_t *node) {
+	int num_items = 0;
+	char ***items = lush_expand_args(node->words, &num_items);
+	if (num_items < 0) {
+		lush_free_args(items);
+		return 1;
+	}
+	lush_expand_globs(items);
+
+	int status = 0;
+	loop_depth++;
+	for (int i = 0; items[0][i]; i++) {
+		lush_env_set(node->name, items[0][i]);
+		status = eval_r(L, node->body);
+		if (loop_should_stop())
+			break;
+	}
+	loop_depth--;
+
+	lush_free_args(items);
+	return status;
+}
+
+static int eval_case(lua_State *L, ast_node_t *node) {
+	char *subject = expand_single(node->name);
+	if (subject == NULL)
+		return 1;
+
+	int status = 0;
+	for (int i = 0; i < node->num_children; i++) {
+		bool matched = false;
+		for (int j = 0; node->patterns[i][j] && !matched; j++) {
+			char *pattern = expand_single(node->patterns[i][j]);
+			if (pattern == NULL) {
+				free(subject);
+				return 1;
+			}
+			matched = fnmatch(pattern, subject, 0) == 0;
+			free(pattern);
+		}
+
+		if (matched) {
+			status = eval_r(L, node->children[i]);
+			break;
+		}
+	}
+
+	free(subject);
+	return status;
+}
+
+static int eval_pipeline(lua_State *L, ast_node_t *node);
+
+static int eval_node(lua_State *L, ast_node_t *node) {
+	switch (node->type) {
+	case AST_CHAIN:
+		return eval_chain(L, node);
+	case AST_LIST:
+		return eval_list(L, node);
+	case AST_IF:
+		return eval_if(L, node);
+	case AST_FOR:
+		return eval_for(L, node);
+	case AST_WHILE:
+	case AST_UNTIL:
+		return eval_loop(L, node);
+	case AST_CASE:
+		return eval_case(L, node);
+	case AST_GROUP:
+		return eval_r(L, node->body);
+	case AST_FUNCTION:
+		return define_function(node);
+	case AST_PIPELINE:
+		return eval_pipeline(L, node);
+	}
+	return 0;
+}
+
+static int eval_r(lua_State *L, ast_node_t *node) {
+	int status = node->input_op != 0 ? eval_with_input(L, node)
+									 : eval_node(L, node);
+	// like sh, a trap waits for the command that was running to finish
+	lush_run_traps();
+	return status;
+}
+
+int lush_eval_tree(lua_State *L, ast_node_t *tree) {
+	int status = eval_r(L, tree);
+	lush_set_last_status(status);
+
+	// nothing left to break out of at the top level
+	if (loop_depth == 0 && function_depth == 0)
+		flow = FLOW_NONE;
+	return status;
+}
+
+int lush_eval_line(lua_State *L, const char *line) {
+	int status = 0;
+	ast_node_t *tree = lush_ast_parse(line, &status);
+	if (tree == NULL) {
+		if (status < 0) {
+			lush_set_last_status(2);
+			return 2;
+		}
+		return 0;
+	}
+
+	status = lush_eval_tree(L, tree);
+	lush_ast_free(tree);
+	return status;
+}
+
+// -- starting without waiting --
+
+static bool is_builtin(const char *name) {
+	for (int i = 0; i < lush_num_builtins(); i++) {
+		if (strcmp(name, builtin_strs[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+// the expanded words of a tree that is one external command and can be
+// spawned as it is, NULL when the shell has to evaluate it
+static char ***expand_external(ast_node_t *tree) {
+	// a line parses to a list even when it holds one command
+	if (tree->type == AST_LIST && tree->num_children == 1)
+		tree = tree->children[0];
+	if (tree->type != AST_CHAIN || tree->num_words != 1 ||
+		tree->input_op != 0 || tree->words[0][0] == NULL ||
+		lush_assignment_length(tree->words[0][0]) > 0)
+		return NULL;
+
+	int status = 0;
+	char ***args = lush_expand_args(tree->words, &status);
+	if (status < 0 || args[0][0] == NULL) {
+		lush_free_args(args);
+		return NULL;
+	}
+	lush_expand_globs(args);
+
+	char *name = args[0][0];
+	char *ext = strrchr(name, '.');
+	if (lush_is_function(name) || is_builtin(name) || lush_is_lua_stage(name) ||
+		(ext && strcmp(ext, ".lua") == 0)) {
+		lush_free_args(args);
+		return NULL;
+	}
+	return args;
+}
+
+// closes what exec would have, so a forked child does not hold pipe ends
+// that its readers and writers wait on
+static void close_exec_fds() {
+	DIR *dir = opendir("/proc/self/fd");
+	if (dir == NULL)
+		return;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		int fd = atoi(entry->d_name);
+		if (fd > STDERR_FILENO && fd != dirfd(dir) &&
+			(fcntl(fd, F_GETFD) & FD_CLOEXEC))
+			close(fd);
+	}
+	closedir(dir);
+}
+
+// sets up a fresh fork to run shell code with fds as its stdio, without
+// touching the parent's jobs, epoll set or terminal
+static void enter_child(const int fds[3]) {
+	for (int i = 0; i < 3; i++) {
+		if (fds[i] != i)
+			dup2(fds[i], i);
+	}
+	close_exec_fds();
+	lush_jobs_after_fork();
+	lush_loop_after_fork();
+
+	// like a spawned command, and a trap must not keep ^C blocked
+	int defaults[] = {SIGINT, SIGQUIT, SIGPIPE, SIGTSTP, SIGTTIN, SIGTTOU};
+	sigset_t set;
+	sigemptyset(&set);
+	for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+		signal(defaults[i], SIG_DFL);
+		sigaddset(&set, defaults[i]);
+	}
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
+// forks a pipeline stage into process group pgid, the child comes back
+// with fds as its stdio
+static pid_t fork_stage(const int fds[3], pid_t pgid, int *status) {
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("lush: fork");
+		*status = 1;
+	}
+	if (pid != 0) {
+		// both sides join the group so neither can run ahead of it
+		if (pid > 0 && pgid >= 0)
+			setpgid(pid, pgid ? pgid : pid);
+		return pid;
+	}
+
+	if (pgid >= 0)
+		setpgid(0, pgid);
+	enter_child(fds);
+	return 0;
+}
+
+// starts a tree into process group pgid as lush_spawn takes it
+static pid_t start_tree(lua_State *L, ast_node_t *tree, const int fds[3],
+						pid_t pgid, bool foreground, int *status) {
+	char ***args = expand_external(tree);
+	if (args != NULL) {
+		pid_t pid = lush_spawn_stdio(args[0], fds, pgid, foreground);
+		if (pid < 0) {
+			fprintf(stderr, "lush: %s: %s\n", args[0][0], strerror(errno));
+			*status = errno == ENOENT ? 127 : 126;
+		}
+		lush_free_args(args);
+		return pid;
+	}
+
+	pid_t pid = fork_stage(fds, pgid, status);
+	if (pid != 0)
+		return pid;
+
+	int rc = lush_eval_tree(L, tree);
+	fflush(stdout);
+	fflush(stderr);
+	_exit(rc & 0xff);
+}
+
+pid_t lush_eval_start(lua_State *L, ast_node_t *tree, const int fds[3],
+					  int *status) {
+	return start_tree(L, tree, fds, -1, false, status);
+}
+
+// -- pipelines --
+
+// the words a stage is listed as by the jobs builtin
+static char **stage_words(ast_node_t *node) {
+	static char *names[][2] = {
+		[AST_IF] = {"if"},		 [AST_FOR] = {"for"},
+		[AST_WHILE] = {"while"}, [AST_UNTIL] = {"until"},
+		[AST_CASE] = {"case"},	 [AST_GROUP] = {"{"},
+		[AST_FUNCTION] = {"function"},
+	};
+	if (node->type == AST_CHAIN)
+		return node->words[0];
+	return names[node->type];
+}
+
+// starts every stage as a job like spawn_pipeline does for a chain, with
+// the shell's stdio at both ends
+static int run_stages(lua_State *L, ast_node_t *node) {
+	int count = node->num_children;
+	char ***words = calloc(count + 1, sizeof(char **));
+	if (words == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+	for (int i = 0; i < count; i++)
+		words[i] = stage_words(node->children[i]);
+	job_t *job = lush_job_new(words, count);
+	free(words);
+
+	bool foreground = !node->background && lush_terminal_owned();
+	int input_fd = STDIN_FILENO;
+	for (int i = 0; i < count; i++) {
+		int pipe_fds[2] = {-1, STDOUT_FILENO};
+		if (i < count - 1 && pipe2(pipe_fds, O_CLOEXEC) == -1) {
+			perror("pipe");
+			lush_job_add_proc(job, -1, 1);
+			break;
+		}
+
+		int status = 0;
+		int fds[3] = {input_fd, pipe_fds[1], STDERR_FILENO};
+		pid_t pid = start_tree(L, node->children[i], fds,
+							   lush_job_spawn_group(job), foreground, &status);
+		lush_job_add_proc(job, pid, status);
+
+		if (input_fd != STDIN_FILENO)
+			close(input_fd);
+		if (pipe_fds[1] != STDOUT_FILENO)
+			close(pipe_fds[1]);
+		input_fd = pipe_fds[0];
+	}
+
+	if (!node->background)
+		return lush_job_foreground(job, false);
+
+	lush_job_background(job, false);
+	lush_set_last_background(job->procs[job->num_procs - 1].pid);
+	if (lush_terminal_owned())
+		printf("[%d] %d\n", job->id, job->pgid);
+	fflush(stdout);
+	return 0;
+}
+
+// points target at the file of a redirection, keeping the old fd in saved
+static int redirect_output(int op, const char *raw, int *saved) {
+	char *path = expand_single(raw);
+	if (path == NULL)
+		return -1;
+	int mode = op <= OP_REDIRECT_BOTH ? O_TRUNC : O_APPEND;
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | mode, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "lush: %s: %s\n", path, strerror(errno));
+		free(path);
+		return -1;
+	}
+	free(path);
+
+	// &> and &>> take both stdout and stderr
+	bool out = op != OP_REDIRECT_STDERR && op != OP_APPEND_STDERR;
+	bool err = op != OP_REDIRECT_STDOUT && op != OP_APPEND_STDOUT;
+	for (int target = STDOUT_FILENO; target <= STDERR_FILENO; target++) {
+		if (target == STDOUT_FILENO ? !out : !err)
+			continue;
+		if (saved[target] < 0)
+			saved[target] = fcntl(target, F_DUPFD_CLOEXEC, 10);
+		if (saved[target] < 0 || dup2(fd, target) < 0) {
+			perror("dup2");
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+	return 0;
+}
+
+static int eval_pipeline(lua_State *L, ast_node_t *node) {
+	// anything still buffered belongs to the old stdout
+	fflush(stdout);
+	fflush(stderr);
+
+	// redirections swap the shell's own fds, so a redirected compound
+	// command still runs in the shell and keeps its assignments
+	int saved[3] = {-1, -1, -1};
+	int rc = 0;
+	for (int i = 0; i + 1 < node->num_words && rc == 0; i += 2) {
+		if (redirect_output(lush_is_operator(node->words[i][0]),
+							node->words[i + 1][0], saved) != 0)
+			rc = 1;
+	}
+
+	if (rc == 0 && node->num_children == 1 && !node->background)
+		rc = eval_r(L, node->children[0]);
+	else if (rc == 0)
+		rc = run_stages(L, node);
+	if (rc == 128 + SIGINT)
+		flow = FLOW_INTERRUPT;
+
+	fflush(stdout);
+	fflush(stderr);
+	for (int target = STDOUT_FILENO; target <= STDERR_FILENO; target++) {
+		if (saved[target] < 0)
+			continue;
+		if (dup2(saved[target], target) < 0)
+			perror("dup2 restore");
+		close(saved[target]);
+	}
+	return rc;
+}
+
+// -- lua stages --
+
+bool lush_is_lua_stage(const char *word) {
+	return strncmp(word, LUA_STAGE_PREFIX, strlen(LUA_STAGE_PREFIX)) == 0 &&
+		   word[strlen(LUA_STAGE_PREFIX)] != '\0';
+}
+
+// pushes the function a dotted name like mod.filter points at
+static bool push_stage_function(lua_State *L, const char *name) {
+	lua_pushglobaltable(L);
+	const char *part = name;
+	while (true) {
+		const char *dot = strchr(part, '.');
+		size_t len = dot ? (size_t)(dot - part) : strlen(part);
+		if (!lua_istable(L, -1)) {
+			lua_pop(L, 1);
+			return false;
+		}
+		lua_pushlstring(L, part, len);
+		lua_gettable(L, -2);
+		lua_remove(L, -2);
+		if (dot == NULL)
+			break;
+		part = dot + 1;
+	}
+	if (lua_isfunction(L, -1))
+		return true;
+	lua_pop(L, 1);
+	return false;
+}
+
+// calls fn for every line of stdin and once more with nil at its end,
+// with the stage's words after the line. returned strings become lines
+static int run_stage(lua_State *L, int fn, const char *name, char **args) {
+	static char buffer[LUA_STAGE_BUFFER];
+	setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+
+	char *line = NULL;
+	size_t capacity = 0;
+	int rc = 0;
+	while (true) {
+		ssize_t len = getline(&line, &capacity, stdin);
+		lua_pushvalue(L, fn);
+		if (len < 0) {
+			lua_pushnil(L);
+		} else {
+			if (len > 0 && line[len - 1] == '\n')
+				len--;
+			lua_pushlstring(L, line, len);
+		}
+		int nargs = 1;
+		for (int i = 1; args[i]; i++, nargs++)
+			lua_pushstring(L, args[i]);
+
+		if (lua_pcall(L, nargs, 1, 0) != LUA_OK) {
+			fprintf(stderr, "lush: %s: %s\n", name, lua_tostring(L, -1));
+			rc = 1;
+			break;
+		}
+		size_t out_len;
+		const char *out = lua_type(L, -1) == LUA_TSTRING ||
+								  lua_type(L, -1) == LUA_TNUMBER
+							  ? lua_tolstring(L, -1, &out_len)
+							  : NULL;
+		if (out != NULL) {
+			fwrite(out, 1, out_len, stdout);
+			putchar('\n');
+		}
+		lua_pop(L, 1);
+		if (len < 0)
+			break;
+	}
+	free(line);
+	if (fflush(stdout) != 0 && rc == 0)
+		rc = 1;
+	return rc;
+}
+
+pid_t lush_lua_stage_start(lua_State *L, char **args, const int fds[3],
+						   pid_t pgid, int *status) {
+	const char *name = args[0] + strlen(LUA_STAGE_PREFIX);
+	if (!push_stage_function(L, name)) {
+		fprintf(stderr, "lush: %s: not a Lua function\n", args[0]);
+		*status = 127;
+		return -1;
+	}
+
+	pid_t pid = fork_stage(fds, pgid, status);
+	if (pid != 0) {
+		lua_pop(L, 1);
+		return pid;
+	}
+
+	int rc = run_stage(L, lua_gettop(L), args[0], args);
+	fflush(stderr);
+	_exit(rc);
+}
+
+pid_t lush_function_stage_start(lua_State *L, char **args, const int fds[3],
+								pid_t pgid, int *status) {
+	pid_t pid = fork_stage(fds, pgid, status);
+	if (pid != 0)
+		return pid;
+
+	int rc = lush_call_function(L, args);
+	fflush(stdout);
+	fflush(stderr);
+	_exit(rc & 0xff);
+}
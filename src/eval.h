@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef EVAL_H
+#define EVAL_H
+
+#include "ast.h"
+#include "lua.h"
+#include <stdbool.h>
+#include <sys/types.h>
+
+// resolves aliases, parses and executes a line, returns its exit status
+int lush_eval_line(lua_State *L, const char *line);
+
+// executes a tree from lush_ast_parse, which is left for the caller to
+// run again or free
+int lush_eval_tree(lua_State *L, ast_node_t *tree);
+
+// returns the read end of a pipe that yields data, takes ownership of data
+int lush_feed_pipe(char *data);
+
+// starts a tree without waiting for it, fds become the child's stdin,
+// stdout and stderr. a tree that is one external command is spawned as it
+// is, anything else is evaluated by a forked copy of the shell. returns the
+// pid, or -1 with status set after printing why
+pid_t lush_eval_start(lua_State *L, ast_node_t *tree, const int fds[3],
+					  int *status);
+
+// a pipeline stage written lua:name calls the Lua function name, which may
+// be a dotted path into tables, for each line of its input
+#define LUA_STAGE_PREFIX "lua:"
+
+bool lush_is_lua_stage(const char *word);
+
+// forks a Lua stage into process group pgid as lush_spawn takes it. the
+// function gets each line without its newline and the stage's other words,
+// then nil once the input ends, and strings it returns are written as
+// lines. returns the pid, or -1 with status set after printing why
+pid_t lush_lua_stage_start(lua_State *L, char **args, const int fds[3],
+						   pid_t pgid, int *status);
+
+// shell functions defined with name() { ... }
+bool lush_is_function(const char *name);
+int lush_call_function(lua_State *L, char **args);
+
+// forks a pipeline stage that calls a shell function, joining pgid like
+// lush_lua_stage_start. returns the pid, or -1 with status set
+pid_t lush_function_stage_start(lua_State *L, char **args, const int fds[3],
+								pid_t pgid, int *status);
+
+// used by the break, continue and return builtins
+int lush_eval_break(int count);
+int lush_eval_continue(int count);
+int lush_eval_return(int status);
+
+#endif // EVAL_H
@@ -0,0 +1,1029 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "expand.h"
+#include "arith.h"
+#include "hashmap.h"
+#include <ctype.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern char **environ;
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t cap;
+} str_buf_t;
+
+// -- growable string buffer --
+
+static int sb_reserve(str_buf_t *sb, size_t extra) {
+	if (sb->len + extra + 1 <= sb->cap)
+		return 0;
+
+	size_t new_cap = sb->cap ? sb->cap : 32;
+	while (new_cap < sb->len + extra + 1)
+		new_cap *= 2;
+
+	char *new_data = realloc(sb->data, new_cap);
+	if (new_data == NULL) {
+		perror("realloc failed");
+		return -1;
+	}
+	sb->data = new_data;
+	sb->cap = new_cap;
+	return 0;
+}
+
+static int sb_append(str_buf_t *sb, const char *str, size_t len) {
+	if (sb_reserve(sb, len) != 0)
+		return -1;
+	memcpy(sb->data + sb->len, str, len);
+	sb->len += len;
+	sb->data[sb->len] = '\0';
+	return 0;
+}
+
+static int sb_push(str_buf_t *sb, char c) { return sb_append(sb, &c, 1); }
+
+static char *sb_finish(str_buf_t *sb) {
+	// always hand back a valid string, even when nothing was appended
+	if (sb->data == NULL && sb_reserve(sb, 0) != 0)
+		return NULL;
+	sb->data[sb->len] = '\0';
+	return sb->data;
+}
+
+// -- environment snapshot --
+
+// the snapshot copies environ into one block and hashes the names so that
+// lookups during expansion do not walk environ like getenv does. later
+// changes are applied to the map one entry at a time
+static hashmap_t *env_map = NULL;
+static char *env_block = NULL;
+static size_t env_block_size = 0;
+
+// names and values set after the snapshot are allocated on their own
+static bool env_owned(const char *str) {
+	return str != NULL &&
+		   (str < env_block || str >= env_block + env_block_size);
+}
+
+static void env_invalidate() {
+	if (env_map != NULL) {
+		for (unsigned int i = 0; i < env_map->cap; i++) {
+			for (map_pair_t *pair = env_map->list[i]; pair;
+				 pair = pair->next) {
+				if (env_owned(pair->key))
+					free(pair->key);
+				if (env_owned(pair->val))
+					free(pair->val);
+			}
+		}
+	}
+	hm_free_hashmap(env_map);
+	free(env_block);
+	env_map = NULL;
+	env_block = NULL;
+	env_block_size = 0;
+}
+
+static void env_snapshot() {
+	size_t total = 0;
+	for (char **env = environ; env && *env; env++) {
+		total += strlen(*env) + 1;
+	}
+
+	env_block = malloc(total + 1);
+	env_map = hm_new_hashmap();
+	if (env_block == NULL || env_map == NULL) {
+		perror("malloc failed");
+		env_invalidate();
+		return;
+	}
+	env_block_size = total + 1;
+
+	char *dest = env_block;
+	for (char **env = environ; env && *env; env++) {
+		size_t len = strlen(*env);
+		memcpy(dest, *env, len + 1);
+
+		char *equals = strchr(dest, '=');
+		if (equals != NULL) {
+			*equals = '\0';
+			hm_set(env_map, dest, equals + 1);
+		}
+		dest += len + 1;
+	}
+}
+
+// brings the snapshot in line with one changed variable, a NULL value
+// unsets it. the map can not delete so an unset name keeps its entry
+static void env_update(const char *name, const char *value) {
+	if (env_map == NULL)
+		return;
+
+	char *copy = NULL;
+	if (value != NULL && (copy = strdup(value)) == NULL) {
+		perror("strdup failed");
+		exit(1);
+	}
+
+	unsigned int index = hm_hashcode(env_map, (char *)name);
+	for (map_pair_t *pair = env_map->list[index]; pair; pair = pair->next) {
+		if (strcmp(pair->key, name) == 0) {
+			if (env_owned(pair->val))
+				free(pair->val);
+			pair->val = copy;
+			return;
+		}
+	}
+	if (copy == NULL)
+		return;
+
+	char *key = strdup(name);
+	if (key == NULL) {
+		perror("strdup failed");
+		exit(1);
+	}
+	hm_set(env_map, key, copy);
+}
+
+char *lush_env_get(const char *name) {
+	if (env_map == NULL) {
+		env_snapshot();
+		if (env_map == NULL)
+			return getenv(name);
+	}
+	return hm_get(env_map, (char *)name);
+}
+
+int lush_env_set(const char *name, const char *value) {
+	if (setenv(name, value, 1) != 0)
+		return -1;
+	env_update(name, value);
+	return 0;
+}
+
+int lush_env_unset(const char *name) {
+	if (unsetenv(name) != 0)
+		return -1;
+	env_update(name, NULL);
+	return 0;
+}
+
+// -- word scanning --
+
+int lush_word_length(const char *word) {
+	size_t i = 0;
+	int depth = 0;
+	char quote = '\0';
+
+	while (word[i]) {
+		char c = word[i];
+		if (quote == '\'') {
+			if (c == '\'')
+				quote = '\0';
+		} else if (c == '\\') {
+			if (word[i + 1])
+				i++;
+		} else if (c == '$' && (word[i + 1] == '{' || word[i + 1] == '(')) {
+			depth++;
+			i++;
+		} else if (depth > 0 && (c == '{' || c == '(')) {
+			depth++;
+		} else if (depth > 0 && (c == '}' || c == ')')) {
+			depth--;
+		} else if (c == '"') {
+			quote = quote == '"' ? '\0' : '"';
+		} else if (c == '\'' && quote == '\0') {
+			quote = '\'';
+		} else if (quote == '\0' && depth == 0 && isspace((unsigned char)c)) {
+			break;
+		}
+		i++;
+	}
+
+	if (quote != '\0' || depth > 0)
+		return -1;
+	return (int)i;
+}
+
+// -- parameter expansion --
+
+static bool is_name_start(char c) {
+	return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_name_char(char c) {
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+// special parameters that are a single character
+static bool is_special_param(char c) { return c && strchr("$?#@*!", c); }
+
+// braced names like ${10} can have more than one positional digit
+static size_t name_length(const char *str, size_t len, bool braced) {
+	if (len == 0)
+		return 0;
+	if (is_special_param(str[0]))
+		return 1;
+	if (isdigit((unsigned char)str[0])) {
+		size_t i = 1;
+		while (braced && i < len && isdigit((unsigned char)str[i]))
+			i++;
+		return i;
+	}
+	if (!is_name_start(str[0]))
+		return 0;
+
+	size_t i = 1;
+	while (i < len && is_name_char(str[i]))
+		i++;
+	return i;
+}
+
+// -- shell parameters --
+
+static char **positional = NULL;
+static int last_status = 0;
+
+char **lush_set_positional(char **args) {
+	char **old = positional;
+	positional = args;
+	return old;
+}
+
+void lush_set_last_status(int status) { last_status = status; }
+
+static pid_t last_background = 0;
+
+void lush_set_last_background(pid_t pid) { last_background = pid; }
+
+// kept formatted since it is read far less often than it is set
+static str_buf_t pipe_status = {0};
+
+void lush_set_pipe_status(const int *statuses, int count) {
+	pipe_status.len = 0;
+	for (int i = 0; i < count; i++) {
+		char num_str[16];
+		int len = snprintf(num_str, sizeof(num_str), i ? " %d" : "%d",
+						   statuses[i]);
+		if (sb_append(&pipe_status, num_str, len) != 0)
+			return;
+	}
+}
+
+int lush_get_last_status() { return last_status; }
+
+static int positional_count() {
+	int count = 0;
+	while (positional && positional[count])
+		count++;
+	return count;
+}
+
+static const char *lookup_special(char c) {
+	static char num_str[32];
+	static str_buf_t joined = {0};
+
+	switch (c) {
+	case '$':
+		snprintf(num_str, sizeof(num_str), "%d", getpid());
+		return num_str;
+	case '?':
+		snprintf(num_str, sizeof(num_str), "%d", last_status);
+		return num_str;
+	case '#':
+		snprintf(num_str, sizeof(num_str), "%d", positional_count());
+		return num_str;
+	case '!':
+		if (last_background <= 0)
+			return NULL;
+		snprintf(num_str, sizeof(num_str), "%d", last_background);
+		return num_str;
+	default:
+		// $* joins the positional parameters with spaces, so does $@ where
+		// it cannot be split into words
+		joined.len = 0;
+		for (int i = 0; positional && positional[i]; i++) {
+			if ((i > 0 && sb_push(&joined, ' ') != 0) ||
+				sb_append(&joined, positional[i], strlen(positional[i])) != 0)
+				return NULL;
+		}
+		if (sb_reserve(&joined, 0) != 0)
+			return NULL;
+		joined.data[joined.len] = '\0';
+		return joined.data;
+	}
+}
+
+static const char *lookup_param(const char *name, size_t len) {
+	if (len == 1 && is_special_param(name[0]))
+		return lookup_special(name[0]);
+
+	if (isdigit((unsigned char)name[0])) {
+		long index = 0;
+		for (size_t i = 0; i < len && index <= INT_MAX; i++)
+			index = index * 10 + (name[i] - '0');
+		if (index == 0)
+			return "lush";
+		return index <= positional_count() ? positional[index - 1] : NULL;
+	}
+
+	if (len == 10 && memcmp(name, "PIPESTATUS", len) == 0)
+		return pipe_status.data ? pipe_status.data : "0";
+
+	char buffer[256];
+	if (len < sizeof(buffer)) {
+		memcpy(buffer, name, len);
+		buffer[len] = '\0';
+		return lush_env_get(buffer);
+	}
+
+	char *long_name = strndup(name, len);
+	if (long_name == NULL)
+		return NULL;
+	const char *value = lush_env_get(long_name);
+	free(long_name);
+	return value;
+}
+
+typedef struct {
+	// a quote was seen, so an empty result is still a word
+	bool quoted;
+	// command arguments escape the glob characters that must stay literal
+	// and split "$@" into one word per parameter unless split is false
+	bool args;
+	bool split;
+	// "$@" expanded with no parameters
+	bool empty_at;
+} expand_state_t;
+
+static int expand_r(str_buf_t *out, const char *word, size_t len,
+					expand_state_t *state);
+
+// expands an operand of a braced parameter such as the default word
+static char *expand_operand(const char *str, size_t len) {
+	str_buf_t sb = {0};
+	expand_state_t state = {0};
+	if (expand_r(&sb, str, len, &state) != 0) {
+		free(sb.data);
+		return NULL;
+	}
+	return sb_finish(&sb);
+}
+
+// finds the end of a pattern operand for ${VAR/pat/rep}, skipping escapes
+static size_t pattern_length(const char *str, size_t len) {
+	size_t i = 0;
+	while (i < len && str[i] != '/') {
+		if (str[i] == '\\' && i + 1 < len)
+			i++;
+		i++;
+	}
+	return i;
+}
+
+static size_t utf8_length(const char *str) {
+	size_t count = 0;
+	for (; *str; str++) {
+		if (((unsigned char)*str & 0xC0) != 0x80)
+			count++;
+	}
+	return count;
+}
+
+// removes the shortest or longest prefix/suffix matching pattern
+static int remove_pattern(str_buf_t *out, const char *value,
+						  const char *pattern, bool suffix, bool longest) {
+	size_t len = strlen(value);
+	char *subject = strdup(value);
+	if (subject == NULL) {
+		perror("strdup failed");
+		return -1;
+	}
+
+	size_t cut = 0;
+	bool found = false;
+	for (size_t step = 0; step <= len && !found; step++) {
+		size_t i = longest ? len - step : step;
+		if (suffix) {
+			// suffix of length i starts at len - i
+			if (fnmatch(pattern, subject + len - i, 0) == 0) {
+				cut = i;
+				found = true;
+			}
+		} else {
+			char saved = subject[i];
+			subject[i] = '\0';
+			if (fnmatch(pattern, subject, 0) == 0) {
+				cut = i;
+				found = true;
+			}
+			subject[i] = saved;
+		}
+	}
+
+	int rc = 0;
+	if (!found) {
+		rc = sb_append(out, value, len);
+	} else if (suffix) {
+		rc = sb_append(out, value, len - cut);
+	} else {
+		rc = sb_append(out, value + cut, len - cut);
+	}
+	free(subject);
+	return rc;
+}
+
+// finds the longest match of pattern starting at start, returns its length
+static size_t match_at(char *subject, size_t len, size_t start,
+					   const char *pattern, bool anchor_end) {
+	for (size_t end = len; end > start; end--) {
+		if (anchor_end && end != len)
+			break;
+		char saved = subject[end];
+		subject[end] = '\0';
+		int rc = fnmatch(pattern, subject + start, 0);
+		subject[end] = saved;
+		if (rc == 0)
+			return end - start;
+	}
+	return 0;
+}
+
+static int replace_pattern(str_buf_t *out, const char *value,
+						   const char *pattern, const char *replacement,
+						   char mode) {
+	size_t len = strlen(value);
+	if (*pattern == '\0')
+		return sb_append(out, value, len);
+
+	char *subject = strdup(value);
+	if (subject == NULL) {
+		perror("strdup failed");
+		return -1;
+	}
+
+	bool replaced = false;
+	size_t i = 0;
+	while (i < len) {
+		size_t matched = 0;
+		if (!replaced || mode == '/') {
+			if (mode != '#' || i == 0)
+				matched = match_at(subject, len, i, pattern, mode == '%');
+		}
+
+		if (matched > 0) {
+			if (sb_append(out, replacement, strlen(replacement)) != 0)
+				break;
+			i += matched;
+			replaced = true;
+		} else {
+			if (sb_push(out, value[i]) != 0)
+				break;
+			i++;
+		}
+	}
+
+	free(subject);
+	return i < len ? -1 : 0;
+}
+
+static int substring(str_buf_t *out, const char *value, const char *spec,
+					 size_t spec_len) {
+	size_t len = strlen(value);
+	const char *colon = memchr(spec, ':', spec_len);
+	size_t offset_len = colon ? (size_t)(colon - spec) : spec_len;
+
+	// offsets and lengths are arithmetic expressions
+	long long offset = 0;
+	char *offset_str = expand_operand(spec, offset_len);
+	if (offset_str == NULL)
+		return -1;
+	int rc = lush_arith_eval(offset_str, &offset);
+	free(offset_str);
+	if (rc != 0)
+		return -1;
+
+	if (offset < 0)
+		offset = (long long)len + offset < 0 ? 0 : (long long)len + offset;
+	if ((size_t)offset > len)
+		offset = (long long)len;
+
+	size_t count = len - offset;
+	if (colon) {
+		long long length = 0;
+		char *length_str =
+			expand_operand(colon + 1, spec_len - offset_len - 1);
+		if (length_str == NULL)
+			return -1;
+		rc = lush_arith_eval(length_str, &length);
+		free(length_str);
+		if (rc != 0)
+			return -1;
+
+		// a negative length counts back from the end of the value
+		if (length < 0)
+			length = (long long)len + length - offset;
+		if (length < 0)
+			length = 0;
+		if ((size_t)length < count)
+			count = length;
+	}
+
+	return sb_append(out, value + offset, count);
+}
+
+static int expand_braced(str_buf_t *out, const char *inner, size_t len) {
+	// ${#VAR} gives the length of the value
+	if (len > 1 && inner[0] == '#') {
+		size_t name_len = name_length(inner + 1, len - 1, true);
+		if (name_len == 0 || name_len != len - 1)
+			return -1;
+		const char *value = lookup_param(inner + 1, name_len);
+		char length_str[32];
+		snprintf(length_str, sizeof(length_str), "%zu",
+				 value ? utf8_length(value) : 0);
+		return sb_append(out, length_str, strlen(length_str));
+	}
+
+	size_t name_len = name_length(inner, len, true);
+	if (name_len == 0)
+		return -1;
+
+	const char *value = lookup_param(inner, name_len);
+	const char *op = inner + name_len;
+	size_t op_len = len - name_len;
+
+	if (op_len == 0) {
+		return value ? sb_append(out, value, strlen(value)) : 0;
+	}
+
+	// ${VAR:-word} ${VAR-word} ${VAR:=word} ${VAR:+word} ${VAR:?word}
+	bool colon = op[0] == ':';
+	char test = colon ? op[1] : op[0];
+	if (op_len >= (colon ? 2u : 1u) && strchr("-=+?", test) && test != '\0') {
+		size_t skip = colon ? 2 : 1;
+		bool is_set = value != NULL && (!colon || *value != '\0');
+
+		if (test == '+') {
+			if (!is_set)
+				return 0;
+		} else if (is_set) {
+			return sb_append(out, value, strlen(value));
+		}
+
+		char *word = expand_operand(op + skip, op_len - skip);
+		if (word == NULL)
+			return -1;
+
+		int rc = 0;
+		if (test == '=') {
+			char *name = strndup(inner, name_len);
+			if (name != NULL) {
+				lush_env_set(name, word);
+				free(name);
+			}
+		} else if (test == '?') {
+			fprintf(stderr, "lush: %.*s: %s\n", (int)name_len, inner,
+					*word ? word : "parameter null or not set");
+			free(word);
+			return -1;
+		}
+		rc = sb_append(out, word, strlen(word));
+		free(word);
+		return rc;
+	}
+
+	if (value == NULL)
+		value = "";
+
+	// ${VAR:offset} and ${VAR:offset:length}
+	if (colon) {
+		return substring(out, value, op + 1, op_len - 1);
+	}
+
+	// ${VAR#pat} ${VAR##pat} ${VAR%pat} ${VAR%%pat}
+	if (op[0] == '#' || op[0] == '%') {
+		bool longest = op_len > 1 && op[1] == op[0];
+		size_t skip = longest ? 2 : 1;
+		char *pattern = expand_operand(op + skip, op_len - skip);
+		if (pattern == NULL)
+			return -1;
+		int rc = remove_pattern(out, value, pattern, op[0] == '%', longest);
+		free(pattern);
+		return rc;
+	}
+
+	// ${VAR/pat/rep} ${VAR//pat/rep} ${VAR/#pat/rep} ${VAR/%pat/rep}
+	if (op[0] == '/') {
+		char mode = '\0';
+		size_t skip = 1;
+		if (op_len > 1 && strchr("/#%", op[1])) {
+			mode = op[1];
+			skip = 2;
+		}
+
+		size_t pat_len = pattern_length(op + skip, op_len - skip);
+		char *pattern = expand_operand(op + skip, pat_len);
+		if (pattern == NULL)
+			return -1;
+
+		size_t rep_start = skip + pat_len + 1;
+		char *replacement = rep_start <= op_len
+								? expand_operand(op + rep_start,
+												 op_len - rep_start)
+								: strdup("");
+		if (replacement == NULL) {
+			free(pattern);
+			return -1;
+		}
+
+		int rc = replace_pattern(out, value, pattern, replacement, mode);
+		free(pattern);
+		free(replacement);
+		return rc;
+	}
+
+	return -1;
+}
+
+// finds the closing brace of ${...}, returns its offset or 0 if missing
+static size_t brace_end(const char *str, size_t len) {
+	int depth = 0;
+	char quote = '\0';
+	for (size_t i = 0; i < len; i++) {
+		char c = str[i];
+		if (quote) {
+			if (c == quote)
+				quote = '\0';
+			else if (c == '\\' && quote == '"')
+				i++;
+		} else if (c == '\\') {
+			i++;
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+		} else if (c == '{') {
+			depth++;
+		} else if (c == '}') {
+			if (--depth == 0)
+				return i;
+		}
+	}
+	return 0;
+}
+
+// finds the closing parenthesis of $(...), returns its offset or 0
+static size_t paren_end(const char *str, size_t len) {
+	int depth = 0;
+	char quote = '\0';
+	for (size_t i = 0; i < len; i++) {
+		char c = str[i];
+		if (quote) {
+			if (c == quote)
+				quote = '\0';
+			else if (c == '\\' && quote == '"')
+				i++;
+		} else if (c == '\\') {
+			i++;
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+		} else if (c == '(') {
+			depth++;
+		} else if (c == ')') {
+			if (--depth == 0)
+				return i;
+		}
+	}
+	return 0;
+}
+
+static substitute_callback_t substitute = NULL;
+
+void lush_set_substitute(substitute_callback_t callback) {
+	substitute = callback;
+}
+
+// $(command) is replaced by the command's output without the trailing
+// newlines
+static int expand_command(str_buf_t *out, const char *command, size_t len) {
+	char *line = strndup(command, len);
+	if (line == NULL)
+		return -1;
+	char *output = NULL;
+	int rc = substitute(line, &output);
+	free(line);
+	if (rc != 0)
+		return -1;
+
+	size_t output_len = strlen(output);
+	while (output_len > 0 && output[output_len - 1] == '\n')
+		output_len--;
+	rc = sb_append(out, output, output_len);
+	free(output);
+	return rc;
+}
+
+// $((expr)) expands the expression first and then evaluates it natively
+static int expand_arith(str_buf_t *out, const char *expr, size_t len) {
+	char *expanded = expand_operand(expr, len);
+	if (expanded == NULL)
+		return -1;
+
+	long long value = 0;
+	int rc = lush_arith_eval(expanded, &value);
+	free(expanded);
+	if (rc != 0)
+		return -1;
+
+	char value_str[32];
+	snprintf(value_str, sizeof(value_str), "%lld", value);
+	return sb_append(out, value_str, strlen(value_str));
+}
+
+// expands the $ construct at the start of str, sets used to the number of
+// characters consumed or 0 if the dollar sign is literal
+static int expand_dollar(str_buf_t *out, const char *str, size_t len,
+						 size_t *used) {
+	*used = 0;
+	if (len < 2)
+		return 0;
+
+	if (len > 2 && str[1] == '(' && str[2] == '(') {
+		// only $((...)) where the inner parentheses close together is
+		// arithmetic, anything else is left for command substitution
+		size_t end = paren_end(str + 1, len - 1);
+		if (end >= 3 && str[end] == ')' &&
+			paren_end(str + 2, end - 1) == end - 2) {
+			if (expand_arith(out, str + 3, end - 3) != 0)
+				return -1;
+			*used = end + 2;
+			return 0;
+		}
+	}
+
+	if (str[1] == '(' && substitute != NULL) {
+		size_t end = paren_end(str + 1, len - 1);
+		if (end == 0)
+			return -1;
+		if (expand_command(out, str + 2, end - 1) != 0)
+			return -1;
+		*used = end + 2;
+		return 0;
+	}
+
+	if (str[1] == '{') {
+		size_t end = brace_end(str + 1, len - 1);
+		if (end == 0)
+			return -1;
+
+		if (expand_braced(out, str + 2, end - 1) != 0) {
+			fprintf(stderr, "lush: %.*s: bad substitution\n", (int)end + 2,
+					str);
+			return -1;
+		}
+		*used = end + 2;
+		return 0;
+	}
+
+	size_t name_len = name_length(str + 1, len - 1, false);
+	if (name_len == 0)
+		return 0;
+
+	const char *value = lookup_param(str + 1, name_len);
+	*used = name_len + 1;
+	return value ? sb_append(out, value, strlen(value)) : 0;
+}
+
+// characters the glob code treats as special. quoted ones are escaped so
+// they stay literal, unquoted substitutions still glob but are never brace
+// or tilde expanded
+#define QUOTED_SPECIAL "\\*?[]{},~"
+#define SUBST_SPECIAL "\\{},~"
+
+static int push_escaped(str_buf_t *out, char c, const char *special) {
+	if (strchr(special, c) != NULL && sb_push(out, '\\') != 0)
+		return -1;
+	return sb_push(out, c);
+}
+
+// escapes what a substitution appended to out from start onwards
+static int escape_tail(str_buf_t *out, size_t start, const char *special) {
+	size_t extra = 0;
+	for (size_t i = start; i < out->len; i++) {
+		if (strchr(special, out->data[i]) != NULL)
+			extra++;
+	}
+	if (extra == 0)
+		return 0;
+	if (sb_reserve(out, extra) != 0)
+		return -1;
+
+	// shift from the end so every byte moves once
+	size_t src = out->len;
+	size_t dst = out->len + extra;
+	out->data[dst] = '\0';
+	while (src > start) {
+		char c = out->data[--src];
+		out->data[--dst] = c;
+		if (strchr(special, c) != NULL)
+			out->data[--dst] = '\\';
+	}
+	out->len += extra;
+	return 0;
+}
+
+// length of a $@ or ${@} at the start of str, 0 if it is something else
+static size_t at_length(const char *str, size_t len) {
+	if (len >= 2 && str[1] == '@')
+		return 2;
+	if (len >= 4 && memcmp(str, "${@}", 4) == 0)
+		return 4;
+	return 0;
+}
+
+// "$@" gives one word per parameter, the words are separated by a nul
+static int expand_at(str_buf_t *out, bool in_double, expand_state_t *state) {
+	const char *special = in_double ? QUOTED_SPECIAL : SUBST_SPECIAL;
+	if (positional == NULL || positional[0] == NULL)
+		state->empty_at = true;
+	for (int i = 0; positional && positional[i]; i++) {
+		if (i > 0 && sb_push(out, '\0') != 0)
+			return -1;
+		for (const char *p = positional[i]; *p; p++) {
+			if (push_escaped(out, *p, special) != 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int expand_r(str_buf_t *out, const char *word, size_t len,
+					expand_state_t *state) {
+	bool in_double = false;
+	// everything pushed literally is escaped in quotes or after a backslash
+	const char *special = state->args ? QUOTED_SPECIAL : "";
+
+	for (size_t i = 0; i < len; i++) {
+		char c = word[i];
+
+		if (c == '\'' && !in_double) {
+			// single quotes keep everything literal
+			const char *end = memchr(word + i + 1, '\'', len - i - 1);
+			if (end == NULL)
+				return -1;
+			state->quoted = true;
+			for (i++; word + i < end; i++) {
+				if (push_escaped(out, word[i], special) != 0)
+					return -1;
+			}
+		} else if (c == '"') {
+			state->quoted = true;
+			in_double = !in_double;
+		} else if (c == '\\' && i + 1 < len) {
+			char next = word[i + 1];
+			// inside double quotes only a few characters can be escaped
+			if (!in_double || strchr("$\"\\`", next)) {
+				if (push_escaped(out, next, special) != 0)
+					return -1;
+				i++;
+			} else if (push_escaped(out, c, special) != 0) {
+				return -1;
+			}
+		} else if (c == '$') {
+			size_t used = state->split ? at_length(word + i, len - i) : 0;
+			size_t start = out->len;
+			if (used > 0) {
+				if (expand_at(out, in_double, state) != 0)
+					return -1;
+			} else if (expand_dollar(out, word + i, len - i, &used) != 0) {
+				return -1;
+			} else if (state->args &&
+					   escape_tail(out, start,
+								   in_double ? QUOTED_SPECIAL
+											 : SUBST_SPECIAL) != 0) {
+				return -1;
+			}
+			if (used > 0) {
+				i += used - 1;
+			} else if (sb_push(out, c) != 0) {
+				return -1;
+			}
+		} else if (in_double || c == '\\') {
+			if (push_escaped(out, c, special) != 0)
+				return -1;
+		} else if (sb_push(out, c) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int lush_expand_word(const char *word, char **result) {
+	str_buf_t sb = {0};
+	expand_state_t state = {0};
+	*result = NULL;
+
+	if (expand_r(&sb, word, strlen(word), &state) != 0) {
+		free(sb.data);
+		return -1;
+	}
+
+	// unquoted words that expand to nothing are dropped from the args
+	if (sb.len == 0 && !state.quoted) {
+		free(sb.data);
+		return 0;
+	}
+
+	*result = sb_finish(&sb);
+	return *result ? 1 : -1;
+}
+
+int lush_expand_fields(const char *word, bool split, argv_t *out) {
+	str_buf_t sb = {0};
+	expand_state_t state = {.args = true, .split = split};
+
+	if (expand_r(&sb, word, strlen(word), &state) != 0) {
+		free(sb.data);
+		return -1;
+	}
+
+	// unquoted words that expand to nothing are dropped from the args and
+	// so is "$@" without parameters, even inside quotes
+	if (sb.len == 0 && (!state.quoted || state.empty_at)) {
+		free(sb.data);
+		return 0;
+	}
+	if (sb_finish(&sb) == NULL)
+		return -1;
+
+	// the words of "$@" are nul separated, the first keeps the buffer
+	lush_argv_push(out, sb.data);
+	for (size_t pos = strlen(sb.data) + 1; pos <= sb.len;
+		 pos += strlen(sb.data + pos) + 1) {
+		char *field = strdup(sb.data + pos);
+		if (field == NULL) {
+			perror("strdup failed");
+			exit(1);
+		}
+		lush_argv_push(out, field);
+	}
+	return 0;
+}
+
+int lush_expand_heredoc(const char *body, char **result) {
+	str_buf_t sb = {0};
+	size_t len = strlen(body);
+	*result = NULL;
+
+	// quotes stay literal, only parameters and a few escapes are special
+	for (size_t i = 0; i < len; i++) {
+		char c = body[i];
+		int rc = 0;
+		if (c == '\\' && i + 1 < len && strchr("$`\\\n", body[i + 1])) {
+			// an escaped newline joins the lines
+			if (body[++i] != '\n')
+				rc = sb_push(&sb, body[i]);
+		} else if (c == '$') {
+			size_t used = 0;
+			rc = expand_dollar(&sb, body + i, len - i, &used);
+			if (used > 0)
+				i += used - 1;
+			else if (rc == 0)
+				rc = sb_push(&sb, c);
+		} else {
+			rc = sb_push(&sb, c);
+		}
+
+		if (rc != 0) {
+			free(sb.data);
+			return -1;
+		}
+	}
+
+	*result = sb_finish(&sb);
+	return *result ? 0 : -1;
+}
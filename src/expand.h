@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "wildcard.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// environment snapshot, all writes must go through these to keep it valid
+char *lush_env_get(const char *name);
+int lush_env_set(const char *name, const char *value);
+int lush_env_unset(const char *name);
+
+// positional parameters for $1.. $# and $@, returns the previous array so
+// callers can restore it. the array is not copied
+char **lush_set_positional(char **args);
+
+// exit status of the last command for $?
+void lush_set_last_status(int status);
+int lush_get_last_status();
+
+// pid of the last command started in the background for $!
+void lush_set_last_background(pid_t pid);
+
+// statuses of every stage of the last pipeline, read back as $PIPESTATUS
+void lush_set_pipe_status(const int *statuses, int count);
+
+// runs the command of a $(...) substitution and sets output to a malloc'd
+// copy of what it printed. returns 0, or -1 if the substitution must fail
+typedef int (*substitute_callback_t)(const char *command, char **output);
+
+// without a callback $(...) is left as written, so the parser never runs
+// commands when it is built on its own for fuzzing and benchmarks
+void lush_set_substitute(substitute_callback_t callback);
+
+// returns the length of the raw word starting at word, -1 if a quote or
+// substitution is left unterminated
+int lush_word_length(const char *word);
+
+// expands quotes, escapes and parameters in a raw word. returns 1 and sets
+// result to a malloc'd string, 0 if an unquoted word expanded to nothing
+// and -1 on a bad substitution
+int lush_expand_word(const char *word, char **result);
+
+// expands a raw word into command arguments and appends them to out. the
+// characters that came from quotes, escapes or substitutions in quotes are
+// backslash escaped so only unquoted ones glob, lush_expand_globs removes
+// the escapes again. "$@" gives one argument per parameter when split is
+// set. returns 0 or -1 on a bad substitution
+int lush_expand_fields(const char *word, bool split, argv_t *out);
+
+// expands the body of an unquoted heredoc, quotes are kept as they are.
+// returns 0 and sets result to a malloc'd string or -1 on error
+int lush_expand_heredoc(const char *body, char **result);
+
+#endif // EXPAND_H
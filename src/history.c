@@ -73,6 +73,7 @@ char *lush_get_past_command(int pos) {
 	while (fgets(line, 1024, fp)) {
 		if (curr_line == pos) {
 			fclose(fp);
+			free(path);
 			return line;
 		}
 		curr_line++;
@@ -84,6 +85,10 @@ char *lush_get_past_command(int pos) {
 }
 
 void lush_push_history(const char *line) {
+	lush_push_history_lines(&line, 1);
+}
+
+void lush_push_history_lines(const char **new_lines, int count) {
 	char *path = get_history_path();
 	// check if the file exists and create if not
 	if (access(path, F_OK) != 0) {
@@ -147,13 +152,16 @@ void lush_push_history(const char *line) {
 		return;
 	}
 
-	// Write the new line
-	fprintf(fp, "%s\n", line);
+	// Write the new lines, most recent first
+	int written = 0;
+	for (int i = count - 1; i >= 0 && written <= MAX_LINES; i--, written++) {
+		fprintf(fp, "%s\n", new_lines[i]);
+	}
 
 	// Write the last MAX_LINES lines
-	int total_lines = line_count < MAX_LINES ? line_count : MAX_LINES;
-	for (int i = 0; i < total_lines; i++) {
-		fprintf(fp, "%s", lines[i]);
+	for (int i = 0; i < index; i++) {
+		if (written++ <= MAX_LINES)
+			fprintf(fp, "%s", lines[i]);
 		free(lines[i]); // Free each line after writing
 	}
 
@@ -0,0 +1,470 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "jobs.h"
+#include "expand.h"
+#include "launch.h"
+#include "loop.h"
+#include "lush.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// finished jobs a script keeps around for wait before the oldest go
+#define MAX_DONE_JOBS 256
+
+static job_t **jobs = NULL;
+static int num_jobs = 0;
+static int jobs_capacity = 0;
+static unsigned long touch_counter = 0;
+static bool job_control = false;
+
+static struct termios shell_tmodes;
+static bool has_shell_tmodes = false;
+
+static void wait_job(job_t *job, int options);
+
+static void children_changed(int signum, void *data) { lush_jobs_update(); }
+
+static void proc_exited(int fd, uint32_t events, void *data) {
+	wait_job(data, WNOHANG);
+}
+
+void lush_jobs_init(bool interactive) {
+	// stops and continues only come as SIGCHLD, exits also through pidfds
+	lush_loop_on_signal(SIGCHLD, children_changed, NULL);
+
+	int fd = lush_terminal_fd();
+	job_control = interactive && fd >= 0;
+	if (!job_control)
+		return;
+
+	// a shell started in the background waits until it is brought forward
+	pid_t pgrp;
+	while (tcgetpgrp(fd) != (pgrp = getpgrp()))
+		kill(-pgrp, SIGTTIN);
+
+	signal(SIGTSTP, SIG_IGN);
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+
+	// stopping a job must never stop the shell with it
+	if (getpgrp() != getpid())
+		setpgid(0, 0);
+	lush_terminal_give(getpgrp());
+	has_shell_tmodes = tcgetattr(fd, &shell_tmodes) == 0;
+}
+
+// -- job records --
+
+static void forget_proc(job_proc_t *proc) {
+	if (proc->pidfd >= 0)
+		lush_loop_remove(proc->pidfd);
+	proc->pidfd = -1;
+}
+
+static void free_job(job_t *job) {
+	for (int i = 0; i < job->num_procs; i++)
+		forget_proc(&job->procs[i]);
+	free(job->procs);
+	free(job->command);
+	free(job);
+}
+
+job_t *lush_job_new(char ***commands, int num_commands) {
+	job_t *job = calloc(1, sizeof(job_t));
+	size_t len = 1;
+	for (int i = 0; i < num_commands; i++) {
+		for (int j = 0; commands[i][j]; j++)
+			len += strlen(commands[i][j]) + 1;
+		len += 3;
+	}
+	if (job == NULL || (job->command = malloc(len)) == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+
+	// the command line as the user would have typed it
+	char *out = job->command;
+	for (int i = 0; i < num_commands; i++) {
+		if (i > 0)
+			out = stpcpy(out, " | ");
+		for (int j = 0; commands[i][j]; j++) {
+			if (j > 0)
+				*out++ = ' ';
+			out = stpcpy(out, commands[i][j]);
+		}
+	}
+	*out = '\0';
+	job->state = JOB_DONE;
+	job->own_group = job_control;
+	return job;
+}
+
+pid_t lush_job_spawn_group(job_t *job) {
+	return job->own_group ? job->pgid : -1;
+}
+
+void lush_job_add_proc(job_t *job, pid_t pid, int status) {
+	job_proc_t *procs =
+		realloc(job->procs, (job->num_procs + 1) * sizeof(job_proc_t));
+	if (procs == NULL) {
+		perror("realloc failed");
+		exit(1);
+	}
+	job->procs = procs;
+
+	job_proc_t *proc = &job->procs[job->num_procs++];
+	proc->pid = pid;
+	proc->status = status;
+	proc->state = pid > 0 ? JOB_RUNNING : JOB_DONE;
+	proc->pidfd = pid > 0 ? lush_loop_watch_pid(pid, proc_exited, job) : -1;
+	if (pid > 0) {
+		job->state = JOB_RUNNING;
+		if (job->pgid == 0)
+			job->pgid = pid;
+	}
+}
+
+// the job is stopped while any stage is, and running while any runs
+static void update_state(job_t *job) {
+	job_state_t state = JOB_DONE;
+	for (int i = 0; i < job->num_procs; i++) {
+		if (job->procs[i].state == JOB_RUNNING)
+			state = JOB_RUNNING;
+		else if (job->procs[i].state == JOB_STOPPED && state == JOB_DONE)
+			state = JOB_STOPPED;
+	}
+	if (state != job->state) {
+		job->changed = true;
+		if (state == JOB_STOPPED)
+			job->touched = ++touch_counter;
+	}
+	job->state = state;
+}
+
+static void record_status(job_t *job, pid_t pid, int wstatus) {
+	for (int i = 0; i < job->num_procs; i++) {
+		job_proc_t *proc = &job->procs[i];
+		if (proc->pid != pid)
+			continue;
+		if (WIFSTOPPED(wstatus)) {
+			proc->state = JOB_STOPPED;
+			proc->status = 128 + WSTOPSIG(wstatus);
+		} else if (WIFCONTINUED(wstatus)) {
+			proc->state = JOB_RUNNING;
+		} else if (WIFEXITED(wstatus)) {
+			proc->state = JOB_DONE;
+			proc->status = WEXITSTATUS(wstatus);
+		} else {
+			proc->state = JOB_DONE;
+			proc->status = 128 + WTERMSIG(wstatus);
+		}
+		if (proc->state == JOB_DONE)
+			forget_proc(proc);
+		break;
+	}
+	update_state(job);
+}
+
+// collects what the job's processes have to report without blocking
+static void poll_job(job_t *job, int options) {
+	for (int i = 0; i < job->num_procs; i++) {
+		job_proc_t *proc = &job->procs[i];
+		if (proc->state == JOB_DONE)
+			continue;
+
+		int wstatus;
+		pid_t pid;
+		do {
+			pid = waitpid(proc->pid, &wstatus,
+						  options | WNOHANG | WUNTRACED);
+		} while (pid < 0 && errno == EINTR);
+		if (pid > 0) {
+			record_status(job, pid, wstatus);
+		} else if (pid < 0) {
+			// someone else reaped it, nothing more will come
+			proc->state = JOB_DONE;
+			forget_proc(proc);
+		}
+	}
+	update_state(job);
+}
+
+// collects the job until nothing in it is left running. unless options has
+// WNOHANG the event loop runs in between, so traps, timers and other jobs
+// are served while a foreground job has the terminal
+static void wait_job(job_t *job, int options) {
+	poll_job(job, options);
+	while (!(options & WNOHANG) && job->state == JOB_RUNNING) {
+		lush_loop_run_once(-1);
+		poll_job(job, options);
+	}
+}
+
+// stops and resumes the whole job, its group when it has one
+static void signal_job(job_t *job, int signum) {
+	if (job->own_group) {
+		kill(-job->pgid, signum);
+		return;
+	}
+	for (int i = 0; i < job->num_procs; i++) {
+		if (job->procs[i].state != JOB_DONE)
+			kill(job->procs[i].pid, signum);
+	}
+}
+
+// the last stage's status or with pipefail the last one that failed
+static int job_result(job_t *job) {
+	if (job->state == JOB_STOPPED)
+		return 128 + SIGTSTP;
+	if (job->num_procs == 0)
+		return 0;
+
+	int rc = job->procs[job->num_procs - 1].status;
+	for (int i = job->num_procs - 1; pipefail_enable && i >= 0 && rc == 0;
+		 i--)
+		rc = job->procs[i].status;
+	return rc;
+}
+
+// -- job table --
+
+void lush_job_remove(job_t *job) {
+	for (int i = 0; i < num_jobs; i++) {
+		if (jobs[i] == job) {
+			memmove(jobs + i, jobs + i + 1,
+					(num_jobs - i - 1) * sizeof(job_t *));
+			num_jobs--;
+			break;
+		}
+	}
+	free_job(job);
+}
+
+// a script that never waits would otherwise keep every job it started
+static void prune_done() {
+	int done = 0;
+	for (int i = num_jobs - 1; i >= 0; i--) {
+		if (jobs[i]->state == JOB_DONE && ++done > MAX_DONE_JOBS)
+			lush_job_remove(jobs[i]);
+	}
+}
+
+static void add_to_table(job_t *job) {
+	if (job->id != 0)
+		return;
+	if (!job_control)
+		prune_done();
+
+	if (num_jobs == jobs_capacity) {
+		jobs_capacity = jobs_capacity ? jobs_capacity * 2 : 8;
+		jobs = realloc(jobs, jobs_capacity * sizeof(job_t *));
+		if (jobs == NULL) {
+			perror("realloc failed");
+			exit(1);
+		}
+	}
+	job->id = num_jobs ? jobs[num_jobs - 1]->id + 1 : 1;
+	jobs[num_jobs++] = job;
+}
+
+int lush_job_count() { return num_jobs; }
+
+job_t *lush_job_at(int index) { return jobs[index]; }
+
+// current is the most recently stopped or backgrounded job
+static job_t *marked_job(int rank) {
+	job_t *first = NULL, *second = NULL;
+	for (int i = 0; i < num_jobs; i++) {
+		if (first == NULL || jobs[i]->touched >= first->touched) {
+			second = first;
+			first = jobs[i];
+		} else if (second == NULL || jobs[i]->touched >= second->touched) {
+			second = jobs[i];
+		}
+	}
+	return rank == 0 ? first : second;
+}
+
+job_t *lush_job_find(const char *spec) {
+	if (spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 ||
+		strcmp(spec, "%+") == 0)
+		return marked_job(0);
+	if (strcmp(spec, "%-") == 0)
+		return marked_job(1);
+
+	if (spec[0] == '%')
+		spec++;
+	char *end;
+	long id = strtol(spec, &end, 10);
+	bool by_id = end != spec && *end == '\0';
+	for (int i = 0; i < num_jobs; i++) {
+		if (by_id ? jobs[i]->id == id
+				  : strncmp(jobs[i]->command, spec, strlen(spec)) == 0)
+			return jobs[i];
+	}
+	return NULL;
+}
+
+// -- waiting --
+
+static void print_stopped(job_t *job) {
+	printf("\n");
+	lush_job_print(job, false);
+	job->changed = false;
+}
+
+int lush_job_foreground(job_t *job, bool cont) {
+	// a stage that was just spawned may already hold the terminal
+	int fd = lush_terminal_fd();
+	pid_t owner = fd >= 0 ? tcgetpgrp(fd) : -1;
+	bool terminal = owner > 0 && (owner == getpgrp() || owner == job->pgid);
+
+	if (terminal && job->own_group && job->pgid > 0) {
+		if (cont && job->has_tmodes)
+			tcsetattr(fd, TCSADRAIN, &job->tmodes);
+		lush_terminal_give(job->pgid);
+	}
+	if (cont && job->state == JOB_STOPPED) {
+		for (int i = 0; i < job->num_procs; i++) {
+			if (job->procs[i].state == JOB_STOPPED)
+				job->procs[i].state = JOB_RUNNING;
+		}
+		update_state(job);
+		signal_job(job, SIGCONT);
+	}
+
+	wait_job(job, 0);
+
+	if (terminal) {
+		lush_terminal_give(getpgrp());
+		if (job->state == JOB_STOPPED)
+			job->has_tmodes = tcgetattr(fd, &job->tmodes) == 0;
+		// whatever mode the job left the terminal in is not ours
+		if (has_shell_tmodes)
+			tcsetattr(fd, TCSADRAIN, &shell_tmodes);
+	}
+
+	int *statuses = malloc((job->num_procs + 1) * sizeof(int));
+	if (statuses == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	for (int i = 0; i < job->num_procs; i++)
+		statuses[i] = job->procs[i].status;
+	lush_set_pipe_status(statuses, job->num_procs);
+	free(statuses);
+
+	int rc = job_result(job);
+	if (job->state == JOB_STOPPED) {
+		add_to_table(job);
+		print_stopped(job);
+	} else if (job->id != 0) {
+		lush_job_remove(job);
+	} else {
+		free_job(job);
+	}
+	return rc;
+}
+
+void lush_job_background(job_t *job, bool cont) {
+	add_to_table(job);
+	job->touched = ++touch_counter;
+	if (cont && job->state == JOB_STOPPED) {
+		for (int i = 0; i < job->num_procs; i++) {
+			if (job->procs[i].state == JOB_STOPPED)
+				job->procs[i].state = JOB_RUNNING;
+		}
+		update_state(job);
+		job->changed = false;
+		signal_job(job, SIGCONT);
+	}
+}
+
+int lush_job_wait(job_t *job) {
+	wait_job(job, 0);
+	int rc = job_result(job);
+	if (job->state == JOB_DONE)
+		lush_job_remove(job);
+	return rc;
+}
+
+void lush_jobs_update() {
+	for (int i = 0; i < num_jobs; i++)
+		wait_job(jobs[i], WNOHANG | WCONTINUED);
+}
+
+void lush_jobs_notify() {
+	lush_jobs_update();
+	for (int i = 0; i < num_jobs;) {
+		job_t *job = jobs[i];
+		if (job->state == JOB_DONE && job_control) {
+			lush_job_print(job, false);
+			lush_job_remove(job);
+		} else if (job->state == JOB_DONE) {
+			i++;
+		} else {
+			if (job->changed && job->state == JOB_STOPPED && job_control)
+				lush_job_print(job, false);
+			job->changed = false;
+			i++;
+		}
+	}
+	fflush(stdout);
+}
+
+void lush_jobs_after_fork() {
+	// the pidfds went with the parent's event loop
+	for (int i = 0; i < num_jobs; i++) {
+		for (int j = 0; j < jobs[i]->num_procs; j++)
+			jobs[i]->procs[j].pidfd = -1;
+		free_job(jobs[i]);
+	}
+	num_jobs = 0;
+	job_control = false;
+	has_shell_tmodes = false;
+}
+
+void lush_job_print(job_t *job, bool with_pids) {
+	char mark = ' ';
+	if (job == marked_job(0))
+		mark = '+';
+	else if (job == marked_job(1))
+		mark = '-';
+
+	char state[32];
+	int rc = job_result(job);
+	if (job->state == JOB_RUNNING)
+		snprintf(state, sizeof(state), "Running");
+	else if (job->state == JOB_STOPPED)
+		snprintf(state, sizeof(state), "Stopped");
+	else if (rc == 0)
+		snprintf(state, sizeof(state), "Done");
+	else
+		snprintf(state, sizeof(state), "Exit %d", rc);
+
+	printf("[%d]%c  ", job->id, mark);
+	if (with_pids)
+		printf("%d ", job->pgid);
+	printf("%-24s%s%s\n", state, job->command,
+		   job->state == JOB_RUNNING ? " &" : "");
+}
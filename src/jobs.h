@@ -0,0 +1,112 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <termios.h>
+
+typedef enum {
+	JOB_RUNNING,
+	JOB_STOPPED,
+	JOB_DONE,
+} job_state_t;
+
+typedef struct {
+	pid_t pid;
+	// exit status, or 128 plus the signal that stopped or killed it
+	int status;
+	job_state_t state;
+	// watched by the event loop until the process is reaped, or -1
+	int pidfd;
+} job_proc_t;
+
+typedef struct {
+	// 0 until the job is put in the table
+	int id;
+	// the first process, which leads the job's group when it has its own
+	pid_t pgid;
+	// without job control the processes stay in the shell's group, so the
+	// terminal's ^C reaches them like it reaches the shell
+	bool own_group;
+	job_proc_t *procs;
+	int num_procs;
+	char *command;
+	job_state_t state;
+	// terminal modes the job had when it was stopped
+	struct termios tmodes;
+	bool has_tmodes;
+	// state changed since the user was last told about it
+	bool changed;
+	// orders jobs for the current (+) and previous (-) marks
+	unsigned long touched;
+} job_t;
+
+// puts an interactive shell in its own foreground process group and makes
+// it ignore the stop signals. scripts do not get job control
+void lush_jobs_init(bool interactive);
+
+// a job for the pipeline made of commands, the stages are added as they
+// are spawned
+job_t *lush_job_new(char ***commands, int num_commands);
+
+// records a spawned stage, pid -1 is a stage that failed with status
+void lush_job_add_proc(job_t *job, pid_t pid, int status);
+
+// the process group the job's next stage should be spawned into, as
+// lush_spawn takes it
+pid_t lush_job_spawn_group(job_t *job);
+
+// gives the job the terminal and waits until it finishes or stops, resuming
+// it first if cont is set. a finished job is freed, a stopped one goes in
+// the table. returns the pipeline's status and sets $PIPESTATUS
+int lush_job_foreground(job_t *job, bool cont);
+
+// puts the job in the table without waiting, resuming it if cont is set
+void lush_job_background(job_t *job, bool cont);
+
+// collects state changes of every job without blocking
+void lush_jobs_update();
+
+// tells an interactive user about finished and stopped jobs and drops the
+// finished ones from the table
+void lush_jobs_notify();
+
+// finds a job from %n, %+, %-, %name or a plain number, NULL picks the
+// current job. NULL when there is no such job
+job_t *lush_job_find(const char *spec);
+
+// blocks until the job finishes or stops and returns its status
+int lush_job_wait(job_t *job);
+
+// prints one job the way the jobs builtin lists it
+void lush_job_print(job_t *job, bool with_pids);
+
+// number of jobs in the table and the one at index, for listing
+int lush_job_count();
+job_t *lush_job_at(int index);
+
+// forgets a job without signalling it
+void lush_job_remove(job_t *job);
+
+// called in a forked child of the shell, it drops the parent's jobs and
+// runs without job control
+void lush_jobs_after_fork();
+
+#endif // JOBS_H
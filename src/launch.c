@@ -0,0 +1,388 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#define _GNU_SOURCE
+#include "launch.h"
+#include "hashmap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// PATH execvp falls back to when it is unset
+#define DEFAULT_PATH "/bin:/usr/bin"
+// seconds a failed lookup is trusted, new installs show up after this
+#define MISS_TTL 1
+
+extern char **environ;
+
+// -- command hash --
+
+typedef enum {
+	HASH_FORGOTTEN,
+	HASH_FOUND,
+	HASH_MISSING,
+} hash_state_t;
+
+typedef struct {
+	char *name;
+	char *path;
+	hash_state_t state;
+	int hits;
+	time_t expires;
+} hash_entry_t;
+
+static hashmap_t *command_hash = NULL;
+// PATH the cache was filled from
+static char *hashed_path = NULL;
+// a relative PATH entry makes lookups depend on the working directory
+static bool path_is_relative = false;
+
+void lush_hash_clear() {
+	if (command_hash == NULL)
+		return;
+
+	for (unsigned int i = 0; i < command_hash->cap; i++) {
+		for (map_pair_t *pair = command_hash->list[i]; pair;
+			 pair = pair->next) {
+			hash_entry_t *entry = (hash_entry_t *)pair->val;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+		}
+	}
+	hm_free_hashmap(command_hash);
+	command_hash = NULL;
+}
+
+void lush_hash_forget(const char *name) {
+	if (command_hash == NULL)
+		return;
+
+	// the map can not delete so the entry is kept around empty
+	hash_entry_t *entry = (hash_entry_t *)hm_get(command_hash, (char *)name);
+	if (entry != NULL) {
+		free(entry->path);
+		entry->path = NULL;
+		entry->state = HASH_FORGOTTEN;
+		entry->hits = 0;
+	}
+}
+
+static const char *current_path() {
+	const char *path = getenv("PATH");
+	return path ? path : DEFAULT_PATH;
+}
+
+// drops everything if PATH changed since the cache was filled
+static void hash_check_path() {
+	const char *path = current_path();
+	if (hashed_path != NULL && strcmp(hashed_path, path) == 0)
+		return;
+
+	lush_hash_clear();
+	free(hashed_path);
+	hashed_path = strdup(path);
+	if (hashed_path == NULL) {
+		perror("strdup failed");
+		exit(1);
+	}
+
+	path_is_relative = false;
+	for (const char *dir = path; dir; dir = strchr(dir, ':')) {
+		if (*dir == ':')
+			dir++;
+		if (*dir != '/')
+			path_is_relative = true;
+	}
+}
+
+// walks PATH like execvp but only stats, returns a malloc'd path
+static char *search_path(const char *name, bool *relative) {
+	size_t name_len = strlen(name);
+	const char *dir = hashed_path;
+	for (;;) {
+		const char *end = strchrnul(dir, ':');
+		size_t dir_len = end - dir;
+
+		// an empty entry means the working directory
+		char *full = malloc(dir_len + name_len + 3);
+		if (full == NULL) {
+			perror("malloc failed");
+			exit(1);
+		}
+		if (dir_len == 0) {
+			memcpy(full, "./", 2);
+			dir_len = 2;
+		} else {
+			memcpy(full, dir, dir_len);
+			full[dir_len++] = '/';
+		}
+		memcpy(full + dir_len, name, name_len + 1);
+
+		struct stat st;
+		if (stat(full, &st) == 0 && S_ISREG(st.st_mode) &&
+			access(full, X_OK) == 0) {
+			*relative = full[0] != '/';
+			return full;
+		}
+		free(full);
+
+		if (*end == '\0')
+			return NULL;
+		dir = end + 1;
+	}
+}
+
+const char *lush_hash_lookup(const char *name) {
+	if (strchr(name, '/') != NULL)
+		return name;
+
+	hash_check_path();
+	if (command_hash == NULL)
+		command_hash = hm_new_hashmap();
+
+	hash_entry_t *entry = (hash_entry_t *)hm_get(command_hash, (char *)name);
+	if (entry != NULL) {
+		if (entry->state == HASH_FOUND) {
+			entry->hits++;
+			return entry->path;
+		}
+		if (entry->state == HASH_MISSING && time(NULL) < entry->expires)
+			return NULL;
+	}
+
+	bool relative = false;
+	char *path = search_path(name, &relative);
+	// answers that depend on the working directory are not kept
+	if ((path != NULL && relative) || (path == NULL && path_is_relative)) {
+		if (entry != NULL)
+			entry->state = HASH_FORGOTTEN;
+		// held until the next uncached answer so the caller never frees it
+		static char *uncached = NULL;
+		free(uncached);
+		uncached = path;
+		return path;
+	}
+
+	if (entry == NULL) {
+		entry = calloc(1, sizeof(hash_entry_t));
+		if (entry == NULL || (entry->name = strdup(name)) == NULL) {
+			perror("calloc failed");
+			exit(1);
+		}
+		hm_set(command_hash, entry->name, (char *)entry);
+	}
+
+	free(entry->path);
+	entry->path = path;
+	if (path != NULL) {
+		entry->state = HASH_FOUND;
+		entry->hits = 1;
+	} else {
+		entry->state = HASH_MISSING;
+		entry->hits = 0;
+		entry->expires = time(NULL) + MISS_TTL;
+	}
+	return path;
+}
+
+int lush_hash_print() {
+	if (command_hash == NULL)
+		return 0;
+
+	int count = 0;
+	for (unsigned int i = 0; i < command_hash->cap; i++) {
+		for (map_pair_t *pair = command_hash->list[i]; pair;
+			 pair = pair->next) {
+			hash_entry_t *entry = (hash_entry_t *)pair->val;
+			if (entry->state != HASH_FOUND)
+				continue;
+			if (count++ == 0)
+				printf("hits\tcommand\n");
+			printf("%4d\t%s\n", entry->hits, entry->path);
+		}
+	}
+	return count;
+}
+
+// -- terminal --
+
+static int terminal_fd = -1;
+
+void lush_terminal_init() {
+	if (terminal_fd >= 0 || !isatty(STDIN_FILENO))
+		return;
+	// kept above the low fds so redirections never clobber it
+	terminal_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+}
+
+int lush_terminal_fd() { return terminal_fd; }
+
+bool lush_terminal_owned() {
+	return terminal_fd >= 0 && tcgetpgrp(terminal_fd) == getpgrp();
+}
+
+void lush_terminal_give(pid_t pgid) {
+	if (terminal_fd < 0)
+		return;
+
+	// a background group setting the terminal would be stopped by SIGTTOU
+	sigset_t block, saved;
+	sigemptyset(&block);
+	sigaddset(&block, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &block, &saved);
+	tcsetpgrp(terminal_fd, pgid);
+	sigprocmask(SIG_SETMASK, &saved, NULL);
+}
+
+// -- launching --
+
+pid_t lush_spawn(char **argv, int input_fd, int output_fd, pid_t pgid,
+				 bool foreground) {
+	int fds[3] = {input_fd, output_fd, STDERR_FILENO};
+	return lush_spawn_stdio(argv, fds, pgid, foreground);
+}
+
+static int spawn_script(pid_t *pid, const char *path,
+						const posix_spawn_file_actions_t *actions,
+						const posix_spawnattr_t *attr, char **argv) {
+	int argc = 0;
+	while (argv[argc] != NULL)
+		argc++;
+	char **sh_argv = malloc((argc + 2) * sizeof(char *));
+	if (sh_argv == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	sh_argv[0] = "/bin/sh";
+	sh_argv[1] = (char *)path;
+	for (int i = 1; i <= argc; i++)
+		sh_argv[i + 1] = argv[i];
+	int err = posix_spawn(pid, "/bin/sh", actions, attr, sh_argv, environ);
+	free(sh_argv);
+	return err;
+}
+
+pid_t lush_spawn_stdio(char **argv, const int fds[3], pid_t pgid,
+					   bool foreground) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	int err = posix_spawn_file_actions_init(&actions);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	err = posix_spawnattr_init(&attr);
+	if (err != 0) {
+		posix_spawn_file_actions_destroy(&actions);
+		errno = err;
+		return -1;
+	}
+
+	short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+	if (pgid >= 0) {
+		posix_spawnattr_setpgroup(&attr, pgid);
+		flags |= POSIX_SPAWN_SETPGROUP;
+	}
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+	// taking the terminal in the child closes the window where it could
+	// read from it while still in the background, the parent also does it
+	if (foreground && pgid == 0 && terminal_fd >= 0)
+		posix_spawn_file_actions_addtcsetpgrp_np(&actions, terminal_fd);
+#endif
+
+	// the dup2 and close the forked child used to do by hand, all the dups
+	// go first since one fd may feed both stdout and stderr
+	for (int i = 0; i < 3; i++) {
+		if (fds[i] != i)
+			posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+	}
+	for (int i = 0; i < 3; i++) {
+		bool seen = fds[i] <= STDERR_FILENO;
+		for (int j = 0; j < i; j++)
+			seen = seen || fds[j] == fds[i];
+		if (!seen)
+			posix_spawn_file_actions_addclose(&actions, fds[i]);
+	}
+
+	// handlers are reset by exec anyway, this covers signals the shell
+	// ignores and a mask left behind by a trap
+	sigset_t defaults;
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGINT);
+	sigaddset(&defaults, SIGQUIT);
+	sigaddset(&defaults, SIGPIPE);
+	sigaddset(&defaults, SIGTSTP);
+	sigaddset(&defaults, SIGTTIN);
+	sigaddset(&defaults, SIGTTOU);
+	sigset_t mask;
+	sigemptyset(&mask);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setflags(&attr, flags);
+
+	// a cached path that vanished gets one fresh search
+	pid_t pid;
+	const char *path = NULL;
+	err = ENOENT;
+	for (int attempt = 0; attempt < 2 && err == ENOENT; attempt++) {
+		path = lush_hash_lookup(argv[0]);
+		if (path == NULL)
+			break;
+		err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+		if (err == ENOENT)
+			lush_hash_forget(argv[0]);
+	}
+	// like execvp, a file without a #! line is run as a shell script
+	if (err == ENOEXEC)
+		err = spawn_script(&pid, path, &actions, &attr, argv);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	if (foreground && pgid == 0 && lush_terminal_owned())
+		lush_terminal_give(pid);
+	return pid;
+}
+
+int lush_spawn_wait(pid_t pid) {
+	int status;
+	do {
+		if (waitpid(pid, &status, WUNTRACED) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("waitpid");
+			return -1;
+		}
+	} while (!WIFEXITED(status) && !WIFSIGNALED(status));
+
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	return 128 + WTERMSIG(status);
+}
@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// launches argv through posix_spawn, which glibc runs as a vfork style
+// clone so the cost does not grow with the shell's heap. the command is
+// found through the hash below instead of a PATH walk per exec. input_fd and
+// output_fd become the child's stdin and stdout and the signals the shell
+// handles itself start out with their default action. the child joins
+// process group pgid, 0 starts a new group and -1 keeps the shell's. a
+// foreground group leader takes the terminal before it execs. returns the
+// pid or -1 with errno set
+pid_t lush_spawn(char **argv, int input_fd, int output_fd, pid_t pgid,
+				 bool foreground);
+
+// lush_spawn with the child's stdin, stdout and stderr given as fds
+pid_t lush_spawn_stdio(char **argv, const int fds[3], pid_t pgid,
+					   bool foreground);
+
+// cached PATH search for a command name, names with a slash are returned
+// as they are. returns NULL when nothing executable is found, a miss is
+// remembered for a short while. the result is owned by the cache
+const char *lush_hash_lookup(const char *name);
+
+// drops one name or the whole cache, it is also dropped when PATH changes
+void lush_hash_forget(const char *name);
+void lush_hash_clear();
+
+// prints the cached commands with their hit counts, returns how many
+int lush_hash_print();
+
+// remembers the shell's controlling terminal, call before stdin is swapped
+void lush_terminal_init();
+
+// the terminal remembered above, -1 when the shell has none
+int lush_terminal_fd();
+
+// true when the shell's process group is in the foreground of a terminal
+bool lush_terminal_owned();
+
+// hands the terminal to pgid, the shell takes it back by passing its own
+void lush_terminal_give(pid_t pgid);
+
+// waits for pid and returns its exit status, or 128 plus the signal that
+// killed it
+int lush_spawn_wait(pid_t pid);
+
+#endif // LAUNCH_H
@@ -0,0 +1,290 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#define _GNU_SOURCE
+#include "loop.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define LOOP_MAX_EVENTS 32
+
+typedef struct {
+	loop_callback_t callback;
+	void *data;
+	// tells a stale event for a closed fd from one for its reuse
+	uint32_t generation;
+	// pidfds and timers belong to the loop and are closed on removal
+	bool owned;
+	bool timer;
+	bool repeat;
+} watcher_t;
+
+typedef struct {
+	signal_callback_t callback;
+	void *data;
+} signal_handler_t;
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static sigset_t signal_mask;
+static signal_handler_t signal_handlers[_NSIG];
+
+// indexed by fd, fds are small and dense so this beats a map
+static watcher_t *watchers = NULL;
+static int watchers_capacity = 0;
+static uint32_t next_generation = 1;
+
+static void read_signals(int fd, uint32_t events, void *data) {
+	struct signalfd_siginfo info[16];
+	ssize_t len;
+	while ((len = read(fd, info, sizeof(info))) > 0) {
+		for (size_t i = 0; i < len / sizeof(*info); i++) {
+			signal_handler_t *handler = &signal_handlers[info[i].ssi_signo];
+			if (handler->callback)
+				handler->callback(info[i].ssi_signo, handler->data);
+		}
+	}
+}
+
+void lush_loop_init() {
+	if (epoll_fd >= 0)
+		return;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		perror("epoll_create1");
+		exit(1);
+	}
+
+	// children are reported through the loop, never by a handler
+	sigemptyset(&signal_mask);
+	sigaddset(&signal_mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &signal_mask, NULL);
+	signal_fd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0 ||
+		lush_loop_add_fd(signal_fd, EPOLLIN, read_signals, NULL) != 0) {
+		perror("signalfd");
+		exit(1);
+	}
+}
+
+void lush_loop_after_fork() {
+	if (epoll_fd < 0)
+		return;
+
+	// closing our copies leaves the parent's epoll set as it was, where
+	// epoll_ctl would have changed it for both
+	for (int fd = 0; fd < watchers_capacity; fd++) {
+		if (watchers[fd].callback && watchers[fd].owned)
+			close(fd);
+	}
+	free(watchers);
+	watchers = NULL;
+	watchers_capacity = 0;
+	close(epoll_fd);
+	close(signal_fd);
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	signal_fd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (epoll_fd < 0 || signal_fd < 0 ||
+		lush_loop_add_fd(signal_fd, EPOLLIN, read_signals, NULL) != 0) {
+		perror("lush_loop_after_fork");
+		exit(1);
+	}
+}
+
+static watcher_t *add_watcher(int fd, uint32_t events,
+							  loop_callback_t callback, void *data) {
+	if (fd >= watchers_capacity) {
+		int capacity = watchers_capacity ? watchers_capacity : 64;
+		while (capacity <= fd)
+			capacity *= 2;
+		watcher_t *grown = realloc(watchers, capacity * sizeof(watcher_t));
+		if (grown == NULL) {
+			perror("realloc failed");
+			exit(1);
+		}
+		memset(grown + watchers_capacity, 0,
+			   (capacity - watchers_capacity) * sizeof(watcher_t));
+		watchers = grown;
+		watchers_capacity = capacity;
+	}
+
+	watcher_t *watcher = &watchers[fd];
+	struct epoll_event event = {0};
+	event.events = events;
+	event.data.u64 = ((uint64_t)next_generation << 32) | (uint32_t)fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+		return NULL;
+
+	memset(watcher, 0, sizeof(watcher_t));
+	watcher->callback = callback;
+	watcher->data = data;
+	watcher->generation = next_generation++;
+	return watcher;
+}
+
+int lush_loop_add_fd(int fd, uint32_t events, loop_callback_t callback,
+					 void *data) {
+	return add_watcher(fd, events, callback, data) ? 0 : -1;
+}
+
+void *lush_loop_remove(int fd) {
+	if (fd < 0 || fd >= watchers_capacity || watchers[fd].callback == NULL)
+		return NULL;
+
+	watcher_t *watcher = &watchers[fd];
+	void *data = watcher->data;
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	if (watcher->owned)
+		close(fd);
+	watcher->callback = NULL;
+	watcher->data = NULL;
+	return data;
+}
+
+int lush_loop_watch_pid(pid_t pid, loop_callback_t callback, void *data) {
+	if (epoll_fd < 0)
+		return -1;
+
+	// pidfds are always close on exec
+	int fd = syscall(SYS_pidfd_open, pid, 0);
+	if (fd < 0)
+		return -1;
+	watcher_t *watcher = add_watcher(fd, EPOLLIN, callback, data);
+	if (watcher == NULL) {
+		close(fd);
+		return -1;
+	}
+	watcher->owned = true;
+	return fd;
+}
+
+int lush_loop_add_timer(long ms, bool repeat, loop_callback_t callback,
+						void *data) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	// a zero value would disarm the timer instead of firing right away
+	struct itimerspec spec = {0};
+	long first = ms > 0 ? ms : 1;
+	spec.it_value.tv_sec = first / 1000;
+	spec.it_value.tv_nsec = (first % 1000) * 1000000;
+	if (repeat)
+		spec.it_interval = spec.it_value;
+
+	watcher_t *watcher = NULL;
+	if (timerfd_settime(fd, 0, &spec, NULL) == 0)
+		watcher = add_watcher(fd, EPOLLIN, callback, data);
+	if (watcher == NULL) {
+		close(fd);
+		return -1;
+	}
+	watcher->owned = true;
+	watcher->timer = true;
+	watcher->repeat = repeat;
+	return fd;
+}
+
+void lush_loop_on_signal(int signum, signal_callback_t callback, void *data) {
+	signal_handlers[signum].callback = callback;
+	signal_handlers[signum].data = data;
+	if (sigismember(&signal_mask, signum))
+		return;
+
+	// blocked signals are queued for the signalfd even when ignored
+	sigset_t block;
+	sigemptyset(&block);
+	sigaddset(&block, signum);
+	sigprocmask(SIG_BLOCK, &block, NULL);
+	sigaddset(&signal_mask, signum);
+	signalfd(signal_fd, &signal_mask, 0);
+}
+
+void lush_loop_release_signal(int signum) {
+	signal_handlers[signum].callback = NULL;
+	signal_handlers[signum].data = NULL;
+	if (signum == SIGCHLD || !sigismember(&signal_mask, signum))
+		return;
+
+	sigdelset(&signal_mask, signum);
+	signalfd(signal_fd, &signal_mask, 0);
+
+	// ignoring it drops a pending one that would otherwise go off with
+	// whatever disposition it has once unblocked, callers set the real one
+	signal(signum, SIG_IGN);
+	sigset_t unblock;
+	sigemptyset(&unblock);
+	sigaddset(&unblock, signum);
+	sigprocmask(SIG_UNBLOCK, &unblock, NULL);
+}
+
+int lush_loop_run_once(int timeout_ms) {
+	struct epoll_event events[LOOP_MAX_EVENTS];
+	int count = epoll_wait(epoll_fd, events, LOOP_MAX_EVENTS, timeout_ms);
+	if (count < 0) {
+		if (errno != EINTR)
+			perror("epoll_wait");
+		return 0;
+	}
+
+	int handled = 0;
+	for (int i = 0; i < count; i++) {
+		int fd = (int)(uint32_t)events[i].data.u64;
+		uint32_t generation = events[i].data.u64 >> 32;
+		// an earlier callback may have removed or replaced this watcher
+		if (fd >= watchers_capacity || watchers[fd].callback == NULL ||
+			watchers[fd].generation != generation)
+			continue;
+
+		watcher_t watcher = watchers[fd];
+		if (watcher.timer) {
+			uint64_t expirations;
+			if (read(fd, &expirations, sizeof(expirations)) < 0)
+				continue;
+			if (!watcher.repeat)
+				lush_loop_remove(fd);
+		}
+		watcher.callback(fd, events[i].events, watcher.data);
+		handled++;
+	}
+	return handled;
+}
+
+static void mark_ready(int fd, uint32_t events, void *data) {
+	*(bool *)data = true;
+}
+
+bool lush_loop_wait_readable(int fd) {
+	// files can not be polled and are always readable
+	bool ready = false;
+	if (epoll_fd < 0 || lush_loop_add_fd(fd, EPOLLIN, mark_ready, &ready) != 0)
+		return true;
+	while (lush_loop_run_once(-1) == 0)
+		;
+	lush_loop_remove(fd);
+	return ready;
+}
@@ -0,0 +1,71 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// called with the fd that became ready and what it is ready for
+typedef void (*loop_callback_t)(int fd, uint32_t events, void *data);
+
+// called with the signal that arrived, outside of any signal handler
+typedef void (*signal_callback_t)(int signum, void *data);
+
+// creates the epoll set and routes SIGCHLD through a signalfd. call before
+// any child or thread is started so the signal is blocked everywhere
+void lush_loop_init();
+
+// gives a forked child a loop of its own. the parent's watchers are
+// dropped, signal callbacks are kept
+void lush_loop_after_fork();
+
+// watches fd for events, returns 0 or -1 with errno set
+int lush_loop_add_fd(int fd, uint32_t events, loop_callback_t callback,
+					 void *data);
+
+// stops watching fd and returns the data it was added with. fds the loop
+// opened itself, pidfds and timers, are closed
+void *lush_loop_remove(int fd);
+
+// calls back once pid has exited through a pidfd, returns the pidfd or -1
+// when the kernel has none, SIGCHLD still reports the exit then
+int lush_loop_watch_pid(pid_t pid, loop_callback_t callback, void *data);
+
+// fires after ms and then every ms when repeat is set, returns the timer's
+// id for lush_loop_remove. a one shot timer is removed after it fires but
+// its data is left to the callback
+int lush_loop_add_timer(long ms, bool repeat, loop_callback_t callback,
+						void *data);
+
+// blocks signum and delivers it to callback, replacing the previous one
+void lush_loop_on_signal(int signum, signal_callback_t callback, void *data);
+
+// gives signum back to its normal disposition
+void lush_loop_release_signal(int signum);
+
+// waits up to timeout_ms, -1 for ever, and dispatches what is ready.
+// returns how many events were handled
+int lush_loop_run_once(int timeout_ms);
+
+// runs the loop until fd is readable or something else was dispatched,
+// returns whether fd is readable
+bool lush_loop_wait_readable(int fd);
+
+#endif // LOOP_H
@@ -15,49 +15,156 @@ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
 IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
 */
 
+#define _GNU_SOURCE
 #include "lua_api.h"
+#include "bytecode.h"
+#include "capture.h"
+#include "eval.h"
+#include "expand.h"
+#include "hashmap.h"
+#include "jobs.h"
+#include "launch.h"
+#include "loop.h"
 #include "lush.h"
+#include "pool.h"
+#include "wildcard.h"
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <lauxlib.h>
 #include <lua.h>
 #include <lualib.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 // globals
 static bool debug_mode = false;
 bool suggestion_enable = true;
 char *alt_shell;
+bool pipefail_enable = false;
 
 // -- script execution --
-int lua_load_script(lua_State *L, const char *script, char **args) {
-	char script_path[512];
-	// check if script is in the current directory
+
+#define SCRIPTS_DIR "/.config/lush/scripts"
+
+// names of scripts found in the scripts directory and where, so running
+// one again does not search for it
+static hashmap_t *script_paths = NULL;
+
+// HOME followed by rest, malloc'd. NULL if HOME is not set
+static char *home_path(const char *rest) {
+	const char *home_dir = getenv("HOME");
+	if (home_dir == NULL)
+		return NULL;
+	char *path = malloc(strlen(home_dir) + strlen(rest) + 1);
+	if (path == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	strcpy(stpcpy(path, home_dir), rest);
+	return path;
+}
+
+void lua_clear_script_cache() {
+	if (script_paths == NULL)
+		return;
+	for (unsigned int i = 0; i < script_paths->cap; i++) {
+		for (map_pair_t *pair = script_paths->list[i]; pair;
+			 pair = pair->next) {
+			free(pair->key);
+			free(pair->val);
+		}
+	}
+	hm_free_hashmap(script_paths);
+	script_paths = NULL;
+}
+
+// takes ownership of path, NULL forgets the script. the map can not
+// delete so a forgotten name keeps its entry without a path
+static void set_script_path(const char *script, char *path) {
+	if (script_paths == NULL)
+		script_paths = hm_new_hashmap();
+
+	unsigned int index = hm_hashcode(script_paths, (char *)script);
+	for (map_pair_t *pair = script_paths->list[index]; pair;
+		 pair = pair->next) {
+		if (strcmp(pair->key, script) == 0) {
+			free(pair->val);
+			pair->val = path;
+			return;
+		}
+	}
+
+	char *key = strdup(script);
+	if (key == NULL) {
+		perror("strdup failed");
+		exit(1);
+	}
+	hm_set(script_paths, key, path);
+}
+
+// the working directory comes first and is never cached, then the scripts
+// directory. returns a malloc'd path or NULL, cached is set for a path
+// that came from the cache without checking it still exists
+static char *find_script(const char *script, bool *cached) {
+	*cached = false;
 	if (access(script, F_OK) == 0) {
-		snprintf(script_path, sizeof(script_path), "%s", script);
-	} else {
-		const char *home_dir = getenv("HOME");
-		if (home_dir != NULL) {
-			snprintf(script_path, sizeof(script_path),
-					 "%s/.config/lush/scripts/%s", home_dir, script);
-
-			if (access(script_path, F_OK) != 0) {
-				// script not in either location
-				fprintf(stderr, "[C] Script not found: %s\n", script);
-				return -1;
-			}
-		} else {
-			// HOME not set
-			fprintf(stderr, "[C] HOME directory is not set.\n");
-			return -1;
+		char *path = strdup(script);
+		if (path == NULL) {
+			perror("strdup failed");
+			exit(1);
 		}
+		return path;
 	}
+
+	char *path = script_paths ? hm_get(script_paths, (char *)script) : NULL;
+	if (path != NULL) {
+		*cached = true;
+		return strdup(path);
+	}
+
+	char *dir = home_path(SCRIPTS_DIR "/");
+	if (dir == NULL)
+		return NULL;
+	path = malloc(strlen(dir) + strlen(script) + 1);
+	if (path == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	strcpy(stpcpy(path, dir), script);
+	free(dir);
+	if (access(path, F_OK) != 0) {
+		free(path);
+		return NULL;
+	}
+	set_script_path(script, strdup(path));
+	return path;
+}
+
+int lua_load_script(lua_State *L, const char *script, char **args) {
+	bool cached;
+	char *script_path = find_script(script, &cached);
+	if (script_path == NULL) {
+		if (getenv("HOME") == NULL)
+			fprintf(stderr, "[C] HOME directory is not set.\n");
+		else
+			fprintf(stderr, "[C] Script not found: %s\n", script);
+		return -1;
+	}
+
 	// add args global if args were passed
 	if (args != NULL && args[0] != NULL) {
 		lua_newtable(L);
@@ -70,8 +177,24 @@ int lua_load_script(lua_State *L, const char *script, char **args) {
 	}
 
 	int rc = 0;
-	// if we got here the file exists
-	if (luaL_loadfile(L, script_path) == LUA_OK) {
+	int load = lush_load_file(L, script_path);
+	// a cached path that vanished gets one fresh search
+	if (load == LUA_ERRFILE && cached) {
+		lua_pop(L, 1);
+		set_script_path(script, NULL);
+		free(script_path);
+		script_path = find_script(script, &cached);
+		if (script_path == NULL) {
+			fprintf(stderr, "[C] Script not found: %s\n", script);
+			rc = -1;
+		} else {
+			load = lush_load_file(L, script_path);
+		}
+	}
+
+	if (rc != 0) {
+		// nothing was loaded
+	} else if (load == LUA_OK) {
 		if (lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK) {
 			const char *error_msg = lua_tostring(L, -1);
 			fprintf(stderr, "[C] Error executing script: %s\n", error_msg);
@@ -84,6 +207,7 @@ int lua_load_script(lua_State *L, const char *script, char **args) {
 		lua_pop(L, 1); // remove error from stack
 		rc = -1;
 	}
+	free(script_path);
 
 	// reset args after running or just keep it nil
 	lua_pushnil(L);
@@ -92,39 +216,74 @@ int lua_load_script(lua_State *L, const char *script, char **args) {
 }
 
 void lua_run_init(lua_State *L) {
-	char script_path[64];
-	const char *home_dir = getenv("HOME");
-	if (home_dir != NULL) {
-		snprintf(script_path, sizeof(script_path), "%s/.config/lush/init.lua",
-				 home_dir);
-		FILE *f = fopen(script_path, "r");
-		if (f != NULL) {
-			fclose(f);
-			lua_load_script(L, script_path, NULL);
+	char *script_path = home_path("/.config/lush/init.lua");
+	if (script_path != NULL && access(script_path, F_OK) == 0)
+		lua_load_script(L, script_path, NULL);
+	free(script_path);
+}
+
+// package.searchers entry for modules in the scripts directory, a.b is
+// looked for as a/b.lua and then a/b/init.lua. require keeps what it
+// loads in package.loaded so each module runs once per session
+static int search_scripts(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+	char *dir = home_path(SCRIPTS_DIR);
+	if (dir == NULL) {
+		lua_pushstring(L, "no HOME for the lush scripts directory");
+		return 1;
+	}
+	const char *module = luaL_gsub(L, name, ".", "/");
+	const char *patterns[] = {"%s/%s.lua", "%s/%s/init.lua"};
+
+	luaL_Buffer tried;
+	luaL_buffinit(L, &tried);
+	for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		const char *path = lua_pushfstring(L, patterns[i], dir, module);
+		if (access(path, R_OK) == 0) {
+			free(dir);
+			if (lush_load_file(L, path) != LUA_OK)
+				return luaL_error(L, "error loading module '%s' from file "
+									 "'%s':\n\t%s",
+								  name, path, lua_tostring(L, -1));
+			lua_pushstring(L, path);
+			return 2;
 		}
+		// 5.4 puts the separator before each searcher's message itself
+		if (i > 0 || LUA_VERSION_NUM < 504)
+			luaL_addstring(&tried, "\n\t");
+		lua_pushfstring(L, "no file '%s'", path);
+		lua_remove(L, -2);
+		luaL_addvalue(&tried);
 	}
+	free(dir);
+	luaL_pushresult(&tried);
+	return 1;
 }
 
-// -- C funtions --
-static int execute_command(lua_State *L, const char *line) {
-	int status = 0;
-	lush_push_history(line);
-	char *expanded_line = lush_resolve_aliases((char *)line);
-	char **commands = lush_split_commands(expanded_line);
-	char ***args = lush_split_args(commands, &status);
-
-	if (status == -1) {
-		fprintf(stderr, "lush: Expected end of quoted string\n");
-	} else if (lush_run(L, args, status) != 0) {
-		return -1;
+// puts search_scripts right after the preload searcher
+static void register_searcher(lua_State *L) {
+	lua_getglobal(L, "package");
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		return;
 	}
-
-	for (int i = 0; args[i]; i++) {
-		free(args[i]);
+	lua_getfield(L, -1, "searchers");
+	if (lua_istable(L, -1)) {
+		for (int i = luaL_len(L, -1); i >= 2; i--) {
+			lua_rawgeti(L, -1, i);
+			lua_rawseti(L, -2, i + 1);
+		}
+		lua_pushcfunction(L, search_scripts);
+		lua_rawseti(L, -2, 2);
 	}
-	free(args);
-	free(commands);
-	return 0;
+	lua_pop(L, 2);
+}
+
+// -- C funtions --
+static int execute_command(lua_State *L, const char *line, bool history) {
+	if (history)
+		lush_push_history(line);
+	return lush_eval_line(L, line);
 }
 
 static char *get_expanded_path(const char *check_item) {
@@ -158,22 +317,79 @@ static char *get_expanded_path(const char *check_item) {
 }
 
 // -- Lua wrappers --
+// whether the options table at index asks for lines to go into history
+static bool history_opt(lua_State *L, int index, bool fallback) {
+	if (!lua_istable(L, index))
+		return fallback;
+	lua_getfield(L, index, "history");
+	bool history = lua_isnil(L, -1) ? fallback : lua_toboolean(L, -1);
+	lua_pop(L, 1);
+	return history;
+}
+
+static void debug_executed(const char *command, bool rc) {
+	if (!debug_mode)
+		return;
+	if (rc)
+		printf("Executed: %s, success\n", command);
+	else
+		printf("Executed: %s, failed\n", command);
+}
+
 static int l_execute_command(lua_State *L) {
 	const char *command = luaL_checkstring(L, 1);
-	int status = execute_command(L, command);
+	int status = execute_command(L, command, history_opt(L, 2, true));
 	bool rc = status == 0 ? true : false;
 
-	if (debug_mode) {
-		if (rc)
-			printf("Executed: %s, success\n", command);
-		else
-			printf("Executed: %s, failed\n", command);
-	}
+	debug_executed(command, rc);
 
 	lua_pushboolean(L, rc);
 	return 1;
 }
 
+// lush.execMany(lines [, opts]) runs each line in order and returns their
+// exit statuses. lines only go into history when opts.history is set and
+// then the file is rewritten once for the whole batch
+static int l_exec_many(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	bool history = history_opt(L, 2, false);
+	int count = luaL_len(L, 1);
+	for (int i = 1; i <= count; i++) {
+		lua_rawgeti(L, 1, i);
+		if (lua_type(L, -1) != LUA_TSTRING)
+			return luaL_error(L, "execMany: line %d is not a string", i);
+		lua_pop(L, 1);
+	}
+
+	if (history && count > 0) {
+		const char **lines = malloc(count * sizeof(char *));
+		if (lines == NULL) {
+			perror("malloc failed");
+			exit(1);
+		}
+		for (int i = 1; i <= count; i++) {
+			lua_rawgeti(L, 1, i);
+			lines[i - 1] = lua_tostring(L, -1);
+			lua_pop(L, 1);
+		}
+		lush_push_history_lines(lines, count);
+		free(lines);
+	}
+
+	lua_createtable(L, count, 0);
+	for (int i = 1; i <= count; i++) {
+		// the line stays on the stack so a command can not collect it
+		lua_rawgeti(L, 1, i);
+		const char *line = lua_tostring(L, -1);
+		int status = execute_command(L, line, false);
+		debug_executed(line, status == 0);
+		lua_pop(L, 1);
+		lua_pushinteger(L, status);
+		lua_rawseti(L, -2, i);
+	}
+	return 1;
+}
+
 static int l_get_cwd(lua_State *L) {
 	char *cwd = getcwd(NULL, 0);
 	lua_pushstring(L, cwd);
@@ -188,6 +404,13 @@ static int l_suggestions(lua_State *L) {
 	return 0;
 }
 
+static int l_pipefail(lua_State *L) {
+	if (lua_isboolean(L, 1)) {
+		pipefail_enable = lua_toboolean(L, 1);
+	}
+	return 0;
+}
+
 static int l_debug(lua_State *L) {
 	if (lua_isboolean(L, 1)) {
 		debug_mode = lua_toboolean(L, 1);
@@ -215,76 +438,48 @@ static int l_cd(lua_State *L) {
 	return 1;
 }
 
+// pushes path with a leading ~ replaced by $HOME and returns it. the other
+// checks go straight to the kernel without resolving the path first
+static const char *push_home_path(lua_State *L, const char *path) {
+	const char *home = getenv("HOME");
+	if (path[0] == '~' && (path[1] == '/' || path[1] == '\0') && home)
+		return lua_pushfstring(L, "%s%s", home, path + 1);
+	lua_pushstring(L, path);
+	return path;
+}
+
 static int l_exists(lua_State *L) {
-	const char *check_item = luaL_checkstring(L, 1);
-	char *exp_path = get_expanded_path(check_item);
-	// if the path doesnt exist
-	if (exp_path == NULL) {
-		lua_pushboolean(L, false);
-		return 1;
-	}
-	lua_pushboolean(L, true);
-	free(exp_path);
+	const char *path = push_home_path(L, luaL_checkstring(L, 1));
+	struct stat path_stat;
+	lua_pushboolean(L, stat(path, &path_stat) == 0);
 	return 1;
 }
 
 static int l_is_file(lua_State *L) {
-	const char *check_item = luaL_checkstring(L, 1);
-	char *exp_path = get_expanded_path(check_item);
-	// if the path doesnt exist
-	if (exp_path == NULL) {
-		lua_pushboolean(L, false);
-		return 1;
-	}
+	const char *path = push_home_path(L, luaL_checkstring(L, 1));
 	struct stat path_stat;
-	stat(exp_path, &path_stat);
-	bool rc = S_ISREG(path_stat.st_mode);
-	lua_pushboolean(L, rc);
-	free(exp_path);
+	lua_pushboolean(L, stat(path, &path_stat) == 0 &&
+						   S_ISREG(path_stat.st_mode));
 	return 1;
 }
 
 static int l_is_dir(lua_State *L) {
-	const char *check_item = luaL_checkstring(L, 1);
-	char *exp_path = get_expanded_path(check_item);
-	// if the path doesnt exist
-	if (exp_path == NULL) {
-		lua_pushboolean(L, false);
-		return 1;
-	}
+	const char *path = push_home_path(L, luaL_checkstring(L, 1));
 	struct stat path_stat;
-	stat(exp_path, &path_stat);
-	bool rc = S_ISDIR(path_stat.st_mode);
-	lua_pushboolean(L, rc);
-	free(exp_path);
+	lua_pushboolean(L, stat(path, &path_stat) == 0 &&
+						   S_ISDIR(path_stat.st_mode));
 	return 1;
 }
 
 static int l_is_readable(lua_State *L) {
-	const char *check_item = luaL_checkstring(L, 1);
-	char *exp_path = get_expanded_path(check_item);
-	// if the path doesnt exist
-	if (exp_path == NULL) {
-		lua_pushboolean(L, false);
-		return 1;
-	}
-	bool rc = access(exp_path, R_OK) == 0;
-	lua_pushboolean(L, rc);
-	free(exp_path);
+	const char *path = push_home_path(L, luaL_checkstring(L, 1));
+	lua_pushboolean(L, access(path, R_OK) == 0);
 	return 1;
 }
 
 static int l_is_writeable(lua_State *L) {
-	const char *check_item = luaL_checkstring(L, 1);
-	char *exp_path = get_expanded_path(check_item);
-	// if the path doesnt exist
-	if (exp_path == NULL) {
-		lua_pushboolean(L, false);
-		return 1;
-	}
-	bool rc = access(exp_path, W_OK) == 0;
-	lua_pushboolean(L, rc);
-	free(exp_path);
+	const char *path = push_home_path(L, luaL_checkstring(L, 1));
+	lua_pushboolean(L, access(path, W_OK) == 0);
 	return 1;
 }
 
@@ -314,7 +509,7 @@ static int l_get_history(lua_State *L) {
 
 static int l_get_env(lua_State *L) {
 	const char *env = luaL_checkstring(L, 1);
-	char *env_val = getenv(env);
+	char *env_val = lush_env_get(env);
 	lua_pushstring(L, env_val);
 	return 1;
 }
@@ -322,13 +517,13 @@ static int l_get_env(lua_State *L) {
 static int l_set_env(lua_State *L) {
 	const char *env_name = luaL_checkstring(L, 1);
 	const char *env_value = luaL_checkstring(L, 2);
-	setenv(env_name, env_value, 1);
+	lush_env_set(env_name, env_value);
 	return 0;
 }
 
 static int l_unset_env(lua_State *L) {
 	const char *env = luaL_checkstring(L, 1);
-	unsetenv(env);
+	lush_env_unset(env);
 	return 0;
 }
 
@@ -381,46 +576,468 @@ static int l_terminal_rows(lua_State *L) {
 	return 1;
 }
 
-static int l_glob(lua_State *L) {
-	const char *ext = luaL_checkstring(L, 1);
-	DIR *dir;
-	struct dirent *entry;
-	size_t size = 0;
+// -- glob --
 
-	// Open the current directory
-	dir = opendir(".");
-	if (dir == NULL) {
-		perror("Unable to open current directory");
+#define GLOB_ITER_META "lush.glob_iter"
+
+static const char *glob_type_name(unsigned char type) {
+	switch (type) {
+	case DT_REG:
+		return "file";
+	case DT_DIR:
+		return "directory";
+	case DT_LNK:
+		return "link";
+	case DT_FIFO:
+		return "fifo";
+	case DT_SOCK:
+		return "socket";
+	case DT_CHR:
+		return "char";
+	case DT_BLK:
+		return "block";
+	default:
+		return "unknown";
+	}
+}
+
+static int glob_parse_type(lua_State *L, const char *type) {
+	if (strcmp(type, "file") == 0 || strcmp(type, "f") == 0)
+		return DT_REG;
+	if (strcmp(type, "directory") == 0 || strcmp(type, "dir") == 0 ||
+		strcmp(type, "d") == 0)
+		return DT_DIR;
+	if (strcmp(type, "link") == 0 || strcmp(type, "l") == 0)
+		return DT_LNK;
+	return luaL_error(L, "glob: unknown type '%s'", type);
+}
+
+// reads a field of the options table, leaving it on the stack
+static int glob_opt(lua_State *L, const char *name) {
+	if (!lua_istable(L, 2))
+		return LUA_TNIL;
+	lua_getfield(L, 2, name);
+	return lua_type(L, -1);
+}
+
+static int glob_iter_gc(lua_State *L) {
+	wildcard_iter_t **iter = luaL_checkudata(L, 1, GLOB_ITER_META);
+	lush_wildcard_iter_free(*iter);
+	*iter = NULL;
+	return 0;
+}
+
+static int glob_iter_next(lua_State *L) {
+	wildcard_iter_t **iter =
+		luaL_checkudata(L, lua_upvalueindex(1), GLOB_ITER_META);
+	if (*iter == NULL)
+		return 0;
+
+	unsigned char type;
+	const char *path = lush_wildcard_iter_next(*iter, &type);
+	if (path == NULL) {
+		// let go of the buffers now instead of waiting for the collector
+		lush_wildcard_iter_free(*iter);
+		*iter = NULL;
 		return 0;
 	}
+	lua_pushstring(L, path);
+	lua_pushstring(L, glob_type_name(type));
+	return 2;
+}
+
+// full glob syntax relative to dir, the dir itself is escaped
+static void glob_expand(lua_State *L, const char *dir, const char *pattern) {
+	size_t dir_len = dir && *pattern != '/' ? strlen(dir) : 0;
+	char *full = malloc(2 * dir_len + strlen(pattern) + 2);
+	if (full == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+
+	size_t len = 0;
+	for (size_t i = 0; i < dir_len; i++) {
+		if (strchr("*?[]{}\\", dir[i]))
+			full[len++] = '\\';
+		full[len++] = dir[i];
+	}
+	if (dir_len > 0 && dir[dir_len - 1] != '/')
+		full[len++] = '/';
+	strcpy(full + len, pattern);
+
+	argv_t matches = {0};
+	lush_wildcard_expand(full, &matches);
+	free(full);
+
+	lua_createtable(L, matches.count, 0);
+	for (size_t i = 0; i < matches.count; i++) {
+		lua_pushstring(L, matches.items[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lush_argv_free(&matches);
+}
+
+static int l_glob(lua_State *L) {
+	const char *pattern = luaL_checkstring(L, 1);
+	if (!lua_isnoneornil(L, 2))
+		luaL_checktype(L, 2, LUA_TTABLE);
+	int top = lua_gettop(L);
+
+	const char *dir = NULL;
+	if (glob_opt(L, "dir") != LUA_TNIL)
+		dir = luaL_checkstring(L, -1);
+	bool recursive = glob_opt(L, "recursive") != LUA_TNIL &&
+					 lua_toboolean(L, -1);
+	int max_depth = -1;
+	bool has_depth = glob_opt(L, "maxDepth") != LUA_TNIL;
+	if (has_depth)
+		max_depth = luaL_checkinteger(L, -1);
+	int type = -1;
+	if (glob_opt(L, "type") != LUA_TNIL)
+		type = glob_parse_type(L, luaL_checkstring(L, -1));
+	bool hidden = glob_opt(L, "hidden") != LUA_TNIL && lua_toboolean(L, -1);
+	bool iterate = glob_opt(L, "iter") != LUA_TNIL && lua_toboolean(L, -1);
+	// the strings stay referenced by the options table
+	lua_settop(L, top);
+
+	// a bare word is an extension like the original lush.glob("txt")
+	if (strpbrk(pattern, "*?[{/.") == NULL && lua_isnoneornil(L, 2)) {
+		lua_pushfstring(L, "*.%s", pattern);
+		pattern = lua_tostring(L, -1);
+	}
+
+	if (!recursive && !has_depth && type < 0 && !iterate && !hidden) {
+		glob_expand(L, dir, pattern);
+		return 1;
+	}
+
+	// walking matches single names so types can come from d_type
+	if (strchr(pattern, '/') != NULL)
+		return luaL_argerror(L, 1, "must not contain / when walking");
+	if (!recursive && !has_depth)
+		max_depth = 1;
+
+	wildcard_iter_t **iter = lua_newuserdata(L, sizeof(wildcard_iter_t *));
+	*iter = lush_wildcard_iter_new(dir, pattern, type, max_depth, hidden);
+	if (luaL_newmetatable(L, GLOB_ITER_META)) {
+		lua_pushcfunction(L, glob_iter_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+
+	if (iterate) {
+		lua_pushcclosure(L, glob_iter_next, 1);
+		return 1;
+	}
 
-	// Create a Lua table for the results
 	lua_newtable(L);
+	unsigned char entry_type;
+	const char *path;
+	for (lua_Integer i = 1;
+		 (path = lush_wildcard_iter_next(*iter, &entry_type)) != NULL; i++) {
+		lua_pushstring(L, path);
+		lua_rawseti(L, -2, i);
+	}
+	return 1;
+}
 
-	// Read each directory entry
-	while ((entry = readdir(dir)) != NULL) {
-		const char *last_dot = strrchr(entry->d_name, '.');
+// -- file metadata --
 
-		// Only process files with extensions
-		if (last_dot != NULL) {
-			last_dot++; // Move past dot to the extension
+#define DIR_ITER_META "lush.dir_iter"
+#define DIR_BUFFER_SIZE 32768
+#define STAT_MASK (STATX_BASIC_STATS | STATX_BTIME)
 
-			// Check if the extension matches the input argument
-			if (strcmp(last_dot, ext) == 0) {
-				lua_pushstring(L, entry->d_name);
-				lua_rawseti(L, -2, size + 1);
-				size++;
-			}
-		}
+typedef struct {
+	int fd;
+	bool stat;
+	bool follow;
+	char *dents;
+	long len;
+	long offset;
+} dir_iter_t;
+
+// the ids access() checks against, read on the first stat. parallel
+// workers stat from their own threads
+static pthread_once_t ids_once = PTHREAD_ONCE_INIT;
+static uid_t stat_uid;
+static gid_t stat_gid;
+static gid_t *stat_groups;
+static int num_stat_groups;
+
+static void load_ids() {
+	stat_uid = getuid();
+	stat_gid = getgid();
+	int count = getgroups(0, NULL);
+	if (count <= 0)
+		return;
+	stat_groups = malloc(count * sizeof(gid_t));
+	if (stat_groups == NULL) {
+		perror("malloc failed");
+		exit(1);
 	}
+	num_stat_groups = getgroups(count, stat_groups);
+	if (num_stat_groups < 0)
+		num_stat_groups = 0;
+}
 
-	// Close the directory
-	closedir(dir);
+static bool in_group(gid_t gid) {
+	if (gid == stat_gid)
+		return true;
+	for (int i = 0; i < num_stat_groups; i++) {
+		if (stat_groups[i] == gid)
+			return true;
+	}
+	return false;
+}
+
+// what access() would say from the mode alone, acls are not looked at
+static bool mode_allows(const struct statx *st, int want) {
+	pthread_once(&ids_once, load_ids);
+	if (stat_uid == 0)
+		return want != X_OK || (st->stx_mode & 0111) ||
+			   S_ISDIR(st->stx_mode);
+	int shift = 0;
+	if (st->stx_uid == stat_uid)
+		shift = 6;
+	else if (in_group(st->stx_gid))
+		shift = 3;
+	return ((st->stx_mode >> shift) & want) == want;
+}
+
+static void set_integer(lua_State *L, const char *name, lua_Integer value) {
+	lua_pushinteger(L, value);
+	lua_setfield(L, -2, name);
+}
+
+static void set_time(lua_State *L, const char *name,
+					 const struct statx_timestamp *ts) {
+	lua_pushnumber(L, ts->tv_sec + ts->tv_nsec / 1e9);
+	lua_setfield(L, -2, name);
+}
 
-	// Return the table with matching filenames
+static void set_boolean(lua_State *L, const char *name, bool value) {
+	lua_pushboolean(L, value);
+	lua_setfield(L, -2, name);
+}
+
+// pushes a table of everything one statx returns for path, relative to
+// dir_fd. leaves the stack alone and returns errno when it fails
+static int push_stat(lua_State *L, int dir_fd, const char *path,
+					 bool follow) {
+	struct statx st;
+	if (statx(dir_fd, path, follow ? 0 : AT_SYMLINK_NOFOLLOW, STAT_MASK,
+			  &st) != 0)
+		return errno;
+
+	lua_createtable(L, 0, 16);
+	lua_pushstring(L, glob_type_name(IFTODT(st.stx_mode)));
+	lua_setfield(L, -2, "type");
+	set_integer(L, "size", st.stx_size);
+	set_integer(L, "mode", st.stx_mode & 07777);
+	set_integer(L, "uid", st.stx_uid);
+	set_integer(L, "gid", st.stx_gid);
+	set_integer(L, "nlink", st.stx_nlink);
+	set_integer(L, "ino", st.stx_ino);
+	set_integer(L, "dev", makedev(st.stx_dev_major, st.stx_dev_minor));
+	set_integer(L, "blocks", st.stx_blocks);
+	set_time(L, "atime", &st.stx_atime);
+	set_time(L, "mtime", &st.stx_mtime);
+	set_time(L, "ctime", &st.stx_ctime);
+	// not every file system keeps the creation time
+	if (st.stx_mask & STATX_BTIME)
+		set_time(L, "btime", &st.stx_btime);
+	set_boolean(L, "readable", mode_allows(&st, R_OK));
+	set_boolean(L, "writeable", mode_allows(&st, W_OK));
+	set_boolean(L, "executable", mode_allows(&st, X_OK));
+	return 0;
+}
+
+// reads opts.follow, on by default, and opts.realpath
+static void stat_opts(lua_State *L, int index, bool *follow, bool *real) {
+	*follow = true;
+	*real = false;
+	if (lua_isnoneornil(L, index))
+		return;
+	luaL_checktype(L, index, LUA_TTABLE);
+	lua_getfield(L, index, "follow");
+	if (!lua_isnil(L, -1))
+		*follow = lua_toboolean(L, -1);
+	lua_getfield(L, index, "realpath");
+	*real = lua_toboolean(L, -1);
+	lua_pop(L, 2);
+}
+
+// adds the resolved path to the table on top, only done when asked since
+// realpath costs a syscall for every component
+static void set_realpath(lua_State *L, const char *path) {
+	char *resolved = realpath(path, NULL);
+	if (resolved == NULL)
+		return;
+	lua_pushstring(L, resolved);
+	lua_setfield(L, -2, "realpath");
+	free(resolved);
+}
+
+// lush.stat(path [, opts]) returns a table of the path's metadata from a
+// single statx, or nil, the error message and errno
+static int l_stat(lua_State *L) {
+	const char *path = luaL_checkstring(L, 1);
+	bool follow, real;
+	stat_opts(L, 2, &follow, &real);
+
+	const char *full = push_home_path(L, path);
+	int err = push_stat(L, AT_FDCWD, full, follow);
+	if (err != 0) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", path, strerror(err));
+		lua_pushinteger(L, err);
+		return 3;
+	}
+	if (real)
+		set_realpath(L, full);
 	return 1;
 }
 
+// lush.statMany(paths [, opts]) stats every path of a list, the result has
+// false where a path could not be read
+static int l_stat_many(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	bool follow, real;
+	stat_opts(L, 2, &follow, &real);
+
+	int count = luaL_len(L, 1);
+	lua_createtable(L, count, 0);
+	for (int i = 1; i <= count; i++) {
+		lua_rawgeti(L, 1, i);
+		if (lua_type(L, -1) != LUA_TSTRING)
+			return luaL_error(L, "statMany: path %d is not a string", i);
+		const char *full = push_home_path(L, lua_tostring(L, -1));
+		if (push_stat(L, AT_FDCWD, full, follow) != 0) {
+			lua_pushboolean(L, false);
+		} else if (real) {
+			set_realpath(L, full);
+		}
+		lua_rawseti(L, -4, i);
+		lua_pop(L, 2);
+	}
+	return 1;
+}
+
+static void dir_iter_close(dir_iter_t *iter) {
+	if (iter->fd >= 0)
+		close(iter->fd);
+	iter->fd = -1;
+	free(iter->dents);
+	iter->dents = NULL;
+}
+
+static int dir_iter_gc(lua_State *L) {
+	dir_iter_close(luaL_checkudata(L, 1, DIR_ITER_META));
+	return 0;
+}
+
+static int dir_iter_next(lua_State *L) {
+	dir_iter_t *iter = luaL_checkudata(L, lua_upvalueindex(1), DIR_ITER_META);
+	while (iter->fd >= 0) {
+		if (iter->offset >= iter->len) {
+			iter->len = syscall(SYS_getdents64, iter->fd, iter->dents,
+								DIR_BUFFER_SIZE);
+			iter->offset = 0;
+			if (iter->len <= 0)
+				dir_iter_close(iter);
+			continue;
+		}
+
+		struct linux_dirent64 *entry =
+			(struct linux_dirent64 *)(iter->dents + iter->offset);
+		iter->offset += entry->d_reclen;
+		const char *name = entry->d_name;
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			continue;
+
+		// only file systems without d_type need a stat
+		unsigned char type = entry->d_type;
+		struct stat st;
+		if (type == DT_UNKNOWN &&
+			fstatat(iter->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+			type = IFTODT(st.st_mode);
+
+		lua_pushstring(L, name);
+		lua_pushstring(L, glob_type_name(type));
+		if (!iter->stat)
+			return 2;
+		if (push_stat(L, iter->fd, name, iter->follow) != 0)
+			lua_pushboolean(L, false);
+		return 3;
+	}
+	return 0;
+}
+
+// for name, type [, stat] in lush.readdir(dir [, opts]) reads the entries
+// with getdents64, opts.stat adds each one's lush.stat table
+static int l_readdir(lua_State *L) {
+	const char *dir = luaL_checkstring(L, 1);
+	bool follow, real;
+	stat_opts(L, 2, &follow, &real);
+	bool with_stat = false;
+	if (lua_istable(L, 2)) {
+		lua_getfield(L, 2, "stat");
+		with_stat = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+	}
+
+	const char *full = push_home_path(L, dir);
+	int fd = open(full, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return luaL_error(L, "readdir: %s: %s", dir, strerror(errno));
+	lua_pop(L, 1);
+
+	dir_iter_t *iter = lua_newuserdata(L, sizeof(dir_iter_t));
+	memset(iter, 0, sizeof(dir_iter_t));
+	iter->fd = fd;
+	iter->stat = with_stat;
+	iter->follow = follow;
+	iter->dents = malloc(DIR_BUFFER_SIZE);
+	if (iter->dents == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	if (luaL_newmetatable(L, DIR_ITER_META)) {
+		lua_pushcfunction(L, dir_iter_gc);
+		lua_setfield(L, -2, "__gc");
+		lua_pushcfunction(L, dir_iter_gc);
+		lua_setfield(L, -2, "__close");
+	}
+	lua_setmetatable(L, -2);
+
+	// the userdata doubles as the closing value of a generic for
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, dir_iter_next, 1);
+	lua_pushnil(L);
+	lua_pushnil(L);
+	lua_pushvalue(L, -4);
+	return 4;
+}
+
+// -- task pool --
+
+// lush.parallel(fn, inputs [, opts]) maps fn over inputs on opts.workers
+// lua states in threads, one per cpu by default
+static int l_parallel(lua_State *L) {
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int workers = 0;
+	if (!lua_isnoneornil(L, 3)) {
+		luaL_checktype(L, 3, LUA_TTABLE);
+		lua_getfield(L, 3, "workers");
+		if (!lua_isnil(L, -1))
+			workers = luaL_checkinteger(L, -1);
+		lua_pop(L, 1);
+		if (workers < 0)
+			return luaL_error(L, "parallel: workers must not be negative");
+	}
+	return lush_pool_map(L, 1, 2, workers);
+}
+
 static int l_exit(lua_State *L) {
 	lua_pushstring(L, "program terminated by lush exit");
 	lua_error(L);
@@ -440,20 +1057,775 @@ static int l_alt_shell(lua_State *L) {
 	return 1;
 }
 
+// -- processes --
+
+#define PROC_META "lush.process"
+
+typedef struct {
+	// read end drained by the event loop, -1 once it hit end of file
+	int fd;
+	char *data;
+	size_t len;
+	size_t capacity;
+} proc_pipe_t;
+
+typedef struct {
+	pid_t pid;
+	int pidfd;
+	// exit status, or 128 plus the signal that killed it
+	int status;
+	bool exited;
+	proc_pipe_t out;
+	proc_pipe_t err;
+	// what the process was started with, for the job table
+	char *command;
+} lua_proc_t;
+
+static void proc_pipe_close(proc_pipe_t *pipe) {
+	if (pipe->fd < 0)
+		return;
+	lush_loop_remove(pipe->fd);
+	close(pipe->fd);
+	pipe->fd = -1;
+}
+
+static void proc_drain(int fd, uint32_t events, void *data) {
+	proc_pipe_t *pipe = data;
+	while (true) {
+		if (pipe->capacity - pipe->len < 4096) {
+			pipe->capacity = pipe->capacity ? pipe->capacity * 2 : 8192;
+			pipe->data = realloc(pipe->data, pipe->capacity);
+			if (pipe->data == NULL) {
+				perror("realloc failed");
+				exit(1);
+			}
+		}
+		ssize_t len =
+			read(fd, pipe->data + pipe->len, pipe->capacity - pipe->len);
+		if (len > 0) {
+			pipe->len += len;
+		} else if (len < 0 && errno == EINTR) {
+			continue;
+		} else {
+			if (len == 0 || errno != EAGAIN)
+				proc_pipe_close(pipe);
+			return;
+		}
+	}
+}
+
+// wakes the loop, the status is collected by proc_update
+static void proc_exited(int fd, uint32_t events, void *data) {}
+
+static void proc_update(lua_proc_t *proc) {
+	if (proc->exited)
+		return;
+
+	int wstatus;
+	pid_t pid = waitpid(proc->pid, &wstatus, WNOHANG);
+	if (pid == 0 || (pid < 0 && errno == EINTR))
+		return;
+	if (pid > 0)
+		proc->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus)
+										  : 128 + WTERMSIG(wstatus);
+	proc->exited = true;
+	if (proc->pidfd >= 0)
+		lush_loop_remove(proc->pidfd);
+	proc->pidfd = -1;
+}
+
+// finished once it exited and everything it wrote was read
+static bool proc_done(lua_proc_t *proc) {
+	proc_update(proc);
+	return proc->exited && proc->out.fd < 0 && proc->err.fd < 0;
+}
+
+static lua_proc_t *check_proc(lua_State *L, int index) {
+	return luaL_checkudata(L, index, PROC_META);
+}
+
+static int proc_gc(lua_State *L) {
+	lua_proc_t *proc = check_proc(L, 1);
+	proc_pipe_close(&proc->out);
+	proc_pipe_close(&proc->err);
+	free(proc->out.data);
+	free(proc->err.data);
+	proc->out.data = proc->err.data = NULL;
+	proc_update(proc);
+
+	// nobody is left to wait on it, the job table reaps it instead
+	if (!proc->exited) {
+		if (proc->pidfd >= 0)
+			lush_loop_remove(proc->pidfd);
+		char *words[] = {proc->command, NULL};
+		char **commands[] = {words};
+		job_t *job = lush_job_new(commands, 1);
+		// it was spawned into the shell's group
+		job->own_group = false;
+		lush_job_add_proc(job, proc->pid, 0);
+		lush_job_background(job, false);
+		proc->exited = true;
+	}
+	free(proc->command);
+	proc->command = NULL;
+	return 0;
+}
+
+// "inherit", "null" or "pipe" for one of the child's stdio fds
+static const char *proc_opt(lua_State *L, const char *name,
+							const char *fallback) {
+	if (!lua_istable(L, 2))
+		return fallback;
+	lua_getfield(L, 2, name);
+	const char *value = lua_isnil(L, -1) ? fallback : lua_tostring(L, -1);
+	lua_pop(L, 1);
+	if (value == NULL || (strcmp(value, "inherit") != 0 &&
+						  strcmp(value, "null") != 0 &&
+						  strcmp(value, "pipe") != 0))
+		luaL_error(L, "spawn: %s must be inherit, null or pipe", name);
+	return value;
+}
+
+// opens the child's end of one stdio fd and the shell's end of a pipe
+static int proc_open(const char *mode, int fd, int *pipe_end) {
+	*pipe_end = -1;
+	if (strcmp(mode, "null") == 0)
+		return open("/dev/null", (fd == STDIN_FILENO ? O_RDONLY : O_WRONLY) |
+									 O_CLOEXEC);
+	if (strcmp(mode, "pipe") != 0)
+		return fd;
+
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) == -1)
+		return -1;
+	// only the shell's end is non blocking, the child sees a normal pipe
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	*pipe_end = fds[0];
+	return fds[1];
+}
+
+static long now_ms() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// waits until one of the handles at index, a single one or an array of
+// them, is done. returns the handle and its position or nothing after
+// timeout_ms, -1 waits for ever
+static int proc_wait_any(lua_State *L, int index, long timeout_ms) {
+	long deadline = timeout_ms >= 0 ? now_ms() + timeout_ms : -1;
+	bool single = !lua_istable(L, index);
+	if (single)
+		check_proc(L, index);
+
+	while (true) {
+		int count = single ? 1 : luaL_len(L, index);
+		for (int i = 1; i <= count; i++) {
+			if (single)
+				lua_pushvalue(L, index);
+			else
+				lua_rawgeti(L, index, i);
+			if (proc_done(check_proc(L, -1))) {
+				lua_pushinteger(L, i);
+				return 2;
+			}
+			lua_pop(L, 1);
+		}
+		if (count == 0)
+			return 0;
+
+		long remaining = deadline < 0 ? -1 : deadline - now_ms();
+		if (deadline >= 0 && remaining <= 0)
+			return 0;
+		lush_loop_run_once(remaining);
+	}
+}
+
+static long opt_timeout(lua_State *L, int index) {
+	if (lua_isnoneornil(L, index))
+		return -1;
+	return (long)(luaL_checknumber(L, index) * 1000);
+}
+
+// lush.wait(handles [, seconds])
+static int l_wait(lua_State *L) {
+	luaL_checkany(L, 1);
+	return proc_wait_any(L, 1, opt_timeout(L, 2));
+}
+
+// handle:wait([seconds]) returns the status or nil on timeout
+static int proc_wait(lua_State *L) {
+	lua_proc_t *proc = check_proc(L, 1);
+	if (proc_wait_any(L, 1, opt_timeout(L, 2)) == 0)
+		return 0;
+	lua_pushinteger(L, proc->status);
+	return 1;
+}
+
+// handle:poll() returns the status once done, nil before
+static int proc_poll(lua_State *L) {
+	lua_proc_t *proc = check_proc(L, 1);
+	lush_loop_run_once(0);
+	if (!proc_done(proc))
+		return 0;
+	lua_pushinteger(L, proc->status);
+	return 1;
+}
+
+static int signal_number(lua_State *L, int index) {
+	if (lua_isnoneornil(L, index))
+		return SIGTERM;
+	if (lua_isnumber(L, index))
+		return lua_tointeger(L, index);
+
+	const char *name = luaL_checkstring(L, index);
+	if (strncmp(name, "SIG", 3) == 0)
+		name += 3;
+	static const struct {
+		const char *name;
+		int signum;
+	} names[] = {{"HUP", SIGHUP},	{"INT", SIGINT},   {"QUIT", SIGQUIT},
+				 {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+				 {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcmp(name, names[i].name) == 0)
+			return names[i].signum;
+	}
+	return luaL_error(L, "kill: unknown signal '%s'", name);
+}
+
+// handle:kill([signal]) sends SIGTERM or the signal given
+static int proc_kill(lua_State *L) {
+	lua_proc_t *proc = check_proc(L, 1);
+	int signum = signal_number(L, 2);
+	proc_update(proc);
+	if (proc->exited) {
+		lua_pushboolean(L, false);
+		return 1;
+	}
+	lua_pushboolean(L, kill(proc->pid, signum) == 0);
+	return 1;
+}
+
+static int proc_index(lua_State *L) {
+	lua_proc_t *proc = check_proc(L, 1);
+	const char *key = luaL_checkstring(L, 2);
+	if (strcmp(key, "pid") == 0) {
+		lua_pushinteger(L, proc->pid);
+	} else if (strcmp(key, "status") == 0) {
+		// only a finished process has one
+		if (proc_done(proc))
+			lua_pushinteger(L, proc->status);
+		else
+			lua_pushnil(L);
+	} else if (strcmp(key, "stdout") == 0 || strcmp(key, "stderr") == 0) {
+		proc_pipe_t *pipe = key[3] == 'o' ? &proc->out : &proc->err;
+		lua_pushlstring(L, pipe->data ? pipe->data : "", pipe->len);
+	} else {
+		// methods live in the metatable
+		luaL_getmetatable(L, PROC_META);
+		lua_getfield(L, -1, key);
+	}
+	return 1;
+}
+
+// copies the strings of the argv table at index, raising an error for an
+// empty table or one holding anything else
+static void check_argv(lua_State *L, int index, const char *name,
+					   argv_t *argv) {
+	int count = luaL_len(L, index);
+	for (int i = 1; i <= count; i++) {
+		lua_rawgeti(L, index, i);
+		const char *arg = lua_tostring(L, -1);
+		if (arg == NULL) {
+			lush_argv_free(argv);
+			luaL_error(L, "%s: argv entries must be strings", name);
+		}
+		lush_argv_push(argv, strdup(arg));
+		lua_pop(L, 1);
+	}
+	if (argv->count == 0)
+		luaL_error(L, "%s: empty argv", name);
+}
+
+static int l_spawn(lua_State *L) {
+	bool is_argv = lua_istable(L, 1);
+	const char *line = is_argv ? NULL : luaL_checkstring(L, 1);
+	const char *input = NULL;
+	if (lua_istable(L, 2)) {
+		lua_getfield(L, 2, "input");
+		input = lua_tostring(L, -1);
+		lua_pop(L, 1);
+	}
+	const char *in_mode = input ? "pipe" : proc_opt(L, "stdin", "inherit");
+	const char *out_mode = proc_opt(L, "stdout", "inherit");
+	const char *err_mode = proc_opt(L, "stderr", "inherit");
+	if (!input && strcmp(in_mode, "pipe") == 0)
+		return luaL_error(L, "spawn: give stdin data as input");
+
+	// an argv table runs without the shell
+	argv_t argv = {0};
+	if (is_argv)
+		check_argv(L, 1, "spawn", &argv);
+
+	lua_proc_t *proc = lua_newuserdata(L, sizeof(lua_proc_t));
+	memset(proc, 0, sizeof(lua_proc_t));
+	proc->pid = -1;
+	proc->pidfd = proc->out.fd = proc->err.fd = -1;
+	proc->command = strdup(is_argv ? argv.items[0] : line);
+	if (luaL_newmetatable(L, PROC_META)) {
+		lua_pushcfunction(L, proc_gc);
+		lua_setfield(L, -2, "__gc");
+		lua_pushcfunction(L, proc_index);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, proc_wait);
+		lua_setfield(L, -2, "wait");
+		lua_pushcfunction(L, proc_poll);
+		lua_setfield(L, -2, "poll");
+		lua_pushcfunction(L, proc_kill);
+		lua_setfield(L, -2, "kill");
+	}
+	lua_setmetatable(L, -2);
+
+	int fds[3];
+	int unused;
+	fds[0] = input ? lush_feed_pipe(strdup(input))
+				   : proc_open(in_mode, STDIN_FILENO, &unused);
+	fds[1] = proc_open(out_mode, STDOUT_FILENO, &proc->out.fd);
+	fds[2] = proc_open(err_mode, STDERR_FILENO, &proc->err.fd);
+
+	proc->status = 1;
+	if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0) {
+		perror("lush: spawn");
+	} else if (is_argv) {
+		proc->pid = lush_spawn_stdio(argv.items, fds, -1, false);
+		if (proc->pid < 0) {
+			fprintf(stderr, "lush: %s: %s\n", argv.items[0], strerror(errno));
+			proc->status = errno == ENOENT ? 127 : 126;
+		}
+	} else {
+		int status = 0;
+		ast_node_t *tree = lush_ast_parse(line, &status);
+		proc->status = status < 0 ? 2 : 0;
+		if (tree != NULL)
+			proc->pid = lush_eval_start(L, tree, fds, &proc->status);
+		lush_ast_free(tree);
+	}
+	lush_argv_free(&argv);
+
+	// the child has its own copies now
+	for (int i = 0; i < 3; i++) {
+		if (fds[i] > STDERR_FILENO)
+			close(fds[i]);
+	}
+
+	if (proc->pid < 0) {
+		proc->exited = true;
+		proc_pipe_close(&proc->out);
+		proc_pipe_close(&proc->err);
+		return 1;
+	}
+	proc->pidfd = lush_loop_watch_pid(proc->pid, proc_exited, proc);
+	if (proc->out.fd >= 0)
+		lush_loop_add_fd(proc->out.fd, EPOLLIN, proc_drain, &proc->out);
+	if (proc->err.fd >= 0)
+		lush_loop_add_fd(proc->err.fd, EPOLLIN, proc_drain, &proc->err);
+	return 1;
+}
+
+// lush.capture(command [, opts]) returns stdout, stderr, the status and
+// whether the output was cut at opts.max_bytes
+static int l_capture(lua_State *L) {
+	bool is_argv = lua_istable(L, 1);
+	const char *line = is_argv ? NULL : luaL_checkstring(L, 1);
+	lua_Integer max_bytes = LUSH_CAPTURE_MAX;
+	if (lua_istable(L, 2)) {
+		lua_getfield(L, 2, "max_bytes");
+		if (!lua_isnil(L, -1))
+			max_bytes = luaL_checkinteger(L, -1);
+		lua_pop(L, 1);
+	}
+	if (max_bytes < 0)
+		return luaL_error(L, "capture: max_bytes must not be negative");
+
+	argv_t argv = {0};
+	if (is_argv)
+		check_argv(L, 1, "capture", &argv);
+
+	capture_t result;
+	lush_capture(L, line, argv.items, max_bytes, true, &result);
+	lush_argv_free(&argv);
+	lua_pushlstring(L, result.out, result.out_len);
+	lua_pushlstring(L, result.err, result.err_len);
+	lua_pushinteger(L, result.status);
+	lua_pushboolean(L, result.truncated);
+	lush_capture_free(&result);
+	return 4;
+}
+
+#define LINES_META "lush.lines"
+#define LINES_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+	pid_t pid;
+	int fd;
+	// lines are cut straight out of this buffer, it only grows for a line
+	// longer than itself
+	char *data;
+	size_t start;
+	size_t end;
+	size_t capacity;
+} lines_iter_t;
+
+// stops a child that is still writing and reaps it
+static void lines_close(lines_iter_t *iter) {
+	if (iter->fd >= 0) {
+		close(iter->fd);
+		iter->fd = -1;
+		if (iter->pid > 0)
+			kill(iter->pid, SIGTERM);
+	}
+	if (iter->pid > 0) {
+		while (waitpid(iter->pid, NULL, 0) < 0 && errno == EINTR)
+			;
+		iter->pid = -1;
+	}
+	free(iter->data);
+	iter->data = NULL;
+}
+
+static int lines_gc(lua_State *L) {
+	lines_close(luaL_checkudata(L, 1, LINES_META));
+	return 0;
+}
+
+// refills the buffer, returns false at end of file
+static bool lines_fill(lines_iter_t *iter) {
+	if (iter->start > 0) {
+		memmove(iter->data, iter->data + iter->start, iter->end - iter->start);
+		iter->end -= iter->start;
+		iter->start = 0;
+	}
+	if (iter->end == iter->capacity) {
+		iter->capacity *= 2;
+		iter->data = realloc(iter->data, iter->capacity);
+		if (iter->data == NULL) {
+			perror("realloc failed");
+			exit(1);
+		}
+	}
+
+	ssize_t len;
+	do {
+		len = read(iter->fd, iter->data + iter->end,
+				   iter->capacity - iter->end);
+	} while (len < 0 && errno == EINTR);
+	if (len <= 0) {
+		close(iter->fd);
+		iter->fd = -1;
+		return false;
+	}
+	iter->end += len;
+	return true;
+}
+
+static int lines_next(lua_State *L) {
+	lines_iter_t *iter = luaL_checkudata(L, lua_upvalueindex(1), LINES_META);
+	if (iter->data == NULL)
+		return 0;
+
+	size_t scanned = iter->start;
+	while (true) {
+		char *newline = memchr(iter->data + scanned, '\n', iter->end - scanned);
+		if (newline != NULL) {
+			char *line = iter->data + iter->start;
+			lua_pushlstring(L, line, newline - line);
+			iter->start = newline - iter->data + 1;
+			return 1;
+		}
+		scanned = iter->end - iter->start;
+		if (iter->fd < 0 || !lines_fill(iter))
+			break;
+	}
+
+	// a last line without a newline still counts
+	int found = iter->end > iter->start;
+	if (found)
+		lua_pushlstring(L, iter->data + iter->start, iter->end - iter->start);
+	lines_close(iter);
+	return found;
+}
+
+// lush.lines(command) iterates over the lines the command prints as they
+// arrive. breaking out of the loop terminates the command
+static int l_lines(lua_State *L) {
+	bool is_argv = lua_istable(L, 1);
+	const char *line = is_argv ? NULL : luaL_checkstring(L, 1);
+	argv_t argv = {0};
+	if (is_argv)
+		check_argv(L, 1, "lines", &argv);
+
+	lines_iter_t *iter = lua_newuserdata(L, sizeof(lines_iter_t));
+	memset(iter, 0, sizeof(lines_iter_t));
+	iter->pid = iter->fd = -1;
+	if (luaL_newmetatable(L, LINES_META)) {
+		lua_pushcfunction(L, lines_gc);
+		lua_setfield(L, -2, "__gc");
+		lua_pushcfunction(L, lines_gc);
+		lua_setfield(L, -2, "__close");
+	}
+	lua_setmetatable(L, -2);
+
+	int pipes[2];
+	if (pipe2(pipes, O_CLOEXEC) == -1) {
+		lush_argv_free(&argv);
+		return luaL_error(L, "lines: %s", strerror(errno));
+	}
+	int fds[3] = {STDIN_FILENO, pipes[1], STDERR_FILENO};
+	int status = 0;
+	if (is_argv) {
+		iter->pid = lush_spawn_stdio(argv.items, fds, -1, false);
+		if (iter->pid < 0)
+			fprintf(stderr, "lush: %s: %s\n", argv.items[0], strerror(errno));
+	} else {
+		ast_node_t *tree = lush_ast_parse(line, &status);
+		if (tree != NULL)
+			iter->pid = lush_eval_start(L, tree, fds, &status);
+		lush_ast_free(tree);
+	}
+	lush_argv_free(&argv);
+	close(pipes[1]);
+
+	iter->fd = pipes[0];
+	iter->capacity = LINES_BUFFER_SIZE;
+	iter->data = malloc(iter->capacity);
+	if (iter->data == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+
+	// the userdata doubles as the closing value of a generic for
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, lines_next, 1);
+	lua_pushnil(L);
+	lua_pushnil(L);
+	lua_pushvalue(L, -4);
+	return 4;
+}
+
+// copies a table of strings into a NULL terminated argument vector
+static char **stage_argv(lua_State *L, int index) {
+	argv_t argv = {0};
+	int count = luaL_len(L, index);
+	for (int i = 1; i <= count; i++) {
+		lua_rawgeti(L, index, i);
+		const char *arg = lua_tostring(L, -1);
+		lua_pop(L, 1);
+		if (arg == NULL) {
+			lush_argv_free(&argv);
+			return NULL;
+		}
+		lush_argv_push(&argv, strdup(arg));
+	}
+	if (argv.count == 0) {
+		lush_argv_free(&argv);
+		return NULL;
+	}
+	return argv.items;
+}
+
+// the stages of lush.run, a table that starts with a string is one stage
+static char ***run_stages(lua_State *L, int *num_stages) {
+	lua_rawgeti(L, 1, 1);
+	bool single = lua_type(L, -1) == LUA_TSTRING;
+	lua_pop(L, 1);
+	*num_stages = single ? 1 : luaL_len(L, 1);
+	if (*num_stages == 0)
+		luaL_error(L, "run: no stages given");
+
+	char ***stages = calloc(*num_stages + 1, sizeof(char **));
+	if (stages == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+	for (int i = 0; i < *num_stages; i++) {
+		if (single) {
+			stages[i] = stage_argv(L, 1);
+		} else {
+			lua_rawgeti(L, 1, i + 1);
+			stages[i] = lua_istable(L, -1) ? stage_argv(L, -1) : NULL;
+			lua_pop(L, 1);
+		}
+		if (stages[i] == NULL) {
+			lush_free_args(stages);
+			luaL_error(L, "run: stage %d is not a table of strings", i + 1);
+		}
+	}
+	return stages;
+}
+
+// opens the file a redirection option of lush.run names, or returns fd
+static int run_redirect(lua_State *L, const char *name, int fd, int flags) {
+	lua_getfield(L, 1, name);
+	const char *path = lua_tostring(L, -1);
+	lua_pop(L, 1);
+	if (path == NULL)
+		return fd;
+
+	int opened = open(path, flags | O_CLOEXEC, 0644);
+	if (opened < 0)
+		fprintf(stderr, "lush: %s: %s\n", path, strerror(errno));
+	return opened;
+}
+
+// lush.run{ {"find", dir, "-name", pat}, {"wc", "-l"}, stdout = "out.txt" }
+// runs argument vectors as a pipeline with no parsing, aliases or globbing
+// unless glob is set. returns the exit status
+static int l_run(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int num_stages;
+	char ***stages = run_stages(L, &num_stages);
+
+	lua_getfield(L, 1, "glob");
+	if (lua_toboolean(L, -1))
+		lush_expand_globs(stages);
+	lua_getfield(L, 1, "append");
+	int mode = lua_toboolean(L, -1) ? O_APPEND : O_TRUNC;
+	lua_getfield(L, 1, "stderr");
+	// stderr = "stdout" shares the stdout of the last stage like 2>&1
+	bool err_to_out = lua_isstring(L, -1) &&
+					  strcmp(lua_tostring(L, -1), "stdout") == 0;
+	lua_pop(L, 3);
+
+	int fds[3];
+	fds[0] = run_redirect(L, "stdin", STDIN_FILENO, O_RDONLY);
+	fds[1] =
+		run_redirect(L, "stdout", STDOUT_FILENO, O_WRONLY | O_CREAT | mode);
+	fds[2] = err_to_out ? fds[1]
+						: run_redirect(L, "stderr", STDERR_FILENO,
+									   O_WRONLY | O_CREAT | mode);
+
+	int rc = 1;
+	if (fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0) {
+		// keep anything Lua printed ahead of the commands' output
+		fflush(stdout);
+		rc = lush_execute_argv(L, stages, num_stages, fds);
+		lush_set_last_status(rc);
+	}
+	for (int i = 0; i < 3; i++) {
+		if (fds[i] > STDERR_FILENO && (i < 2 || !err_to_out))
+			close(fds[i]);
+	}
+	lush_free_args(stages);
+	lua_pushinteger(L, rc);
+	return 1;
+}
+
+// -- timers --
+
+// timers only fire while the shell waits in its event loop, at the prompt
+// or for a command, never in the middle of running Lua
+typedef struct lua_timer {
+	int id;
+	int fd;
+	int ref;
+	bool repeat;
+	lua_State *L;
+	struct lua_timer *next;
+} lua_timer_t;
+
+static lua_timer_t *timers = NULL;
+static int next_timer_id = 1;
+
+static void free_timer(lua_timer_t *timer) {
+	for (lua_timer_t **it = &timers; *it; it = &(*it)->next) {
+		if (*it == timer) {
+			*it = timer->next;
+			break;
+		}
+	}
+	luaL_unref(timer->L, LUA_REGISTRYINDEX, timer->ref);
+	free(timer);
+}
+
+static void run_timer(int fd, uint32_t events, void *data) {
+	lua_timer_t *timer = data;
+	lua_State *L = timer->L;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, timer->ref);
+	// the loop already dropped a one shot timer, a repeating one may be
+	// cleared by its own callback so it is not touched after the call
+	if (!timer->repeat)
+		free_timer(timer);
+	if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+		fprintf(stderr, "lush: timer: %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+}
+
+static int l_set_timer(lua_State *L) {
+	lua_Integer ms = luaL_checkinteger(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	bool repeat = lua_toboolean(L, 3);
+
+	lua_timer_t *timer = malloc(sizeof(lua_timer_t));
+	if (timer == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	lua_pushvalue(L, 2);
+	timer->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	timer->L = L;
+	timer->repeat = repeat;
+	timer->fd = lush_loop_add_timer(ms, repeat, run_timer, timer);
+	if (timer->fd < 0) {
+		luaL_unref(L, LUA_REGISTRYINDEX, timer->ref);
+		free(timer);
+		return luaL_error(L, "setTimer: %s", strerror(errno));
+	}
+
+	// ids are never reused, unlike the timer fds behind them
+	timer->id = next_timer_id++;
+	timer->next = timers;
+	timers = timer;
+	lua_pushinteger(L, timer->id);
+	return 1;
+}
+
+static int l_clear_timer(lua_State *L) {
+	lua_Integer id = luaL_checkinteger(L, 1);
+	for (lua_timer_t *timer = timers; timer; timer = timer->next) {
+		if (timer->id == id) {
+			lush_loop_remove(timer->fd);
+			free_timer(timer);
+			lua_pushboolean(L, true);
+			return 1;
+		}
+	}
+	lua_pushboolean(L, false);
+	return 1;
+}
+
 // -- register Lua functions --
 
 void lua_register_api(lua_State *L) {
+	register_searcher(L);
+
 	// global table for api functions
 	lua_newtable(L);
 
 	lua_pushcfunction(L, l_execute_command);
 	lua_setfield(L, -2, "exec");
+	lua_pushcfunction(L, l_exec_many);
+	lua_setfield(L, -2, "execMany");
 	lua_pushcfunction(L, l_get_cwd);
 	lua_setfield(L, -2, "getcwd");
 	lua_pushcfunction(L, l_debug);
 	lua_setfield(L, -2, "debug");
 	lua_pushcfunction(L, l_suggestions);
 	lua_setfield(L, -2, "suggestions");
+	lua_pushcfunction(L, l_pipefail);
+	lua_setfield(L, -2, "pipefail");
 	lua_pushcfunction(L, l_cd);
 	lua_setfield(L, -2, "cd");
 	lua_pushcfunction(L, l_exists);
@@ -466,6 +1838,12 @@ void lua_register_api(lua_State *L) {
 	lua_setfield(L, -2, "isReadable");
 	lua_pushcfunction(L, l_is_writeable);
 	lua_setfield(L, -2, "isWriteable");
+	lua_pushcfunction(L, l_stat);
+	lua_setfield(L, -2, "stat");
+	lua_pushcfunction(L, l_stat_many);
+	lua_setfield(L, -2, "statMany");
+	lua_pushcfunction(L, l_readdir);
+	lua_setfield(L, -2, "readdir");
 	lua_pushcfunction(L, l_last_history);
 	lua_setfield(L, -2, "lastHistory");
 	lua_pushcfunction(L, l_get_history);
@@ -490,6 +1868,26 @@ void lua_register_api(lua_State *L) {
 	lua_setfield(L, -2, "exit");
 	lua_pushcfunction(L, l_alt_shell);
 	lua_setfield(L, -2, "altShell");
+	lua_pushcfunction(L, l_set_timer);
+	lua_setfield(L, -2, "setTimer");
+	lua_pushcfunction(L, l_clear_timer);
+	lua_setfield(L, -2, "clearTimer");
+	lua_pushcfunction(L, l_spawn);
+	lua_setfield(L, -2, "spawn");
+	lua_pushcfunction(L, l_capture);
+	lua_setfield(L, -2, "capture");
+	lua_pushcfunction(L, l_lines);
+	lua_setfield(L, -2, "lines");
+	lua_pushcfunction(L, l_run);
+	lua_setfield(L, -2, "run");
+	lua_pushcfunction(L, l_wait);
+	lua_setfield(L, -2, "wait");
+	lua_pushcfunction(L, proc_poll);
+	lua_setfield(L, -2, "poll");
+	lua_pushcfunction(L, proc_kill);
+	lua_setfield(L, -2, "kill");
+	lua_pushcfunction(L, l_parallel);
+	lua_setfield(L, -2, "parallel");
 	// set the table as global
 	lua_setglobal(L, "lush");
 }
@@ -22,6 +22,8 @@ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
 
 int lua_load_script(lua_State *L, const char *script, char **args);
 void lua_run_init(lua_State *L);
+// forgets where scripts run from the prompt were found
+void lua_clear_script_cache();
 void lua_register_api(lua_State *L);
 
 #endif
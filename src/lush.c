@@ -15,9 +15,16 @@ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
 IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
 */
 
+#define _GNU_SOURCE
 #include "lush.h"
-#include "hashmap.h"
+#include "ast.h"
+#include "capture.h"
+#include "eval.h"
+#include "expand.h"
+#include "jobs.h"
+#include "launch.h"
 #include "lauxlib.h"
+#include "loop.h"
 #include "lua.h"
 #include "lua_api.h"
 #include "lualib.h"
@@ -26,8 +33,8 @@ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
 #include <bits/time.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <glob.h>
 #include <linux/limits.h>
 #include <locale.h>
 #include <pwd.h>
@@ -48,40 +55,10 @@ int luaopen_bit32 (lua_State *L);
 int luaopen_utf8 (lua_State *L);
 
 #define BUFFER_SIZE 1024
-#define MAX_GLOB 512
-
-typedef enum {
-	OP_PIPE = 1,		// |
-	OP_AND,				// &&
-	OP_OR,				// ||
-	OP_SEMICOLON,		// ;
-	OP_BACKGROUND,		// &
-	OP_REDIRECT_STDOUT, // 1> or >
-	OP_REDIRECT_STDERR, // 2>
-	OP_REDIRECT_BOTH,	// &>
-	OP_APPEND_STDOUT,	// 1>> or >>
-	OP_APPEND_STDERR,	// 2>>
-	OP_APPEND_BOTH,		// &>>
-	OP_OTHER			// All other operators like parentheses, braces, etc.
-} OperatorType;
 
 // initialize prompt format
 char *prompt_format = NULL;
 
-// -- aliasing --
-hashmap_t *aliases = NULL;
-
-void lush_add_alias(const char *alias, const char *command) {
-	// make a new map if one doesnt exist
-	if (aliases == NULL) {
-		aliases = hm_new_hashmap();
-	}
-
-	hm_set(aliases, (char *)alias, (char *)command);
-}
-
-char *lush_get_alias(char *alias) { return hm_get(aliases, alias); }
-
 // -- shell utility --
 
 static void set_raw_mode(struct termios *orig_termios) {
@@ -647,6 +624,20 @@ static void reprint_buffer(char *buffer, int *last_lines, int *pos,
 	free_suggestions(suggestions, suggestions_count);
 }
 
+// idles in the event loop so jobs, traps and timers are served while the
+// user is typing
+static int read_key() {
+	fflush(stdout);
+	while (!lush_loop_wait_readable(STDIN_FILENO))
+		lush_run_traps();
+
+	unsigned char c;
+	ssize_t len;
+	while ((len = read(STDIN_FILENO, &c, 1)) < 0 && errno == EINTR)
+		;
+	return len == 1 ? c : EOF;
+}
+
 char *lush_read_line() {
 	struct termios orig_termios;
 	char *buffer = (char *)calloc(BUFFER_SIZE, sizeof(char));
@@ -660,11 +651,11 @@ char *lush_read_line() {
 	set_raw_mode(&orig_termios);
 
 	while (true) {
-		c = getchar();
+		c = read_key();
 
 		if (c == '\033') { // escape sequence
-			getchar();	   // skip [
-			switch (getchar()) {
+			read_key();	   // skip [
+			switch (read_key()) {
 			case 'A': // up arrow
 				reprint_buffer(buffer, &last_lines, &pos, ++history_pos);
 				break;
@@ -707,7 +698,7 @@ char *lush_read_line() {
 				free(prompt);
 			} break;
 			case '3': // delete
-				if (getchar() == '~') {
+				if (read_key() == '~') {
 					if (pos < strlen(buffer)) {
 						memmove(&buffer[pos], &buffer[pos + 1],
 								strlen(&buffer[pos + 1]) + 1);
@@ -765,6 +756,11 @@ char *lush_read_line() {
 			free(suggestions_path);
 			free_suggestions(suggestions, suggestions_count);
 
+		} else if (c == EOF || (c == '\004' && buffer[0] == '\0')) {
+			// ^D on an empty line ends the input
+			reset_terminal_mode(&orig_termios);
+			free(buffer);
+			return NULL;
 		} else if (c == '\n') {
 			// if modifying text reset history
 			history_pos = -1;
@@ -797,374 +793,52 @@ char *lush_read_line() {
 	return buffer;
 }
 
-char *lush_resolve_aliases(char *line) {
-	// Allocate memory for the new string
-	char *result = (char *)malloc(BUFFER_SIZE);
-	if (!result) {
-		perror("malloc failed");
-		return NULL;
-	}
-
-	// Create a copy of the input line for tokenization
-	char *line_copy = strdup(line);
-	if (!line_copy) {
-		perror("strdup failed");
-		free(result);
-		return NULL;
-	}
-
-	// Start building the result string
-	char *dest = result;
-	char *arg = strtok(line_copy, " ");
-	while (arg != NULL) {
-		// Check shell aliases
-		if (aliases != NULL) {
-			char *alias = hm_get(aliases, arg);
-			if (alias != NULL) {
-				// Replace alias
-				strcpy(dest, alias);
-				dest += strlen(alias);
-			} else {
-				// No alias found, use the original token
-				strcpy(dest, arg);
-				dest += strlen(arg);
-			}
-		} else {
-			// No aliases set, just use the original token
-			strcpy(dest, arg);
-			dest += strlen(arg);
-		}
-
-		// Add a space after each token (if it's not the last one)
-		arg = strtok(NULL, " ");
-		if (arg != NULL) {
-			*dest++ = ' ';
-		}
-	}
-
-	*dest = '\0'; // Null-terminate the result string
-
-	// Clean up
-	free(line_copy);
-
-	return result;
-}
-
-static void lush_expand_globs(char ***args) {
-	if (args == NULL || *args == NULL) {
-		return;
-	}
-
-	// iterate over each arg
-	for (int i = 0; args[i]; i++) {
-		char **arg_list = args[i];
-		for (int j = 0; arg_list[j]; j++) {
-			char *arg = arg_list[j];
-
-			// check if the arg string has a glob pattern
-			if (strpbrk(arg, "*?[") != NULL) {
-				glob_t glob_result;
-				memset(&glob_result, 0, sizeof(glob_result));
-
-				// use glob to expand the arg
-				int ret =
-					glob(arg, GLOB_TILDE | GLOB_BRACE, NULL, &glob_result);
-				if (ret == 0) {
-					// if there is a nonzero number of matches malloc new arg
-					// memory
-					if (glob_result.gl_pathc > 0) {
-						char **new_args = (char **)malloc(
-							(glob_result.gl_pathc + 1) * sizeof(char *));
-						if (new_args == NULL) {
-							perror("malloc failed");
-							globfree(&glob_result);
-							return;
-						}
-
-						for (size_t k = 0; k < glob_result.gl_pathc; k++) {
-							new_args[k] = strdup(glob_result.gl_pathv[k]);
-							if (new_args[k] == NULL) {
-								perror("strdup failed");
-								for (size_t l = 0; l < k; l++) {
-									free(new_args[l]);
-								}
-								free(new_args);
-								globfree(&glob_result);
-								return;
-							}
-						}
-						new_args[glob_result.gl_pathc] = NULL;
-
-						// replace the original arg with new list
-						arg_list[j] = new_args[0];
-
-						for (size_t k = 1; k < glob_result.gl_pathc; k++) {
-							// insert the new argument
-							arg_list[j + k] = new_args[k];
-						}
-
-						free(new_args);
-					}
-				} else if (ret == GLOB_NOMATCH) {
-
-				} else {
-					fprintf(stderr, "glob failed with error code %d\n", ret);
-				}
-
-				globfree(&glob_result);
-			}
-		}
-	}
-}
-
-static int is_operator(const char *str) {
-	const char *operators[] = {"1>>", "2>>", "&>>", ">>", "1>", "2>", "&>",
-							   "||",  "&&",	 ">",	"&",  ";",	"|"};
-	int num_operators = sizeof(operators) / sizeof(operators[0]);
-	for (int i = 0; i < num_operators; i++) {
-		if (strncmp(str, operators[i], strlen(operators[i])) == 0) {
-			switch (i) {
-			case 0:
-				return OP_APPEND_STDOUT;
-			case 1:
-				return OP_APPEND_STDERR;
-			case 2:
-				return OP_APPEND_BOTH;
-			case 3:
-				return OP_APPEND_STDOUT;
-			case 4:
-				return OP_REDIRECT_STDOUT;
-			case 5:
-				return OP_REDIRECT_STDERR;
-			case 6:
-				return OP_REDIRECT_BOTH;
-			case 7:
-				return OP_OR;
-			case 8:
-				return OP_AND;
-			case 9:
-				return OP_REDIRECT_STDOUT;
-			case 10:
-				return OP_BACKGROUND;
-			case 11:
-				return OP_SEMICOLON;
-			case 12:
-				return OP_PIPE;
-			default:
-				return 0;
-			}
-		}
-	}
-	return 0; // Not an operator
-}
-
-static int operator_length(const char *str) {
-	const char *operators[] = {"1>>", "2>>", "&>>", ">>", "1>", "2>", "&>",
-							   "||",  "&&",	 ">",	"&",  ";",	"|"};
-	int num_operators = sizeof(operators) / sizeof(operators[0]);
-	for (int i = 0; i < num_operators; i++) {
-		if (strncmp(str, operators[i], strlen(operators[i])) == 0) {
-			switch (i) {
-			case 0:
-			case 1:
-			case 2:
-				return 3;
-			case 3:
-			case 4:
-			case 5:
-			case 6:
-			case 7:
-			case 8:
-				return 2;
-			case 9:
-			case 10:
-			case 11:
-			case 12:
-				return 1;
-			default:
-				return 0;
-			}
-		}
-	}
-	return 0;
-}
-
-static char *trim_whitespace(char *str) {
-	char *end;
-
-	// Trim leading space
-	while (isspace((unsigned char)*str))
-		str++;
-
-	if (*str == 0)
-		return str; // If all spaces, return empty string
-
-	// Trim trailing space
-	end = str + strlen(str) - 1;
-	while (end > str && isspace((unsigned char)*end))
-		end--;
-
-	*(end + 1) = '\0';
-
-	return str;
-}
-
-// Split the command based on various chaining operations
-char **lush_split_commands(char *line) {
-	char **commands = calloc(16, sizeof(char *));
-	if (!commands) {
-		perror("calloc failed");
-		exit(1);
-	}
-
-	int pos = 0;
-	char *start = line;
-	bool in_quote = false;
-	while (*start) {
-		// Skip leading spaces
-		while (isspace((unsigned char)*start))
-			start++;
-
-		// Check for operators
-		int op_len = operator_length(start);
-		if (op_len > 0) {
-			// Allocate memory for operator command
-			char *operator_cmd = calloc(op_len + 1, sizeof(char));
-			strncpy(operator_cmd, start, op_len);
-			commands[pos++] = operator_cmd;
-			start += op_len;
-		} else {
-			// Collect regular commands until the next operator or end of string
-			char *next = start;
-			while (*next) {
-				if (*next == '"') {
-					in_quote = !in_quote;
-				}
-				next++;
-
-				if (!in_quote && is_operator(next))
-					break;
-			}
-
-			// Copy the command between start and next
-			char *command = strndup(start, next - start);
-			commands[pos++] = trim_whitespace(command);
-			start = next;
-		}
-
-		if (pos >= 16) {
-			// Resize if necessary
-			commands = realloc(commands, (pos + 16) * sizeof(char *));
-			if (!commands) {
-				perror("realloc failed");
-				exit(1);
-			}
-		}
-	}
-
-	commands[pos] = NULL;
-	return commands;
-}
-
-char ***lush_split_args(char **commands, int *status) {
-	int outer_pos = 0;
-	char ***command_args = calloc(128, sizeof(char **));
-	if (!command_args) {
-		perror("calloc failed");
-		exit(1);
-	}
-
-	for (int i = 0; commands[i]; i++) {
-		int pos = 0;
-		char **args = calloc(128, sizeof(char *));
-		if (!args) {
-			perror("calloc failed");
-			exit(1);
-		}
-
-		bool inside_string = false;
-		char *current_token = &commands[i][0];
-		for (int j = 0; commands[i][j]; j++) {
-			if (commands[i][j] == '"' && !inside_string) {
-				// beginning of a string
-				commands[i][j++] = '\0';
-				if (commands[i][j] != '"') {
-					inside_string = true;
-					current_token = &commands[i][j];
-				} else {
-					commands[i][j] = '\0';
-					current_token = &commands[i][++j];
-				}
-			} else if (inside_string) {
-				if (commands[i][j] == '"') {
-					// ending of a string
-					inside_string = false;
-					commands[i][j] = '\0';
-					args[pos++] = current_token;
-					current_token = NULL;
-				} else {
-					// character in string
-					continue;
-				}
-			} else if (commands[i][j] == ' ') {
-				// space delimeter
-				if (current_token && *current_token != ' ') {
-					args[pos++] = current_token;
-				}
-				current_token = &commands[i][j + 1]; // go past the space
-				commands[i][j] = '\0';				 // null the space
-			} else if (commands[i][j] == '$' && commands[i][j + 1] &&
-					   commands[i][j + 1] != ' ') {
-				// environment variable
-				args[pos++] = getenv(&commands[i][++j]);
-				while (commands[i][j]) {
-					++j;
-				}
-				current_token = &commands[i][j + 1];
-			} else {
-				// regular character
-				continue;
-			}
-		}
-
-		// verify that string literals are finished
-		if (inside_string) {
-			*status = -1;
-			return command_args;
-		} else if (current_token && *current_token != ' ') {
-			// tack on last arg
-			args[pos++] = current_token;
-		}
+static int run_command(lua_State *L, char ***commands) {
+	// every word expanded to nothing
+	if (commands[0][0] == NULL)
+		return 0;
 
-		// add this commands args array to the outer array
-		command_args[outer_pos++] = args;
+	// shell functions shadow everything else
+	int rc;
+	if (lush_is_function(commands[0][0])) {
+		rc = lush_call_function(L, commands[0]);
+		lush_set_pipe_status(&rc, 1);
+		return rc;
 	}
 
-	*status = outer_pos;
-	return command_args;
-}
-
-static int run_command(lua_State *L, char ***commands) {
 	// check if the command is a lua script
 	char *ext = strrchr(commands[0][0], '.');
 	if (ext) {
 		ext++;
 		if (strcmp(ext, "lua") == 0) {
-			return ((*builtin_func[LUSH_LUA])(L, commands));
+			rc = (*builtin_func[LUSH_LUA])(L, commands);
+			lush_set_pipe_status(&rc, 1);
+			return rc;
 		}
 	}
 
 	// check shell builtins
 	for (int j = 0; j < lush_num_builtins(); j++) {
 		if (strcmp(commands[0][0], builtin_strs[j]) == 0) {
-			return ((*builtin_func[j])(L, commands));
+			rc = (*builtin_func[j])(L, commands);
+			// keep builtin output ordered with the commands around it
+			fflush(stdout);
+			lush_set_pipe_status(&rc, 1);
+			return rc;
 		}
 	}
 
+	// a lua stage on its own is a pipeline of one
+	if (lush_is_lua_stage(commands[0][0]))
+		return lush_execute_pipeline(L, commands, 1);
+
 	return lush_execute_command(commands[0], STDIN_FILENO, STDOUT_FILENO);
 }
 
-static int run_command_redirect(lua_State *L, char ***commands, int operator) {
+// runs the command, or the pipeline ending in it when stages are given,
+// with its output sent to the file after the operator
+static int run_command_redirect(lua_State *L, char ***commands, int operator,
+								char ***stages, int num_stages) {
 	if (commands[2] == NULL)
 		return -1;
 
@@ -1181,8 +855,11 @@ static int run_command_redirect(lua_State *L, char ***commands, int operator) {
 		redirect_flags = 3;
 	}
 
+	// anything still buffered belongs to the old stdout
+	fflush(stdout);
 	int saved_stdout = -1, saved_stderr = -1;
-	int fd = open(commands[2][0], O_WRONLY | O_CREAT | mode, 0644);
+	int fd =
+		open(commands[2][0], O_WRONLY | O_CREAT | O_CLOEXEC | mode, 0644);
 	if (fd == -1) {
 		perror("invalid fd");
 		return -1;
@@ -1190,7 +867,7 @@ static int run_command_redirect(lua_State *L, char ***commands, int operator) {
 
 	// Redirect stdout
 	if (redirect_flags & 1) {
-		saved_stdout = dup(STDOUT_FILENO);
+		saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
 		if (saved_stdout == -1) {
 			perror("dup stdout");
 			close(fd);
@@ -1207,7 +884,7 @@ static int run_command_redirect(lua_State *L, char ***commands, int operator) {
 
 	// Redirect stderr
 	if (redirect_flags & 2) {
-		saved_stderr = dup(STDERR_FILENO);
+		saved_stderr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
 		if (saved_stderr == -1) {
 			perror("dup stderr");
 			if (saved_stdout != -1) {
@@ -1233,7 +910,10 @@ static int run_command_redirect(lua_State *L, char ***commands, int operator) {
 	close(fd);
 
 	// Run the command
-	run_command(L, commands);
+	int rc = stages ? lush_execute_pipeline(L, stages, num_stages)
+					: run_command(L, commands);
+	// builtins print through stdio, push it out before the fd goes back
+	fflush(stdout);
 
 	// Restore stdout
 	if (saved_stdout != -1) {
@@ -1255,59 +935,50 @@ static int run_command_redirect(lua_State *L, char ***commands, int operator) {
 		close(saved_stderr);
 	}
 
-	return 0;
+	return rc;
 }
 
-// TODO: Allow background process to run lua script
-static int run_command_background(lua_State *L, char ***commands) {
-	pid_t pid = fork();
-
-	if (pid < 0) {
-		perror("fork");
-		return -1;
-	} else if (pid == 0) {
-		execvp(commands[0][0], commands[0]);
-		perror("execvp background");
-		exit(EXIT_FAILURE);
-	}
-
-	printf("Process %d running in background\n", pid);
-	return 0;
-}
+static int execute_background(lua_State *L, char ***commands,
+							  int num_commands);
 
 int lush_execute_chain(lua_State *L, char ***commands, int num_commands) {
-	if (commands[0][0][0] == '\0') {
+	if (commands[0][0] != NULL && commands[0][0][0] == '\0') {
 		return 0;
 	}
 
 	int num_actions = (num_commands + 1) / 2;
 	int last_result = 0;
+	char ***end = commands + num_commands;
 
 	for (int i = 0; i < num_actions; i++) {
+		// redirections consume their target so we can run out early
+		if (commands >= end)
+			break;
+
 		// Handle &&, ||, and ; operators
 		if (i > 0 && commands[0] != NULL) {
 			commands--;
 			if (last_result != 0) {
-				if (is_operator(commands[0][0]) == OP_AND) {
+				if (lush_is_operator(commands[0][0]) == OP_AND) {
 					commands += 3;
 					continue;
 				}
 			} else {
-				if (is_operator(commands[0][0]) == OP_OR) {
+				if (lush_is_operator(commands[0][0]) == OP_OR) {
 					commands += 3;
 					continue;
 				}
 			}
 			commands++;
 
-			if (is_operator(commands[0][0]) == OP_SEMICOLON) {
+			if (lush_is_operator(commands[0][0]) == OP_SEMICOLON) {
 				commands++;
 			}
 		}
 
 		// Handle other operations
 		if (commands[1] != NULL) {
-			int op_type = is_operator(commands[1][0]);
+			int op_type = lush_is_operator(commands[1][0]);
 			if (op_type == OP_PIPE) {
 				char ***pipe_commands =
 					malloc(sizeof(char **) * (num_actions - i));
@@ -1317,32 +988,49 @@ int lush_execute_chain(lua_State *L, char ***commands, int num_commands) {
 					pipe_commands[pipe_count++] = commands[0];
 					commands += 2;
 					i++;
-					if (i < num_actions - 1) {
-						op_type = is_operator(commands[1][0]);
+					if (i < num_actions - 1 && commands + 1 < end) {
+						op_type = lush_is_operator(commands[1][0]);
 					} else {
 						break;
 					}
 				}
 
 				pipe_commands[pipe_count++] = commands[0];
-				last_result = lush_execute_pipeline(pipe_commands, pipe_count);
+				op_type = commands + 1 < end && commands[1]
+							  ? lush_is_operator(commands[1][0])
+							  : 0;
+				if (op_type >= OP_REDIRECT_STDOUT &&
+					op_type <= OP_APPEND_BOTH) {
+					last_result = run_command_redirect(
+						L, commands, op_type, pipe_commands, pipe_count);
+					commands += 3;
+				} else if (op_type == OP_BACKGROUND) {
+					last_result =
+						execute_background(L, pipe_commands, pipe_count);
+					commands += 2;
+				} else {
+					last_result =
+						lush_execute_pipeline(L, pipe_commands, pipe_count);
+					commands += 2;
+				}
 
 				free(pipe_commands);
-				commands += 2;
 				continue;
 			} else if (op_type == OP_BACKGROUND) {
-				last_result = run_command_background(L, commands);
+				// TODO: Allow background process to run lua script
+				last_result = execute_background(L, commands, 1);
 				commands += 2;
 				continue;
 			} else if (op_type >= OP_REDIRECT_STDOUT &&
 					   op_type <= OP_APPEND_BOTH) {
-				last_result = run_command_redirect(L, commands, op_type);
+				last_result =
+					run_command_redirect(L, commands, op_type, NULL, 0);
 				commands += 3;
 				continue;
 			}
 		}
 		// Run the command or move past the operator
-		if (commands[0] != NULL && !is_operator(commands[0][0])) {
+		if (commands[0] != NULL && !lush_is_operator(commands[0][0])) {
 			last_result = run_command(L, commands);
 			commands += 2;
 		} else {
@@ -1350,124 +1038,141 @@ int lush_execute_chain(lua_State *L, char ***commands, int num_commands) {
 		}
 	}
 
-	return 0;
+	return last_result;
 }
 
-int lush_execute_pipeline(char ***commands, int num_commands) {
-	// no command given
-	if (commands[0][0][0] == '\0') {
-		return 0;
-	}
+// joins args with spaces for the alt shell's -c
+static char *build_alt_command(char **args) {
+	size_t len = 1;
+	for (int i = 0; args[i]; i++)
+		len += strlen(args[i]) + 1;
 
-	// create pipes for each command
-	int **pipes = malloc((num_commands - 1) * sizeof(int *));
-	for (int i = 0; i < num_commands - 1; i++) {
-		pipes[i] =
-			malloc(2 * sizeof(int)); // pipes[i][0] = in, pipes[i][1] = out
-		if (pipe(pipes[i]) == -1) {
-			perror("pipe");
-			return 0;
-		}
+	char *command = calloc(len, sizeof(char));
+	if (command == NULL) {
+		perror("calloc failed");
+		exit(1);
 	}
+	for (int i = 0; args[i]; i++) {
+		strcat(command, args[i]);
+		strcat(command, " ");
+	}
+	return command;
+}
 
-	// execute commands in the pipeline
-	for (int i = 0; i < num_commands - 1; i++) {
-		int input_fd = (i == 0) ? STDIN_FILENO : pipes[i - 1][0];
-		int output_fd = pipes[i][1];
-
-		lush_execute_command(commands[i], input_fd, output_fd);
-		close(output_fd); // no longer need to write to this pipe
+// spawns one command with fds as its stdin, stdout and stderr, falling back
+// to the alt shell when it is not found. on failure the error is printed
+// and status gets what the shell reports
+static pid_t spawn_stage(lua_State *L, char **args, const int fds[3],
+						 pid_t pgid, bool foreground, int *status) {
+	// functions run in a fork of the shell like lua stages
+	if (L != NULL && lush_is_function(args[0]))
+		return lush_function_stage_start(L, args, fds, pgid, status);
+	if (L != NULL && lush_is_lua_stage(args[0]))
+		return lush_lua_stage_start(L, args, fds, pgid, status);
+
+	pid_t pid = lush_spawn_stdio(args, fds, pgid, foreground);
+	if (pid < 0 && errno == ENOENT && alt_shell) {
+		char *command = build_alt_command(args);
+		char *alt_args[] = {alt_shell, "-c", command, NULL};
+		pid = lush_spawn_stdio(alt_args, fds, pgid, foreground);
+		free(command);
 	}
 
-	// execute last or only command
-	int input_fd =
-		(num_commands > 1) ? pipes[num_commands - 2][0] : STDIN_FILENO;
-	int output_fd = STDOUT_FILENO;
-	lush_execute_command(commands[num_commands - 1], input_fd, output_fd);
-
-	// close pipes
-	for (int i = 0; i < num_commands - 1; i++) {
-		close(pipes[i][0]);
-		close(pipes[i][1]);
-		free(pipes[i]);
+	if (pid < 0) {
+		fprintf(stderr, "lush: %s: %s\n", args[0], strerror(errno));
+		*status = errno == ENOENT ? 127 : 126;
 	}
-	free(pipes);
-	return 0;
+	return pid;
 }
 
-static void build_alt_command(char *buffer, char **args) {
-	size_t offset = 0;
-
-	for (int i = 0; args[i]; i++) {
-		if (offset + strlen(args[i]) + 1 < BUFFER_SIZE) {
-			strcat(buffer, args[i]);
-			strcat(buffer, " ");
-			offset = strlen(buffer);
-		} else {
-			fprintf(stderr, "command too long\n");
-			exit(EXIT_FAILURE);
+// spawns every stage into one process group and returns them as a job.
+// fds are the first stage's stdin, the last one's stdout and every stderr
+static job_t *spawn_pipeline(lua_State *L, char ***commands, int num_commands,
+							 const int fds[3], bool foreground) {
+	job_t *job = lush_job_new(commands, num_commands);
+
+	// every stage starts before any is waited on so a stage writing more
+	// than a pipe buffer never blocks on a reader that does not exist yet.
+	// the pipes are close on exec so each child only keeps its own ends
+	int input_fd = fds[0];
+	for (int i = 0; i < num_commands; i++) {
+		int pipe_fds[2] = {-1, fds[1]};
+		if (i < num_commands - 1 && pipe2(pipe_fds, O_CLOEXEC) == -1) {
+			perror("pipe");
+			lush_job_add_proc(job, -1, 1);
+			break;
 		}
+
+		// a stage that expanded to nothing just closes its ends
+		int status = 0;
+		pid_t pid = -1;
+		int stage_fds[3] = {input_fd, pipe_fds[1], fds[2]};
+		if (commands[i][0] != NULL)
+			pid = spawn_stage(L, commands[i], stage_fds,
+							  lush_job_spawn_group(job), foreground, &status);
+		lush_job_add_proc(job, pid, status);
+
+		if (input_fd != fds[0])
+			close(input_fd);
+		if (pipe_fds[1] != fds[1])
+			close(pipe_fds[1]);
+		input_fd = pipe_fds[0];
 	}
+	return job;
 }
 
-int lush_execute_command(char **args, int input_fd, int output_fd) {
-	// create child
-	pid_t pid;
-	int status;
-
-	struct sigaction sa;
+int lush_execute_pipeline(lua_State *L, char ***commands, int num_commands) {
+	// no command given
+	if (commands[0][0] == NULL || commands[0][0][0] == '\0') {
+		return 0;
+	}
 
-	if ((pid = fork()) == 0) {
-		// child process content
+	int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+	return lush_execute_argv(L, commands, num_commands, fds);
+}
 
-		// restore default sigint for child
-		sa.sa_handler = SIG_DFL;
-		sigemptyset(&sa.sa_mask);
-		sa.sa_flags = 0;
-		sigaction(SIGINT, &sa, NULL);
+int lush_execute_argv(lua_State *L, char ***commands, int num_commands,
+					  const int fds[3]) {
+	job_t *job = spawn_pipeline(L, commands, num_commands, fds,
+								lush_terminal_owned());
+	return lush_job_foreground(job, false);
+}
 
-		// redirect in and out fd's if needed
-		if (input_fd != STDIN_FILENO) {
-			dup2(input_fd, STDIN_FILENO);
-			close(input_fd);
-		}
+// runs a pipeline as a job without waiting for it
+static int execute_background(lua_State *L, char ***commands,
+							  int num_commands) {
+	if (commands[0][0] == NULL)
+		return 0;
 
-		if (output_fd != STDOUT_FILENO) {
-			dup2(output_fd, STDOUT_FILENO);
-			close(output_fd);
-		}
+	int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+	job_t *job = spawn_pipeline(L, commands, num_commands, fds, false);
+	lush_job_background(job, false);
+	lush_set_last_background(job->procs[job->num_procs - 1].pid);
+	if (lush_terminal_owned())
+		printf("[%d] %d\n", job->id, job->pgid);
+	fflush(stdout);
+	return 0;
+}
 
-		// execute the command
-		if (execvp(args[0], args) == -1) {
-			if (alt_shell) {
-				char command[BUFFER_SIZE] = {0};
-				build_alt_command(command, args);
-				execlp(alt_shell, alt_shell, "-c", command, (char *)NULL);
-				perror("alt shell");
-			} else {
-				perror("lush");
-				exit(EXIT_FAILURE);
-			}
-		}
-	} else if (pid < 0) {
-		// forking failed
-		perror("fork");
-		exit(EXIT_FAILURE);
-	} else {
-		// parent process
-		do {
-			waitpid(pid, &status, WUNTRACED);
-		} while (!WIFEXITED(status) && !WIFSIGNALED(status));
-	}
+int lush_execute_command(char **args, int input_fd, int output_fd) {
+	// every word expanded to nothing
+	if (args[0] == NULL)
+		return 0;
 
-	if (WIFEXITED(status)) {
-		return WEXITSTATUS(status);
-	}
-	return -1;
+	// with job control a single command is its own process group like any
+	// pipeline
+	bool foreground = lush_terminal_owned();
+	job_t *job = lush_job_new(&args, 1);
+	int status = 0;
+	int fds[3] = {input_fd, output_fd, STDERR_FILENO};
+	pid_t pid = spawn_stage(NULL, args, fds, lush_job_spawn_group(job),
+							foreground, &status);
+	lush_job_add_proc(job, pid, status);
+	return lush_job_foreground(job, false);
 }
 
 int lush_run(lua_State *L, char ***commands, int num_commands) {
-	if (commands[0][0] == NULL) {
+	if (num_commands <= 0 || commands[0] == NULL || commands[0][0] == NULL) {
 		// no command given
 		return 0;
 	}
@@ -1475,10 +1180,33 @@ int lush_run(lua_State *L, char ***commands, int num_commands) {
 	return lush_execute_chain(L, commands, num_commands);
 }
 
-static void background_handler(int sig) {
-	// Reap all child processes
-	while (waitpid(-1, NULL, WNOHANG) > 0)
-		;
+// keeps reading lines while a heredoc is waiting for its delimiter
+static char *read_heredoc_lines(char *line) {
+	char *next = NULL;
+	size_t capacity = 0;
+
+	while (lush_heredoc_pending(line)) {
+		printf("> ");
+		fflush(stdout);
+		ssize_t len = getline(&next, &capacity, stdin);
+		if (len < 0)
+			break;
+		if (len > 0 && next[len - 1] == '\n')
+			next[--len] = '\0';
+
+		size_t line_len = strlen(line);
+		char *joined = realloc(line, line_len + len + 2);
+		if (joined == NULL) {
+			perror("realloc failed");
+			break;
+		}
+		line = joined;
+		line[line_len] = '\n';
+		memcpy(line + line_len + 1, next, len + 1);
+	}
+
+	free(next);
+	return line;
 }
 
 int main(int argc, char *argv[]) {
@@ -1490,7 +1218,13 @@ int main(int argc, char *argv[]) {
 		return 0;
 	}
 
-		// init lua state
+	// before any redirection can replace stdin
+	lush_terminal_init();
+	// before any child is started so SIGCHLD is never missed
+	lush_loop_init();
+	lush_jobs_init(false);
+
+	// init lua state
 	lua_State *L = luaL_newstate();
 	if (!L) {
     	fprintf(stderr, "Failed to create Lua state\n");
@@ -1505,6 +1239,7 @@ int main(int argc, char *argv[]) {
     luaL_requiref(L, "utf8", luaopen_utf8, 1);
     lua_pop(L, 1);
     // --- End pre-loading ---
+	lush_capture_init(L);
 	lua_register_api(L);
 	lua_run_init(L);
 
@@ -1512,31 +1247,11 @@ int main(int argc, char *argv[]) {
 	if (argc > 2 && strcmp(argv[1], "-c") == 0) {
 
 		// execute the command provided
-		char *command = argv[2];
-		char *expanded_command = lush_resolve_aliases(command);
-		char **commands = lush_split_commands(expanded_command);
-		int status = 0;
-		char ***args = lush_split_args(commands, &status);
-
-		if (status == -1) {
-			fprintf(stderr, "lush: Expected end of quoted string\n");
-		} else {
-			lush_expand_globs(args);
-		}
-
-		if (lush_run(L, args, status) != 0) {
-			exit(1);
-		}
+		int status = lush_eval_line(L, argv[2]);
 
 		// clean up
-		for (int i = 0; args[i]; i++) {
-			free(args[i]);
-		}
-		free(args);
-		free(commands);
-		free(expanded_command);
 		lua_close(L);
-		return 0;
+		return status;
 	}
 
     // This is the corrected logic for running a script file non-interactively.
@@ -1567,61 +1282,46 @@ int main(int argc, char *argv[]) {
 	sigemptyset(&sa_int.sa_mask);
 	sigaction(SIGINT, &sa_int, NULL);
 
-	struct sigaction sa_bk;
-	sa_bk.sa_handler = &background_handler;
-	sigemptyset(&sa_bk.sa_mask);
-	sa_bk.sa_flags = SA_RESTART;
-	sigaction(SIGCHLD, &sa_bk, NULL);
+	// job changes are collected by the event loop and reported before
+	// each prompt
+	lush_jobs_init(true);
 
 	// set custom envars
 	char hostname[256];
 	gethostname(hostname, sizeof(hostname));
-	setenv("HOSTNAME", hostname, 1);
+	lush_env_set("HOSTNAME", hostname);
 	char *cwd = getcwd(NULL, 0);
-	setenv("OLDPWD", cwd, 1);
+	lush_env_set("OLDPWD", cwd);
 	free(cwd);
 
-	int status = 0;
 	while (true) {
+		lush_run_traps();
+		lush_jobs_notify();
+
 		// Prompt
 		char *prompt = get_prompt();
 
 		printf("%s ", prompt);
+		free(prompt);
 		char *line = lush_read_line();
-		lush_push_history(line);
 		printf("\n");
-		if (line == NULL || strlen(line) == 0) {
+		// end of input leaves the shell like exit does
+		if (line == NULL)
+			break;
+		lush_push_history(line);
+		if (strlen(line) == 0) {
 			free(line);
 			continue;
 		}
-		char *expanded_line = lush_resolve_aliases(line);
-		char **commands = lush_split_commands(expanded_line);
-		char ***args = lush_split_args(commands, &status);
-		if (status == -1) {
-			fprintf(stderr, "lush: Expected end of quoted string\n");
-		} else {
-			lush_expand_globs(args);
-		}
-
-		if (lush_run(L, args, status) != 0) {
-			exit(1);
-		}
+		line = read_heredoc_lines(line);
+		lush_eval_line(L, line);
 
-		for (int i = 0; args[i]; i++) {
-			free(args[i]);
-		}
-		// add last line to history
-		free(prompt);
-		free(args);
-		free(commands);
-		free(expanded_line);
 		free(line);
 	}
 	lua_close(L);
 	if (prompt_format != NULL)
 		free(prompt_format);
-	if (aliases != NULL)
-		free(aliases);
+	lush_free_aliases();
 	if (alt_shell != NULL)
 		free(alt_shell);
 	return 0;
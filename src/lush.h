@@ -18,15 +18,11 @@ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
 #ifndef LUSH_H
 #define LUSH_H
 
+#include "parse.h"
 #include <lua.h>
 #include <stdbool.h>
 
-#define LUSH_LUA 5
-
-// alias
-void lush_add_alias(const char *alias, const char *command);
-char *lush_get_alias(char *alias);
-char *lush_resolve_aliases(char *line);
+#define LUSH_LUA 15
 
 // builtins
 extern char *builtin_strs[];
@@ -39,18 +35,34 @@ int lush_help(lua_State *L, char ***args);
 int lush_exit(lua_State *L, char ***args);
 int lush_time(lua_State *L, char ***args);
 int lush_trap(lua_State *L, char ***args);
+int lush_break(lua_State *L, char ***args);
+int lush_continue(lua_State *L, char ***args);
+int lush_return(lua_State *L, char ***args);
+int lush_hash(lua_State *L, char ***args);
+int lush_jobs(lua_State *L, char ***args);
+int lush_fg(lua_State *L, char ***args);
+int lush_bg(lua_State *L, char ***args);
+int lush_wait(lua_State *L, char ***args);
+int lush_disown(lua_State *L, char ***args);
+int lush_parallel(lua_State *L, char ***args);
 int lush_lua(lua_State *L, char ***args);
 
 int lush_num_builtins();
 
+// runs the traps of signals that arrived since the last call. called
+// between commands and while waiting at the prompt, never from a handler
+void lush_run_traps();
+
 int lush_run(lua_State *L, char ***commands, int num_commands);
 
 char *lush_read_line();
-char **lush_split_commands(char *line);
-char ***lush_split_args(char **commands, int *status);
 
 int lush_execute_command(char **args, int input_fd, int output_fd);
-int lush_execute_pipeline(char ***commands, int num_commands);
+int lush_execute_pipeline(lua_State *L, char ***commands, int num_commands);
+// runs argument vectors as a foreground pipeline without any parsing, fds
+// are the first stage's stdin, the last one's stdout and every stderr
+int lush_execute_argv(lua_State *L, char ***commands, int num_commands,
+					  const int fds[3]);
 int lush_execute_chain(lua_State *L, char ***commands, int num_commands);
 
 void lush_format_prompt(const char *prompt_format);
@@ -58,6 +70,8 @@ void lush_format_prompt(const char *prompt_format);
 // initialized in the lua_api
 extern bool suggestion_enable;
 extern char *alt_shell;
+// a pipeline fails when any stage does, not only the last
+extern bool pipefail_enable;
 
 // format spec for the prompt
 extern char *prompt_format;
@@ -65,5 +79,7 @@ extern char *prompt_format;
 // history
 char *lush_get_past_command(int pos);
 void lush_push_history(const char *line);
+// records lines in the order they ran with one rewrite of the file
+void lush_push_history_lines(const char **lines, int count);
 
 #endif // LUSH_H
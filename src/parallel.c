@@ -0,0 +1,320 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#define _GNU_SOURCE
+#include "parallel.h"
+#include "ast.h"
+#include "eval.h"
+#include "expand.h"
+#include "loop.h"
+#include "lush.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// GNU parallel's cap, higher counts would wrap as an exit status
+#define MAX_REPORTED_FAILURES 101
+// finished jobs whose output waits on an earlier one before new jobs stop
+// starting, each holds an fd
+#define MAX_HELD_OUTPUTS 256
+
+typedef struct {
+	pid_t pid;
+	int pidfd;
+	// grouped output not yet released, -1 when there is none
+	int output_fd;
+	int status;
+	bool done;
+} worker_t;
+
+typedef struct {
+	lua_State *L;
+	const parallel_opts_t *opts;
+	// the template parsed once, NULL when every input is its own line
+	ast_node_t *tree;
+	char **inputs;
+	int num_inputs;
+	worker_t *workers;
+	// indexes of the workers still running
+	int *running;
+	int num_running;
+	int next_start;
+	int next_release;
+	int null_fd;
+	int failures;
+	int first_failure;
+	bool stop;
+	bool interrupted;
+	// what the user had in PARALLEL_ARG and PARALLEL_SEQ, NULL if unset
+	char *saved_arg;
+	char *saved_seq;
+} pool_t;
+
+// swaps {} and {#} for parameters so the template is parsed once and each
+// job only sets them. without {} the input goes last like in GNU parallel
+static char *prepare_template(const char *template) {
+	char *prepared = malloc(strlen(template) * 8 + 32);
+	if (prepared == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+
+	char *out = prepared;
+	bool has_input = false;
+	for (const char *c = template; *c;) {
+		if (strncmp(c, "{}", 2) == 0) {
+			out = stpcpy(out, "${PARALLEL_ARG}");
+			has_input = true;
+			c += 2;
+		} else if (strncmp(c, "{#}", 3) == 0) {
+			out = stpcpy(out, "${PARALLEL_SEQ}");
+			c += 3;
+		} else {
+			*out++ = *c++;
+		}
+	}
+	*out = '\0';
+	if (!has_input)
+		strcpy(out, " ${PARALLEL_ARG}");
+	return prepared;
+}
+
+static void write_all(int fd, const char *buffer, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, buffer, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buffer += written;
+		len -= written;
+	}
+}
+
+static void release_output(worker_t *worker) {
+	if (worker->output_fd < 0)
+		return;
+
+	char buffer[65536];
+	off_t offset = 0;
+	ssize_t len;
+	fflush(stdout);
+	while ((len = pread(worker->output_fd, buffer, sizeof(buffer), offset)) >
+		   0) {
+		write_all(STDOUT_FILENO, buffer, len);
+		offset += len;
+	}
+	close(worker->output_fd);
+	worker->output_fd = -1;
+}
+
+static void finish_job(pool_t *pool, int index) {
+	worker_t *worker = &pool->workers[index];
+	worker->done = true;
+	if (worker->pidfd >= 0)
+		lush_loop_remove(worker->pidfd);
+	worker->pidfd = -1;
+
+	if (worker->status == 128 + SIGINT) {
+		// ^C stops the whole run like it stops a loop
+		pool->interrupted = true;
+		pool->stop = true;
+	} else if (worker->status != 0) {
+		pool->failures++;
+		if (pool->first_failure == 0)
+			pool->first_failure = worker->status;
+		if (pool->opts->halt != PARALLEL_HALT_NEVER)
+			pool->stop = true;
+		if (pool->opts->halt == PARALLEL_HALT_NOW) {
+			for (int i = 0; i < pool->num_running; i++)
+				kill(pool->workers[pool->running[i]].pid, SIGTERM);
+		}
+	}
+
+	if (!pool->opts->keep_order) {
+		release_output(worker);
+		return;
+	}
+	while (pool->next_release < pool->next_start &&
+		   pool->workers[pool->next_release].done)
+		release_output(&pool->workers[pool->next_release++]);
+}
+
+static char *save_var(const char *name) {
+	const char *value = lush_env_get(name);
+	if (value == NULL)
+		return NULL;
+	char *copy = strdup(value);
+	if (copy == NULL) {
+		perror("strdup failed");
+		exit(1);
+	}
+	return copy;
+}
+
+static void restore_var(const char *name, const char *value) {
+	if (value != NULL)
+		lush_env_set(name, value);
+	else
+		lush_env_unset(name);
+}
+
+// wakes the loop, the pool collects its workers itself
+static void worker_exited(int fd, uint32_t events, void *data) {}
+
+static void start_job(pool_t *pool, int index) {
+	worker_t *worker = &pool->workers[index];
+	worker->pid = -1;
+	worker->pidfd = -1;
+	worker->output_fd = -1;
+
+	char seq[24];
+	snprintf(seq, sizeof(seq), "%d", index + 1);
+	// the job is expanded or forked while starting, so the variables only
+	// have to be there until it has been started
+	lush_env_set("PARALLEL_ARG", pool->inputs[index]);
+	lush_env_set("PARALLEL_SEQ", seq);
+
+	// grouped output goes to an anonymous file until it is released
+	if (!pool->opts->ungroup) {
+		worker->output_fd = memfd_create("lush-parallel", MFD_CLOEXEC);
+		if (worker->output_fd < 0)
+			perror("lush: parallel: memfd_create");
+	}
+	int output_fd =
+		worker->output_fd >= 0 ? worker->output_fd : STDOUT_FILENO;
+
+	ast_node_t *tree = pool->tree;
+	ast_node_t *own_tree = NULL;
+	if (tree == NULL) {
+		int status = 0;
+		tree = own_tree = lush_ast_parse(pool->inputs[index], &status);
+		worker->status = status < 0 ? 2 : 0;
+	}
+
+	if (tree != NULL) {
+		int fds[3] = {pool->null_fd, output_fd, STDERR_FILENO};
+		worker->pid = lush_eval_start(pool->L, tree, fds, &worker->status);
+	}
+	lush_ast_free(own_tree);
+	restore_var("PARALLEL_ARG", pool->saved_arg);
+	restore_var("PARALLEL_SEQ", pool->saved_seq);
+
+	if (worker->pid < 0) {
+		finish_job(pool, index);
+		return;
+	}
+	worker->pidfd = lush_loop_watch_pid(worker->pid, worker_exited, NULL);
+	pool->running[pool->num_running++] = index;
+}
+
+static void collect_jobs(pool_t *pool) {
+	for (int i = 0; i < pool->num_running;) {
+		int index = pool->running[i];
+		worker_t *worker = &pool->workers[index];
+		int wstatus;
+		pid_t pid = waitpid(worker->pid, &wstatus, WNOHANG);
+		if (pid == 0 || (pid < 0 && errno == EINTR)) {
+			i++;
+			continue;
+		}
+
+		if (pid > 0 && WIFEXITED(wstatus))
+			worker->status = WEXITSTATUS(wstatus);
+		else if (pid > 0)
+			worker->status = 128 + WTERMSIG(wstatus);
+		pool->running[i] = pool->running[--pool->num_running];
+		finish_job(pool, index);
+	}
+}
+
+static bool can_start(pool_t *pool) {
+	if (pool->stop || pool->next_start >= pool->num_inputs ||
+		pool->num_running >= pool->opts->max_jobs)
+		return false;
+	// a slow early job holds back the output of everything after it
+	return !pool->opts->keep_order ||
+		   pool->next_start - pool->next_release <
+			   pool->opts->max_jobs + MAX_HELD_OUTPUTS;
+}
+
+int lush_parallel_run(lua_State *L, const char *template, char **inputs,
+					  int num_inputs, const parallel_opts_t *opts) {
+	pool_t pool = {0};
+	pool.L = L;
+	pool.opts = opts;
+	pool.inputs = inputs;
+	pool.num_inputs = num_inputs;
+
+	// jobs read nothing, the inputs may have come from stdin
+	pool.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (pool.null_fd < 0) {
+		perror("lush: parallel: /dev/null");
+		return 1;
+	}
+
+	if (template != NULL && template[0] != '\0') {
+		char *prepared = prepare_template(template);
+		int status = 0;
+		pool.tree = lush_ast_parse(prepared, &status);
+		free(prepared);
+		if (pool.tree == NULL) {
+			close(pool.null_fd);
+			return status < 0 ? 2 : 0;
+		}
+	}
+
+	pool.saved_arg = save_var("PARALLEL_ARG");
+	pool.saved_seq = save_var("PARALLEL_SEQ");
+	pool.workers = calloc(num_inputs + 1, sizeof(worker_t));
+	pool.running = calloc(opts->max_jobs, sizeof(int));
+	if (pool.workers == NULL || pool.running == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+	while (true) {
+		while (can_start(&pool))
+			start_job(&pool, pool.next_start++);
+		if (pool.num_running == 0)
+			break;
+		lush_loop_run_once(-1);
+		collect_jobs(&pool);
+	}
+
+	fflush(stdout);
+
+	free(pool.saved_arg);
+	free(pool.saved_seq);
+	close(pool.null_fd);
+	lush_ast_free(pool.tree);
+	free(pool.workers);
+	free(pool.running);
+
+	if (pool.interrupted)
+		return 128 + SIGINT;
+	if (opts->halt != PARALLEL_HALT_NEVER)
+		return pool.first_failure;
+	return pool.failures < MAX_REPORTED_FAILURES ? pool.failures
+												 : MAX_REPORTED_FAILURES;
+}
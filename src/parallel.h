@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "lua.h"
+#include <stdbool.h>
+
+typedef enum {
+	PARALLEL_HALT_NEVER, // run every job whatever fails
+	PARALLEL_HALT_SOON,	 // start nothing new after a failure
+	PARALLEL_HALT_NOW,	 // also terminate the jobs still running
+} parallel_halt_t;
+
+typedef struct {
+	// jobs running at once
+	int max_jobs;
+	// release grouped output in the order the inputs were given instead of
+	// the order the jobs finished
+	bool keep_order;
+	// jobs write straight to stdout and their lines may interleave
+	bool ungroup;
+	parallel_halt_t halt;
+} parallel_opts_t;
+
+// runs template once per input on a pool of child processes. {} in the
+// template is the input and {#} its number from 1, without {} the input is
+// appended. the template is parsed once, an empty one runs each input as
+// its own command line. a job that is one external command is spawned
+// directly, anything else runs in a forked copy of the shell. returns the
+// number of failed jobs, at most 101, or with a halt policy the status of
+// the first failure
+int lush_parallel_run(lua_State *L, const char *template, char **inputs,
+					  int num_inputs, const parallel_opts_t *opts);
+
+#endif // PARALLEL_H
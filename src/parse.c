@@ -0,0 +1,518 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "parse.h"
+#include "expand.h"
+#include "hashmap.h"
+#include "wildcard.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -- aliasing --
+static hashmap_t *aliases = NULL;
+
+void lush_add_alias(const char *alias, const char *command) {
+	// make a new map if one doesnt exist
+	if (aliases == NULL) {
+		aliases = hm_new_hashmap();
+	}
+
+	// lua strings can be collected so the map keeps its own copies
+	char *value = strdup(command);
+	if (value == NULL) {
+		perror("strdup failed");
+		return;
+	}
+
+	char *old = hm_get(aliases, (char *)alias);
+	if (old != NULL) {
+		free(old);
+		hm_set(aliases, (char *)alias, value);
+	} else {
+		char *key = strdup(alias);
+		if (key == NULL) {
+			perror("strdup failed");
+			free(value);
+			return;
+		}
+		hm_set(aliases, key, value);
+	}
+}
+
+char *lush_get_alias(char *alias) {
+	return aliases ? hm_get(aliases, alias) : NULL;
+}
+
+void lush_free_aliases() {
+	if (aliases == NULL)
+		return;
+
+	for (unsigned int i = 0; i < aliases->cap; i++) {
+		for (map_pair_t *pair = aliases->list[i]; pair; pair = pair->next) {
+			free(pair->key);
+			free(pair->val);
+		}
+	}
+	hm_free_hashmap(aliases);
+	aliases = NULL;
+}
+
+// -- line splitting --
+
+char *lush_resolve_aliases(char *line) {
+	// Allocate memory for the new string, grown as aliases are substituted
+	size_t capacity = strlen(line) + 1;
+	char *result = (char *)malloc(capacity);
+	if (!result) {
+		perror("malloc failed");
+		return NULL;
+	}
+
+	// Create a copy of the input line for tokenization
+	char *line_copy = strdup(line);
+	if (!line_copy) {
+		perror("strdup failed");
+		free(result);
+		return NULL;
+	}
+
+	// Start building the result string
+	size_t len = 0;
+	char *arg = strtok(line_copy, " ");
+	while (arg != NULL) {
+		// Check shell aliases
+		char *token = arg;
+		if (aliases != NULL) {
+			char *alias = hm_get(aliases, arg);
+			if (alias != NULL) {
+				// Replace alias
+				token = alias;
+			}
+		}
+
+		size_t token_len = strlen(token);
+		if (len + token_len + 2 > capacity) {
+			capacity = (len + token_len + 2) * 2;
+			char *new_result = realloc(result, capacity);
+			if (!new_result) {
+				perror("realloc failed");
+				free(result);
+				free(line_copy);
+				return NULL;
+			}
+			result = new_result;
+		}
+		memcpy(result + len, token, token_len);
+		len += token_len;
+
+		// Add a space after each token (if it's not the last one)
+		arg = strtok(NULL, " ");
+		if (arg != NULL) {
+			result[len++] = ' ';
+		}
+	}
+
+	result[len] = '\0'; // Null-terminate the result string
+
+	// Clean up
+	free(line_copy);
+
+	return result;
+}
+
+void lush_expand_globs(char ***args) {
+	if (args == NULL) {
+		return;
+	}
+
+	for (int i = 0; args[i]; i++) {
+		// only rebuild the arg list when something in it is a pattern
+		int j = 0;
+		while (args[i][j] && !lush_wildcard_has_magic(args[i][j]))
+			lush_wildcard_unescape(args[i][j++]);
+		if (args[i][j] == NULL)
+			continue;
+
+		argv_t expanded = {0};
+		for (int k = 0; k < j; k++)
+			lush_argv_push(&expanded, args[i][k]);
+		for (; args[i][j]; j++) {
+			char *arg = args[i][j];
+			// patterns without matches are passed on without their escapes
+			if (lush_wildcard_has_magic(arg) &&
+				lush_wildcard_expand(arg, &expanded) > 0) {
+				free(arg);
+				continue;
+			}
+			lush_wildcard_unescape(arg);
+			lush_argv_push(&expanded, arg);
+		}
+		free(args[i]);
+		args[i] = expanded.items;
+	}
+}
+
+int lush_is_operator(const char *str) {
+	if (str == NULL)
+		return 0;
+
+	const char *operators[] = {"1>>", "2>>", "&>>", ">>",  "1>",  "2>",
+							   "&>",  "||",	 "&&",	";;",  ">",	  "&",
+							   ";",	  "|",	 "<<<", "<<-", "<<",  "<"};
+	int num_operators = sizeof(operators) / sizeof(operators[0]);
+	for (int i = 0; i < num_operators; i++) {
+		if (strncmp(str, operators[i], strlen(operators[i])) == 0) {
+			switch (i) {
+			case 0:
+				return OP_APPEND_STDOUT;
+			case 1:
+				return OP_APPEND_STDERR;
+			case 2:
+				return OP_APPEND_BOTH;
+			case 3:
+				return OP_APPEND_STDOUT;
+			case 4:
+				return OP_REDIRECT_STDOUT;
+			case 5:
+				return OP_REDIRECT_STDERR;
+			case 6:
+				return OP_REDIRECT_BOTH;
+			case 7:
+				return OP_OR;
+			case 8:
+				return OP_AND;
+			case 9:
+				return OP_CASE_END;
+			case 10:
+				return OP_REDIRECT_STDOUT;
+			case 11:
+				return OP_BACKGROUND;
+			case 12:
+				return OP_SEMICOLON;
+			case 13:
+				return OP_PIPE;
+			case 14:
+				return OP_HERESTRING;
+			case 15:
+				return OP_HEREDOC_STRIP;
+			case 16:
+				return OP_HEREDOC;
+			case 17:
+				return OP_REDIRECT_STDIN;
+			default:
+				return 0;
+			}
+		}
+	}
+	return 0; // Not an operator
+}
+
+int lush_operator_length(const char *str) {
+	const char *operators[] = {"1>>", "2>>", "&>>", ">>",  "1>",  "2>",
+							   "&>",  "||",	 "&&",	";;",  ">",	  "&",
+							   ";",	  "|",	 "<<<", "<<-", "<<",  "<"};
+	int num_operators = sizeof(operators) / sizeof(operators[0]);
+	for (int i = 0; i < num_operators; i++) {
+		if (strncmp(str, operators[i], strlen(operators[i])) == 0) {
+			switch (i) {
+			case 0:
+			case 1:
+			case 2:
+			case 14:
+			case 15:
+				return 3;
+			case 3:
+			case 4:
+			case 5:
+			case 6:
+			case 7:
+			case 8:
+			case 9:
+			case 16:
+				return 2;
+			case 10:
+			case 11:
+			case 12:
+			case 13:
+			case 17:
+				return 1;
+			default:
+				return 0;
+			}
+		}
+	}
+	return 0;
+}
+
+static char *trim_whitespace(char *str) {
+	char *end;
+
+	// Trim leading space
+	while (isspace((unsigned char)*str))
+		str++;
+
+	if (*str == 0)
+		return str; // If all spaces, return empty string
+
+	// Trim trailing space
+	end = str + strlen(str) - 1;
+	while (end > str && isspace((unsigned char)*end))
+		end--;
+
+	*(end + 1) = '\0';
+
+	return str;
+}
+
+// Split the command based on various chaining operations
+char **lush_split_commands(char *line) {
+	size_t capacity = 16;
+	char **commands = calloc(capacity, sizeof(char *));
+	if (!commands) {
+		perror("calloc failed");
+		exit(1);
+	}
+
+	size_t pos = 0;
+	char *start = line;
+	while (*start) {
+		// Skip leading spaces, newlines separate commands like ;
+		while (isspace((unsigned char)*start) && *start != '\n')
+			start++;
+
+		// nothing but trailing whitespace left
+		if (*start == '\0')
+			break;
+
+		// Check for operators
+		int op_len = lush_operator_length(start);
+		if (*start == '\n') {
+			commands[pos++] = strdup(";");
+			start++;
+		} else if (op_len > 0) {
+			// Allocate memory for operator command
+			commands[pos++] = strndup(start, op_len);
+			start += op_len;
+		} else {
+			// Collect regular commands until the next operator or end of
+			// string, operators inside quotes or ${...} are left alone
+			char *next = start;
+			char quote = '\0';
+			int depth = 0;
+			while (*next) {
+				if (quote) {
+					if (*next == '\\' && quote == '"' && next[1])
+						next++;
+					else if (*next == quote)
+						quote = '\0';
+				} else if (*next == '"' || *next == '\'') {
+					quote = *next;
+				} else if (*next == '\\' && next[1]) {
+					next++;
+				} else if (*next == '$' && (next[1] == '{' || next[1] == '(')) {
+					depth++;
+					next++;
+				} else if (depth > 0 && (*next == '{' || *next == '(')) {
+					depth++;
+				} else if (depth > 0 && (*next == '}' || *next == ')')) {
+					depth--;
+				}
+				next++;
+
+				if (!quote && depth == 0 &&
+					(*next == '\n' || lush_is_operator(next)))
+					break;
+			}
+
+			// Copy the command between start and next
+			char *command = strndup(start, next - start);
+			commands[pos++] = trim_whitespace(command);
+			start = next;
+		}
+
+		if (pos + 1 >= capacity) {
+			// double so long lines do not realloc per segment
+			capacity *= 2;
+			commands = realloc(commands, capacity * sizeof(char *));
+			if (!commands) {
+				perror("realloc failed");
+				exit(1);
+			}
+		}
+	}
+
+	commands[pos] = NULL;
+	return commands;
+}
+
+// appends a word to a NULL terminated growable array
+static char **push_word(char **words, size_t *pos, size_t *capacity,
+						char *word) {
+	if (*pos + 1 >= *capacity) {
+		*capacity *= 2;
+		words = realloc(words, *capacity * sizeof(char *));
+		if (!words) {
+			perror("realloc failed");
+			exit(1);
+		}
+	}
+	words[(*pos)++] = word;
+	words[*pos] = NULL;
+	return words;
+}
+
+char ***lush_split_words(char **commands, int *status) {
+	int num_commands = 0;
+	while (commands[num_commands])
+		num_commands++;
+
+	char ***command_words = calloc(num_commands + 1, sizeof(char **));
+	if (!command_words) {
+		perror("calloc failed");
+		exit(1);
+	}
+
+	for (int i = 0; commands[i]; i++) {
+		size_t pos = 0;
+		size_t capacity = 16;
+		char **words = calloc(capacity, sizeof(char *));
+		if (!words) {
+			perror("calloc failed");
+			exit(1);
+		}
+		// attach right away so a failed split can still be freed
+		command_words[i] = words;
+
+		const char *cursor = commands[i];
+		while (*cursor) {
+			if (isspace((unsigned char)*cursor)) {
+				cursor++;
+				continue;
+			}
+
+			// verify that string literals and substitutions are finished
+			int len = lush_word_length(cursor);
+			if (len < 0) {
+				*status = -1;
+				return command_words;
+			}
+
+			char *raw = strndup(cursor, len);
+			if (!raw) {
+				perror("strndup failed");
+				exit(1);
+			}
+			cursor += len;
+
+			words = push_word(words, &pos, &capacity, raw);
+			command_words[i] = words;
+		}
+	}
+
+	*status = num_commands;
+	return command_words;
+}
+
+size_t lush_assignment_length(const char *word) {
+	if (!(isalpha((unsigned char)word[0]) || word[0] == '_'))
+		return 0;
+	size_t i = 1;
+	while (isalnum((unsigned char)word[i]) || word[i] == '_')
+		i++;
+	return word[i] == '=' ? i : 0;
+}
+
+char ***lush_expand_args(char ***words, int *status) {
+	int num_commands = 0;
+	while (words[num_commands])
+		num_commands++;
+
+	char ***command_args = calloc(num_commands + 1, sizeof(char **));
+	if (!command_args) {
+		perror("calloc failed");
+		exit(1);
+	}
+
+	// the fields of one word, their strings move into the args
+	argv_t fields = {0};
+	for (int i = 0; words[i]; i++) {
+		size_t pos = 0;
+		size_t capacity = 16;
+		char **args = calloc(capacity, sizeof(char *));
+		if (!args) {
+			perror("calloc failed");
+			exit(1);
+		}
+		command_args[i] = args;
+
+		// leading assignments keep "$@" as one word like the shell does
+		bool assigning = true;
+		for (int j = 0; words[i][j]; j++) {
+			assigning = assigning && lush_assignment_length(words[i][j]) > 0;
+			fields.count = 0;
+			if (lush_expand_fields(words[i][j], !assigning, &fields) != 0) {
+				free(fields.items);
+				*status = -2;
+				return command_args;
+			}
+
+			// an unquoted word that expanded to nothing adds no fields
+			for (size_t k = 0; k < fields.count; k++)
+				args = push_word(args, &pos, &capacity, fields.items[k]);
+			command_args[i] = args;
+		}
+	}
+
+	free(fields.items);
+	*status = num_commands;
+	return command_args;
+}
+
+char ***lush_split_args(char **commands, int *status) {
+	char ***words = lush_split_words(commands, status);
+	if (*status < 0)
+		return words;
+
+	char ***args = lush_expand_args(words, status);
+	lush_free_args(words);
+	return args;
+}
+
+void lush_free_args(char ***args) {
+	if (args == NULL)
+		return;
+
+	for (int i = 0; args[i]; i++) {
+		for (int j = 0; args[i][j]; j++) {
+			free(args[i][j]);
+		}
+		free(args[i]);
+	}
+	free(args);
+}
+
+void lush_free_commands(char **commands) {
+	if (commands == NULL)
+		return;
+
+	for (int i = 0; commands[i]; i++) {
+		free(commands[i]);
+	}
+	free(commands);
+}
@@ -0,0 +1,62 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stddef.h>
+
+typedef enum {
+	OP_PIPE = 1,		// |
+	OP_AND,				// &&
+	OP_OR,				// ||
+	OP_SEMICOLON,		// ;
+	OP_BACKGROUND,		// &
+	OP_REDIRECT_STDOUT, // 1> or >
+	OP_REDIRECT_STDERR, // 2>
+	OP_REDIRECT_BOTH,	// &>
+	OP_APPEND_STDOUT,	// 1>> or >>
+	OP_APPEND_STDERR,	// 2>>
+	OP_APPEND_BOTH,		// &>>
+	OP_CASE_END,		// ;;
+	OP_REDIRECT_STDIN,	// <
+	OP_HEREDOC,			// <<
+	OP_HEREDOC_STRIP,	// <<-
+	OP_HERESTRING,		// <<<
+	OP_OTHER			// All other operators like parentheses, braces, etc.
+} OperatorType;
+
+// alias
+void lush_add_alias(const char *alias, const char *command);
+char *lush_get_alias(char *alias);
+void lush_free_aliases();
+char *lush_resolve_aliases(char *line);
+
+// line splitting, kept free of the REPL so it can be fuzzed on its own
+int lush_is_operator(const char *str);
+int lush_operator_length(const char *str);
+char **lush_split_commands(char *line);
+char ***lush_split_words(char **commands, int *status);
+// length of the name of a NAME=value word, 0 if it is no assignment
+size_t lush_assignment_length(const char *word);
+char ***lush_expand_args(char ***words, int *status);
+char ***lush_split_args(char **commands, int *status);
+void lush_expand_globs(char ***args);
+void lush_free_args(char ***args);
+void lush_free_commands(char **commands);
+
+#endif // PARSE_H
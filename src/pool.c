@@ -0,0 +1,461 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "pool.h"
+#include "lua_api.h"
+#include <lauxlib.h>
+#include <lualib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// deeper tables are taken for a cycle
+#define POOL_MAX_DEPTH 64
+// stack slots that decoding the deepest table can need
+#define POOL_STACK (3 * POOL_MAX_DEPTH + 3)
+
+enum {
+	TAG_NIL,
+	TAG_FALSE,
+	TAG_TRUE,
+	TAG_INTEGER,
+	TAG_NUMBER,
+	TAG_STRING,
+	TAG_TABLE,
+	TAG_END,
+};
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t capacity;
+} pool_buf_t;
+
+typedef struct {
+	pool_buf_t value;
+	// the value is an error message instead of a result
+	bool failed;
+} pool_result_t;
+
+typedef struct {
+	// lua source, or a dumped function when is_binary
+	pool_buf_t code;
+	bool is_binary;
+	pool_buf_t *inputs;
+	pool_result_t *results;
+	size_t count;
+	// the serialized inputs are the queue, a worker claims the next index
+	// and is the only one to write that result
+	atomic_size_t next;
+	// set on the first error so the others stop claiming inputs
+	atomic_bool stop;
+} pool_t;
+
+typedef struct {
+	pthread_t thread;
+	pool_t *pool;
+	// why the worker's state could not be set up
+	char *error;
+} pool_worker_t;
+
+// these change the shell or start processes, which only the main state
+// may do while the workers run
+static const char *worker_blocked[] = {
+	"exec", "execMany", "debug", "suggestions", "pipefail", "cd", "setenv",
+	"unsetenv", "setPrompt", "alias", "altShell", "setTimer", "clearTimer",
+	"spawn", "capture", "lines", "run", "wait", "poll", "kill", "parallel",
+	NULL};
+
+static void buf_put(pool_buf_t *buf, const void *data, size_t len) {
+	if (buf->len + len > buf->capacity) {
+		size_t capacity = buf->capacity ? buf->capacity * 2 : 64;
+		while (capacity < buf->len + len)
+			capacity *= 2;
+		char *grown = realloc(buf->data, capacity);
+		if (grown == NULL) {
+			perror("realloc failed");
+			exit(1);
+		}
+		buf->data = grown;
+		buf->capacity = capacity;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void buf_tag(pool_buf_t *buf, char tag) { buf_put(buf, &tag, 1); }
+
+// appends the value at index, returns why it can not be passed or NULL
+static const char *encode(lua_State *L, int index, pool_buf_t *buf,
+						  int depth) {
+	switch (lua_type(L, index)) {
+	case LUA_TNIL:
+		buf_tag(buf, TAG_NIL);
+		return NULL;
+	case LUA_TBOOLEAN:
+		buf_tag(buf, lua_toboolean(L, index) ? TAG_TRUE : TAG_FALSE);
+		return NULL;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, index)) {
+			lua_Integer value = lua_tointeger(L, index);
+			buf_tag(buf, TAG_INTEGER);
+			buf_put(buf, &value, sizeof(value));
+		} else {
+			lua_Number value = lua_tonumber(L, index);
+			buf_tag(buf, TAG_NUMBER);
+			buf_put(buf, &value, sizeof(value));
+		}
+		return NULL;
+	case LUA_TSTRING: {
+		size_t len;
+		const char *value = lua_tolstring(L, index, &len);
+		buf_tag(buf, TAG_STRING);
+		buf_put(buf, &len, sizeof(len));
+		buf_put(buf, value, len);
+		return NULL;
+	}
+	case LUA_TTABLE:
+		break;
+	default:
+		return "only nil, booleans, numbers, strings and tables can be "
+			   "passed";
+	}
+
+	if (depth >= POOL_MAX_DEPTH || !lua_checkstack(L, 3))
+		return "tables are nested too deep or hold a cycle";
+	index = lua_absindex(L, index);
+	buf_tag(buf, TAG_TABLE);
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		const char *error = encode(L, -2, buf, depth + 1);
+		if (error == NULL)
+			error = encode(L, -1, buf, depth + 1);
+		if (error != NULL) {
+			lua_pop(L, 2);
+			return error;
+		}
+		lua_pop(L, 1);
+	}
+	buf_tag(buf, TAG_END);
+	return NULL;
+}
+
+// pushes the value at *pos and moves past it, the caller makes sure there
+// are POOL_STACK free slots
+static void decode(lua_State *L, const char **pos) {
+	switch (*(*pos)++) {
+	case TAG_NIL:
+		lua_pushnil(L);
+		return;
+	case TAG_FALSE:
+		lua_pushboolean(L, false);
+		return;
+	case TAG_TRUE:
+		lua_pushboolean(L, true);
+		return;
+	case TAG_INTEGER: {
+		lua_Integer value;
+		memcpy(&value, *pos, sizeof(value));
+		*pos += sizeof(value);
+		lua_pushinteger(L, value);
+		return;
+	}
+	case TAG_NUMBER: {
+		lua_Number value;
+		memcpy(&value, *pos, sizeof(value));
+		*pos += sizeof(value);
+		lua_pushnumber(L, value);
+		return;
+	}
+	case TAG_STRING: {
+		size_t len;
+		memcpy(&len, *pos, sizeof(len));
+		*pos += sizeof(len);
+		lua_pushlstring(L, *pos, len);
+		*pos += len;
+		return;
+	}
+	case TAG_TABLE:
+		lua_newtable(L);
+		while (**pos != TAG_END) {
+			decode(L, pos);
+			decode(L, pos);
+			lua_rawset(L, -3);
+		}
+		(*pos)++;
+		return;
+	}
+}
+
+static const char *error_message(lua_State *L) {
+	const char *message = lua_tostring(L, -1);
+	return message ? message : "(error object is not a string)";
+}
+
+static void set_error(pool_worker_t *worker, const char *message) {
+	worker->error = strdup(message);
+	if (worker->error == NULL) {
+		perror("strdup failed");
+		exit(1);
+	}
+	atomic_store(&worker->pool->stop, true);
+}
+
+static int blocked(lua_State *L) {
+	return luaL_error(L, "lush.%s is not available in parallel workers",
+					  lua_tostring(L, lua_upvalueindex(1)));
+}
+
+// a state with the libraries and api the shell's own has, minus what may
+// not run off the main thread
+static lua_State *worker_state() {
+	lua_State *L = luaL_newstate();
+	if (L == NULL)
+		return NULL;
+	luaL_openlibs(L);
+	lua_register_api(L);
+
+	lua_getglobal(L, "lush");
+	for (int i = 0; worker_blocked[i] != NULL; i++) {
+		lua_pushstring(L, worker_blocked[i]);
+		lua_pushcclosure(L, blocked, 1);
+		lua_setfield(L, -2, worker_blocked[i]);
+	}
+	lua_pop(L, 1);
+	return L;
+}
+
+// leaves the function the workers call on the stack
+static int worker_setup(lua_State *L) {
+	pool_t *pool = lua_touserdata(L, 1);
+	if (luaL_loadbufferx(L, pool->code.data, pool->code.len, "=parallel",
+						 pool->is_binary ? "b" : "t") != LUA_OK)
+		return lua_error(L);
+	if (!pool->is_binary) {
+		lua_call(L, 0, 1);
+		if (!lua_isfunction(L, -1))
+			return luaL_error(L, "the source must return a function");
+	}
+	return 1;
+}
+
+// calls the function with one decoded input and encodes what it returns
+static int run_item(lua_State *L) {
+	pool_buf_t *input = lua_touserdata(L, 2);
+	pool_buf_t *output = lua_touserdata(L, 3);
+	luaL_checkstack(L, POOL_STACK, "parallel");
+
+	lua_pushvalue(L, 1);
+	const char *pos = input->data;
+	decode(L, &pos);
+	lua_call(L, 1, 1);
+
+	const char *error = encode(L, -1, output, 0);
+	if (error != NULL) {
+		output->len = 0;
+		return luaL_error(L, "result: %s", error);
+	}
+	return 0;
+}
+
+static void *pool_worker(void *arg) {
+	pool_worker_t *worker = arg;
+	pool_t *pool = worker->pool;
+	lua_State *L = worker_state();
+	if (L == NULL) {
+		set_error(worker, "not enough memory for a worker");
+		return NULL;
+	}
+
+	lua_pushcfunction(L, worker_setup);
+	lua_pushlightuserdata(L, pool);
+	if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+		set_error(worker, error_message(L));
+		lua_close(L);
+		return NULL;
+	}
+
+	// the function stays at index 1
+	while (!atomic_load(&pool->stop)) {
+		size_t i = atomic_fetch_add(&pool->next, 1);
+		if (i >= pool->count)
+			break;
+
+		pool_result_t *result = &pool->results[i];
+		lua_pushcfunction(L, run_item);
+		lua_pushvalue(L, 1);
+		lua_pushlightuserdata(L, &pool->inputs[i]);
+		lua_pushlightuserdata(L, &result->value);
+		if (lua_pcall(L, 3, 0, 0) != LUA_OK) {
+			const char *message = error_message(L);
+			result->value.len = 0;
+			buf_put(&result->value, message, strlen(message) + 1);
+			result->failed = true;
+			atomic_store(&pool->stop, true);
+		}
+		lua_settop(L, 1);
+	}
+	lua_close(L);
+	return NULL;
+}
+
+static int dump_writer(lua_State *L, const void *data, size_t len,
+					   void *buf) {
+	buf_put(buf, data, len);
+	return 0;
+}
+
+static void pool_free(pool_t *pool) {
+	free(pool->code.data);
+	for (size_t i = 0; i < pool->count; i++) {
+		free(pool->inputs[i].data);
+		free(pool->results[i].value.data);
+	}
+	free(pool->inputs);
+	free(pool->results);
+}
+
+// checks that fn works in another state and puts its code into the pool
+static void pool_code(lua_State *L, int fn, pool_t *pool) {
+	if (!lua_isfunction(L, fn)) {
+		size_t len;
+		const char *source = luaL_checklstring(L, fn, &len);
+		// syntax errors show up once here instead of in every worker
+		if (luaL_loadbufferx(L, source, len, "=parallel", "t") != LUA_OK)
+			lua_error(L);
+		lua_pop(L, 1);
+		buf_put(&pool->code, source, len);
+		return;
+	}
+
+	if (lua_iscfunction(L, fn))
+		luaL_argerror(L, fn, "C functions can not be sent to workers");
+	// a loaded function's first upvalue becomes the worker's globals, any
+	// other would be nil there
+	const char *name = lua_getupvalue(L, fn, 2);
+	if (name == NULL) {
+		name = lua_getupvalue(L, fn, 1);
+		if (name != NULL) {
+			lua_pop(L, 1);
+			if (strcmp(name, "_ENV") == 0)
+				name = NULL;
+		}
+	}
+	if (name != NULL)
+		luaL_error(L, "parallel: function uses the outer local '%s'", name);
+
+	pool->is_binary = true;
+	lua_pushvalue(L, fn);
+	lua_dump(L, dump_writer, &pool->code, 0);
+	lua_pop(L, 1);
+}
+
+int lush_pool_map(lua_State *L, int fn, int inputs, int workers) {
+	fn = lua_absindex(L, fn);
+	inputs = lua_absindex(L, inputs);
+	luaL_checktype(L, inputs, LUA_TTABLE);
+	luaL_checkstack(L, POOL_STACK, "parallel");
+
+	pool_t pool = {0};
+	pool_code(L, fn, &pool);
+	pool.count = luaL_len(L, inputs);
+	if (pool.count == 0) {
+		free(pool.code.data);
+		lua_newtable(L);
+		return 1;
+	}
+	if (workers < 1) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = cpus > 0 ? cpus : 1;
+	}
+	if ((size_t)workers > pool.count)
+		workers = pool.count;
+
+	pool.inputs = calloc(pool.count, sizeof(pool_buf_t));
+	pool.results = calloc(pool.count, sizeof(pool_result_t));
+	pool_worker_t *threads = calloc(workers, sizeof(pool_worker_t));
+	if (pool.inputs == NULL || pool.results == NULL || threads == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < pool.count; i++) {
+		lua_rawgeti(L, inputs, i + 1);
+		const char *error = encode(L, -1, &pool.inputs[i], 0);
+		lua_pop(L, 1);
+		if (error != NULL) {
+			pool_free(&pool);
+			free(threads);
+			return luaL_error(L, "parallel: input %d: %s", (int)i + 1,
+							  error);
+		}
+	}
+	atomic_init(&pool.next, 0);
+	atomic_init(&pool.stop, false);
+
+	// signals stay with the main thread
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int started = 0;
+	for (; started < workers; started++) {
+		threads[started].pool = &pool;
+		if (pthread_create(&threads[started].thread, NULL, pool_worker,
+						   &threads[started]) != 0)
+			break;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	// the pool makes do with the threads it got
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	// the first failed input wins, then a worker that did not start
+	bool failed = started == 0;
+	if (failed)
+		lua_pushstring(L, "parallel: could not start a worker thread");
+	for (size_t i = 0; i < pool.count && !failed; i++) {
+		if (pool.results[i].failed) {
+			lua_pushfstring(L, "parallel: input %d: %s", (int)i + 1,
+							pool.results[i].value.data);
+			failed = true;
+		}
+	}
+	for (int i = 0; i < started; i++) {
+		if (threads[i].error != NULL && !failed) {
+			lua_pushfstring(L, "parallel: %s", threads[i].error);
+			failed = true;
+		}
+		free(threads[i].error);
+	}
+	if (!failed) {
+		lua_createtable(L, pool.count, 0);
+		for (size_t i = 0; i < pool.count; i++) {
+			const char *pos = pool.results[i].value.data;
+			decode(L, &pos);
+			lua_rawseti(L, -2, i + 1);
+		}
+	}
+
+	pool_free(&pool);
+	free(threads);
+	return failed ? lua_error(L) : 1;
+}
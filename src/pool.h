@@ -0,0 +1,32 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <lua.h>
+
+// runs the function given at fn on every element of the list at inputs,
+// spread over workers threads that each have a lua state of their own,
+// and pushes a table of the first results in input order. fn is either
+// lua source that returns the function or a function without upvalues.
+// values cross between states serialized, so only nil, booleans, numbers,
+// strings and tables of them can be passed. a worker count below one
+// means one per cpu. raises the first error a worker ran into
+int lush_pool_map(lua_State *L, int fn, int inputs, int workers);
+
+#endif // POOL_H
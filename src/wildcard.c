@@ -0,0 +1,1122 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#define _GNU_SOURCE
+#include "wildcard.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define DENTS_SIZE 65536
+#define SORT_CUTOFF 16
+#define RADIX_CUTOFF 256
+#define WALK_MAX_THREADS 16
+
+typedef struct {
+	argv_t *out;
+	char *path;
+	size_t len;
+	size_t capacity;
+	char *dents;
+	// only the top level walk may start threads for **
+	bool parallel;
+} walk_t;
+
+// directories waiting to be read by one walker thread. the owner works
+// from the tail and idle threads steal from the head
+typedef struct {
+	pthread_mutex_t lock;
+	char **items;
+	size_t head;
+	size_t tail;
+	size_t capacity;
+} deque_t;
+
+typedef struct globstar globstar_t;
+
+typedef struct {
+	globstar_t *globstar;
+	size_t index;
+	deque_t deque;
+	walk_t walk;
+	argv_t out;
+	pthread_t thread;
+	bool started;
+} worker_t;
+
+struct globstar {
+	worker_t *workers;
+	size_t num_workers;
+	// directories queued or being read, the walk is over at zero
+	atomic_size_t pending;
+	// pattern after the **, NULL when it was the last component
+	const char *rest;
+	// rest is one component so it is matched while reading
+	bool rest_simple;
+	bool rest_hidden;
+};
+
+void lush_argv_push(argv_t *argv, char *item) {
+	if (argv->count + 1 >= argv->capacity) {
+		size_t capacity = argv->capacity ? argv->capacity * 2 : 16;
+		char **items = realloc(argv->items, capacity * sizeof(char *));
+		if (items == NULL) {
+			perror("realloc failed");
+			exit(1);
+		}
+		argv->items = items;
+		argv->capacity = capacity;
+	}
+	argv->items[argv->count++] = item;
+	argv->items[argv->count] = NULL;
+}
+
+void lush_argv_free(argv_t *argv) {
+	for (size_t i = 0; i < argv->count; i++)
+		free(argv->items[i]);
+	free(argv->items);
+	argv->items = NULL;
+	argv->count = 0;
+	argv->capacity = 0;
+}
+
+static void push_copy(argv_t *argv, const char *str, size_t len) {
+	char *copy = strndup(str, len);
+	if (copy == NULL) {
+		perror("strndup failed");
+		exit(1);
+	}
+	lush_argv_push(argv, copy);
+}
+
+// -- matching --
+
+typedef struct {
+	const char *name;
+	int (*test)(int);
+} char_class_t;
+
+static const char_class_t char_classes[] = {
+	{"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+	{"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+	{"lower", islower}, {"print", isprint}, {"punct", ispunct},
+	{"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+};
+
+static bool match_class(const char *name, size_t len, unsigned char c) {
+	for (size_t i = 0; i < sizeof(char_classes) / sizeof(*char_classes);
+		 i++) {
+		if (strlen(char_classes[i].name) == len &&
+			strncmp(char_classes[i].name, name, len) == 0)
+			return char_classes[i].test(c);
+	}
+	return false;
+}
+
+// matches c against the bracket expression starting at pattern. returns
+// the length of the expression or 0 if it is never closed
+static size_t match_bracket(const char *pattern, unsigned char c,
+							bool *matched) {
+	size_t i = 1;
+	bool negate = pattern[i] == '!' || pattern[i] == '^';
+	if (negate)
+		i++;
+
+	bool found = false;
+	// a ] right after the opening bracket is a literal
+	bool first = true;
+	while (pattern[i] && (first || pattern[i] != ']')) {
+		first = false;
+		if (pattern[i] == '[' && pattern[i + 1] == ':') {
+			const char *end = strstr(pattern + i + 2, ":]");
+			if (end != NULL) {
+				const char *name = pattern + i + 2;
+				if (match_class(name, end - name, c))
+					found = true;
+				i = end - pattern + 2;
+				continue;
+			}
+		}
+
+		unsigned char low = pattern[i];
+		if (low == '\\' && pattern[i + 1])
+			low = pattern[++i];
+		i++;
+
+		unsigned char high = low;
+		if (pattern[i] == '-' && pattern[i + 1] && pattern[i + 1] != ']') {
+			i++;
+			if (pattern[i] == '\\' && pattern[i + 1])
+				i++;
+			high = pattern[i++];
+		}
+
+		if (c >= low && c <= high)
+			found = true;
+	}
+
+	if (pattern[i] != ']')
+		return 0;
+	*matched = found != negate;
+	return i + 1;
+}
+
+bool lush_wildcard_match(const char *pattern, const char *name) {
+	const char *star_pattern = NULL;
+	const char *star_name = NULL;
+
+	while (*name) {
+		if (*pattern == '*') {
+			while (*pattern == '*')
+				pattern++;
+			star_pattern = pattern;
+			star_name = name;
+			continue;
+		}
+
+		bool ok = false;
+		bool matched = false;
+		size_t len = 0;
+		if (*pattern == '?') {
+			ok = true;
+			pattern++;
+		} else if (*pattern == '[' &&
+				   (len = match_bracket(pattern, *name, &matched)) > 0) {
+			ok = matched;
+			if (ok)
+				pattern += len;
+		} else {
+			// an unterminated [ falls through as a literal
+			const char *literal = pattern;
+			if (*literal == '\\' && literal[1])
+				literal++;
+			if (*literal == *name) {
+				ok = true;
+				pattern = literal + 1;
+			}
+		}
+
+		if (ok) {
+			name++;
+			continue;
+		}
+
+		// retry the last star one character further along
+		if (star_pattern == NULL)
+			return false;
+		pattern = star_pattern;
+		name = ++star_name;
+	}
+
+	while (*pattern == '*')
+		pattern++;
+	return *pattern == '\0';
+}
+
+static bool has_magic(const char *pattern, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		if (pattern[i] == '\\' && i + 1 < len)
+			i++;
+		else if (pattern[i] == '*' || pattern[i] == '?' || pattern[i] == '[')
+			return true;
+	}
+	return false;
+}
+
+bool lush_wildcard_has_magic(const char *pattern) {
+	return has_magic(pattern, strlen(pattern));
+}
+
+void lush_wildcard_unescape(char *pattern) {
+	char *out = pattern;
+	for (; *pattern; pattern++) {
+		if (*pattern == '\\' && pattern[1])
+			pattern++;
+		*out++ = *pattern;
+	}
+	*out = '\0';
+}
+
+// -- sorting --
+
+// the next 8 bytes of a string, big endian so keys compare like strings
+typedef struct {
+	uint64_t key;
+	char *str;
+} sort_key_t;
+
+static uint64_t load_key(const char *str, size_t depth) {
+	const unsigned char *cursor = (const unsigned char *)str + depth;
+	uint64_t key = 0;
+	for (int i = 0; i < 8; i++) {
+		key <<= 8;
+		// bytes past the end stay zero
+		if (*cursor)
+			key |= *cursor++;
+	}
+	return key;
+}
+
+static void swap_keys(sort_key_t *keys, size_t a, size_t b) {
+	sort_key_t tmp = keys[a];
+	keys[a] = keys[b];
+	keys[b] = tmp;
+}
+
+static void sort_keys_r(sort_key_t *keys, size_t count) {
+	while (count > SORT_CUTOFF) {
+		// median of three keeps sorted directories from going quadratic
+		size_t mid = count / 2;
+		if (keys[mid].key < keys[0].key)
+			swap_keys(keys, mid, 0);
+		if (keys[count - 1].key < keys[0].key)
+			swap_keys(keys, count - 1, 0);
+		if (keys[count - 1].key < keys[mid].key)
+			swap_keys(keys, count - 1, mid);
+		uint64_t pivot = keys[mid].key;
+
+		size_t i = 0;
+		size_t j = count - 1;
+		for (;;) {
+			while (keys[i].key < pivot)
+				i++;
+			while (keys[j].key > pivot)
+				j--;
+			if (i >= j)
+				break;
+			swap_keys(keys, i++, j--);
+		}
+
+		// recurse into the smaller half to bound the stack
+		if (j + 1 < count - j - 1) {
+			sort_keys_r(keys, j + 1);
+			keys += j + 1;
+			count -= j + 1;
+		} else {
+			sort_keys_r(keys + j + 1, count - j - 1);
+			count = j + 1;
+		}
+	}
+
+	for (size_t i = 1; i < count; i++) {
+		for (size_t j = i; j > 0 && keys[j - 1].key > keys[j].key; j--)
+			swap_keys(keys, j, j - 1);
+	}
+}
+
+// lsd radix sort for large batches, passes where every key has the same
+// byte are skipped. the sorted keys end up back in keys
+static void radix_sort(sort_key_t *keys, sort_key_t *tmp, size_t count) {
+	// not static, globs run on parallel workers' threads at the same time
+	size_t counts[8][256] = {0};
+	for (size_t i = 0; i < count; i++) {
+		for (int byte = 0; byte < 8; byte++)
+			counts[byte][(keys[i].key >> (byte * 8)) & 0xff]++;
+	}
+
+	sort_key_t *src = keys;
+	sort_key_t *dst = tmp;
+	for (int byte = 0; byte < 8; byte++) {
+		size_t *bucket = counts[byte];
+		if (bucket[(src[0].key >> (byte * 8)) & 0xff] == count)
+			continue;
+
+		size_t offset = 0;
+		for (int i = 0; i < 256; i++) {
+			size_t size = bucket[i];
+			bucket[i] = offset;
+			offset += size;
+		}
+		for (size_t i = 0; i < count; i++)
+			dst[bucket[(src[i].key >> (byte * 8)) & 0xff]++] = src[i];
+
+		sort_key_t *swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if (src != keys)
+		memcpy(keys, src, count * sizeof(sort_key_t));
+}
+
+// sorts on 8 bytes at a time, only runs that tie go a level deeper so the
+// strings themselves are touched once per level
+static void sort_r(sort_key_t *keys, sort_key_t *tmp, size_t count,
+				   size_t depth) {
+	for (size_t i = 0; i < count; i++)
+		keys[i].key = load_key(keys[i].str, depth);
+	if (count >= RADIX_CUTOFF)
+		radix_sort(keys, tmp, count);
+	else
+		sort_keys_r(keys, count);
+
+	size_t start = 0;
+	for (size_t i = 1; i <= count; i++) {
+		if (i < count && keys[i].key == keys[start].key)
+			continue;
+		// a zero low byte means the strings ended and are equal
+		if (i - start > 1 && (keys[start].key & 0xff) != 0)
+			sort_r(keys + start, tmp + start, i - start, depth + 8);
+		start = i;
+	}
+}
+
+void lush_wildcard_sort(char **items, size_t count) {
+	if (count < 2)
+		return;
+
+	// matches from one directory share their whole prefix, skip it
+	size_t prefix = strlen(items[0]);
+	for (size_t i = 1; i < count && prefix > 0; i++) {
+		size_t j = 0;
+		while (j < prefix && items[i][j] == items[0][j])
+			j++;
+		prefix = j;
+	}
+
+	// one allocation holds the keys and the radix scratch space
+	sort_key_t *keys = malloc(2 * count * sizeof(sort_key_t));
+	if (keys == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	for (size_t i = 0; i < count; i++)
+		keys[i].str = items[i];
+	sort_r(keys, keys + count, count, prefix);
+	for (size_t i = 0; i < count; i++)
+		items[i] = keys[i].str;
+	free(keys);
+}
+
+// -- expansion --
+
+// finds the first {a,b} group that has a comma at its top level
+static bool find_braces(const char *pattern, size_t *open, size_t *close) {
+	for (size_t i = 0; pattern[i]; i++) {
+		if (pattern[i] == '\\' && pattern[i + 1]) {
+			i++;
+			continue;
+		}
+		if (pattern[i] != '{')
+			continue;
+
+		int depth = 0;
+		bool comma = false;
+		for (size_t j = i; pattern[j]; j++) {
+			if (pattern[j] == '\\' && pattern[j + 1]) {
+				j++;
+			} else if (pattern[j] == '{') {
+				depth++;
+			} else if (pattern[j] == ',' && depth == 1) {
+				comma = true;
+			} else if (pattern[j] == '}' && --depth == 0) {
+				if (!comma)
+					break;
+				*open = i;
+				*close = j;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void expand_braces_r(const char *pattern, argv_t *out) {
+	size_t open, close;
+	if (!find_braces(pattern, &open, &close)) {
+		push_copy(out, pattern, strlen(pattern));
+		return;
+	}
+
+	size_t total = strlen(pattern);
+	char *buf = malloc(total + 1);
+	if (buf == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	memcpy(buf, pattern, open);
+
+	size_t start = open + 1;
+	int depth = 0;
+	for (size_t i = start; i <= close; i++) {
+		if (pattern[i] == '\\' && i + 1 < close) {
+			i++;
+			continue;
+		}
+		if (pattern[i] == '{') {
+			depth++;
+		} else if (pattern[i] == '}' && depth > 0) {
+			depth--;
+		} else if ((pattern[i] == ',' && depth == 0) || i == close) {
+			size_t len = i - start;
+			memcpy(buf + open, pattern + start, len);
+			strcpy(buf + open + len, pattern + close + 1);
+			expand_braces_r(buf, out);
+			start = i + 1;
+		}
+	}
+	free(buf);
+}
+
+// resolves a leading ~ or ~user, returns NULL if there is none
+static const char *expand_tilde(const char *pattern, const char **rest) {
+	if (pattern[0] != '~')
+		return NULL;
+
+	size_t len = strcspn(pattern + 1, "/");
+	*rest = pattern + 1 + len;
+	if (len == 0)
+		return getenv("HOME");
+
+	char *user = strndup(pattern + 1, len);
+	if (user == NULL) {
+		perror("strndup failed");
+		exit(1);
+	}
+	struct passwd *pw = getpwnam(user);
+	free(user);
+	return pw ? pw->pw_dir : NULL;
+}
+
+static void path_append(walk_t *walk, const char *str, size_t len) {
+	if (walk->len + len + 1 > walk->capacity) {
+		size_t capacity = walk->capacity ? walk->capacity : 256;
+		while (walk->len + len + 1 > capacity)
+			capacity *= 2;
+		char *path = realloc(walk->path, capacity);
+		if (path == NULL) {
+			perror("realloc failed");
+			exit(1);
+		}
+		walk->path = path;
+		walk->capacity = capacity;
+	}
+	memcpy(walk->path + walk->len, str, len);
+	walk->len += len;
+	walk->path[walk->len] = '\0';
+}
+
+static void path_truncate(walk_t *walk, size_t len) {
+	walk->len = len;
+	walk->path[len] = '\0';
+}
+
+// appends a literal component with its escapes removed
+static void path_append_literal(walk_t *walk, const char *str, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		if (str[i] == '\\' && i + 1 < len)
+			i++;
+		path_append(walk, str + i, 1);
+	}
+}
+
+static bool is_dir_at(int dir_fd, const char *name) {
+	struct stat st;
+	return fstatat(dir_fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void walk_globstar(walk_t *walk, const char *rest);
+
+static bool starts_with_dot(const char *pattern) {
+	return pattern[0] == '.' || (pattern[0] == '\\' && pattern[1] == '.');
+}
+
+static bool is_dot_dir(const char *name) {
+	return name[0] == '.' &&
+		   (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+static void walk_r(walk_t *walk, const char *pattern) {
+	// separators are copied into the path as they are
+	while (*pattern == '/') {
+		path_append(walk, "/", 1);
+		pattern++;
+	}
+	if (*pattern == '\0') {
+		push_copy(walk->out, walk->path, walk->len);
+		return;
+	}
+
+	const char *end = pattern;
+	while (*end && *end != '/') {
+		if (*end == '\\' && end[1])
+			end++;
+		end++;
+	}
+	size_t len = end - pattern;
+	bool last = *end == '\0';
+	size_t base = walk->len;
+
+	if (len == 2 && pattern[0] == '*' && pattern[1] == '*') {
+		walk_globstar(walk, last ? NULL : end);
+		return;
+	}
+
+	if (!has_magic(pattern, len)) {
+		path_append_literal(walk, pattern, len);
+		struct stat st;
+		if (!last)
+			walk_r(walk, end);
+		else if (fstatat(AT_FDCWD, walk->path, &st, AT_SYMLINK_NOFOLLOW) == 0)
+			push_copy(walk->out, walk->path, walk->len);
+		path_truncate(walk, base);
+		return;
+	}
+
+	int fd = open(walk->len ? walk->path : ".",
+				  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	char *component = strndup(pattern, len);
+	if (component == NULL) {
+		perror("strndup failed");
+		exit(1);
+	}
+	// dot files only match a pattern that starts with a dot
+	bool hidden = starts_with_dot(component);
+
+	// directories are collected first so only one fd is open at a time
+	argv_t dirs = {0};
+	long nread;
+	while ((nread = syscall(SYS_getdents64, fd, walk->dents, DENTS_SIZE)) >
+		   0) {
+		for (long offset = 0; offset < nread;) {
+			struct linux_dirent64 *entry =
+				(struct linux_dirent64 *)(walk->dents + offset);
+			offset += entry->d_reclen;
+
+			const char *name = entry->d_name;
+			if (name[0] == '.' && (!hidden || is_dot_dir(name)))
+				continue;
+			if (!lush_wildcard_match(component, name))
+				continue;
+
+			if (last) {
+				path_append(walk, name, strlen(name));
+				push_copy(walk->out, walk->path, walk->len);
+				path_truncate(walk, base);
+			} else if (entry->d_type == DT_DIR ||
+					   ((entry->d_type == DT_LNK ||
+						 entry->d_type == DT_UNKNOWN) &&
+						is_dir_at(fd, name))) {
+				push_copy(&dirs, name, strlen(name));
+			}
+		}
+	}
+	close(fd);
+	free(component);
+
+	for (size_t i = 0; i < dirs.count; i++) {
+		path_append(walk, dirs.items[i], strlen(dirs.items[i]));
+		walk_r(walk, end);
+		path_truncate(walk, base);
+	}
+	lush_argv_free(&dirs);
+}
+
+// -- globstar --
+
+static void deque_push(deque_t *deque, char *dir) {
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail == deque->capacity) {
+		// reuse the space stolen from the head before growing
+		if (deque->head > 0) {
+			memmove(deque->items, deque->items + deque->head,
+					(deque->tail - deque->head) * sizeof(char *));
+			deque->tail -= deque->head;
+			deque->head = 0;
+		} else {
+			size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+			char **items = realloc(deque->items, capacity * sizeof(char *));
+			if (items == NULL) {
+				perror("realloc failed");
+				exit(1);
+			}
+			deque->items = items;
+			deque->capacity = capacity;
+		}
+	}
+	deque->items[deque->tail++] = dir;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static char *deque_pop(deque_t *deque) {
+	char *dir = NULL;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail > deque->head)
+		dir = deque->items[--deque->tail];
+	if (deque->tail == deque->head)
+		deque->head = deque->tail = 0;
+	pthread_mutex_unlock(&deque->lock);
+	return dir;
+}
+
+static char *deque_steal(deque_t *deque) {
+	char *dir = NULL;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail > deque->head)
+		dir = deque->items[deque->head++];
+	pthread_mutex_unlock(&deque->lock);
+	return dir;
+}
+
+// joins a directory and an entry name, the root of the walk may be empty
+// or already end in a slash
+static char *join_path(const char *dir, const char *name) {
+	size_t dir_len = strlen(dir);
+	size_t name_len = strlen(name);
+	bool slash = dir_len > 0 && dir[dir_len - 1] != '/';
+	char *path = malloc(dir_len + slash + name_len + 1);
+	if (path == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	memcpy(path, dir, dir_len);
+	if (slash)
+		path[dir_len] = '/';
+	memcpy(path + dir_len + slash, name, name_len + 1);
+	return path;
+}
+
+// reads one directory, queues its subdirectories and collects matches
+static void globstar_scan(worker_t *worker, const char *dir) {
+	globstar_t *globstar = worker->globstar;
+	int fd = open(*dir ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	long nread;
+	while ((nread = syscall(SYS_getdents64, fd, worker->walk.dents,
+							DENTS_SIZE)) > 0) {
+		for (long offset = 0; offset < nread;) {
+			struct linux_dirent64 *entry =
+				(struct linux_dirent64 *)(worker->walk.dents + offset);
+			offset += entry->d_reclen;
+
+			const char *name = entry->d_name;
+			if (is_dot_dir(name))
+				continue;
+
+			// symlinks are not followed so the walk can not loop
+			bool hidden = name[0] == '.';
+			struct stat st;
+			bool is_dir = entry->d_type == DT_DIR ||
+						  (entry->d_type == DT_UNKNOWN &&
+						   fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+						   S_ISDIR(st.st_mode));
+			if (is_dir && !hidden) {
+				atomic_fetch_add(&globstar->pending, 1);
+				deque_push(&worker->deque, join_path(dir, name));
+			}
+
+			if (globstar->rest == NULL) {
+				if (!hidden)
+					lush_argv_push(&worker->out, join_path(dir, name));
+			} else if (globstar->rest_simple &&
+					   (!hidden || globstar->rest_hidden) &&
+					   lush_wildcard_match(globstar->rest, name)) {
+				lush_argv_push(&worker->out, join_path(dir, name));
+			}
+		}
+	}
+	close(fd);
+
+	if (globstar->rest == NULL || globstar->rest_simple)
+		return;
+
+	// anything longer after the ** is walked from every directory
+	walk_t *walk = &worker->walk;
+	path_truncate(walk, 0);
+	path_append(walk, dir, strlen(dir));
+	if (walk->len > 0 && walk->path[walk->len - 1] != '/')
+		path_append(walk, "/", 1);
+	if (*globstar->rest == '\0' && walk->len == 0)
+		return;
+	walk_r(walk, globstar->rest);
+}
+
+static void *globstar_run(void *arg) {
+	worker_t *worker = arg;
+	globstar_t *globstar = worker->globstar;
+
+	for (;;) {
+		char *dir = deque_pop(&worker->deque);
+		for (size_t i = 1; dir == NULL && i < globstar->num_workers; i++) {
+			size_t victim = (worker->index + i) % globstar->num_workers;
+			dir = deque_steal(&globstar->workers[victim].deque);
+		}
+
+		if (dir == NULL) {
+			if (atomic_load(&globstar->pending) == 0)
+				break;
+			sched_yield();
+			continue;
+		}
+
+		globstar_scan(worker, dir);
+		free(dir);
+		atomic_fetch_sub(&globstar->pending, 1);
+	}
+	return NULL;
+}
+
+static void *globstar_thread(void *arg) {
+	// signals are left to the main thread
+	sigset_t mask;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	return globstar_run(arg);
+}
+
+static size_t globstar_num_threads() {
+	cpu_set_t cpus;
+	size_t count = 1;
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+		count = CPU_COUNT(&cpus);
+	if (count < 1)
+		count = 1;
+	return count > WALK_MAX_THREADS ? WALK_MAX_THREADS : count;
+}
+
+// matches ** against the directory in walk->path and everything below it.
+// each thread reads directories from its own deque and steals from the
+// others when it runs dry, the results are sorted by the caller
+static void walk_globstar(walk_t *walk, const char *rest) {
+	globstar_t globstar = {0};
+	if (rest != NULL) {
+		while (*rest == '/')
+			rest++;
+		globstar.rest = rest;
+		globstar.rest_simple = *rest && strchr(rest, '/') == NULL;
+		globstar.rest_hidden = starts_with_dot(rest);
+	}
+
+	// a ** inside a worker is walked on that thread
+	globstar.num_workers = walk->parallel ? globstar_num_threads() : 1;
+	globstar.workers = calloc(globstar.num_workers, sizeof(worker_t));
+	if (globstar.workers == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < globstar.num_workers; i++) {
+		worker_t *worker = &globstar.workers[i];
+		worker->globstar = &globstar;
+		worker->index = i;
+		pthread_mutex_init(&worker->deque.lock, NULL);
+		worker->walk.out = &worker->out;
+		worker->walk.dents = i == 0 ? walk->dents : malloc(DENTS_SIZE);
+		if (worker->walk.dents == NULL) {
+			perror("malloc failed");
+			exit(1);
+		}
+		path_append(&worker->walk, "", 0);
+	}
+
+	// dir/** matches dir/ itself like zero directories would
+	if (rest == NULL && walk->len > 0)
+		push_copy(walk->out, walk->path, walk->len);
+
+	char *root = strdup(walk->path);
+	if (root == NULL) {
+		perror("strdup failed");
+		exit(1);
+	}
+	atomic_store(&globstar.pending, 1);
+	deque_push(&globstar.workers[0].deque, root);
+
+	// if a thread can not be started the others pick up its share
+	for (size_t i = 1; i < globstar.num_workers; i++) {
+		worker_t *worker = &globstar.workers[i];
+		worker->started = pthread_create(&worker->thread, NULL,
+										 globstar_thread, worker) == 0;
+	}
+	globstar_run(&globstar.workers[0]);
+
+	// every thread has to stop before any deque can go away
+	for (size_t i = 1; i < globstar.num_workers; i++) {
+		if (globstar.workers[i].started)
+			pthread_join(globstar.workers[i].thread, NULL);
+	}
+
+	for (size_t i = 0; i < globstar.num_workers; i++) {
+		worker_t *worker = &globstar.workers[i];
+		for (size_t j = 0; j < worker->out.count; j++)
+			lush_argv_push(walk->out, worker->out.items[j]);
+		free(worker->out.items);
+
+		if (i > 0)
+			free(worker->walk.dents);
+		free(worker->walk.path);
+		free(worker->deque.items);
+		pthread_mutex_destroy(&worker->deque.lock);
+	}
+	free(globstar.workers);
+}
+
+size_t lush_wildcard_expand(const char *pattern, argv_t *out) {
+	argv_t alternatives = {0};
+	expand_braces_r(pattern, &alternatives);
+
+	walk_t walk = {.out = out, .parallel = true};
+	walk.dents = malloc(DENTS_SIZE);
+	if (walk.dents == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	path_append(&walk, "", 0);
+
+	size_t total = out->count;
+	for (size_t i = 0; i < alternatives.count; i++) {
+		const char *rest = alternatives.items[i];
+		const char *home = expand_tilde(rest, &rest);
+		path_truncate(&walk, 0);
+		if (home != NULL)
+			path_append(&walk, home, strlen(home));
+		else
+			rest = alternatives.items[i];
+
+		// each alternative is sorted on its own like glob with GLOB_BRACE
+		size_t start = out->count;
+		walk_r(&walk, rest);
+		if (out->count > start)
+			lush_wildcard_sort(out->items + start, out->count - start);
+	}
+
+	free(walk.dents);
+	free(walk.path);
+	lush_argv_free(&alternatives);
+	return out->count - total;
+}
+
+// -- iteration --
+
+typedef struct {
+	char *name;
+	unsigned char type;
+} iter_entry_t;
+
+typedef struct {
+	char *path;
+	int depth;
+} iter_dir_t;
+
+struct wildcard_iter {
+	char *pattern;
+	int type;
+	int max_depth;
+	bool hidden;
+
+	// directories still to be read, used as a stack
+	iter_dir_t *pending;
+	size_t num_pending;
+	size_t pending_capacity;
+
+	// entries of the directory being handed out
+	char *dir;
+	int depth;
+	iter_entry_t *entries;
+	size_t num_entries;
+	size_t entries_capacity;
+	size_t pos;
+
+	walk_t walk;
+};
+
+static void iter_push_dir(wildcard_iter_t *iter, char *path, int depth) {
+	if (iter->num_pending == iter->pending_capacity) {
+		size_t capacity =
+			iter->pending_capacity ? iter->pending_capacity * 2 : 16;
+		iter_dir_t *pending =
+			realloc(iter->pending, capacity * sizeof(iter_dir_t));
+		if (pending == NULL) {
+			perror("realloc failed");
+			exit(1);
+		}
+		iter->pending = pending;
+		iter->pending_capacity = capacity;
+	}
+	iter->pending[iter->num_pending].path = path;
+	iter->pending[iter->num_pending].depth = depth;
+	iter->num_pending++;
+}
+
+static void iter_clear_entries(wildcard_iter_t *iter) {
+	for (size_t i = 0; i < iter->num_entries; i++)
+		free(iter->entries[i].name);
+	iter->num_entries = 0;
+	iter->pos = 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+	return strcmp(((const iter_entry_t *)a)->name,
+				  ((const iter_entry_t *)b)->name);
+}
+
+// reads the next pending directory, returns false when there are none
+static bool iter_load(wildcard_iter_t *iter) {
+	if (iter->num_pending == 0)
+		return false;
+
+	iter_dir_t next = iter->pending[--iter->num_pending];
+	free(iter->dir);
+	iter->dir = next.path;
+	iter->depth = next.depth;
+	iter_clear_entries(iter);
+
+	int fd = open(*iter->dir ? iter->dir : ".",
+				  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return true;
+
+	long nread;
+	while ((nread = syscall(SYS_getdents64, fd, iter->walk.dents,
+							DENTS_SIZE)) > 0) {
+		for (long offset = 0; offset < nread;) {
+			struct linux_dirent64 *entry =
+				(struct linux_dirent64 *)(iter->walk.dents + offset);
+			offset += entry->d_reclen;
+
+			const char *name = entry->d_name;
+			if (is_dot_dir(name) || (name[0] == '.' && !iter->hidden))
+				continue;
+
+			// only file systems without d_type need a stat
+			unsigned char type = entry->d_type;
+			struct stat st;
+			if (type == DT_UNKNOWN &&
+				fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+				type = IFTODT(st.st_mode);
+
+			if (iter->num_entries == iter->entries_capacity) {
+				size_t capacity = iter->entries_capacity
+									  ? iter->entries_capacity * 2
+									  : 64;
+				iter_entry_t *entries =
+					realloc(iter->entries, capacity * sizeof(iter_entry_t));
+				if (entries == NULL) {
+					perror("realloc failed");
+					exit(1);
+				}
+				iter->entries = entries;
+				iter->entries_capacity = capacity;
+			}
+			iter_entry_t *slot = &iter->entries[iter->num_entries++];
+			slot->name = strdup(name);
+			if (slot->name == NULL) {
+				perror("strdup failed");
+				exit(1);
+			}
+			slot->type = type;
+		}
+	}
+	close(fd);
+
+	qsort(iter->entries, iter->num_entries, sizeof(iter_entry_t),
+		  compare_entries);
+
+	// pushed in reverse so the stack hands them back in order
+	if (iter->max_depth < 0 || iter->depth + 1 < iter->max_depth) {
+		for (size_t i = iter->num_entries; i-- > 0;) {
+			if (iter->entries[i].type == DT_DIR)
+				iter_push_dir(iter,
+							  join_path(iter->dir, iter->entries[i].name),
+							  iter->depth + 1);
+		}
+	}
+	return true;
+}
+
+wildcard_iter_t *lush_wildcard_iter_new(const char *dir, const char *pattern,
+										int type, int max_depth,
+										bool hidden) {
+	wildcard_iter_t *iter = calloc(1, sizeof(wildcard_iter_t));
+	if (iter == NULL) {
+		perror("calloc failed");
+		exit(1);
+	}
+	iter->type = type;
+	iter->max_depth = max_depth;
+	iter->hidden = hidden;
+
+	iter->pattern = pattern ? strdup(pattern) : NULL;
+	char *root = strdup(dir ? dir : "");
+	iter->walk.dents = malloc(DENTS_SIZE);
+	if ((pattern && iter->pattern == NULL) || root == NULL ||
+		iter->walk.dents == NULL) {
+		perror("malloc failed");
+		exit(1);
+	}
+	path_append(&iter->walk, "", 0);
+	iter_push_dir(iter, root, 0);
+	return iter;
+}
+
+const char *lush_wildcard_iter_next(wildcard_iter_t *iter,
+									unsigned char *type) {
+	for (;;) {
+		while (iter->pos < iter->num_entries) {
+			iter_entry_t *entry = &iter->entries[iter->pos++];
+			if (iter->type >= 0 && entry->type != iter->type)
+				continue;
+			if (iter->pattern &&
+				!lush_wildcard_match(iter->pattern, entry->name))
+				continue;
+
+			walk_t *walk = &iter->walk;
+			path_truncate(walk, 0);
+			path_append(walk, iter->dir, strlen(iter->dir));
+			if (walk->len > 0 && walk->path[walk->len - 1] != '/')
+				path_append(walk, "/", 1);
+			path_append(walk, entry->name, strlen(entry->name));
+			*type = entry->type;
+			return walk->path;
+		}
+
+		if (!iter_load(iter))
+			return NULL;
+	}
+}
+
+void lush_wildcard_iter_free(wildcard_iter_t *iter) {
+	if (iter == NULL)
+		return;
+
+	iter_clear_entries(iter);
+	free(iter->entries);
+	for (size_t i = 0; i < iter->num_pending; i++)
+		free(iter->pending[i].path);
+	free(iter->pending);
+	free(iter->dir);
+	free(iter->pattern);
+	free(iter->walk.dents);
+	free(iter->walk.path);
+	free(iter);
+}
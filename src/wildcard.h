@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// layout of the records returned by getdents64
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+// growable NULL terminated argument array, the items are owned by it
+typedef struct {
+	char **items;
+	size_t count;
+	size_t capacity;
+} argv_t;
+
+void lush_argv_push(argv_t *argv, char *item);
+void lush_argv_free(argv_t *argv);
+
+// true if the pattern has an unescaped *, ? or [ in it
+bool lush_wildcard_has_magic(const char *pattern);
+
+// removes the backslashes that keep characters of a pattern literal
+void lush_wildcard_unescape(char *pattern);
+
+// matches one path component against a pattern, / is not special here
+bool lush_wildcard_match(const char *pattern, const char *name);
+
+// appends the paths matching pattern to out, sorted bytewise. braces and
+// a leading ~ are expanded first and a ** component matches any number of
+// directories. returns the number of paths added
+size_t lush_wildcard_expand(const char *pattern, argv_t *out);
+
+// sorts strings by their bytes so the order does not depend on the locale
+void lush_wildcard_sort(char **items, size_t count);
+
+// walks a directory tree one entry at a time so huge trees never have to
+// be held in memory. entries of a directory come out sorted before its
+// subdirectories are read
+typedef struct wildcard_iter wildcard_iter_t;
+
+// dir may be NULL for the working directory. pattern is matched against
+// entry names and may be NULL to match everything. type is a DT_ value
+// from dirent.h or -1 for any, max_depth is -1 for no limit and 1 to only
+// read dir itself
+wildcard_iter_t *lush_wildcard_iter_new(const char *dir, const char *pattern,
+										int type, int max_depth,
+										bool hidden);
+
+// returns the next matching path or NULL at the end, the path is valid
+// until the next call. type is set to the DT_ value of the entry
+const char *lush_wildcard_iter_next(wildcard_iter_t *iter,
+									unsigned char *type);
+
+void lush_wildcard_iter_free(wildcard_iter_t *iter);
+
+#endif // WILDCARD_H
@@ -0,0 +1,82 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+local function write_file(path, content)
+	local file = io.open(path, "w")
+	file:write(content)
+	file:close()
+end
+
+local function read_file(path)
+	local file = io.open(path, "r")
+	if file == nil then
+		return nil
+	end
+	local content = file:read("a")
+	file:close()
+	return content
+end
+
+-- cache entries are named after the FNV-1a hash of the script's full path
+local function cache_entry(path)
+	local hash = 0xcbf29ce484222325
+	for i = 1, #path do
+		hash = (hash ~ path:byte(i)) * 0x100000001b3
+	end
+	local xdg = lush.getenv("XDG_CACHE_HOME")
+	local dir = xdg and xdg:sub(1, 1) == "/" and xdg .. "/lush" or lush.getenv("HOME") .. "/.cache/lush"
+	return string.format("%s/%016x.luac", dir, hash)
+end
+
+local script = lush.getcwd() .. "/bytecode_script.lua"
+write_file(script, 'io.open("bytecode.txt", "w"):write("one"):close()\n')
+lush.exec("bytecode_script.lua")
+local entry = cache_entry(script)
+local cached = read_file(entry) ~= nil
+lush.exec("bytecode_script.lua")
+if cached and read_file("bytecode.txt") == "one" then
+	print("cache store test passed ✅\n")
+else
+	print("cache store test failed ❌\n")
+	lush.exit()
+end
+
+-- a changed script is compiled again even when its size stays the same
+write_file(script, 'io.open("bytecode.txt", "w"):write("two"):close()\n')
+lush.exec("bytecode_script.lua")
+if read_file("bytecode.txt") == "two" then
+	print("stale cache test passed ✅\n")
+else
+	print("stale cache test failed ❌\n")
+	lush.exit()
+end
+
+-- a damaged entry falls back to the source
+local damaged = read_file(entry)
+write_file(entry, damaged:sub(1, #damaged - 8) .. string.rep("\0", 8))
+write_file("bytecode.txt", "")
+lush.exec("bytecode_script.lua")
+if read_file("bytecode.txt") == "two" then
+	print("corrupt cache test passed ✅\n")
+else
+	print("corrupt cache test failed ❌\n")
+	lush.exit()
+end
+
+os.remove(script)
+os.remove(entry)
+os.remove("bytecode.txt")
@@ -0,0 +1,88 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+-- both streams and the status come back without touching the disk
+local out, err, status, truncated = lush.capture("echo out && ls /lush_no_such_dir")
+if out == "out\n" and err:find("lush_no_such_dir") and status == 2 and not truncated then
+	print("capture test passed ✅\n")
+else
+	print("capture test failed ❌\n")
+	lush.exit()
+end
+
+-- output past max_bytes is dropped and the command stopped
+out, err, status, truncated = lush.capture({ "yes" }, { max_bytes = 4096 })
+if #out == 4096 and status == 141 and truncated then
+	print("capture limit test passed ✅\n")
+else
+	print("capture limit test failed ❌\n")
+	lush.exit()
+end
+
+-- substitutions drop trailing newlines and nest
+lush.exec("CAP_SUB=$(printf 'a\\nb\\n\\n')")
+lush.exec("CAP_NESTED=x$(echo $(echo inner) | tr a-z A-Z)y")
+if lush.getenv("CAP_SUB") == "a\nb" and lush.getenv("CAP_NESTED") == "xINNERy" then
+	print("command substitution test passed ✅\n")
+else
+	print("command substitution test failed ❌\n")
+	lush.exit()
+end
+
+-- quoted parentheses do not end a substitution and arithmetic still wins
+lush.exec("CAP_QUOTED=\"$(echo 'a)b')\" CAP_ARITH=$(( 1 + $(echo 2) ))")
+if lush.getenv("CAP_QUOTED") == "a)b" and lush.getenv("CAP_ARITH") == "3" then
+	print("substitution quoting test passed ✅\n")
+else
+	print("substitution quoting test failed ❌\n")
+	lush.exit()
+end
+
+-- lines arrive one by one, a last line without a newline included
+local lines = {}
+for line in lush.lines("printf 'one\\n\\ntwo\\nthree'") do
+	lines[#lines + 1] = line
+end
+local count = 0
+for _ in lush.lines({ "seq", "1", "100000" }) do
+	count = count + 1
+end
+if table.concat(lines, ",") == "one,,two,three" and count == 100000 then
+	print("lines test passed ✅\n")
+else
+	print("lines test failed ❌\n")
+	lush.exit()
+end
+
+-- breaking out of the loop stops a command that never ends
+count = 0
+for _ in lush.lines({ "yes" }) do
+	count = count + 1
+	if count == 1000 then
+		break
+	end
+end
+if count == 1000 then
+	print("lines break test passed ✅\n")
+else
+	print("lines break test failed ❌\n")
+	lush.exit()
+end
+
+for _, name in ipairs({ "CAP_SUB", "CAP_NESTED", "CAP_QUOTED", "CAP_ARITH" }) do
+	lush.unsetenv(name)
+end
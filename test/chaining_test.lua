@@ -86,3 +86,40 @@ else
 end
 
 lush.cd(cwd)
+
+lush.exec("true # history marker")
+lush.exec("true # hidden marker", { history = false })
+if lush.lastHistory():find("history marker", 1, true) then
+	print("history free exec test passed ✅\n")
+else
+	print("history free exec test failed ❌\n")
+	lush.exit()
+end
+
+local statuses = lush.execMany({ "true", "false", "x=5", "test $x = 5", "true | false" })
+if
+	#statuses == 5
+	and statuses[1] == 0
+	and statuses[2] == 1
+	and statuses[3] == 0
+	and statuses[4] == 0
+	and statuses[5] == 1
+	and lush.lastHistory():find("history marker", 1, true)
+then
+	print("execMany test passed ✅\n")
+else
+	print("execMany test failed ❌\n")
+	lush.exit()
+end
+
+lush.execMany({ "true # batch one", "true # batch two" }, { history = true })
+if
+	lush.getHistory(1):find("batch two", 1, true)
+	and lush.getHistory(2):find("batch one", 1, true)
+	and not pcall(lush.execMany, { "true", {} })
+then
+	print("execMany history test passed ✅\n")
+else
+	print("execMany history test failed ❌\n")
+	lush.exit()
+end
@@ -0,0 +1,116 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+-- loops assign shell variables so the results can be read back
+lush.exec("CF_SUM=0; for n in 1 2 3 4; do CF_SUM=$((CF_SUM + n)); done")
+if lush.getenv("CF_SUM") == "10" then
+	print("for loop test passed ✅\n")
+else
+	print("for loop test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("CF_I=0; while [ $CF_I -lt 5 ]; do CF_I=$((CF_I + 1)); if [ $CF_I = 3 ]; then break; fi; done")
+if lush.getenv("CF_I") == "3" then
+	print("while loop test passed ✅\n")
+else
+	print("while loop test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec([[
+if false; then
+	CF_BRANCH=if
+elif [ -n "$CF_SUM" ]; then
+	CF_BRANCH=elif
+else
+	CF_BRANCH=else
+fi]])
+if lush.getenv("CF_BRANCH") == "elif" then
+	print("if test passed ✅\n")
+else
+	print("if test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("case lib.so in *.c) CF_CASE=c;; *.a|*.so) CF_CASE=lib;; *) CF_CASE=other;; esac")
+if lush.getenv("CF_CASE") == "lib" then
+	print("case test passed ✅\n")
+else
+	print("case test failed ❌\n")
+	lush.exit()
+end
+
+-- functions are cached and can be called from later lines
+lush.exec("cf_add() { CF_RESULT=$(($1 + $2)); return $#; }")
+lush.exec("cf_add 2 40; CF_STATUS=$?")
+if lush.getenv("CF_RESULT") == "42" and lush.getenv("CF_STATUS") == "2" then
+	print("function test passed ✅\n")
+else
+	print("function test failed ❌\n")
+	lush.exit()
+end
+
+-- "$@" keeps each argument a word of its own even when it has a space
+lush.exec('cf_count() { CF_COUNT=0; for arg in "$@"; do CF_COUNT=$((CF_COUNT + 1)); CF_LAST="$arg"; done; }')
+lush.exec('cf_count "a b" c "d e"')
+local first = lush.getenv("CF_COUNT") == "3" and lush.getenv("CF_LAST") == "d e"
+lush.exec("cf_count")
+if first and lush.getenv("CF_COUNT") == "0" then
+	print("positional words test passed ✅\n")
+else
+	print("positional words test failed ❌\n")
+	lush.exit()
+end
+
+-- compound commands can be piped and redirected, a redirected one still
+-- runs in the shell so its assignments stay
+local piped = lush.capture("for n in 3 1 2; do echo $n; done | sort | tr '\\n' ' '")
+lush.exec("echo x | while [ -z \"$CF_SEEN\" ]; do cat; CF_SEEN=1; done > cf.txt")
+lush.exec("if true; then echo y; fi >> cf.txt; { echo z; } 2> /dev/null >> cf.txt")
+local file = io.open("cf.txt", "r")
+local written = file:read("a")
+file:close()
+os.remove("cf.txt")
+if piped == "1 2 3 " and written == "x\ny\nz\n" and lush.getenv("CF_SEEN") == nil then
+	print("compound pipe test passed ✅\n")
+else
+	print("compound pipe test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("for n in 1; do CF_KEPT=$n; done > /dev/null")
+if lush.getenv("CF_KEPT") == "1" then
+	print("compound redirect test passed ✅\n")
+else
+	print("compound redirect test failed ❌\n")
+	lush.exit()
+end
+
+for _, name in ipairs({
+	"CF_SUM",
+	"CF_I",
+	"CF_BRANCH",
+	"CF_CASE",
+	"CF_RESULT",
+	"CF_STATUS",
+	"CF_COUNT",
+	"CF_LAST",
+	"CF_KEPT",
+}) do
+	lush.unsetenv(name)
+end
@@ -30,3 +30,19 @@ else
 	print("unsetenv test failed ❌\n")
 	lush.exit()
 end
+
+-- expansion reads a snapshot that every change has to keep up with
+lush.exec("ENVTEST=one")
+local first = lush.capture("echo $ENVTEST")
+lush.unsetenv("ENVTEST")
+local unset = lush.capture("echo [$ENVTEST]")
+lush.setenv("ENVTEST", "two")
+lush.exec("ENVTEST=$ENVTEST-three")
+local last = lush.capture("echo $ENVTEST")
+lush.unsetenv("ENVTEST")
+if first == "one\n" and unset == "[]\n" and last == "two-three\n" then
+	print("expansion snapshot test passed ✅\n")
+else
+	print("expansion snapshot test failed ❌\n")
+	lush.exit()
+end
@@ -0,0 +1,141 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+-- ${VAR:=word} assigns the expanded word so the results can be read back
+lush.setenv("EXP_PATH", "/usr/local/lib/libfoo.so.1")
+
+lush.exec("echo ${EXP_DEFAULT:=${EXP_UNSET:-fallback}}")
+if lush.getenv("EXP_DEFAULT") == "fallback" then
+	print("default expansion test passed ✅\n")
+else
+	print("default expansion test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("echo ${EXP_PREFIX:=${EXP_PATH##*/}} ${EXP_SUFFIX:=${EXP_PATH%%.*}}")
+if lush.getenv("EXP_PREFIX") == "libfoo.so.1" and lush.getenv("EXP_SUFFIX") == "/usr/local/lib/libfoo" then
+	print("pattern removal test passed ✅\n")
+else
+	print("pattern removal test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("echo ${EXP_REPLACE:=${EXP_PATH//lib/LIB}} ${EXP_LENGTH:=${#EXP_PATH}}")
+if lush.getenv("EXP_REPLACE") == "/usr/local/LIB/LIBfoo.so.1" and lush.getenv("EXP_LENGTH") == "26" then
+	print("replace and length test passed ✅\n")
+else
+	print("replace and length test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("echo ${EXP_SUBSTR:=${EXP_PATH:5:5}}")
+if lush.getenv("EXP_SUBSTR") == "local" then
+	print("substring test passed ✅\n")
+else
+	print("substring test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("echo ${EXP_ARITH:=$((2 + 3 * 4 ** 2 % 7 - (1 << 2)))}")
+if lush.getenv("EXP_ARITH") == "4" then
+	print("arithmetic precedence test passed ✅\n")
+else
+	print("arithmetic precedence test failed ❌\n")
+	lush.exit()
+end
+
+lush.setenv("EXP_COUNT", "0")
+for _ = 1, 10 do
+	lush.exec("echo $((EXP_COUNT += 2)) > /dev/null")
+end
+if lush.getenv("EXP_COUNT") == "20" then
+	print("arithmetic assignment test passed ✅\n")
+else
+	print("arithmetic assignment test failed ❌\n")
+	lush.exit()
+end
+
+-- a variable holding an expression is evaluated from a copy, its own
+-- assignments must not pull the value out from under the parser
+lush.setenv("EXP_INNER", "1")
+lush.setenv("EXP_EXPR", "EXP_INNER++ + 5")
+lush.exec("echo $((EXP_EXPR)) > /dev/null")
+if lush.getenv("EXP_INNER") == "2" then
+	print("arithmetic nested assignment test passed ✅\n")
+else
+	print("arithmetic nested assignment test failed ❌\n")
+	lush.exit()
+end
+
+-- a variable in a short circuited operand has no side effects either
+lush.setenv("EXP_INNER", "1")
+lush.setenv("EXP_EXPR", "EXP_INNER=5")
+lush.exec("echo $((0 && EXP_EXPR)) $((1 || EXP_EXPR)) > /dev/null")
+if lush.getenv("EXP_INNER") == "1" then
+	print("arithmetic short circuit test passed ✅\n")
+else
+	print("arithmetic short circuit test failed ❌\n")
+	lush.exit()
+end
+
+-- quoted, escaped and quoted substituted patterns stay literal while an
+-- unquoted substitution still globs
+lush.exec("mkdir -p exp_glob")
+for _, name in ipairs({ "a.c", "b.c", "h" }) do
+	local file = io.open("exp_glob/" .. name, "w")
+	file:close()
+end
+lush.setenv("EXP_PATTERN", "exp_glob/*.c")
+local patterns = {
+	{ "echo 'exp_glob/*.c'", "exp_glob/*.c\n" },
+	{ 'echo "exp_glob/*.c"', "exp_glob/*.c\n" },
+	{ "echo exp_glob/\\*.c", "exp_glob/*.c\n" },
+	{ 'echo "$EXP_PATTERN"', "exp_glob/*.c\n" },
+	{ "echo $EXP_PATTERN", "exp_glob/a.c exp_glob/b.c\n" },
+	{ 'echo "exp_glob/[ah]" exp_glob/[ah]', "exp_glob/[ah] exp_glob/h\n" },
+	{ "echo 'exp_glob/{a,b}'.c 'a\\b'", "exp_glob/{a,b}.c a\\b\n" },
+}
+local glob_ok = true
+for _, case in ipairs(patterns) do
+	if lush.capture(case[1]) ~= case[2] then
+		glob_ok = false
+	end
+end
+lush.exec("rm -r exp_glob")
+if glob_ok then
+	print("quoted pattern test passed ✅\n")
+else
+	print("quoted pattern test failed ❌\n")
+	lush.exit()
+end
+
+for _, name in ipairs({
+	"EXP_PATH",
+	"EXP_DEFAULT",
+	"EXP_PREFIX",
+	"EXP_SUFFIX",
+	"EXP_REPLACE",
+	"EXP_LENGTH",
+	"EXP_SUBSTR",
+	"EXP_ARITH",
+	"EXP_COUNT",
+	"EXP_INNER",
+	"EXP_EXPR",
+	"EXP_PATTERN",
+}) do
+	lush.unsetenv(name)
+end
@@ -49,3 +49,44 @@ else
 	print("isWriteable test failed ❌\n")
 	lush.exit()
 end
+
+local st = lush.stat("~/.lush/scripts/example.lua", { realpath = true })
+if
+	st
+	and st.type == "file"
+	and st.size > 0
+	and st.readable
+	and st.mtime > 0
+	and st.realpath:sub(-#"/example.lua") == "/example.lua"
+	and lush.stat("~/.lush/scripts").type == "directory"
+	and lush.stat("~/.lush/scripts/missing.lua") == nil
+then
+	print("stat test passed ✅\n")
+else
+	print("stat test failed ❌\n")
+	lush.exit()
+end
+
+local stats = lush.statMany({ "~/.lush/scripts", "~/.lush/scripts/missing.lua" })
+if #stats == 2 and stats[1].type == "directory" and stats[2] == false then
+	print("statMany test passed ✅\n")
+else
+	print("statMany test failed ❌\n")
+	lush.exit()
+end
+
+local found = false
+for name, type, entry in lush.readdir("~/.lush/scripts", { stat = true }) do
+	if name == "example.lua" then
+		found = type == "file" and entry.size == st.size
+	elseif name == "." or name == ".." then
+		found = false
+		break
+	end
+end
+if found then
+	print("readdir test passed ✅\n")
+else
+	print("readdir test failed ❌\n")
+	lush.exit()
+end
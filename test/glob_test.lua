@@ -0,0 +1,119 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+local function read_file(path)
+	local file = io.open(path, "r")
+	if file == nil then
+		return nil
+	end
+	local content = file:read("a")
+	file:close()
+	return content
+end
+
+local function touch(path)
+	local file = io.open(path, "w")
+	file:close()
+end
+
+lush.exec("mkdir -p glob_dir/sub")
+for _, name in ipairs({ "b.txt", "a.txt", "B.txt", "c.log", ".hidden.txt", "sub/d.txt" }) do
+	touch("glob_dir/" .. name)
+end
+
+lush.exec("echo glob_dir/*.txt > glob.txt")
+if read_file("glob.txt") == "glob_dir/B.txt glob_dir/a.txt glob_dir/b.txt\n" then
+	print("glob sort test passed ✅\n")
+else
+	print("glob sort test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("echo glob_dir/[ab].* glob_dir/*/ glob_dir/*/*.txt > glob.txt")
+if read_file("glob.txt") == "glob_dir/a.txt glob_dir/b.txt glob_dir/sub/ glob_dir/sub/d.txt\n" then
+	print("glob bracket and directory test passed ✅\n")
+else
+	print("glob bracket and directory test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("echo glob_dir/{c,a}.* glob_dir/*.none > glob.txt")
+if read_file("glob.txt") == "glob_dir/c.log glob_dir/a.txt glob_dir/*.none\n" then
+	print("glob brace and no match test passed ✅\n")
+else
+	print("glob brace and no match test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("echo glob_dir/**/*.txt glob_dir/**/ > glob.txt")
+if read_file("glob.txt") == "glob_dir/B.txt glob_dir/a.txt glob_dir/b.txt glob_dir/sub/d.txt glob_dir/ glob_dir/sub/\n" then
+	print("recursive glob test passed ✅\n")
+else
+	print("recursive glob test failed ❌\n")
+	lush.exit()
+end
+
+-- far more matches than the old fixed size argument array could hold
+lush.exec("mkdir -p glob_dir/many")
+for i = 1, 5000 do
+	touch(string.format("glob_dir/many/%04d.log", i))
+end
+lush.exec("echo first glob_dir/many/*.log last > glob.txt")
+local words = {}
+for word in read_file("glob.txt"):gmatch("%S+") do
+	table.insert(words, word)
+end
+if #words == 5002 and words[1] == "first" and words[2] == "glob_dir/many/0001.log" and words[5002] == "last" then
+	print("large glob test passed ✅\n")
+else
+	print("large glob test failed ❌\n")
+	lush.exit()
+end
+
+local found = lush.glob("*.txt", { dir = "glob_dir", recursive = true })
+if table.concat(found, " ") == "glob_dir/B.txt glob_dir/a.txt glob_dir/b.txt glob_dir/sub/d.txt" then
+	print("lush.glob recursive test passed ✅\n")
+else
+	print("lush.glob recursive test failed ❌\n")
+	lush.exit()
+end
+
+local count = 0
+for path, kind in lush.glob("*.log", { dir = "glob_dir/many", iter = true, type = "file" }) do
+	if kind == "file" then
+		count = count + 1
+	end
+end
+local dirs = lush.glob("*", { dir = "glob_dir", type = "directory" })
+if count == 5000 and table.concat(dirs, " ") == "glob_dir/many glob_dir/sub" then
+	print("lush.glob iterator and type test passed ✅\n")
+else
+	print("lush.glob iterator and type test failed ❌\n")
+	lush.exit()
+end
+
+-- quoted parts of a word reach the matcher escaped so they stay literal
+touch("glob_dir/[ab].txt")
+lush.exec("echo 'glob_dir/*.txt' glob_dir/'[ab]'* glob_dir/\\{c,a\\}.* > glob.txt")
+if read_file("glob.txt") == "glob_dir/*.txt glob_dir/[ab].txt glob_dir/{c,a}.*\n" then
+	print("glob quoted pattern test passed ✅\n")
+else
+	print("glob quoted pattern test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("rm -r glob_dir glob.txt")
@@ -0,0 +1,95 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+local function read_file(path)
+	local file = io.open(path, "r")
+	if file == nil then
+		return nil
+	end
+	local content = file:read("a")
+	file:close()
+	return content
+end
+
+local function write_tool(dir, word)
+	lush.exec("mkdir -p " .. dir)
+	local file = io.open(dir .. "/hashtool", "w")
+	file:write("#!/bin/sh\necho " .. word .. "\n")
+	file:close()
+	lush.exec("chmod +x " .. dir .. "/hashtool")
+end
+
+local cwd = lush.getenv("PWD")
+local old_path = lush.getenv("PATH")
+write_tool("hash_dir/one", "one")
+write_tool("hash_dir/two", "two")
+
+lush.exec("hash -r")
+lush.setenv("PATH", cwd .. "/hash_dir/one:" .. cwd .. "/hash_dir/two:" .. old_path)
+lush.exec("hashtool > hash.txt")
+lush.exec("hash -t hashtool >> hash.txt")
+if read_file("hash.txt") == "one\n" .. cwd .. "/hash_dir/one/hashtool\n" then
+	print("hash lookup test passed ✅\n")
+else
+	print("hash lookup test failed ❌\n")
+	lush.exit()
+end
+
+-- the cached path is gone so the next directory on PATH has to be found
+lush.exec("rm hash_dir/one/hashtool")
+lush.exec("hashtool > hash.txt")
+if read_file("hash.txt") == "two\n" then
+	print("hash stale entry test passed ✅\n")
+else
+	print("hash stale entry test failed ❌\n")
+	lush.exit()
+end
+
+write_tool("hash_dir/one", "one")
+lush.setenv("PATH", cwd .. "/hash_dir/two:" .. old_path)
+lush.exec("hashtool > hash.txt")
+lush.setenv("PATH", cwd .. "/hash_dir/one:" .. old_path)
+lush.exec("hashtool >> hash.txt")
+if read_file("hash.txt") == "two\none\n" then
+	print("hash path change test passed ✅\n")
+else
+	print("hash path change test failed ❌\n")
+	lush.exit()
+end
+
+lush.setenv("PATH", old_path)
+if lush.exec("hash no_such_hash_command") == false then
+	print("hash not found test passed ✅\n")
+else
+	print("hash not found test failed ❌\n")
+	lush.exit()
+end
+
+-- a script without a #! line runs through /bin/sh like execvp does it
+local file = io.open("hash_dir/plainscript", "w")
+file:write('echo plain "$1" "$2"\n')
+file:close()
+lush.exec("chmod +x hash_dir/plainscript")
+lush.exec("hash_dir/plainscript a 'b c' > hash.txt")
+if read_file("hash.txt") == "plain a b c\n" then
+	print("script without interpreter test passed ✅\n")
+else
+	print("script without interpreter test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("rm -rf hash_dir hash.txt")
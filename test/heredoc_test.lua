@@ -0,0 +1,83 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+local function read_file(path)
+	local file = io.open(path, "r")
+	if file == nil then
+		return nil
+	end
+	local content = file:read("a")
+	file:close()
+	return content
+end
+
+lush.setenv("HD_NAME", "moon")
+lush.exec([[
+cat <<EOF > heredoc.txt
+hello $HD_NAME "quoted"
+EOF]])
+if read_file("heredoc.txt") == 'hello moon "quoted"\n' then
+	print("heredoc expansion test passed ✅\n")
+else
+	print("heredoc expansion test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec([[
+cat <<'EOF' > heredoc.txt
+hello $HD_NAME
+EOF]])
+if read_file("heredoc.txt") == "hello $HD_NAME\n" then
+	print("quoted heredoc test passed ✅\n")
+else
+	print("quoted heredoc test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("tr a-z A-Z <<< $HD_NAME > heredoc.txt")
+if read_file("heredoc.txt") == "MOON\n" then
+	print("here-string test passed ✅\n")
+else
+	print("here-string test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("wc -l < heredoc.txt > heredoc_count.txt")
+if read_file("heredoc_count.txt") == "1\n" then
+	print("input redirect test passed ✅\n")
+else
+	print("input redirect test failed ❌\n")
+	lush.exit()
+end
+
+-- larger than a default pipe buffer so the pipe is grown, and past the
+-- resize cap so the body is streamed by a writer thread
+local big = string.rep("lunar shell\n", 20000)
+lush.exec("cat <<'EOF' > heredoc.txt\n" .. big .. "EOF")
+local huge = string.rep("lunar shell\n", 100000)
+lush.exec("cat <<'EOF' > heredoc_huge.txt\n" .. huge .. "EOF")
+if read_file("heredoc.txt") == big and read_file("heredoc_huge.txt") == huge then
+	print("large heredoc test passed ✅\n")
+else
+	print("large heredoc test failed ❌\n")
+	lush.exit()
+end
+
+os.remove("heredoc.txt")
+os.remove("heredoc_huge.txt")
+os.remove("heredoc_count.txt")
+lush.unsetenv("HD_NAME")
@@ -0,0 +1,77 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+local function read_file(path)
+	local file = io.open(path, "r")
+	if file == nil then
+		return nil
+	end
+	local content = file:read("a")
+	file:close()
+	return content
+end
+
+-- start from an empty job table
+lush.exec("wait")
+
+lush.exec("sleep 0.2 | sh -c 'exit 4' &")
+lush.exec("jobs > jobs.txt")
+lush.exec("wait %1")
+lush.exec("echo $? >> jobs.txt")
+if read_file("jobs.txt") == "[1]+  Running                 sleep 0.2 | sh -c exit 4 &\n4\n" then
+	print("background job test passed ✅\n")
+else
+	print("background job test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("sh -c 'exit 3' &")
+lush.exec("wait $!")
+lush.exec("echo $? > jobs.txt")
+lush.exec("wait %1 2>> jobs.txt")
+if read_file("jobs.txt") == "3\nlush: wait: %1: no such job\n" then
+	print("wait pid test passed ✅\n")
+else
+	print("wait pid test failed ❌\n")
+	lush.exit()
+end
+
+-- a stopped command hands control back instead of hanging the shell
+lush.exec("sh -c 'kill -STOP $$; exit 5'")
+lush.exec("echo $? > jobs.txt")
+lush.exec("jobs >> jobs.txt")
+lush.exec("bg")
+lush.exec("wait")
+lush.exec("jobs >> jobs.txt")
+if read_file("jobs.txt") == "148\n[1]+  Stopped                 sh -c kill -STOP $$; exit 5\n" then
+	print("stopped job test passed ✅\n")
+else
+	print("stopped job test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("sleep 5 &")
+lush.exec("disown")
+lush.exec("jobs > jobs.txt")
+if read_file("jobs.txt") == "" then
+	print("disown test passed ✅\n")
+else
+	print("disown test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("rm jobs.txt")
@@ -0,0 +1,73 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+-- timers fire while the shell waits on a command
+local ticks = 0
+local fired = false
+local id = lush.setTimer(50, function()
+	ticks = ticks + 1
+end, true)
+lush.setTimer(100, function()
+	fired = true
+end)
+lush.exec("sleep 0.5")
+lush.clearTimer(id)
+local stopped = ticks
+lush.exec("sleep 0.2")
+if fired and ticks >= 3 and ticks == stopped then
+	print("timer test passed ✅\n")
+else
+	print("timer test failed ❌\n")
+	lush.exit()
+end
+
+-- a trap waits in the loop until the foreground command is done
+lush.exec("trap 'echo trapped > loop.txt' SIGUSR1")
+lush.exec("sh -c 'kill -USR1 $PPID; sleep 0.2; test -e loop.txt && echo early > loop2.txt'")
+lush.exec("trap - SIGUSR1")
+local early = io.open("loop2.txt", "r")
+local file = io.open("loop.txt", "r")
+local trapped = file and file:read("a")
+if early then
+	early:close()
+end
+if file then
+	file:close()
+end
+lush.exec("rm -f loop.txt loop2.txt")
+if trapped == "trapped\n" and early == nil then
+	print("trap test passed ✅\n")
+else
+	print("trap test failed ❌\n")
+	lush.exit()
+end
+
+-- a background job is reaped without anybody waiting on it
+lush.exec("wait")
+lush.exec("true &")
+lush.exec("sleep 0.2")
+lush.exec("jobs > loop.txt")
+local file = io.open("loop.txt", "r")
+local listed = file:read("a")
+file:close()
+lush.exec("rm loop.txt")
+if listed == "[1]+  Done                    true\n" then
+	print("reaping test passed ✅\n")
+else
+	print("reaping test failed ❌\n")
+	lush.exit()
+end
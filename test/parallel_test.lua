@@ -0,0 +1,118 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+local function read_file(path)
+	local file = io.open(path, "r")
+	if file == nil then
+		return nil
+	end
+	local content = file:read("a")
+	file:close()
+	return content
+end
+
+-- -k releases every job's output in the order the inputs were given
+lush.exec("parallel -j 4 -k 'sleep 0.{}; echo {#} {}' ::: 3 1 2 0 > parallel.txt")
+if read_file("parallel.txt") == "1 3\n2 1\n3 2\n4 0\n" then
+	print("ordered output test passed ✅\n")
+else
+	print("ordered output test failed ❌\n")
+	lush.exit()
+end
+
+-- inputs come from stdin when there is no :::, lines are whole commands
+-- without a template and the status counts the failures
+lush.exec("printf 'echo one\\nfalse\\nsh -c \"exit 3\"\\necho four\\n' > parallel.txt")
+lush.exec("parallel -k < parallel.txt > parallel2.txt")
+lush.exec("echo $? >> parallel2.txt")
+if read_file("parallel2.txt") == "one\nfour\n2\n" then
+	print("stdin input test passed ✅\n")
+else
+	print("stdin input test failed ❌\n")
+	lush.exit()
+end
+
+-- a compound template runs in a copy of the shell
+lush.exec("parallel -k 'echo {} | tr a-z A-Z && echo done' ::: ab cd > parallel.txt")
+if read_file("parallel.txt") == "AB\ndone\nCD\ndone\n" then
+	print("compound template test passed ✅\n")
+else
+	print("compound template test failed ❌\n")
+	lush.exit()
+end
+
+-- halt soon starts nothing after the first failure and returns its status
+lush.exec("parallel -j 1 -k --halt soon 'echo {}; test {} = ok' ::: ok bad ok > parallel.txt")
+lush.exec("echo $? >> parallel.txt")
+if read_file("parallel.txt") == "ok\nbad\n1\n" then
+	print("halt test passed ✅\n")
+else
+	print("halt test failed ❌\n")
+	lush.exit()
+end
+
+-- the job variables reach only the jobs, the user's own values survive
+lush.setenv("PARALLEL_ARG", "mine")
+lush.unsetenv("PARALLEL_SEQ")
+lush.exec("parallel -k 'echo {} $PARALLEL_SEQ; sh -c \"echo \\$PARALLEL_ARG\"' ::: a b > parallel.txt")
+if
+	read_file("parallel.txt") == "a 1\na\nb 2\nb\n"
+	and lush.getenv("PARALLEL_ARG") == "mine"
+	and lush.getenv("PARALLEL_SEQ") == nil
+then
+	print("job variables test passed ✅\n")
+else
+	print("job variables test failed ❌\n")
+	lush.exit()
+end
+lush.unsetenv("PARALLEL_ARG")
+
+lush.exec("rm parallel.txt parallel2.txt")
+
+-- lush.parallel maps a function over its inputs on worker lua states
+local inputs = {}
+for i = 1, 50 do
+	inputs[i] = { n = i, word = "w" .. i }
+end
+local results = lush.parallel(
+	"return function(t) return { square = t.n * t.n, word = t.word:upper() } end",
+	inputs,
+	{ workers = 4 }
+)
+local ok = #results == 50
+for i = 1, 50 do
+	ok = ok and results[i].square == i * i and results[i].word == "W" .. i
+end
+if ok then
+	print("lua parallel test passed ✅\n")
+else
+	print("lua parallel test failed ❌\n")
+	lush.exit()
+end
+
+-- functions without outer locals are sent as they are, errors name the input
+local doubled = lush.parallel(function(x)
+	return x * 2
+end, { 1, 2, 3 })
+local failed, err = pcall(lush.parallel, "return function(x) assert(x ~= 2, 'two') return x end", { 1, 2, 3 })
+local blocked = pcall(lush.parallel, "return function() lush.exec('true') end", { 1 })
+if doubled[3] == 6 and not failed and err:find("input 2", 1, true) and not blocked then
+	print("lua parallel errors test passed ✅\n")
+else
+	print("lua parallel errors test failed ❌\n")
+	lush.exit()
+end
@@ -0,0 +1,154 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+local function read_file(path)
+	local file = io.open(path, "r")
+	if file == nil then
+		return nil
+	end
+	local content = file:read("a")
+	file:close()
+	return content
+end
+
+-- far more than a pipe buffer, stages waited on one by one would deadlock
+lush.exec("head -c 4000000 /dev/zero | cat | cat | wc -c > pipe.txt")
+if read_file("pipe.txt") == "4000000\n" then
+	print("large pipeline test passed ✅\n")
+else
+	print("large pipeline test failed ❌\n")
+	lush.exit()
+end
+
+lush.exec("sh -c 'exit 3' | false | true")
+lush.exec("echo $PIPESTATUS > pipe.txt")
+if read_file("pipe.txt") == "3 1 0\n" then
+	print("PIPESTATUS test passed ✅\n")
+else
+	print("PIPESTATUS test failed ❌\n")
+	lush.exit()
+end
+
+-- the reader exits first and the writer is stopped by SIGPIPE
+lush.exec("yes | head -n 1 > pipe.txt")
+lush.exec("echo $PIPESTATUS >> pipe.txt")
+if read_file("pipe.txt") == "y\n141 0\n" then
+	print("early reader exit test passed ✅\n")
+else
+	print("early reader exit test failed ❌\n")
+	lush.exit()
+end
+
+local plain = lush.exec("false | true")
+lush.pipefail(true)
+local failed = lush.exec("false | true")
+lush.pipefail(false)
+if plain == true and failed == false then
+	print("pipefail test passed ✅\n")
+else
+	print("pipefail test failed ❌\n")
+	lush.exit()
+end
+
+-- stages only get their own pipe ends
+lush.exec("true | ls /proc/self/fd | cat > pipe.txt")
+if read_file("pipe.txt") == "0\n1\n2\n3\n" then
+	print("pipe fd test passed ✅\n")
+else
+	print("pipe fd test failed ❌\n")
+	lush.exit()
+end
+
+-- lua stages stream lines through a function, nil marks the end
+function pipe_upper(line)
+	if line then
+		return line:upper()
+	end
+end
+local pipe_lines = 0
+pipe_filters = {
+	count = function(line)
+		if line == nil then
+			return "lines " .. pipe_lines
+		end
+		pipe_lines = pipe_lines + 1
+	end,
+}
+lush.exec("printf 'b\\na\\n' | lua:pipe_upper | sort | lua:pipe_filters.count > pipe.txt")
+lush.exec("yes | lua:pipe_upper | head -n 2 >> pipe.txt")
+if read_file("pipe.txt") == "lines 2\nY\nY\n" then
+	print("lua stage test passed ✅\n")
+else
+	print("lua stage test failed ❌\n")
+	lush.exit()
+end
+
+-- a failing function fails its stage
+function pipe_fail()
+	error("no lines wanted")
+end
+lush.exec("echo x | lua:pipe_fail | cat 2> /dev/null")
+lush.exec("echo $PIPESTATUS > pipe.txt")
+lush.exec("true | lua:pipe_missing 2> /dev/null")
+lush.exec("echo $PIPESTATUS >> pipe.txt")
+if read_file("pipe.txt") == "0 1 0\n0 127\n" then
+	print("lua stage status test passed ✅\n")
+else
+	print("lua stage status test failed ❌\n")
+	lush.exit()
+end
+
+-- shell functions can sit anywhere in a pipeline
+lush.exec("pipe_gen() { echo one; echo two; }")
+lush.exec("pipe_upper() { tr a-z A-Z; }")
+lush.exec("pipe_gen | pipe_upper | tail -n 1 > pipe.txt")
+if read_file("pipe.txt") == "TWO\n" then
+	print("function stage test passed ✅\n")
+else
+	print("function stage test failed ❌\n")
+	lush.exit()
+end
+
+-- prefix assignments only reach the stage they are written on, also when
+-- it is redirected
+lush.exec("PIPE_A=1 sh -c 'echo $PIPE_A-$PIPE_B' | PIPE_B=2 sh -c 'cat; echo $PIPE_A-$PIPE_B' > pipe.txt")
+lush.exec("PIPE_C=3 sh -c 'echo $PIPE_C' >> pipe.txt")
+if read_file("pipe.txt") == "1-\n-2\n3\n" and lush.getenv("PIPE_A") == nil then
+	print("stage assignment test passed ✅\n")
+else
+	print("stage assignment test failed ❌\n")
+	lush.exit()
+end
+
+-- lush.run hands argument vectors over as they are, quotes and spaces
+-- included, and only globs when asked
+local odd = "pipe 'odd' \"name\".txt"
+local file = io.open(odd, "w")
+file:write("odd\n")
+file:close()
+local run_rc = lush.run({ { "cat", odd }, { "tr", "a-z", "A-Z" }, stdout = "pipe.txt" })
+local literal = lush.run({ "ls", "pipe*.txt", stderr = "/dev/null", stdout = "/dev/null" })
+lush.run({ "ls", "pipe 'o*", glob = true, stdout = "pipe.txt", append = true })
+if run_rc == 0 and literal == 2 and read_file("pipe.txt") == "ODD\n" .. odd .. "\n" then
+	print("run test passed ✅\n")
+else
+	print("run test failed ❌\n")
+	lush.exit()
+end
+os.remove(odd)
+
+lush.exec("rm pipe.txt")
@@ -0,0 +1,76 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+local function write_file(path, content)
+	local file = io.open(path, "w")
+	file:write(content)
+	file:close()
+end
+
+local scripts = lush.getenv("HOME") .. "/.config/lush/scripts"
+lush.exec("mkdir -p " .. scripts .. "/lush_req_pkg")
+write_file(scripts .. "/lush_req_mod.lua",
+	"lush_req_loads = (lush_req_loads or 0) + 1\n" ..
+	"return { double = function(n) return n * 2 end }\n")
+write_file(scripts .. "/lush_req_pkg/init.lua", "return { name = 'pkg' }\n")
+write_file(scripts .. "/lush_req_pkg/sub.lua", "return { name = 'sub' }\n")
+write_file(scripts .. "/lush_req_tool.lua", "lush_req_runs = (lush_req_runs or 0) + 1\n")
+
+local function cleanup()
+	lush.exec("rm -rf " .. scripts .. "/lush_req_pkg " .. scripts ..
+		"/lush_req_mod.lua " .. scripts .. "/lush_req_tool.lua")
+end
+
+local function fail(msg)
+	cleanup()
+	print(msg .. " failed ❌\n")
+	lush.exit()
+end
+
+-- modules in the scripts directory load once per session
+local mod = require("lush_req_mod")
+if mod.double(21) ~= 42 or require("lush_req_mod") ~= mod or lush_req_loads ~= 1 then
+	fail("require")
+end
+print("require test passed ✅\n")
+
+if require("lush_req_pkg").name ~= "pkg" or require("lush_req_pkg.sub").name ~= "sub" then
+	fail("require package")
+end
+print("require package test passed ✅\n")
+
+local ok, err = pcall(require, "lush_req_missing")
+if ok or not err:find(scripts .. "/lush_req_missing.lua", 1, true) then
+	fail("require missing")
+end
+print("require missing test passed ✅\n")
+
+-- resolved script paths are cached but a moved script is searched again
+lush.exec("lush_req_tool.lua")
+lush.exec("lush_req_tool.lua")
+os.remove(scripts .. "/lush_req_tool.lua")
+if lush.exec("lush_req_tool.lua") then
+	fail("script path cache")
+end
+write_file(scripts .. "/lush_req_tool.lua", "lush_req_runs = lush_req_runs + 1\n")
+lush.exec("lush_req_tool.lua")
+if lush_req_runs ~= 3 then
+	fail("script path cache")
+end
+print("script path cache test passed ✅\n")
+
+cleanup()
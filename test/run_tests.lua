@@ -44,3 +44,87 @@ rc = lush.exec("env_test.lua")
 if rc == false then
 	lush.exit()
 end
+
+print("\nTesting Parameter Expansion...")
+rc = lush.exec("expansion_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Control Flow...")
+rc = lush.exec("control_flow_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Heredocs...")
+rc = lush.exec("heredoc_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Globs...")
+rc = lush.exec("glob_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Command Hash...")
+rc = lush.exec("hash_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Pipelines...")
+rc = lush.exec("pipeline_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Jobs...")
+rc = lush.exec("jobs_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Event Loop...")
+rc = lush.exec("loop_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Traps...")
+rc = lush.exec("trap_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Parallel...")
+rc = lush.exec("parallel_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Spawn...")
+rc = lush.exec("spawn_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Capture...")
+rc = lush.exec("capture_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Bytecode Cache...")
+rc = lush.exec("bytecode_test.lua")
+if rc == false then
+	lush.exit()
+end
+
+print("\nTesting Require...")
+rc = lush.exec("require_test.lua")
+if rc == false then
+	lush.exit()
+end
@@ -0,0 +1,74 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+-- piped output is collected while the command runs
+local proc = lush.spawn("echo one && echo two | tr o 0", { stdout = "pipe" })
+if proc:wait() == 0 and proc.stdout == "one\ntw0\n" then
+	print("piped output test passed ✅\n")
+else
+	print("piped output test failed ❌\n")
+	lush.exit()
+end
+
+-- an argv table skips the shell and input is fed to stdin
+proc = lush.spawn({ "tr", "a-z", "A-Z" }, { input = "spawned\n", stdout = "pipe" })
+if proc:wait() == 0 and proc.stdout == "SPAWNED\n" then
+	print("argv input test passed ✅\n")
+else
+	print("argv input test failed ❌\n")
+	lush.exit()
+end
+
+-- poll and a timed wait return nothing while the command runs, a killed
+-- command reports 128 plus the signal
+proc = lush.spawn({ "sleep", "5" })
+local polled = proc:poll()
+local waited = lush.wait({ proc }, 0.05)
+proc:kill("TERM")
+if polled == nil and waited == nil and proc.status == nil and proc:wait() == 143 then
+	print("poll and kill test passed ✅\n")
+else
+	print("poll and kill test failed ❌\n")
+	lush.exit()
+end
+
+-- the commands run at the same time, wait returns each as it finishes
+local procs = {}
+for i = 1, 4 do
+	procs[i] = lush.spawn("sleep 0." .. (5 - i) .. " && echo " .. i, { stdout = "pipe" })
+end
+local order = ""
+while #procs > 0 do
+	local done, index = lush.wait(procs)
+	order = order .. done.stdout
+	table.remove(procs, index)
+end
+if order == "4\n3\n2\n1\n" then
+	print("concurrent wait test passed ✅\n")
+else
+	print("concurrent wait test failed ❌\n")
+	lush.exit()
+end
+
+-- a command that cannot start is already finished
+proc = lush.spawn({ "lush_no_such_command" })
+if proc.status == 127 and proc:wait() == 127 then
+	print("missing command test passed ✅\n")
+else
+	print("missing command test failed ❌\n")
+	lush.exit()
+end
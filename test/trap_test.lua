@@ -0,0 +1,77 @@
+--[[
+Copyright (c) 2024, Lance Borden
+All rights reserved.
+
+This software is licensed under the BSD 3-Clause License.
+You may obtain a copy of the license at:
+https://opensource.org/licenses/BSD-3-Clause
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted under the conditions stated in the BSD 3-Clause
+License.
+
+THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTIES,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+]]
+
+local function read_file(path)
+	local file = io.open(path, "r")
+	if file == nil then
+		return nil
+	end
+	local content = file:read("a")
+	file:close()
+	return content
+end
+
+local function count_lines(text)
+	local count = 0
+	for _ in (text or ""):gmatch("\n") do
+		count = count + 1
+	end
+	return count
+end
+
+-- trap -p and a bare trap list what is set
+lush.exec("trap 'echo usr1' SIGUSR1")
+lush.exec("trap 'echo usr2' SIGUSR2")
+lush.exec("trap -p SIGUSR2 > trap.txt")
+lush.exec("trap >> trap.txt")
+if read_file("trap.txt") == "trap -- 'echo usr2' SIGUSR2\n" ..
+	"trap -- 'echo usr1' SIGUSR1\ntrap -- 'echo usr2' SIGUSR2\n" then
+	print("trap listing test passed ✅\n")
+else
+	print("trap listing test failed ❌\n")
+	lush.exit()
+end
+lush.exec("trap - SIGUSR2")
+
+-- a burst that lands during one command runs the trap once after it
+lush.exec("trap 'echo x >> trap.txt' SIGUSR1")
+lush.exec("rm trap.txt")
+lush.exec("sh -c 'i=0; while [ $i -lt 100000 ]; do kill -USR1 $PPID; i=$((i+1)); done'")
+if read_file("trap.txt") == "x\n" then
+	print("trap coalescing test passed ✅\n")
+else
+	print("trap coalescing test failed ❌\n")
+	lush.exit()
+end
+
+-- the same burst from the background while the shell keeps running
+-- commands, every one of them is a point where the trap may run
+lush.exec("rm trap.txt")
+lush.exec("sh -c 'i=0; while [ $i -lt 100000 ]; do kill -USR1 $PPID; i=$((i+1)); done' &")
+while lush.exec("kill -0 $! 2> /dev/null") do
+	lush.exec("true")
+end
+lush.exec("wait")
+lush.exec("trap - SIGUSR1")
+local runs = count_lines(read_file("trap.txt"))
+lush.exec("rm trap.txt")
+if runs >= 1 and runs < 100000 then
+	print("trap stress test passed ✅\n")
+else
+	print("trap stress test failed ❌\n")
+	lush.exit()
+end